@@ -0,0 +1,942 @@
+/********************************************************************
+ * Copyright (c) 2014, Eldar Gaynetdinov <hal9000ed2k@gmail.com>    *
+ *                                                                  *
+ * Permission to use, copy, modify, and/or distribute this software *
+ * for any purpose with or without fee is hereby granted, provided  *
+ * that the above copyright notice and this permission notice       *
+ * appear in all copies.                                            *
+ *                                                                  *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL    *
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED    *
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL     *
+ * THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT,          *
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING     *
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF       *
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF    *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.   *
+ ********************************************************************/
+
+/* Latency and throughput benchmark of the transports */
+
+/* NOTE: assert is used here instead of c_assert */
+
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "main.h"
+#include "linked_list.h"
+#include "module.h"
+#include "config.h"
+#include "logger.h"
+#include "network.h"
+#include "http.h"
+#include "fiber.h"
+#include "bench.h"
+#include "bench_internal.h"
+
+char           *cfg_bench_mode = NULL;
+char           *cfg_bench_rx_endpoint = NULL;
+char           *cfg_bench_tx_endpoint = NULL;
+int            *cfg_bench_count = NULL;
+int            *cfg_bench_burst = NULL;
+int            *cfg_bench_payload_size = NULL;
+int            *cfg_bench_port = NULL;
+char           *cfg_bench_unix_path = NULL;
+struct timeval *cfg_bench_interval = NULL;
+struct timeval *cfg_bench_drain_timeout = NULL;
+
+static bench_t          g_bench;
+
+/******************* Stats functions ******************************************/
+
+static uint64_t __ts_diff_ns( struct timespec *from, struct timespec *to )
+{
+    int64_t             diff;
+
+    diff = (int64_t) (to->tv_sec - from->tv_sec) * 1000000000LL +
+           (to->tv_nsec - from->tv_nsec);
+
+    return ( diff > 0 ) ? (uint64_t) diff : 0;
+}
+
+static int __cmp_u64( const void *a, const void *b )
+{
+    uint64_t            x = *(const uint64_t *) a;
+    uint64_t            y = *(const uint64_t *) b;
+
+    return ( x > y ) - ( x < y );
+}
+
+static uint64_t __percentile( uint64_t *arr, uint64_t cnt, int pct )
+{
+    if( !cnt )
+        return 0;
+
+    return arr[(cnt - 1) * pct / 100];
+}
+
+static void __report( uint64_t *arr, uint64_t cnt, char *name )
+{
+    uint64_t            sum = 0;
+    uint64_t            i;
+
+    qsort( arr, cnt, sizeof(uint64_t), __cmp_u64 );
+
+    for( i = 0; i < cnt; i++ )
+        sum += arr[i];
+
+    LOG( "%s cnt:%llu min:%llu avg:%llu p50:%llu p99:%llu p999:%llu "
+         "max:%llu (nsec)",
+         name, (unsigned long long) cnt,
+         (unsigned long long) ( cnt ? arr[0] : 0 ),
+         (unsigned long long) ( cnt ? sum / cnt : 0 ),
+         (unsigned long long) __percentile( arr, cnt, 50 ),
+         (unsigned long long) __percentile( arr, cnt, 99 ),
+         (unsigned long long) ( cnt ? arr[(cnt - 1) * 999 / 1000] : 0 ),
+         (unsigned long long) ( cnt ? arr[cnt - 1] : 0 ) );
+
+    printf( "%-8s min %8llu avg %8llu p50 %8llu p99 %8llu "
+            "p999 %8llu max %8llu nsec\n",
+            name,
+            (unsigned long long) ( cnt ? arr[0] : 0 ),
+            (unsigned long long) ( cnt ? sum / cnt : 0 ),
+            (unsigned long long) __percentile( arr, cnt, 50 ),
+            (unsigned long long) __percentile( arr, cnt, 99 ),
+            (unsigned long long) ( cnt ? arr[(cnt - 1) * 999 / 1000] : 0 ),
+            (unsigned long long) ( cnt ? arr[cnt - 1] : 0 ) );
+}
+
+/******************* Perf counter functions ***********************************/
+
+static int __perf_open( uint32_t type, uint64_t config )
+{
+    struct perf_event_attr  attr;
+
+    memset( &attr, 0, sizeof(attr) );
+
+    attr.type = type;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+
+static void __perf_init()
+{
+    bench_t            *b = &g_bench;
+    int                 i;
+
+    b->perf_fds[BENCH_PERF_L1D_MISSES] =
+        __perf_open( PERF_TYPE_HW_CACHE,
+                     PERF_COUNT_HW_CACHE_L1D |
+                     (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) );
+
+    b->perf_fds[BENCH_PERF_LLC_MISSES] =
+        __perf_open( PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES );
+
+    for( i = 0; i < BENCH_PERF_EVENTS; i++ )
+    {
+        if( b->perf_fds[i] < 0 )
+        {
+            LOG( "perf counter:%d isn't available errno:%d strerror:%s",
+                 i, errno, strerror( errno ) );
+        }
+    }
+}
+
+static void __perf_start()
+{
+    bench_t            *b = &g_bench;
+    int                 i;
+
+    for( i = 0; i < BENCH_PERF_EVENTS; i++ )
+    {
+        if( b->perf_fds[i] < 0 )
+            continue;
+
+        ioctl( b->perf_fds[i], PERF_EVENT_IOC_RESET, 0 );
+        ioctl( b->perf_fds[i], PERF_EVENT_IOC_ENABLE, 0 );
+    }
+}
+
+/* NOTE: cache misses of the loop thread per received message */
+static void __perf_report( uint64_t cnt )
+{
+    bench_t            *b = &g_bench;
+    uint64_t            val[BENCH_PERF_EVENTS];
+    char                str[BENCH_PERF_EVENTS][32];
+    int                 i;
+
+    for( i = 0; i < BENCH_PERF_EVENTS; i++ )
+    {
+        if( b->perf_fds[i] < 0 || !cnt ||
+            read( b->perf_fds[i], &val[i], sizeof(uint64_t) ) !=
+            sizeof(uint64_t) )
+        {
+            snprintf( str[i], sizeof(str[i]), "n/a" );
+
+            continue;
+        }
+
+        snprintf( str[i], sizeof(str[i]), "%.2f",
+                  (double) val[i] / cnt );
+    }
+
+    LOG( "cache per msg l1d_misses:%s llc_misses:%s",
+         str[BENCH_PERF_L1D_MISSES], str[BENCH_PERF_LLC_MISSES] );
+
+    printf( "cache    l1d_misses %s llc_misses %s per msg\n",
+            str[BENCH_PERF_L1D_MISSES], str[BENCH_PERF_LLC_MISSES] );
+}
+
+static void __finish()
+{
+    bench_t            *b = &g_bench;
+    uint64_t            elapsed;
+    uint64_t            pps = 0;
+
+    elapsed = __ts_diff_ns( &b->first_rx, &b->last_rx );
+
+    if( elapsed && b->received > 1 )
+        pps = (b->received - 1) * 1000000000ULL / elapsed;
+
+    LOG( "mode:%s sent:%llu received:%llu lost:%llu out_of_order:%llu "
+         "batches:%llu updates:%llu pps:%llu",
+         cfg_bench_mode,
+         (unsigned long long) b->sent,
+         (unsigned long long) b->received,
+         (unsigned long long) ( b->sent - b->received ),
+         (unsigned long long) b->out_of_order,
+         (unsigned long long) b->rx_batches,
+         (unsigned long long) b->rx_updates,
+         (unsigned long long) pps );
+
+    printf( "mode %s sent %llu received %llu lost %llu "
+            "batches %llu updates %llu pps %llu\n",
+            cfg_bench_mode,
+            (unsigned long long) b->sent,
+            (unsigned long long) b->received,
+            (unsigned long long) ( b->sent - b->received ),
+            (unsigned long long) b->rx_batches,
+            (unsigned long long) b->rx_updates,
+            (unsigned long long) pps );
+
+    __perf_report( b->received );
+
+    __report( b->lat, b->received, "latency" );
+    __report( b->kern_lat, b->kern_lat_cnt, "kernel" );
+
+    fflush( stdout );
+
+    /* NOTE: the benchmark runs once */
+    exit( 0 );
+}
+
+/* NOTE: it's called once per received batch */
+static void __on_msgs_received( char           **bufs,
+                                int             *lens,
+                                struct timespec *rx_ts,
+                                int              cnt )
+{
+    bench_t            *b = &g_bench;
+    bench_hdr_t         hdr;
+    struct timespec     now;
+    int                 i;
+
+    clock_gettime( CLOCK_REALTIME, &now );
+
+    if( !b->received )
+    {
+        b->first_rx = now;
+
+        __perf_start();
+    }
+
+    b->last_rx = now;
+    b->rx_batches++;
+    b->is_rx_dirty = true;
+
+    for( i = 0; i < cnt; i++ )
+    {
+        if( lens[i] < (int) sizeof(bench_hdr_t) ||
+            b->received >= (uint64_t) *cfg_bench_count )
+        {
+            LOGE( "len:%d received:%llu",
+                  lens[i], (unsigned long long) b->received );
+
+            continue;
+        }
+
+        memcpy( &hdr, bufs[i], sizeof(hdr) );
+
+        if( hdr.seq < b->last_seq )
+            b->out_of_order++;
+
+        b->last_seq = hdr.seq;
+
+        b->lat[b->received++] = __ts_diff_ns( &hdr.sent, &now );
+
+        if( rx_ts && rx_ts[i].tv_sec )
+            b->kern_lat[b->kern_lat_cnt++] = __ts_diff_ns( &rx_ts[i], &now );
+    }
+
+    if( b->received == (uint64_t) *cfg_bench_count )
+        __finish();
+}
+
+/* NOTE: all batches read in one iteration make one update */
+static void __rx_update_hook( ptr_id_t  hook_id,
+                              ptr_id_t  udata_id )
+{
+    bench_t            *b = &g_bench;
+
+    if( !b->is_rx_dirty )
+        return;
+
+    b->is_rx_dirty = false;
+    b->rx_updates++;
+}
+
+/******************* UDP mode *************************************************/
+
+static void __udp_dgram_cb( conn_id_t      conn_id,
+                            ptr_id_t       udata_id,
+                            net_dgram_t   *dgrams,
+                            int            cnt )
+{
+    char               *bufs[BENCH_MAX_BURST];
+    int                 lens[BENCH_MAX_BURST];
+    struct timespec     rx_ts[BENCH_MAX_BURST];
+    int                 i;
+
+    assert( conn_id == g_bench.rx_conn_id && cnt <= BENCH_MAX_BURST );
+
+    for( i = 0; i < cnt; i++ )
+    {
+        bufs[i] = dgrams[i].buf;
+        lens[i] = dgrams[i].len;
+        rx_ts[i] = dgrams[i].ts;
+    }
+
+    __on_msgs_received( bufs, lens, rx_ts, cnt );
+}
+
+static void __udp_clo_cb( conn_id_t     conn_id,
+                          ptr_id_t      udata_id,
+                          int           code )
+{
+    LOGE( "id:0x%llx code:%d", NET_ID_FMT( conn_id ), code );
+
+    assert( false );
+}
+
+static int __udp_send( char *payload, int len, int cnt )
+{
+    net_dgram_t         dgrams[BENCH_MAX_BURST];
+    int                 i;
+
+    memset( dgrams, 0, cnt * sizeof(net_dgram_t) );
+
+    for( i = 0; i < cnt; i++ )
+    {
+        dgrams[i].buf = payload + i * len;
+        dgrams[i].len = len;
+    }
+
+    return net_send_dgrams( g_bench.tx_conn_id, dgrams, cnt );
+}
+
+static void __udp_start()
+{
+    g_bench.send_cb = __udp_send;
+    g_bench.is_tx_ready = true;
+
+    g_bench.rx_conn_id = net_make_udp( cfg_bench_rx_endpoint,
+                                       __udp_dgram_cb,
+                                       __udp_clo_cb,
+                                       g_bench.udata_id );
+    assert( g_bench.rx_conn_id );
+
+    g_bench.tx_conn_id = net_make_udp( cfg_bench_tx_endpoint,
+                                       __udp_dgram_cb,
+                                       __udp_clo_cb,
+                                       g_bench.udata_id );
+    assert( g_bench.tx_conn_id );
+}
+
+/******************* Stream modes *********************************************/
+
+/* NOTE: messages have the fixed size, a tail is kept */
+static int __conn_r_cb( conn_id_t   conn_id,
+                        ptr_id_t    udata_id,
+                        char       *buf,
+                        int         len,
+                        bool        is_closed )
+{
+    char               *bufs[BENCH_MAX_BURST];
+    int                 lens[BENCH_MAX_BURST];
+    int                 size = g_bench.payload_size;
+    int                 consumed = 0;
+    int                 cnt;
+
+    while( len - consumed >= size )
+    {
+        cnt = 0;
+
+        while( cnt < BENCH_MAX_BURST && len - consumed >= size )
+        {
+            bufs[cnt] = buf + consumed;
+            lens[cnt] = size;
+
+            consumed += size;
+            cnt++;
+        }
+
+        __on_msgs_received( bufs, lens, NULL, cnt );
+    }
+
+    return consumed;
+}
+
+static void __async_start();
+
+static void __conn_est_cb( conn_id_t    conn_id,
+                           ptr_id_t     udata_id )
+{
+    LOG( "id:0x%llx", NET_ID_FMT( conn_id ) );
+
+    if( conn_id == g_bench.tx_conn_id )
+        g_bench.is_tx_ready = true;
+    else
+        g_bench.rx_conn_id = conn_id;
+
+    if( g_bench.is_async && conn_id == g_bench.tx_conn_id )
+        __async_start();
+}
+
+static void __conn_clo_cb( conn_id_t    conn_id,
+                           ptr_id_t     udata_id,
+                           int          code )
+{
+    LOGE( "id:0x%llx code:%d", NET_ID_FMT( conn_id ), code );
+
+    assert( false );
+}
+
+/* NOTE: accepted conn needs its own udata_id */
+static ptr_id_t __dup_udata_cb( conn_id_t   conn_id,
+                                ptr_id_t    udata_id )
+{
+    return PTRID( &g_bench );
+}
+
+static int __conn_send( char *payload, int len, int cnt )
+{
+    int                 r;
+    int                 i;
+
+    for( i = 0; i < cnt; i++ )
+    {
+        r = net_post_data( g_bench.tx_conn_id,
+                           payload + i * len, len, false );
+        assert( r != -1 );
+    }
+
+    return cnt;
+}
+
+/* NOTE: unix_type is NULL for loopback TCP */
+static void __conn_start( char *unix_type )
+{
+    bench_t            *b = &g_bench;
+    char                port[MAX_PORT_STR_LEN];
+
+    if( unix_type )
+    {
+        b->listen_id = net_make_unix_listen( __conn_r_cb,
+                                             __conn_est_cb,
+                                             __conn_clo_cb,
+                                             __dup_udata_cb,
+                                             __conn_clo_cb,
+                                             b->udata_id,
+                                             cfg_bench_unix_path,
+                                             unix_type );
+
+        b->host.hostname = strdup( cfg_bench_unix_path );
+        b->host.port = strdup( unix_type );
+    }
+    else
+    {
+        b->listen_id = net_make_listen( __conn_r_cb,
+                                        __conn_est_cb,
+                                        __conn_clo_cb,
+                                        __dup_udata_cb,
+                                        __conn_clo_cb,
+                                        b->udata_id,
+                                        *cfg_bench_port,
+                                        false,
+                                        NULL );
+
+        snprintf( port, sizeof(port), "%d", *cfg_bench_port );
+
+        b->host.hostname = strdup( "127.0.0.1" );
+        b->host.port = strdup( port );
+
+        net_update_host( &b->host );
+    }
+
+    assert( b->listen_id );
+
+    b->tx_conn_id = net_make_conn( &b->host,
+                                   __conn_r_cb,
+                                   __conn_est_cb,
+                                   __conn_clo_cb,
+                                   b->udata_id );
+    assert( b->tx_conn_id );
+
+    b->send_cb = __conn_send;
+}
+
+/******************* Sender functions *****************************************/
+
+static void __drain_tmr_cb( conn_id_t   conn_id,
+                            ptr_id_t    conn_udata_id,
+                            tmr_id_t    tmr_id,
+                            ptr_id_t    tmr_udata_id )
+{
+    __finish();
+}
+
+static void __start_drain()
+{
+    bench_t            *b = &g_bench;
+
+    b->drain_tmr_id = net_make_global_tmr( b->udata_id,
+                                           __drain_tmr_cb,
+                                           cfg_bench_drain_timeout );
+    assert( b->drain_tmr_id );
+}
+
+/* NOTE: a burst is stamped once, payloads differ by seq, *
+ *       it returns true when everything is sent          */
+static bool __tx_burst()
+{
+    bench_t            *b = &g_bench;
+    bench_hdr_t         hdr;
+    int                 cnt, sent;
+    int                 i;
+
+    cnt = *cfg_bench_burst;
+
+    if( b->sent + cnt > (uint64_t) *cfg_bench_count )
+        cnt = *cfg_bench_count - b->sent;
+
+    clock_gettime( CLOCK_REALTIME, &hdr.sent );
+
+    for( i = 0; i < cnt; i++ )
+    {
+        hdr.seq = b->sent + i;
+
+        memcpy( b->payload + i * b->payload_size, &hdr, sizeof(hdr) );
+    }
+
+    sent = b->send_cb( b->payload, b->payload_size, cnt );
+    assert( sent >= 0 );
+
+    b->sent += sent;
+
+    return b->sent >= (uint64_t) *cfg_bench_count;
+}
+
+static void __tx_tmr_cb( conn_id_t      conn_id,
+                         ptr_id_t       conn_udata_id,
+                         tmr_id_t       tmr_id,
+                         ptr_id_t       tmr_udata_id )
+{
+    bench_t            *b = &g_bench;
+    int                 r;
+
+    if( !b->is_tx_ready )
+        return;
+
+    if( b->is_fiber )
+    {
+        r = fiber_resume( b->tx_fiber_id );
+        assert( !r );
+
+        if( b->sent < (uint64_t) *cfg_bench_count )
+            return;
+    }
+    else
+    if( !__tx_burst() )
+        return;
+
+    r = net_del_global_tmr( tmr_id );
+    assert( !r );
+
+    b->tx_tmr_id = 0;
+
+    __start_drain();
+}
+
+/******************* Fiber mode ***********************************************/
+
+static void __noop_fn( fiber_id_t fiber_id, ptr_id_t udata_id )
+{
+}
+
+static void __calibrate_fn( fiber_id_t fiber_id, ptr_id_t udata_id )
+{
+    while( !g_bench.is_calibrated )
+        fiber_suspend();
+}
+
+/* NOTE: cost of resume + suspend against a call by pointer, *
+ *       it's what a fiber adds to each callback it awaits   */
+static void __fiber_calibrate()
+{
+    bench_t            *b = &g_bench;
+    void              ( *volatile call )( fiber_id_t, ptr_id_t ) = __noop_fn;
+    struct timespec     t0, t1, t2;
+    uint64_t            call_ns;
+    uint64_t            switch_ns;
+    fiber_id_t          fiber_id;
+    int                 r;
+    int                 i;
+
+    fiber_id = fiber_spawn( __calibrate_fn, b->udata_id );
+    assert( fiber_id );
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+
+    for( i = 0; i < BENCH_FIBER_SWITCHES; i++ )
+        call( 0, 0 );
+
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+
+    for( i = 0; i < BENCH_FIBER_SWITCHES; i++ )
+    {
+        r = fiber_resume( fiber_id );
+        assert( !r );
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &t2 );
+
+    b->is_calibrated = true;
+
+    r = fiber_resume( fiber_id );
+    assert( !r );
+
+    call_ns = __ts_diff_ns( &t0, &t1 ) / BENCH_FIBER_SWITCHES;
+    switch_ns = __ts_diff_ns( &t1, &t2 ) / BENCH_FIBER_SWITCHES;
+
+    LOG( "call:%llu resume_suspend:%llu (nsec)",
+         (unsigned long long) call_ns,
+         (unsigned long long) switch_ns );
+
+    printf( "fiber    call %llu resume+suspend %llu nsec\n",
+            (unsigned long long) call_ns,
+            (unsigned long long) switch_ns );
+}
+
+/* NOTE: the tx timer resumes it for each burst, so the *
+ *       timing is the same as in tcp mode              */
+static void __fiber_tx_fn( fiber_id_t fiber_id, ptr_id_t udata_id )
+{
+    fiber_stats_t       stats;
+
+    do
+        fiber_suspend();
+    while( !__tx_burst() );
+
+    fiber_get_stats( &stats );
+
+    LOG( "switches:%llu stacks_mapped:%llu stacks_reused:%llu",
+         (unsigned long long) stats.switches,
+         (unsigned long long) stats.stacks_mapped,
+         (unsigned long long) stats.stacks_reused );
+}
+
+static void __fiber_start()
+{
+    bench_t            *b = &g_bench;
+
+    __fiber_calibrate();
+
+    __conn_start( NULL );
+
+    b->tx_fiber_id = fiber_spawn( __fiber_tx_fn, b->udata_id );
+    assert( b->tx_fiber_id );
+}
+
+/******************* Async mode ***********************************************/
+
+/* NOTE: loop thread, the tx thread has finished */
+static void __async_done_cb( ptr_id_t udata_id )
+{
+    bench_t            *b = &g_bench;
+    int                 r;
+
+    r = pthread_join( b->tx_thread, NULL );
+    assert( !r );
+
+    b->sent = *cfg_bench_count;
+
+    __start_drain();
+}
+
+/* NOTE: no net functions except net_async_* and no logging here */
+static void *__async_tx_thread( void *arg )
+{
+    bench_t            *b = arg;
+    bench_hdr_t         hdr;
+    struct timespec     interval;
+    char               *msg;
+    int                 cnt, sent = 0;
+    int                 r;
+    int                 i;
+
+    msg = malloc( b->payload_size );
+    memset( msg, 0, b->payload_size );
+
+    interval.tv_sec = cfg_bench_interval->tv_sec;
+    interval.tv_nsec = cfg_bench_interval->tv_usec * 1000;
+
+    while( sent < *cfg_bench_count )
+    {
+        nanosleep( &interval, NULL );
+
+        cnt = *cfg_bench_burst;
+
+        if( sent + cnt > *cfg_bench_count )
+            cnt = *cfg_bench_count - sent;
+
+        clock_gettime( CLOCK_REALTIME, &hdr.sent );
+
+        for( i = 0; i < cnt; i++ )
+        {
+            hdr.seq = sent + i;
+
+            memcpy( msg, &hdr, sizeof(hdr) );
+
+            r = net_async_post_data( b->tx_conn_id, msg, b->payload_size,
+                                     false, NET_PRIO_NORMAL );
+            assert( !r );
+        }
+
+        sent += cnt;
+    }
+
+    free( msg );
+
+    r = net_async_call( __async_done_cb, b->udata_id );
+    assert( !r );
+
+    return NULL;
+}
+
+static void __async_start()
+{
+    int                 r;
+
+    r = pthread_create( &g_bench.tx_thread, NULL,
+                        __async_tx_thread, &g_bench );
+    assert( !r );
+}
+
+/******************* Config functions *****************************************/
+
+static void __default_config_init()
+{
+    if( !cfg_bench_mode )
+        cfg_bench_mode = strdup( "udp" );
+
+    if( !cfg_bench_rx_endpoint )
+        cfg_bench_rx_endpoint = strdup( "mcast_feed" );
+
+    if( !cfg_bench_tx_endpoint )
+        cfg_bench_tx_endpoint = strdup( "mcast_sender" );
+
+    if( !cfg_bench_count )
+    {
+        cfg_bench_count = malloc( sizeof(int) );
+
+        *cfg_bench_count = 100000;
+    }
+
+    if( !cfg_bench_burst )
+    {
+        cfg_bench_burst = malloc( sizeof(int) );
+
+        *cfg_bench_burst = 64;
+    }
+
+    if( !cfg_bench_payload_size )
+    {
+        cfg_bench_payload_size = malloc( sizeof(int) );
+
+        *cfg_bench_payload_size = 64;
+    }
+
+    if( !cfg_bench_port )
+    {
+        cfg_bench_port = malloc( sizeof(int) );
+
+        *cfg_bench_port = 31100;
+    }
+
+    if( !cfg_bench_unix_path )
+        cfg_bench_unix_path = strdup( "/tmp/euclid_bench.sock" );
+
+    if( !cfg_bench_interval )
+    {
+        cfg_bench_interval = malloc( sizeof(struct timeval) );
+
+        cfg_bench_interval->tv_sec = 0;
+        cfg_bench_interval->tv_usec = 1000;
+    }
+
+    if( !cfg_bench_drain_timeout )
+    {
+        cfg_bench_drain_timeout = malloc( sizeof(struct timeval) );
+
+        cfg_bench_drain_timeout->tv_sec = 1;
+        cfg_bench_drain_timeout->tv_usec = 0;
+    }
+}
+
+void bench_cfg_init()
+{
+    config_add_file( "bench/bench.cfg" );
+
+    config_add_cmd( "bench_mode",
+                    CONFIG_CMD_TYPE_STRING,
+                    (void **) &cfg_bench_mode );
+
+    config_add_cmd( "bench_rx_endpoint",
+                    CONFIG_CMD_TYPE_STRING,
+                    (void **) &cfg_bench_rx_endpoint );
+
+    config_add_cmd( "bench_tx_endpoint",
+                    CONFIG_CMD_TYPE_STRING,
+                    (void **) &cfg_bench_tx_endpoint );
+
+    config_add_cmd( "bench_count",
+                    CONFIG_CMD_TYPE_INTEGER,
+                    (void **) &cfg_bench_count );
+
+    config_add_cmd( "bench_burst",
+                    CONFIG_CMD_TYPE_INTEGER,
+                    (void **) &cfg_bench_burst );
+
+    config_add_cmd( "bench_payload_size",
+                    CONFIG_CMD_TYPE_INTEGER,
+                    (void **) &cfg_bench_payload_size );
+
+    config_add_cmd( "bench_port",
+                    CONFIG_CMD_TYPE_INTEGER,
+                    (void **) &cfg_bench_port );
+
+    config_add_cmd( "bench_unix_path",
+                    CONFIG_CMD_TYPE_STRING,
+                    (void **) &cfg_bench_unix_path );
+
+    config_add_cmd( "bench_interval",
+                    CONFIG_CMD_TYPE_TIMEVAL,
+                    (void **) &cfg_bench_interval );
+
+    config_add_cmd( "bench_drain_timeout",
+                    CONFIG_CMD_TYPE_TIMEVAL,
+                    (void **) &cfg_bench_drain_timeout );
+}
+
+void bench_init()
+{
+    bench_t            *b = &g_bench;
+
+    __default_config_init();
+
+    assert( *cfg_bench_count > 0 );
+    assert( *cfg_bench_burst > 0 && *cfg_bench_burst <= BENCH_MAX_BURST );
+    assert( *cfg_bench_payload_size >= (int) sizeof(bench_hdr_t) );
+
+    memset( b, 0, sizeof(bench_t) );
+
+    b->udata_id = PTRID( b );
+
+    b->payload_size = *cfg_bench_payload_size;
+    b->payload = malloc( *cfg_bench_burst * b->payload_size );
+    memset( b->payload, 0, *cfg_bench_burst * b->payload_size );
+
+    b->lat = malloc( *cfg_bench_count * sizeof(uint64_t) );
+    b->kern_lat = malloc( *cfg_bench_count * sizeof(uint64_t) );
+
+    __perf_init();
+
+    if( !strcmp( cfg_bench_mode, "udp" ) )
+    {
+        __udp_start();
+    }
+    else
+    if( !strcmp( cfg_bench_mode, "tcp" ) )
+    {
+        __conn_start( NULL );
+    }
+    else
+    if( !strcmp( cfg_bench_mode, "unix" ) )
+    {
+        __conn_start( "stream" );
+    }
+    else
+    if( !strcmp( cfg_bench_mode, "seqpacket" ) )
+    {
+        __conn_start( "seqpacket" );
+    }
+    else
+    if( !strcmp( cfg_bench_mode, "shm" ) )
+    {
+        __conn_start( "shm" );
+    }
+    else
+    if( !strcmp( cfg_bench_mode, "async" ) )
+    {
+        b->is_async = true;
+
+        __conn_start( NULL );
+    }
+    else
+    if( !strcmp( cfg_bench_mode, "fiber" ) )
+    {
+        b->is_fiber = true;
+
+        __fiber_start();
+    }
+    else
+    {
+        LOGE( "mode:%s", cfg_bench_mode );
+
+        assert( false );
+    }
+
+    b->rx_hook_id = net_add_loop_hook( NET_HOOK_POST_DISPATCH,
+                                       __rx_update_hook, b->udata_id );
+    assert( b->rx_hook_id );
+
+    /* NOTE: async mode is driven by its own thread */
+    if( !b->is_async )
+    {
+        b->tx_tmr_id = net_make_global_tmr( b->udata_id,
+                                            __tx_tmr_cb,
+                                            cfg_bench_interval );
+        assert( b->tx_tmr_id );
+    }
+
+    LOG( "mode:%s count:%d burst:%d payload_size:%d",
+         cfg_bench_mode, *cfg_bench_count,
+         *cfg_bench_burst, b->payload_size );
+}
@@ -0,0 +1,89 @@
+/********************************************************************
+ * Copyright (c) 2014, Eldar Gaynetdinov <hal9000ed2k@gmail.com>    *
+ *                                                                  *
+ * Permission to use, copy, modify, and/or distribute this software *
+ * for any purpose with or without fee is hereby granted, provided  *
+ * that the above copyright notice and this permission notice       *
+ * appear in all copies.                                            *
+ *                                                                  *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL    *
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED    *
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL     *
+ * THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT,          *
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING     *
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF       *
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF    *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.   *
+ ********************************************************************/
+
+/* NOTE: payload header of every sent message */
+typedef struct {
+    uint64_t            seq;
+    struct timespec     sent;
+} bench_hdr_t;
+
+/* NOTE: hw cache counters of the loop thread, user space only */
+typedef enum {
+    BENCH_PERF_L1D_MISSES = 0,
+    BENCH_PERF_LLC_MISSES,
+    BENCH_PERF_EVENTS
+} bench_perf_t;
+
+/* NOTE: it returns the number of sent messages */
+typedef int ( *bench_send_t )( char *payload, int len, int cnt );
+
+typedef struct {
+    ptr_id_t            udata_id;
+
+    bench_send_t        send_cb;
+    bool                is_tx_ready;
+
+    /* NOTE: async mode, tx_thread posts by net_async_post_data */
+    bool                is_async;
+    pthread_t           tx_thread;
+
+    /* NOTE: fiber mode, tx timer resumes tx_fiber_id */
+    bool                is_fiber;
+    bool                is_calibrated;
+    fiber_id_t          tx_fiber_id;
+
+    conn_id_t           rx_conn_id;
+    conn_id_t           tx_conn_id;
+    conn_id_t           listen_id;
+    tmr_id_t            tx_tmr_id;
+    tmr_id_t            drain_tmr_id;
+
+    net_host_t          host;
+
+    char               *payload;
+    int                 payload_size;
+
+    uint64_t            sent;
+    uint64_t            received;
+    uint64_t            rx_batches;
+
+    /* NOTE: loop iterations which have received something */
+    net_hook_id_t       rx_hook_id;
+    bool                is_rx_dirty;
+    uint64_t            rx_updates;
+    uint64_t            out_of_order;
+    uint64_t            last_seq;
+
+    struct timespec     first_rx;
+    struct timespec     last_rx;
+
+    /* NOTE: user space latency, from send to the callback *
+     *       and kernel latency, from rx timestamp to the  *
+     *       callback, both in nsec per received message   */
+    uint64_t           *lat;
+    uint64_t           *kern_lat;
+    uint64_t            kern_lat_cnt;
+
+    /* NOTE: -1 if the counter isn't available, *
+     *       they count from the first message  */
+    int                 perf_fds[BENCH_PERF_EVENTS];
+} bench_t;
+
+#define BENCH_MAX_BURST         1024
+
+#define BENCH_FIBER_SWITCHES    1000000
@@ -24,6 +24,7 @@
 #include "module.h"
 #include "network.h"
 #include "http.h"
+#include "fiber.h"
 #include "config.h"
 #include "config_internal.h"
 
@@ -77,7 +78,7 @@ static char_type_t __get_char_type( char ch )
     if( ch >= 'A' && ch <= 'Z' )
         return CH_WORD;
     else
-    if( ch == '_' || ch == '.' || ch == '/' )
+    if( ch == '_' || ch == '.' || ch == '/' || ch == '@' )
         return CH_WORD;
 
     return CH_UNKNOWN;
@@ -1155,6 +1156,7 @@ static void __parse_net_host( ll_t         *list,
 #define PORT            "port"
 #define SSL             "ssl"
 #define LABEL           "label"
+#define SOCK_PROFILE    "sock_profile"
 
     mapping_node_t     *node;
     mapping_node_t     *node_next;
@@ -1162,6 +1164,7 @@ static void __parse_net_host( ll_t         *list,
     bool                port_flag = false;
     bool                ssl_flag = false;
     bool                label_flag = false;
+    bool                sock_profile_flag = false;
 
     assert( !host->hostname && !host->port &&
             !host->use_ssl );
@@ -1222,6 +1225,18 @@ static void __parse_net_host( ll_t         *list,
                  node->val, host->label );
         }
         else
+        if( !strncmp( node->key, SOCK_PROFILE, sizeof(SOCK_PROFILE) ) )
+        {
+            assert( !sock_profile_flag );
+
+            host->sock_profile = strdup( node->val );
+
+            sock_profile_flag = true;
+
+            LOG( "cfg_val:%s sock_profile:%s",
+                 node->val, host->sock_profile );
+        }
+        else
         {
             assert( false );
         }
@@ -1233,10 +1248,22 @@ static void __parse_net_host( ll_t         *list,
             host->hostname[0] && host->port[0] &&
             (host->use_ssl == 0 || host->use_ssl == 1) );
 
+    /* NOTE: AF_UNIX host, port is the socket type */
+    assert( host->hostname[0] != '/' ||
+            (!host->use_ssl &&
+             (!strcmp( host->port, "stream" ) ||
+              !strcmp( host->port, "seqpacket" ) ||
+              !strcmp( host->port, "shm" ))) );
+
+    /* NOTE: in-process pipe host, port is a listening port */
+    assert( host->hostname[0] != '@' ||
+            (!host->use_ssl && atoi( host->port ) > 0) );
+
 #undef HOST
 #undef PORT
 #undef SSL
 #undef LABEL
+#undef SOCK_PROFILE
 }
 
 static ll_node_t *__parse_net_host_node( ll_t *list )
@@ -1261,6 +1288,260 @@ static void __main_hosts_cb( char          *cmd_name,
                             __parse_net_host_node );
 }
 
+/* NOTE: values are parsed by strtol with base 0, *
+ *       so tos can be written as 0x10            */
+static void __parse_sock_profile( ll_t                 *list,
+                                  net_sock_profile_t   *profile )
+{
+#define NAME            "name"
+
+    mapping_node_t     *node;
+    mapping_node_t     *node_next;
+    int                *opt;
+
+    assert( !profile->name );
+
+    profile->nodelay = NET_SOCK_OPT_UNSET;
+    profile->quickack = NET_SOCK_OPT_UNSET;
+    profile->sndbuf = NET_SOCK_OPT_UNSET;
+    profile->rcvbuf = NET_SOCK_OPT_UNSET;
+    profile->user_timeout = NET_SOCK_OPT_UNSET;
+    profile->tos = NET_SOCK_OPT_UNSET;
+    profile->priority = NET_SOCK_OPT_UNSET;
+    profile->fastopen = NET_SOCK_OPT_UNSET;
+    profile->fastopen_qlen = NET_SOCK_OPT_UNSET;
+    profile->rx_timestamping = NET_SOCK_OPT_UNSET;
+
+    LL_CHECK( list, list->head );
+    node = PTRID_GET_PTR( list->head );
+
+    while( node )
+    {
+        LL_CHECK( list, node->id );
+        node_next = PTRID_GET_PTR( node->next );
+
+        opt = NULL;
+
+        if( !strncmp( node->key, NAME, sizeof(NAME) ) )
+        {
+            assert( !profile->name );
+
+            profile->name = strdup( node->val );
+
+            LOG( "cfg_val:%s name:%s",
+                 node->val, profile->name );
+        }
+        else
+        if( !strcmp( node->key, "nodelay" ) )
+            opt = &profile->nodelay;
+        else
+        if( !strcmp( node->key, "quickack" ) )
+            opt = &profile->quickack;
+        else
+        if( !strcmp( node->key, "sndbuf" ) )
+            opt = &profile->sndbuf;
+        else
+        if( !strcmp( node->key, "rcvbuf" ) )
+            opt = &profile->rcvbuf;
+        else
+        if( !strcmp( node->key, "user_timeout" ) )
+            opt = &profile->user_timeout;
+        else
+        if( !strcmp( node->key, "tos" ) )
+            opt = &profile->tos;
+        else
+        if( !strcmp( node->key, "priority" ) )
+            opt = &profile->priority;
+        else
+        if( !strcmp( node->key, "fastopen" ) )
+            opt = &profile->fastopen;
+        else
+        if( !strcmp( node->key, "fastopen_qlen" ) )
+            opt = &profile->fastopen_qlen;
+        else
+        if( !strcmp( node->key, "rx_timestamping" ) )
+            opt = &profile->rx_timestamping;
+        else
+        {
+            assert( false );
+        }
+
+        if( opt )
+        {
+            assert( *opt == NET_SOCK_OPT_UNSET );
+
+            *opt = strtol( node->val, NULL, 0 );
+
+            assert( *opt >= 0 );
+
+            LOG( "cfg_val:%s %s:%d",
+                 node->val, node->key, *opt );
+        }
+
+        node = node_next;
+    }
+
+    assert( profile->name && profile->name[0] );
+
+#undef NAME
+}
+
+static ll_node_t *__parse_sock_profile_node( ll_t *list )
+{
+    net_sock_profile_t     *profile;
+
+    profile = malloc( sizeof(net_sock_profile_t) );
+    memset( profile, 0, sizeof(net_sock_profile_t) );
+
+    __parse_sock_profile( list, profile );
+
+    return (ll_node_t *) profile;
+}
+
+static void __sock_profiles_cb( char           *cmd_name,
+                                cmd_type_t      cmd_type,
+                                void           *cfg_val,
+                                void          **result_val )
+{
+    __generic_mapping_list( cmd_name, cmd_type,
+                            cfg_val, result_val,
+                            __parse_sock_profile_node );
+}
+
+static void __parse_udp_endpoint( ll_t                  *list,
+                                  net_udp_endpoint_t    *udp )
+{
+    mapping_node_t     *node;
+    mapping_node_t     *node_next;
+    char              **str;
+    int                *opt;
+
+    assert( !udp->name );
+
+    udp->rcvbuf = NET_SOCK_OPT_UNSET;
+    udp->sndbuf = NET_SOCK_OPT_UNSET;
+    udp->tos = NET_SOCK_OPT_UNSET;
+    udp->mcast_ttl = NET_SOCK_OPT_UNSET;
+    udp->mcast_loop = NET_SOCK_OPT_UNSET;
+    udp->dgram_size = NET_SOCK_OPT_UNSET;
+
+    LL_CHECK( list, list->head );
+    node = PTRID_GET_PTR( list->head );
+
+    while( node )
+    {
+        LL_CHECK( list, node->id );
+        node_next = PTRID_GET_PTR( node->next );
+
+        str = NULL;
+        opt = NULL;
+
+        if( !strcmp( node->key, "name" ) )
+            str = &udp->name;
+        else
+        if( !strcmp( node->key, "bind" ) )
+            str = &udp->bind;
+        else
+        if( !strcmp( node->key, "group" ) )
+            str = &udp->group;
+        else
+        if( !strcmp( node->key, "iface" ) )
+            str = &udp->iface;
+        else
+        if( !strcmp( node->key, "dest" ) )
+            str = &udp->dest;
+        else
+        if( !strcmp( node->key, "port" ) )
+            opt = &udp->port;
+        else
+        if( !strcmp( node->key, "dest_port" ) )
+            opt = &udp->dest_port;
+        else
+        if( !strcmp( node->key, "rcvbuf" ) )
+            opt = &udp->rcvbuf;
+        else
+        if( !strcmp( node->key, "sndbuf" ) )
+            opt = &udp->sndbuf;
+        else
+        if( !strcmp( node->key, "tos" ) )
+            opt = &udp->tos;
+        else
+        if( !strcmp( node->key, "mcast_ttl" ) )
+            opt = &udp->mcast_ttl;
+        else
+        if( !strcmp( node->key, "mcast_loop" ) )
+            opt = &udp->mcast_loop;
+        else
+        if( !strcmp( node->key, "dgram_size" ) )
+            opt = &udp->dgram_size;
+        else
+        if( !strcmp( node->key, "xdp_ifname" ) )
+            str = &udp->xdp_ifname;
+        else
+        if( !strcmp( node->key, "xdp_queue" ) )
+            opt = &udp->xdp_queue;
+        else
+        if( !strcmp( node->key, "xdp_mode" ) )
+            str = &udp->xdp_mode;
+        else
+        {
+            assert( false );
+        }
+
+        if( str )
+        {
+            assert( !*str );
+
+            *str = strdup( node->val );
+
+            LOG( "cfg_val:%s %s:%s",
+                 node->val, node->key, *str );
+        }
+
+        if( opt )
+        {
+            *opt = strtol( node->val, NULL, 0 );
+
+            assert( *opt >= 0 );
+
+            LOG( "cfg_val:%s %s:%d",
+                 node->val, node->key, *opt );
+        }
+
+        node = node_next;
+    }
+
+    assert( udp->name && udp->name[0] );
+    assert( udp->port <= 65535 && udp->dest_port <= 65535 );
+    assert( !udp->dest || udp->dest_port );
+    assert( !udp->xdp_ifname || udp->port );
+    assert( !udp->xdp_mode ||
+            !strcmp( udp->xdp_mode, "skb" ) ||
+            !strcmp( udp->xdp_mode, "drv" ) );
+}
+
+static ll_node_t *__parse_udp_endpoint_node( ll_t *list )
+{
+    net_udp_endpoint_t     *udp;
+
+    udp = malloc( sizeof(net_udp_endpoint_t) );
+    memset( udp, 0, sizeof(net_udp_endpoint_t) );
+
+    __parse_udp_endpoint( list, udp );
+
+    return (ll_node_t *) udp;
+}
+
+static void __udp_endpoints_cb( char           *cmd_name,
+                                cmd_type_t      cmd_type,
+                                void           *cfg_val,
+                                void          **result_val )
+{
+    __generic_mapping_list( cmd_name, cmd_type,
+                            cfg_val, result_val,
+                            __parse_udp_endpoint_node );
+}
+
 /******************* Register config commands *********************************/
 
 static void __register_cmds()
@@ -1335,6 +1616,146 @@ static void __register_cmds()
                (void **) &cfg_net_flush_and_close_timeout,
                __timeval_cb );
 
+    __add_cmd( "net_write_high_watermark", SCALAR,
+               (void **) &cfg_net_write_high_watermark,
+               __integer_cb );
+
+    __add_cmd( "net_write_low_watermark", SCALAR,
+               (void **) &cfg_net_write_low_watermark,
+               __integer_cb );
+
+    __add_cmd( "net_write_high_msgs", SCALAR,
+               (void **) &cfg_net_write_high_msgs,
+               __integer_cb );
+
+    __add_cmd( "net_write_low_msgs", SCALAR,
+               (void **) &cfg_net_write_low_msgs,
+               __integer_cb );
+
+    __add_cmd( "net_sock_profiles", MAPPINGS_BLOCKS_LIST,
+               (void **) &cfg_net_sock_profiles,
+               __sock_profiles_cb );
+
+    __add_cmd( "net_default_sock_profile", SCALAR,
+               (void **) &cfg_net_default_sock_profile,
+               __string_cb );
+
+    __add_cmd( "net_udp_recv_batch", SCALAR,
+               (void **) &cfg_net_udp_recv_batch,
+               __integer_cb );
+
+    __add_cmd( "net_udp_endpoints", MAPPINGS_BLOCKS_LIST,
+               (void **) &cfg_net_udp_endpoints,
+               __udp_endpoints_cb );
+
+    __add_cmd( "net_shm_ring_size", SCALAR,
+               (void **) &cfg_net_shm_ring_size,
+               __integer_cb );
+
+    __add_cmd( "net_tcp_info_interval", MAPPINGS_BLOCK,
+               (void **) &cfg_net_tcp_info_interval,
+               __timeval_cb );
+
+    __add_cmd( "net_handover_path", SCALAR,
+               (void **) &cfg_net_handover_path,
+               __string_cb );
+
+    __add_cmd( "net_handover_idle_conns", SCALAR,
+               (void **) &cfg_net_handover_idle_conns,
+               __integer_cb );
+
+    __add_cmd( "net_handover_drain_timeout", MAPPINGS_BLOCK,
+               (void **) &cfg_net_handover_drain_timeout,
+               __timeval_cb );
+
+    __add_cmd( "net_offload_threads", SCALAR,
+               (void **) &cfg_net_offload_threads,
+               __integer_cb );
+
+    __add_cmd( "net_warm_up", SCALAR,
+               (void **) &cfg_net_warm_up,
+               __integer_cb );
+
+    __add_cmd( "net_warm_up_heap_size", SCALAR,
+               (void **) &cfg_net_warm_up_heap_size,
+               __integer_cb );
+
+    __add_cmd( "net_mlockall", SCALAR,
+               (void **) &cfg_net_mlockall,
+               __integer_cb );
+
+    __add_cmd( "net_huge_pages", SCALAR,
+               (void **) &cfg_net_huge_pages,
+               __integer_cb );
+
+    __add_cmd( "net_fault_report_time", MAPPINGS_BLOCK,
+               (void **) &cfg_net_fault_report_time,
+               __timeval_cb );
+
+    __add_cmd( "net_overload_lag", MAPPINGS_BLOCK,
+               (void **) &cfg_net_overload_lag,
+               __timeval_cb );
+
+    __add_cmd( "net_overload_depth", SCALAR,
+               (void **) &cfg_net_overload_depth,
+               __integer_cb );
+
+    __add_cmd( "net_overload_pause_accept", SCALAR,
+               (void **) &cfg_net_overload_pause_accept,
+               __integer_cb );
+
+    __add_cmd( "net_watchdog_budget", MAPPINGS_BLOCK,
+               (void **) &cfg_net_watchdog_budget,
+               __timeval_cb );
+
+    __add_cmd( "net_sim", SCALAR,
+               (void **) &cfg_net_sim,
+               __integer_cb );
+
+    __add_cmd( "net_sim_seed", SCALAR,
+               (void **) &cfg_net_sim_seed,
+               __integer_cb );
+
+    __add_cmd( "net_sim_latency", MAPPINGS_BLOCK,
+               (void **) &cfg_net_sim_latency,
+               __timeval_cb );
+
+    __add_cmd( "net_sim_loss", SCALAR,
+               (void **) &cfg_net_sim_loss,
+               __integer_cb );
+
+    __add_cmd( "net_sim_rto", MAPPINGS_BLOCK,
+               (void **) &cfg_net_sim_rto,
+               __timeval_cb );
+
+    __add_cmd( "net_sim_duration", MAPPINGS_BLOCK,
+               (void **) &cfg_net_sim_duration,
+               __timeval_cb );
+
+    __add_cmd( "net_capture_file", SCALAR,
+               (void **) &cfg_net_capture_file,
+               __string_cb );
+
+    __add_cmd( "net_capture_file_size", SCALAR,
+               (void **) &cfg_net_capture_file_size,
+               __integer_cb );
+
+    __add_cmd( "net_replay_file", SCALAR,
+               (void **) &cfg_net_replay_file,
+               __string_cb );
+
+    __add_cmd( "net_replay_port", SCALAR,
+               (void **) &cfg_net_replay_port,
+               __integer_cb );
+
+    __add_cmd( "net_replay_paced", SCALAR,
+               (void **) &cfg_net_replay_paced,
+               __integer_cb );
+
+    __add_cmd( "net_replay_drain_timeout", MAPPINGS_BLOCK,
+               (void **) &cfg_net_replay_drain_timeout,
+               __timeval_cb );
+
     /*************** http cmds *********************/
 
     __add_cmd( "http_response_timeout", MAPPINGS_BLOCK,
@@ -1344,6 +1765,28 @@ static void __register_cmds()
     __add_cmd( "http_check_messages_queue_interval", MAPPINGS_BLOCK,
                (void **) &cfg_http_check_messages_queue_interval,
                __timeval_cb );
+
+    __add_cmd( "http_offload_inflate_size", SCALAR,
+               (void **) &cfg_http_offload_inflate_size,
+               __integer_cb );
+
+    __add_cmd( "http_warm_up_rounds", SCALAR,
+               (void **) &cfg_http_warm_up_rounds,
+               __integer_cb );
+
+    __add_cmd( "http_overload_shed", SCALAR,
+               (void **) &cfg_http_overload_shed,
+               __integer_cb );
+
+    /*************** fiber cmds ********************/
+
+    __add_cmd( "fiber_stack_size", SCALAR,
+               (void **) &cfg_fiber_stack_size,
+               __integer_cb );
+
+    __add_cmd( "fiber_pool_size", SCALAR,
+               (void **) &cfg_fiber_pool_size,
+               __integer_cb );
 }
 
 /******************* Interface functions **************************************/
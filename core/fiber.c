@@ -0,0 +1,864 @@
+/********************************************************************
+ * Copyright (c) 2014, Eldar Gaynetdinov <hal9000ed2k@gmail.com>    *
+ *                                                                  *
+ * Permission to use, copy, modify, and/or distribute this software *
+ * for any purpose with or without fee is hereby granted, provided  *
+ * that the above copyright notice and this permission notice       *
+ * appear in all copies.                                            *
+ *                                                                  *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL    *
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED    *
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL     *
+ * THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT,          *
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING     *
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF       *
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF    *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.   *
+ ********************************************************************/
+
+#include "main.h"
+#include "linked_list.h"
+#include "logger.h"
+#include "network.h"
+#include "http.h"
+#include "fiber.h"
+#include "fiber_internal.h"
+
+int                *cfg_fiber_stack_size = NULL;
+int                *cfg_fiber_pool_size = NULL;
+
+static fiber_t         *g_current = NULL;
+static fiber_ctx_t      g_loop_ctx;
+
+static fiber_stack_t   *g_stack_pool = NULL;
+static size_t           g_stack_size;
+static size_t           g_page_size;
+
+static fiber_stats_t    g_stats;
+
+static void __fiber_entry();
+
+/******************* Context switch functions *********************************/
+
+#if defined(__x86_64__)
+
+/* NOTE: callee-saved registers, MXCSR and x87 control word   *
+ *       are pushed to the current stack, then rsp is swapped */
+void __fiber_switch( void **from_sp, void *to_sp );
+
+__asm__(
+    ".text\n"
+    ".globl __fiber_switch\n"
+    ".type __fiber_switch, @function\n"
+    "__fiber_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size __fiber_switch, .-__fiber_switch\n" );
+
+/* NOTE: the frame which __fiber_switch pops at the first switch, *
+ *       it "returns" to __fiber_entry with the ABI stack align   */
+static void __fiber_ctx_init( fiber_t *f )
+{
+    uint64_t           *top;
+    uint32_t            mxcsr;
+    uint16_t            fpucw;
+
+    top = (uint64_t *) (f->stack + g_stack_size);
+    c_assert( !((uintptr_t) top & 15) );
+
+    __asm__ __volatile__( "stmxcsr %0" : "=m" (mxcsr) );
+    __asm__ __volatile__( "fnstcw %0" : "=m" (fpucw) );
+
+    top[-1] = 0;
+    top[-2] = (uint64_t) (uintptr_t) __fiber_entry;
+    memset( &top[-8], 0, 6 * sizeof(uint64_t) );
+    top[-9] = (uint64_t) mxcsr | ((uint64_t) fpucw << 32);
+
+    f->ctx.sp = &top[-9];
+}
+
+static inline void __fiber_ctx_switch( fiber_ctx_t *from, fiber_ctx_t *to )
+{
+    __fiber_switch( &from->sp, to->sp );
+}
+
+#else
+
+/* NOTE: swapcontext also saves the signal mask, so it's slower */
+static void __fiber_ctx_init( fiber_t *f )
+{
+    int                 r;
+
+    r = getcontext( &f->ctx.uc );
+    c_assert( !r );
+
+    f->ctx.uc.uc_stack.ss_sp = f->stack;
+    f->ctx.uc.uc_stack.ss_size = g_stack_size;
+    f->ctx.uc.uc_link = NULL;
+
+    makecontext( &f->ctx.uc, __fiber_entry, 0 );
+}
+
+static inline void __fiber_ctx_switch( fiber_ctx_t *from, fiber_ctx_t *to )
+{
+    int                 r;
+
+    r = swapcontext( &from->uc, &to->uc );
+    c_assert( !r );
+}
+
+#endif
+
+/******************* Stack pool functions *************************************/
+
+/* NOTE: the lowest page is a guard, so an overflow is SIGSEGV */
+static char *__get_stack()
+{
+    fiber_stack_t      *s;
+    char               *map;
+    int                 r;
+
+    if( g_stack_pool )
+    {
+        s = g_stack_pool;
+        g_stack_pool = s->next;
+
+        g_stats.pooled--;
+        g_stats.stacks_reused++;
+
+        return (char *) s;
+    }
+
+    map = mmap( NULL, g_stack_size + g_page_size,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+
+    c_assert( map != MAP_FAILED );
+
+    r = mprotect( map, g_page_size, PROT_NONE );
+    c_assert( !r );
+
+    g_stats.stacks_mapped++;
+
+    return map + g_page_size;
+}
+
+static void __put_stack( char *stack )
+{
+    fiber_stack_t      *s;
+    int                 r;
+
+    if( g_stats.pooled < *cfg_fiber_pool_size )
+    {
+        s = (fiber_stack_t *) stack;
+        s->next = g_stack_pool;
+        g_stack_pool = s;
+
+        g_stats.pooled++;
+        return;
+    }
+
+    r = munmap( stack - g_page_size, g_stack_size + g_page_size );
+    c_assert( !r );
+}
+
+/******************* Fiber misc functions *************************************/
+
+static void __free_conn( fiber_conn_t *rec )
+{
+    fiber_msg_node_t   *node;
+
+    while( rec->queued.total )
+    {
+        node = PTRID_GET_PTR( rec->queued.head );
+        LL_DEL_NODE( &rec->queued, node->id );
+
+        http_free_msg( node->msg );
+        free( node );
+    }
+
+    memset( rec, 0, sizeof(fiber_conn_t) );
+    free( rec );
+}
+
+static fiber_conn_t *__find_conn( fiber_t      *f,
+                                  http_id_t     http_id )
+{
+    fiber_conn_t       *rec;
+
+    if( !f->conns.total )
+        return NULL;
+
+    /* NOTE: the newest one, an id may be reused after close */
+    LL_CHECK( &f->conns, f->conns.tail );
+    rec = PTRID_GET_PTR( f->conns.tail );
+
+    while( rec )
+    {
+        if( rec->http_id == http_id )
+            return rec;
+
+        rec = PTRID_GET_PTR( rec->prev );
+    }
+
+    return NULL;
+}
+
+static void __release_owned_msg( fiber_t *f )
+{
+    if( !f->owned_msg )
+        return;
+
+    http_free_msg( f->owned_msg );
+    f->owned_msg = NULL;
+}
+
+/* NOTE: shutdown of a conn isn't inline, so it's freed by clo_cb */
+static void __detach_conn( fiber_t         *f,
+                           fiber_conn_t    *rec,
+                           bool             flush_and_close )
+{
+    http_id_t           http_id = rec->http_id;
+    int                 r;
+
+    LL_DEL_NODE( &f->conns, rec->id );
+
+    if( rec->is_closed )
+    {
+        __free_conn( rec );
+        return;
+    }
+
+    rec->is_orphan = true;
+
+    r = http_shutdown( http_id, flush_and_close );
+
+    if( r )
+    {
+        LOGE( "fiber_id:0x%llx http_id:0x%llx",
+              PTRID_FMT( f->id ), PTRID_FMT( http_id ) );
+    }
+}
+
+static void __free_fiber( fiber_t *f )
+{
+    c_assert( f->is_done && !f->tmr_id && f != g_current );
+
+    LOG( "fiber_id:0x%llx conns:%d", PTRID_FMT( f->id ), f->conns.total );
+
+    __release_owned_msg( f );
+
+    while( f->conns.total )
+        __detach_conn( f, PTRID_GET_PTR( f->conns.head ), false );
+
+    __put_stack( f->stack );
+
+    g_stats.finished++;
+    g_stats.active--;
+
+    memset( f, 0, sizeof(fiber_t) );
+    free( f );
+}
+
+/******************* Scheduling functions *************************************/
+
+static void __switch_to_fiber( fiber_t *f )
+{
+    c_assert( !g_current && !f->is_done );
+
+    g_current = f;
+    g_stats.switches++;
+
+    __fiber_ctx_switch( &g_loop_ctx, &f->ctx );
+
+    g_current = NULL;
+
+    if( f->is_done )
+        __free_fiber( f );
+}
+
+static void __switch_to_loop()
+{
+    fiber_t            *f = g_current;
+
+    c_assert( f );
+
+    g_stats.switches++;
+
+    __fiber_ctx_switch( &f->ctx, &g_loop_ctx );
+}
+
+static void __fiber_entry()
+{
+    fiber_t            *f = g_current;
+
+    f->fn( f->id, f->udata_id );
+
+    f->is_done = true;
+
+    __switch_to_loop();
+
+    /* NOTE: done fiber is never resumed */
+    c_assert( false );
+}
+
+static void __fiber_tmr_cb( conn_id_t      conn_id,
+                            ptr_id_t       conn_udata_id,
+                            tmr_id_t       tmr_id,
+                            ptr_id_t       tmr_udata_id )
+{
+    fiber_t            *f;
+    int                 r;
+
+    c_assert( !conn_id && !conn_udata_id && tmr_udata_id );
+
+    f = PTRID_GET_PTR( tmr_udata_id );
+    c_assert( f->id == tmr_udata_id && f->tmr_id == tmr_id &&
+              f->wait != FIBER_WAIT_NONE );
+
+    r = net_del_global_tmr( tmr_id );
+    c_assert( !r );
+
+    f->tmr_id = 0;
+    f->is_timed_out = true;
+
+    __switch_to_fiber( f );
+}
+
+/* NOTE: it returns -1 if timeout has expired */
+static int __wait( fiber_t         *f,
+                   int              wait,
+                   fiber_conn_t    *rec,
+                   struct timeval  *timeout )
+{
+    int                 r;
+
+    c_assert( f == g_current && f->wait == FIBER_WAIT_NONE );
+
+    f->wait = wait;
+    f->wait_conn_id = rec ? rec->id : 0;
+    f->is_timed_out = false;
+
+    if( timeout )
+    {
+        f->tmr_id = net_make_global_tmr( f->id, __fiber_tmr_cb, timeout );
+        c_assert( f->tmr_id );
+    }
+
+    __switch_to_loop();
+
+    f->wait = FIBER_WAIT_NONE;
+    f->wait_conn_id = 0;
+
+    if( f->tmr_id )
+    {
+        r = net_del_global_tmr( f->tmr_id );
+        c_assert( !r );
+
+        f->tmr_id = 0;
+    }
+
+    return f->is_timed_out ? -1 : 0;
+}
+
+static void __wake( fiber_conn_t *rec, int wait )
+{
+    fiber_t            *f;
+
+    f = PTRID_GET_PTR( rec->fiber_id );
+    c_assert( f->id == rec->fiber_id );
+
+    if( f->wait != wait || f->wait_conn_id != rec->id )
+        return;
+
+    __switch_to_fiber( f );
+}
+
+static void __start_cb( ptr_id_t udata_id )
+{
+    fiber_t            *f;
+
+    f = PTRID_GET_PTR( udata_id );
+    c_assert( f->id == udata_id && !f->is_started );
+
+    f->is_started = true;
+
+    __switch_to_fiber( f );
+}
+
+/******************* HTTP callbacks *******************************************/
+
+static void __r_cb( http_id_t       http_id,
+                    ptr_id_t        udata_id,
+                    http_msg_t     *http_msg )
+{
+    fiber_conn_t       *rec;
+    fiber_msg_node_t   *node;
+    fiber_t            *f;
+    int                 r;
+
+    c_assert( http_id && udata_id && http_msg );
+
+    rec = PTRID_GET_PTR( udata_id );
+    c_assert( rec->id == udata_id && rec->http_id == http_id );
+
+    if( rec->is_orphan )
+        return;
+
+    f = PTRID_GET_PTR( rec->fiber_id );
+    c_assert( f->id == rec->fiber_id );
+
+    if( f->wait == FIBER_WAIT_RESPONSE && f->wait_conn_id == rec->id )
+    {
+        rec->msg = http_msg;
+
+        __switch_to_fiber( f );
+
+        /* NOTE: rec is freed only by clo_cb */
+        rec->msg = NULL;
+        return;
+    }
+
+    node = malloc( sizeof(fiber_msg_node_t) );
+    memset( node, 0, sizeof(fiber_msg_node_t) );
+
+    node->msg = http_dup_msg( http_msg, false );
+
+    LL_ADD_NODE( &rec->queued, node );
+
+    LOG( "fiber_id:0x%llx http_id:0x%llx queued:%d",
+         PTRID_FMT( f->id ), PTRID_FMT( http_id ), rec->queued.total );
+
+    /* NOTE: it may fail if the conn is being closed */
+    r = http_pause_read( http_id, true );
+
+    if( r )
+    {
+        LOG( "fiber_id:0x%llx http_id:0x%llx",
+             PTRID_FMT( f->id ), PTRID_FMT( http_id ) );
+    }
+}
+
+static void __est_cb( http_id_t     http_id,
+                      ptr_id_t      udata_id )
+{
+    fiber_conn_t       *rec;
+
+    c_assert( http_id && udata_id );
+
+    rec = PTRID_GET_PTR( udata_id );
+    c_assert( rec->id == udata_id && rec->http_id == http_id );
+
+    rec->is_est = true;
+
+    if( rec->is_orphan )
+        return;
+
+    __wake( rec, FIBER_WAIT_EST );
+}
+
+static void __clo_cb( http_id_t     http_id,
+                      ptr_id_t      udata_id,
+                      int           code )
+{
+    fiber_conn_t       *rec;
+
+    c_assert( http_id && udata_id );
+
+    rec = PTRID_GET_PTR( udata_id );
+    c_assert( rec->id == udata_id && rec->http_id == http_id );
+
+    LOG( "fiber_id:0x%llx http_id:0x%llx code:%d orphan:%d",
+         PTRID_FMT( rec->fiber_id ), PTRID_FMT( http_id ),
+         code, rec->is_orphan );
+
+    rec->is_closed = true;
+    rec->clo_code = code;
+
+    if( rec->is_orphan )
+    {
+        __free_conn( rec );
+        return;
+    }
+
+    /* NOTE: rec may be freed by the fiber after that */
+    if( !rec->is_est )
+        __wake( rec, FIBER_WAIT_EST );
+    else
+        __wake( rec, FIBER_WAIT_RESPONSE );
+}
+
+/******************* Initialization functions *********************************/
+
+static void __default_config_init()
+{
+    if( !cfg_fiber_stack_size )
+    {
+        cfg_fiber_stack_size = malloc( sizeof(int) );
+
+        *cfg_fiber_stack_size = 65536;
+    }
+
+    if( !cfg_fiber_pool_size )
+    {
+        cfg_fiber_pool_size = malloc( sizeof(int) );
+
+        *cfg_fiber_pool_size = 64;
+    }
+}
+
+void fiber_init()
+{
+    __default_config_init();
+
+    c_assert( *cfg_fiber_stack_size >= FIBER_MIN_STACK_SIZE &&
+              *cfg_fiber_pool_size >= 0 );
+
+    g_page_size = sysconf( _SC_PAGESIZE );
+
+    g_stack_size = ( *cfg_fiber_stack_size + g_page_size - 1 ) &
+                   ~(g_page_size - 1);
+
+    memset( &g_stats, 0, sizeof(fiber_stats_t) );
+
+    LOG( "stack_size:%lu pool_size:%d",
+         g_stack_size, *cfg_fiber_pool_size );
+}
+
+/******************* Interface functions **************************************/
+
+/* NOTE: stacks are MAP_NORESERVE, so every page is touched */
+void fiber_warm_up()
+{
+    char               *stack;
+    char              **stacks;
+    unsigned long       n;
+    int                 i;
+
+    if( !*cfg_net_warm_up || !*cfg_fiber_pool_size )
+        return;
+
+    stacks = malloc( *cfg_fiber_pool_size * sizeof(char *) );
+
+    for( i = 0; i < *cfg_fiber_pool_size; i++ )
+    {
+        stack = __get_stack();
+
+        for( n = 0; n < g_stack_size; n += g_page_size )
+            stack[n] = 0;
+
+        stacks[i] = stack;
+    }
+
+    for( i = 0; i < *cfg_fiber_pool_size; i++ )
+        __put_stack( stacks[i] );
+
+    free( stacks );
+
+    LOG( "pooled:%d stacks_mapped:%llu",
+         g_stats.pooled,
+         (unsigned long long) g_stats.stacks_mapped );
+}
+
+fiber_id_t fiber_spawn( fiber_fn_t      fn,
+                        ptr_id_t        udata_id )
+{
+    fiber_t            *f;
+    int                 r;
+
+    if( !fn )
+    {
+        LOGE( "" );
+        return 0;
+    }
+
+    f = malloc( sizeof(fiber_t) );
+    memset( f, 0, sizeof(fiber_t) );
+
+    f->id = PTRID( f );
+    f->fn = fn;
+    f->udata_id = udata_id;
+
+    f->stack = __get_stack();
+
+    __fiber_ctx_init( f );
+
+    g_stats.spawned++;
+    g_stats.active++;
+
+    LOG( "fiber_id:0x%llx udata_id:0x%llx nested:%d",
+         PTRID_FMT( f->id ), PTRID_FMT( udata_id ), !!g_current );
+
+    /* NOTE: fibers are resumed only from the loop */
+    if( g_current )
+    {
+        r = net_defer( __start_cb, f->id );
+        c_assert( !r );
+
+        return f->id;
+    }
+
+    f->is_started = true;
+
+    __switch_to_fiber( f );
+
+    return f->id;
+}
+
+int fiber_sleep( struct timeval *timeout )
+{
+    fiber_t            *f = g_current;
+
+    if( !f || !timeout )
+    {
+        LOGE( "" );
+        return -1;
+    }
+
+    __release_owned_msg( f );
+
+    __wait( f, FIBER_WAIT_SLEEP, NULL, timeout );
+
+    return 0;
+}
+
+http_id_t fiber_http_make_conn( net_host_t *host )
+{
+    fiber_t            *f = g_current;
+    fiber_conn_t       *rec;
+
+    if( !f || !host )
+    {
+        LOGE( "" );
+        return 0;
+    }
+
+    rec = malloc( sizeof(fiber_conn_t) );
+    memset( rec, 0, sizeof(fiber_conn_t) );
+
+    rec->fiber_id = f->id;
+
+    LL_ADD_NODE( &f->conns, rec );
+
+    rec->http_id = http_make_conn( host, __r_cb, __est_cb,
+                                   __clo_cb, rec->id );
+
+    if( !rec->http_id )
+    {
+        LOGE( "fiber_id:0x%llx host:%s:%s http_errno:%u",
+              PTRID_FMT( f->id ), host->hostname, host->port,
+              G_http_errno );
+
+        LL_DEL_NODE( &f->conns, rec->id );
+        __free_conn( rec );
+
+        return 0;
+    }
+
+    LOG( "fiber_id:0x%llx http_id:0x%llx host:%s:%s",
+         PTRID_FMT( f->id ), PTRID_FMT( rec->http_id ),
+         host->hostname, host->port );
+
+    return rec->http_id;
+}
+
+int fiber_await_established( http_id_t          http_id,
+                             struct timeval    *timeout )
+{
+    fiber_t            *f = g_current;
+    fiber_conn_t       *rec;
+    int                 r;
+
+    if( !f || !http_id || !(rec = __find_conn( f, http_id )) )
+    {
+        LOGE( "http_id:0x%llx", PTRID_FMT( http_id ) );
+        return -1;
+    }
+
+    __release_owned_msg( f );
+
+    if( !rec->is_est && !rec->is_closed )
+    {
+        r = __wait( f, FIBER_WAIT_EST, rec, timeout );
+
+        if( r )
+        {
+            LOG( "fiber_id:0x%llx http_id:0x%llx timeout",
+                 PTRID_FMT( f->id ), PTRID_FMT( http_id ) );
+
+            return -1;
+        }
+    }
+
+    return ( rec->is_est && !rec->is_closed ) ? 0 : -1;
+}
+
+int fiber_http_post( http_id_t     http_id,
+                     http_msg_t   *msg )
+{
+    fiber_t            *f = g_current;
+    fiber_conn_t       *rec;
+    int                 r;
+
+    if( !f || !http_id || !msg || !(rec = __find_conn( f, http_id )) )
+    {
+        LOGE( "http_id:0x%llx", PTRID_FMT( http_id ) );
+        return -1;
+    }
+
+    /* NOTE: http_id is stale after clo_cb */
+    if( rec->is_closed )
+    {
+        LOG( "fiber_id:0x%llx http_id:0x%llx is closed",
+             PTRID_FMT( f->id ), PTRID_FMT( http_id ) );
+
+        return -1;
+    }
+
+    r = http_post_data( http_id, msg, 0, NULL );
+
+    if( r )
+    {
+        LOGE( "fiber_id:0x%llx http_id:0x%llx http_errno:%u",
+              PTRID_FMT( f->id ), PTRID_FMT( http_id ), G_http_errno );
+    }
+
+    return r;
+}
+
+http_msg_t *fiber_await_response( http_id_t         http_id,
+                                  struct timeval   *timeout )
+{
+    fiber_t            *f = g_current;
+    fiber_conn_t       *rec;
+    fiber_msg_node_t   *node;
+    int                 r;
+
+    if( !f || !http_id || !(rec = __find_conn( f, http_id )) )
+    {
+        LOGE( "http_id:0x%llx", PTRID_FMT( http_id ) );
+        return NULL;
+    }
+
+    __release_owned_msg( f );
+
+    if( rec->queued.total )
+    {
+        node = PTRID_GET_PTR( rec->queued.head );
+        LL_DEL_NODE( &rec->queued, rec->queued.head );
+
+        f->owned_msg = node->msg;
+        free( node );
+
+        if( !rec->queued.total && !rec->is_closed )
+            http_pause_read( http_id, false );
+
+        return f->owned_msg;
+    }
+
+    if( rec->is_closed )
+        return NULL;
+
+    r = __wait( f, FIBER_WAIT_RESPONSE, rec, timeout );
+
+    if( r )
+    {
+        LOG( "fiber_id:0x%llx http_id:0x%llx timeout",
+             PTRID_FMT( f->id ), PTRID_FMT( http_id ) );
+
+        return NULL;
+    }
+
+    /* NOTE: NULL if it's woken by clo_cb */
+    return rec->msg;
+}
+
+int fiber_http_close( http_id_t         http_id,
+                      bool              flush_and_close )
+{
+    fiber_t            *f = g_current;
+    fiber_conn_t       *rec;
+
+    if( !f || !http_id || !(rec = __find_conn( f, http_id )) )
+    {
+        LOGE( "http_id:0x%llx", PTRID_FMT( http_id ) );
+        return -1;
+    }
+
+    __release_owned_msg( f );
+
+    __detach_conn( f, rec, flush_and_close );
+
+    return 0;
+}
+
+void fiber_suspend()
+{
+    fiber_t            *f = g_current;
+
+    if( !f )
+    {
+        LOGE( "" );
+        return;
+    }
+
+    __release_owned_msg( f );
+
+    __switch_to_loop();
+}
+
+int fiber_resume( fiber_id_t fiber_id )
+{
+    fiber_t            *f;
+
+    if( !fiber_id || g_current )
+    {
+        LOGE( "fiber_id:0x%llx", PTRID_FMT( fiber_id ) );
+        return -1;
+    }
+
+    f = PTRID_GET_PTR( fiber_id );
+    c_assert( f->id == fiber_id );
+
+    /* NOTE: the built-in awaits are woken by their callbacks */
+    if( f->wait != FIBER_WAIT_NONE || !f->is_started )
+    {
+        LOGE( "fiber_id:0x%llx wait:%d", PTRID_FMT( fiber_id ), f->wait );
+        return -1;
+    }
+
+    __switch_to_fiber( f );
+
+    return 0;
+}
+
+fiber_id_t fiber_self()
+{
+    return g_current ? g_current->id : 0;
+}
+
+void fiber_get_stats( fiber_stats_t *stats )
+{
+    c_assert( stats );
+
+    memcpy( stats, &g_stats, sizeof(fiber_stats_t) );
+}
@@ -0,0 +1,84 @@
+/********************************************************************
+ * Copyright (c) 2014, Eldar Gaynetdinov <hal9000ed2k@gmail.com>    *
+ *                                                                  *
+ * Permission to use, copy, modify, and/or distribute this software *
+ * for any purpose with or without fee is hereby granted, provided  *
+ * that the above copyright notice and this permission notice       *
+ * appear in all copies.                                            *
+ *                                                                  *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL    *
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED    *
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL     *
+ * THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT,          *
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING     *
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF       *
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF    *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.   *
+ ********************************************************************/
+
+/* NOTE: stackful fibers on top of the loop, a fiber runs until *
+ *       it awaits something, then the loop goes on and resumes *
+ *       it from the callback which has brought the result.     *
+ *       Everything is in the loop thread, so no locking.       */
+
+typedef ptr_id_t    fiber_id_t;
+
+typedef void ( *fiber_fn_t )( fiber_id_t        fiber_id,
+                              ptr_id_t          udata_id );
+
+typedef struct {
+    uint64_t            spawned;
+    uint64_t            finished;
+    uint64_t            switches;
+    uint64_t            stacks_mapped;
+    uint64_t            stacks_reused;
+    int                 active;
+    int                 pooled;
+} fiber_stats_t;
+
+void        fiber_init();
+
+/* NOTE: if net_warm_up is set, the stack pool is filled */
+void        fiber_warm_up();
+
+/* NOTE: fn runs at once until its first await (by net_defer  *
+ *       if it's called from a fiber), the fiber ends when fn *
+ *       returns, its conns are shut down then                */
+fiber_id_t  fiber_spawn( fiber_fn_t             fn,
+                         ptr_id_t               udata_id );
+
+/* NOTE: the functions below are called only from a fiber. *
+ *       timeout may be NULL, it means no timeout.         */
+int         fiber_sleep( struct timeval        *timeout );
+
+http_id_t   fiber_http_make_conn( net_host_t   *host );
+
+/* NOTE: http_post_data which is safe after the conn is closed */
+int         fiber_http_post( http_id_t         http_id,
+                             http_msg_t       *msg );
+
+/* NOTE: -1 means that conn was closed or timeout expired */
+int         fiber_await_established( http_id_t          http_id,
+                                     struct timeval    *timeout );
+
+/* NOTE: NULL means that conn was closed or timeout expired, *
+ *       msg is valid until the next await, sleep or close.  *
+ *       If nobody waits, a response is kept by http_dup_msg *
+ *       and reading is paused until it's taken.             */
+http_msg_t *fiber_await_response( http_id_t             http_id,
+                                  struct timeval       *timeout );
+
+int         fiber_http_close( http_id_t        http_id,
+                              bool             flush_and_close );
+
+/* NOTE: low level, for other callback APIs: a fiber suspends *
+ *       itself, the loop (not a fiber) resumes it later      */
+void        fiber_suspend();
+int         fiber_resume( fiber_id_t           fiber_id );
+
+fiber_id_t  fiber_self();
+
+void        fiber_get_stats( fiber_stats_t    *stats );
+
+extern int *cfg_fiber_stack_size;
+extern int *cfg_fiber_pool_size;
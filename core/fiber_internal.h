@@ -0,0 +1,102 @@
+/********************************************************************
+ * Copyright (c) 2014, Eldar Gaynetdinov <hal9000ed2k@gmail.com>    *
+ *                                                                  *
+ * Permission to use, copy, modify, and/or distribute this software *
+ * for any purpose with or without fee is hereby granted, provided  *
+ * that the above copyright notice and this permission notice       *
+ * appear in all copies.                                            *
+ *                                                                  *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL    *
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED    *
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL     *
+ * THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT,          *
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING     *
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF       *
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF    *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.   *
+ ********************************************************************/
+
+#include <sys/mman.h>
+
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+#define FIBER_MIN_STACK_SIZE    16384
+
+/* NOTE: what a suspended fiber waits for */
+enum {
+    FIBER_WAIT_NONE = 0,
+    FIBER_WAIT_SLEEP,
+    FIBER_WAIT_EST,
+    FIBER_WAIT_RESPONSE
+};
+
+typedef struct {
+#if defined(__x86_64__)
+    void               *sp;
+#else
+    ucontext_t          uc;
+#endif
+} fiber_ctx_t;
+
+typedef struct {
+    /* ll_node_t */
+    ptr_id_t            id;
+    ptr_id_t            prev;
+    ptr_id_t            next;
+
+    http_msg_t         *msg;
+} fiber_msg_node_t;
+
+typedef struct {
+    /* ll_node_t */
+    ptr_id_t            id;
+    ptr_id_t            prev;
+    ptr_id_t            next;
+
+    fiber_id_t          fiber_id;
+    http_id_t           http_id;
+
+    bool                is_est;
+    bool                is_closed;
+    int                 clo_code;
+
+    /* NOTE: conn outlives its fiber until clo_cb */
+    bool                is_orphan;
+
+    /* NOTE: valid while the fiber runs inside r_cb */
+    http_msg_t         *msg;
+
+    /* NOTE: http_dup_msg of responses nobody waited for */
+    ll_t                queued;
+} fiber_conn_t;
+
+typedef struct fiber_stack_s    fiber_stack_t;
+
+struct fiber_stack_s {
+    fiber_stack_t      *next;
+};
+
+typedef struct {
+    fiber_id_t          id;
+
+    fiber_fn_t          fn;
+    ptr_id_t            udata_id;
+
+    fiber_ctx_t         ctx;
+    char               *stack;
+
+    ll_t                conns;
+
+    int                 wait;
+    ptr_id_t            wait_conn_id;
+    tmr_id_t            tmr_id;
+    bool                is_timed_out;
+
+    /* NOTE: msg handed out by await, freed at the next one */
+    http_msg_t         *owned_msg;
+
+    bool                is_started;
+    bool                is_done;
+} fiber_t;
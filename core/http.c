@@ -26,8 +26,12 @@
 
 struct timeval     *cfg_http_response_timeout = NULL;
 struct timeval     *cfg_http_check_messages_queue_interval = NULL;
+int                *cfg_http_offload_inflate_size = NULL;
+int                *cfg_http_warm_up_rounds = NULL;
+int                *cfg_http_overload_shed = NULL;
 
 static bool         g_percent_encoding_map[256];
+static char         g_shed_response[] = HTTP_SHED_RESPONSE;
 
 /******************* Misc util functions **************************************/
 
@@ -105,6 +109,13 @@ static void __free_http( http_conn_t *http )
     if( http->read_state.http_msg.body )
         free( http->read_state.http_msg.body );
 
+    /* NOTE: the job is freed by its completion */
+    if( http->inflate_job )
+        http->inflate_job->is_detached = true;
+
+    if( http->inflated_body )
+        free( http->inflated_body );
+
     memset( http, 0, sizeof(http_conn_t) );
     free( http );
 }
@@ -186,8 +197,8 @@ static void __check_messages_queue_tmr_cb( conn_id_t    conn_id,
               tmr_id && !tmr_udata_id );
 
     LOGD( "conn_id:0x%llx conn_udata_id:0x%llx tmr_id:0x%llx",
-          PTRID_FMT( conn_id ), PTRID_FMT( conn_udata_id ),
-          PTRID_FMT( tmr_id ) );
+          NET_ID_FMT( conn_id ), PTRID_FMT( conn_udata_id ),
+          NET_ID_FMT( tmr_id ) );
 
     http = PTRID_GET_PTR( conn_udata_id );
 
@@ -209,8 +220,8 @@ static void __check_messages_queue_tmr_cb( conn_id_t    conn_id,
         {
             LOGE( "conn_id:0x%llx conn_udata_id:0x%llx "
                   "tmr_id:0x%llx tmr_udata_id:0x%llx",
-                  PTRID_FMT( conn_id ), PTRID_FMT( conn_udata_id ),
-                  PTRID_FMT( tmr_id ), PTRID_FMT( tmr_udata_id ) );
+                  NET_ID_FMT( conn_id ), PTRID_FMT( conn_udata_id ),
+                  NET_ID_FMT( tmr_id ), PTRID_FMT( tmr_udata_id ) );
 
             r = net_shutdown_conn( conn_id, false );
             c_assert( !r );
@@ -863,14 +874,16 @@ static int __post_data( http_conn_t    *http,
 {
     int         r;
 
+    /* NOTE: HTTP messages aren't throttled,  *
+     *       so NET_POST_OVER_HIGH is ignored */
     r = net_post_data( http->conn_id, hdr, hdr_len,
                        body_len ? false : flush_and_close );
 
-    if( r )
+    if( r == -1 )
     {
         LOGE( "http_id:0x%llx conn_id:0x%llx",
               PTRID_FMT( http->http_id ),
-              PTRID_FMT( http->conn_id ) );
+              NET_ID_FMT( http->conn_id ) );
 
         G_http_errno = HTTP_ERRNO_GENERAL_ERR;
         return -1;
@@ -881,11 +894,11 @@ static int __post_data( http_conn_t    *http,
         r = net_post_data( http->conn_id, body, body_len,
                            flush_and_close );
 
-        if( r )
+        if( r == -1 )
         {
             LOGE( "http_id:0x%llx conn_id:0x%llx",
                   PTRID_FMT( http->http_id ),
-                  PTRID_FMT( http->conn_id ) );
+                  NET_ID_FMT( http->conn_id ) );
 
             G_http_errno = HTTP_ERRNO_GENERAL_ERR;
             return -1;
@@ -1011,6 +1024,32 @@ static int __post_client_request( http_conn_t    *http,
     return 0;
 }
 
+/* NOTE: server_r_cb isn't called, the reply keeps its place *
+ *       among pipelined ones and the conn is closed after   */
+static int __shed_server_request( http_conn_t *http )
+{
+    ptr_id_t            msg_qid;
+    http_post_state_t   state;
+
+    msg_qid = __messages_queue_push( http, true, false );
+
+    /* NOTE: connection close was sent already, *
+     *       so the message is just dropped     */
+    if( !msg_qid )
+        return 0;
+
+    LOG( "conn_id:0x%llx http_id:0x%llx url:%.*s",
+         NET_ID_FMT( http->conn_id ),
+         PTRID_FMT( http->http_id ),
+         http->read_state.http_msg.url_len,
+         http->read_state.http_msg.url );
+
+    return __post_server_response( http, msg_qid,
+                                   g_shed_response,
+                                   sizeof(g_shed_response) - 1,
+                                   NULL, 0, true, &state );
+}
+
 /******************* HTTP message parsing functions ***************************/
 
 static int __parse_status_line( http_read_state_t     *read_state,
@@ -2043,26 +2082,13 @@ static void __msg_fill_ptrs( http_msg_t    *msg,
     }
 }
 
-static int __decompress_raw_body( http_msg_t  *msg )
+/* NOTE: it's also run on offload threads, so no logging here */
+static int __inflate_gzip( char    *in,
+                           int      in_len,
+                           char   **out_ptr,
+                           int     *out_len,
+                           int     *z_r )
 {
-    c_assert( (msg->body && msg->body_len) ||
-              (!msg->body && !msg->body_len) );
-
-    c_assert( (msg->raw_body && msg->raw_body_len) ||
-              (!msg->raw_body && !msg->raw_body_len) );
-
-    if( (!msg->raw_body_len && !msg->body_len) ||
-        msg->content_encoding_len != HTTP_HDR_GZIP_ENCODING_LEN ||
-        strncasecmp( msg->content_encoding,
-                     HTTP_HDR_GZIP_ENCODING,
-                     HTTP_HDR_GZIP_ENCODING_LEN ) )
-    {
-        return 0;
-    }
-
-    char       *body;
-    int         body_len;
-
     z_stream    strm = {0};
     char       *out;
     int         chunk_size;
@@ -2070,13 +2096,7 @@ static int __decompress_raw_body( http_msg_t  *msg )
     int         offset;
     int         r;
 
-    body = msg->body ? msg->body :
-                       msg->raw_body;
-
-    body_len = msg->body_len ? msg->body_len :
-                               msg->raw_body_len;
-
-    chunk_size = body_len * HTTP_ZLIB_COEFFICIENT;
+    chunk_size = in_len * HTTP_ZLIB_COEFFICIENT;
     alloc_size = chunk_size;
 
     out = malloc( alloc_size );
@@ -2087,11 +2107,16 @@ static int __decompress_raw_body( http_msg_t  *msg )
                       HTTP_ZLIB_WINDOW_BITS |
                       HTTP_ZLIB_GZIP_ENCODING );
 
+    *z_r = r;
+
     if( r != Z_OK )
+    {
+        free( out );
         return -1;
+    }
 
-    strm.avail_in = body_len;
-    strm.next_in = (unsigned char *) body;
+    strm.avail_in = in_len;
+    strm.next_in = (unsigned char *) in;
 
     strm.avail_out = chunk_size;
     strm.next_out = (unsigned char *) out;
@@ -2115,31 +2140,227 @@ static int __decompress_raw_body( http_msg_t  *msg )
         }
     }
 
-    if( r == Z_BUF_ERROR && !strm.avail_in )
-    {
-        LOG( "" );
-    }
-    else
-    if( r != Z_STREAM_END )
-    {
-        LOGE( "%d", r );
+    *z_r = r;
 
+    if( !(r == Z_BUF_ERROR && !strm.avail_in) &&
+        r != Z_STREAM_END )
+    {
         free( out );
 
         inflateEnd( &strm );
         return -1;
     }
 
+    *out_ptr = out;
+    *out_len = strm.total_out;
+
+    inflateEnd( &strm );
+    return 0;
+}
+
+static void __set_body( http_msg_t     *msg,
+                        char           *body,
+                        int             body_len )
+{
     if( msg->body )
         free( msg->body );
 
-    msg->body = out;
-    msg->body_len = strm.total_out;
+    msg->body = body;
+    msg->body_len = body_len;
+}
+
+static int __decompress_raw_body( http_msg_t  *msg )
+{
+    c_assert( (msg->body && msg->body_len) ||
+              (!msg->body && !msg->body_len) );
+
+    c_assert( (msg->raw_body && msg->raw_body_len) ||
+              (!msg->raw_body && !msg->raw_body_len) );
+
+    if( (!msg->raw_body_len && !msg->body_len) ||
+        msg->content_encoding_len != HTTP_HDR_GZIP_ENCODING_LEN ||
+        strncasecmp( msg->content_encoding,
+                     HTTP_HDR_GZIP_ENCODING,
+                     HTTP_HDR_GZIP_ENCODING_LEN ) )
+    {
+        return 0;
+    }
+
+    char       *body;
+    int         body_len;
+
+    char       *out;
+    int         out_len;
+    int         z_r;
+    int         r;
+
+    body = msg->body ? msg->body :
+                       msg->raw_body;
+
+    body_len = msg->body_len ? msg->body_len :
+                               msg->raw_body_len;
+
+    r = __inflate_gzip( body, body_len, &out, &out_len, &z_r );
+
+    if( r == -1 )
+    {
+        LOGE( "%d", z_r );
+        return -1;
+    }
+
+    if( z_r == Z_BUF_ERROR )
+    {
+        LOG( "" );
+    }
+
+    __set_body( msg, out, out_len );
 
-    inflateEnd( &strm );
     return 0;
 }
 
+/******************* Offload inflation functions ******************************/
+
+static void __inflate_job_fn( void *arg )
+{
+    http_inflate_job_t     *job = arg;
+
+    job->r = __inflate_gzip( job->in, job->in_len,
+                             &job->out, &job->out_len, &job->z_r );
+}
+
+static void __free_inflate_job( http_inflate_job_t *job )
+{
+    free( job->in );
+
+    if( job->out )
+        free( job->out );
+
+    memset( job, 0, sizeof(http_inflate_job_t) );
+    free( job );
+}
+
+static void __inflate_job_done_cb( void *arg )
+{
+    http_inflate_job_t     *job = arg;
+    http_conn_t            *http;
+    int                     r;
+
+    if( job->is_detached )
+    {
+        LOG( "http_id:0x%llx in_len:%d is detached",
+             PTRID_FMT( job->http_id ), job->in_len );
+
+        __free_inflate_job( job );
+        return;
+    }
+
+    http = PTRID_GET_PTR( job->http_id );
+    c_assert( http->http_id == job->http_id &&
+              http->inflate_job == job && !http->is_inflated );
+
+    http->inflate_job = NULL;
+
+    if( job->r == -1 )
+    {
+        LOGE( "conn_id:0x%llx http_id:0x%llx z_r:%d",
+              NET_ID_FMT( http->conn_id ),
+              PTRID_FMT( http->http_id ), job->z_r );
+
+        __free_inflate_job( job );
+
+        /* NOTE: conn may be already in flush_and_close state */
+        net_shutdown_conn( http->conn_id, false );
+        return;
+    }
+
+    if( job->z_r == Z_BUF_ERROR )
+    {
+        LOG( "" );
+    }
+
+    http->inflated_body = job->out;
+    http->inflated_body_len = job->out_len;
+    http->is_inflated = true;
+
+    job->out = NULL;
+
+    LOG( "conn_id:0x%llx http_id:0x%llx in_len:%d out_len:%d",
+         NET_ID_FMT( http->conn_id ), PTRID_FMT( http->http_id ),
+         job->in_len, http->inflated_body_len );
+
+    __free_inflate_job( job );
+
+    /* NOTE: the message is parsed again from rb after resume */
+    r = net_pause_read( http->conn_id, false );
+
+    if( r )
+    {
+        LOGE( "conn_id:0x%llx http_id:0x%llx",
+              NET_ID_FMT( http->conn_id ),
+              PTRID_FMT( http->http_id ) );
+    }
+}
+
+/* NOTE: it's called before __msg_fill_ptrs, so it uses ndx, *
+ *       1 means that the message waits for inflation        */
+static int __offload_inflate( http_conn_t  *http,
+                              char         *buf,
+                              bool          is_closed )
+{
+    http_msg_t             *msg = &http->read_state.http_msg;
+    http_inflate_job_t     *job;
+    char                   *body;
+    int                     body_len;
+    int                     r;
+
+    body = msg->body ? msg->body :
+                       buf + msg->raw_body_ndx;
+
+    body_len = msg->body_len ? msg->body_len :
+                               msg->raw_body_len;
+
+    /* NOTE: conn is closed right after this read, so inline */
+    if( !*cfg_http_offload_inflate_size || is_closed ||
+        body_len < *cfg_http_offload_inflate_size ||
+        (!msg->body_len && !msg->raw_body_ndx) ||
+        msg->content_encoding_len != HTTP_HDR_GZIP_ENCODING_LEN ||
+        strncasecmp( buf + msg->content_encoding_ndx,
+                     HTTP_HDR_GZIP_ENCODING,
+                     HTTP_HDR_GZIP_ENCODING_LEN ) )
+    {
+        return 0;
+    }
+
+    r = net_pause_read( http->conn_id, true );
+
+    if( r )
+        return 0;
+
+    job = malloc( sizeof(http_inflate_job_t) );
+    c_assert( job );
+
+    memset( job, 0, sizeof(http_inflate_job_t) );
+
+    job->http_id = http->http_id;
+
+    job->in = malloc( body_len );
+    c_assert( job->in );
+
+    memcpy( job->in, body, body_len );
+    job->in_len = body_len;
+
+    r = net_offload( __inflate_job_fn, job, __inflate_job_done_cb );
+    c_assert( !r );
+
+    http->inflate_job = job;
+
+    LOG( "conn_id:0x%llx http_id:0x%llx in_len:%d",
+         NET_ID_FMT( http->conn_id ), PTRID_FMT( http->http_id ),
+         body_len );
+
+    return 1;
+}
+
 static int __parse_message( http_conn_t    *http,
                             char           *buf,
                             int             buf_len,
@@ -2168,7 +2389,7 @@ static int __parse_message( http_conn_t    *http,
         if( http->server_r_cb && is_closed )
         {
             LOGE( "conn_id:0x%llx http_id:0x%llx",
-                  PTRID_FMT( http->conn_id ),
+                  NET_ID_FMT( http->conn_id ),
                   PTRID_FMT( http->http_id ) );
 
             return HTTP_PARSE_ERROR;
@@ -2237,18 +2458,44 @@ static int __parse_message( http_conn_t    *http,
 
     if( http->read_state.state == S_HTTP_EOM )
     {
+        /* NOTE: user might resume reading meanwhile */
+        if( http->inflate_job )
+        {
+            net_pause_read( http->conn_id, true );
+            return 0;
+        }
+
+        if( !http->is_inflated &&
+            __offload_inflate( http, buf, is_closed ) )
+        {
+            return 0;
+        }
+
         if( http->read_state.hdr_state.is_http_ver10 )
             http->read_state.http_msg.connection_close = true;
 
         __msg_fill_ptrs( &http->read_state.http_msg,
                          buf, buf_len );
 
-        r = __decompress_raw_body( &http->read_state.http_msg );
+        if( http->is_inflated )
+        {
+            __set_body( &http->read_state.http_msg,
+                        http->inflated_body,
+                        http->inflated_body_len );
+
+            http->inflated_body = NULL;
+            http->inflated_body_len = 0;
+            http->is_inflated = false;
+
+            r = 0;
+        }
+        else
+            r = __decompress_raw_body( &http->read_state.http_msg );
 
         if( r == -1 )
         {
             LOGE( "conn_id:0x%llx http_id:0x%llx",
-                  PTRID_FMT( http->conn_id ),
+                  NET_ID_FMT( http->conn_id ),
                   PTRID_FMT( http->http_id ) );
 
             return HTTP_PARSE_ERROR;
@@ -2259,7 +2506,7 @@ static int __parse_message( http_conn_t    *http,
             if( __messages_queue_pop( http ) == -1 )
             {
                 LOGE( "conn_id:0x%llx http_id:0x%llx",
-                      PTRID_FMT( http->conn_id ),
+                      NET_ID_FMT( http->conn_id ),
                       PTRID_FMT( http->http_id ) );
 
                 return HTTP_PARSE_ERROR;
@@ -2273,6 +2520,12 @@ static int __parse_message( http_conn_t    *http,
                 return HTTP_PARSE_CONN_CLOSE;
         }
         else
+        if( *cfg_http_overload_shed && net_is_overloaded() )
+        {
+            if( __shed_server_request( http ) == -1 )
+                return HTTP_PARSE_ERROR;
+        }
+        else
         {
             ptr_id_t    msg_qid;
 
@@ -2321,7 +2574,7 @@ static int __parse_multiply_messages( http_conn_t  *http,
         if( http->got_connect_method )
         {
             LOGE( "conn_id:0x%llx http_id:0x%llx",
-                  PTRID_FMT( http->conn_id ),
+                  NET_ID_FMT( http->conn_id ),
                   PTRID_FMT( http->http_id ) );
 
             r = net_shutdown_conn( http->conn_id, false );
@@ -2337,7 +2590,7 @@ static int __parse_multiply_messages( http_conn_t  *http,
         {
             LOGE( "conn_id:0x%llx http_id:0x%llx read_state:%u "
                   "host:%s url:%.*s status_code:%d",
-                  PTRID_FMT( http->conn_id ),
+                  NET_ID_FMT( http->conn_id ),
                   PTRID_FMT( http->http_id ),
                   http->read_state.state, http->host,
                   http->read_state.http_msg.url_len,
@@ -2405,7 +2658,7 @@ static int __r_cb( conn_id_t        conn_id,
 
     LOG( "conn_id:0x%llx http_id:0x%llx messages_handled:%d "
          "sent_close:%d is_closed:%d",
-         PTRID_FMT( conn_id ), PTRID_FMT( udata_id ),
+         NET_ID_FMT( conn_id ), PTRID_FMT( udata_id ),
          http->messages_handled,
          http->sent_close, is_closed );
 
@@ -2433,11 +2686,31 @@ static int __r_cb( conn_id_t        conn_id,
     return r;
 }
 
+/* NOTE: a conn with a message in flight, a half-inflated *
+ *       body or http timers isn't handed over            */
+static bool __idle_cb( conn_id_t    conn_id,
+                       ptr_id_t     udata_id )
+{
+    http_conn_t        *http;
+
+    c_assert( conn_id && udata_id );
+
+    http = PTRID_GET_PTR( udata_id );
+
+    c_assert( http->http_id == udata_id &&
+              http->conn_id == conn_id );
+
+    return !http->messages_queue.total && !http->inflate_job &&
+           !http->tmr_list.total && !http->sent_close &&
+           !http->got_connect_method && !http->tunneling_mode;
+}
+
 static void __est_cb( conn_id_t     conn_id,
                       ptr_id_t      udata_id )
 {
     http_conn_t        *http;
     tmr_id_t            tmr_id;
+    int                 r;
 
     c_assert( conn_id && udata_id );
 
@@ -2453,9 +2726,12 @@ static void __est_cb( conn_id_t     conn_id,
     /* NOTE: error is impossible for just established conn */
     c_assert( tmr_id );
 
+    r = net_set_idle_check( conn_id, __idle_cb );
+    c_assert( !r );
+
     LOG( "conn_id:0x%llx http_id:0x%llx tmr_id:0x%llx",
-         PTRID_FMT( conn_id ), PTRID_FMT( udata_id ),
-         PTRID_FMT( tmr_id ) );
+         NET_ID_FMT( conn_id ), PTRID_FMT( udata_id ),
+         NET_ID_FMT( tmr_id ) );
 
     http->est_cb( http->http_id, http->udata_id );
 }
@@ -2474,7 +2750,7 @@ static void __clo_cb( conn_id_t     conn_id,
               http->conn_id == conn_id );
 
     LOG( "conn_id:0x%llx http_id:0x%llx",
-         PTRID_FMT( conn_id ), PTRID_FMT( udata_id ) );
+         NET_ID_FMT( conn_id ), PTRID_FMT( udata_id ) );
 
     http->clo_cb( udata_id, http->udata_id, code );
 
@@ -2507,13 +2783,32 @@ static void __tmr_cb( conn_id_t     conn_id,
 
     LOG( "conn_id:0x%llx http_id:0x%llx "
          "tmr_id:0x%llx http_tmr_id:0x%llx",
-         PTRID_FMT( conn_id ), PTRID_FMT( conn_udata_id ),
-         PTRID_FMT( tmr_id ), PTRID_FMT( tmr_udata_id ) );
+         NET_ID_FMT( conn_id ), PTRID_FMT( conn_udata_id ),
+         NET_ID_FMT( tmr_id ), PTRID_FMT( tmr_udata_id ) );
 
     tmr->cb( http->http_id, http->udata_id,
              tmr->id, tmr->udata_id );
 }
 
+static void __drain_cb( conn_id_t     conn_id,
+                        ptr_id_t      udata_id )
+{
+    http_conn_t    *http;
+
+    c_assert( conn_id && udata_id );
+
+    http = PTRID_GET_PTR( udata_id );
+
+    c_assert( http->http_id == udata_id &&
+              http->conn_id == conn_id &&
+              http->drain_cb );
+
+    LOGD( "conn_id:0x%llx http_id:0x%llx",
+          NET_ID_FMT( conn_id ), PTRID_FMT( udata_id ) );
+
+    http->drain_cb( http->http_id, http->udata_id );
+}
+
 static ptr_id_t __dup_udata_cb( conn_id_t   conn_id,
                                 ptr_id_t    udata_id )
 {
@@ -2560,7 +2855,7 @@ static ptr_id_t __dup_udata_cb( conn_id_t   conn_id,
 
     LOG( "conn_id:0x%llx l_http_id:0x%llx "
          "http_id:0x%llx udata_id:0x%llx",
-         PTRID_FMT( http->conn_id ),
+         NET_ID_FMT( http->conn_id ),
          PTRID_FMT( l_http->http_id ),
          PTRID_FMT( http->http_id ),
          PTRID_FMT( http->udata_id ) );
@@ -2631,7 +2926,7 @@ http_id_t http_make_conn( net_host_t           *host,
 
     LOG( "conn_id:0x%llx http_id:0x%llx "
          "host:%s:%s use_ssl:%d",
-         PTRID_FMT( http->conn_id ), PTRID_FMT( http_id ),
+         NET_ID_FMT( http->conn_id ), PTRID_FMT( http_id ),
          host->hostname, host->port, host->use_ssl );
 
     return http_id;
@@ -2644,7 +2939,8 @@ http_id_t http_make_listen( http_server_r_uh_t  child_r_cb,
                             http_clo_uh_t       clo_cb,
                             ptr_id_t            udata_id,
                             int                 port,
-                            bool                use_ssl )
+                            bool                use_ssl,
+                            char               *sock_profile )
 {
     http_conn_t    *http;
     http_id_t       http_id;
@@ -2681,7 +2977,7 @@ http_id_t http_make_listen( http_server_r_uh_t  child_r_cb,
     http->conn_id = net_make_listen( __r_cb, __est_cb,
                                      __clo_cb, __dup_udata_cb,
                                      __clo_cb, http_id,
-                                     port, use_ssl );
+                                     port, use_ssl, sock_profile );
 
     if( !http->conn_id )
     {
@@ -2694,7 +2990,7 @@ http_id_t http_make_listen( http_server_r_uh_t  child_r_cb,
     }
 
     LOG( "conn_id:0x%llx http_id:0x%llx host:%d use_ssl:%d",
-         PTRID_FMT( http->conn_id ), PTRID_FMT( http_id ),
+         NET_ID_FMT( http->conn_id ), PTRID_FMT( http_id ),
          port, use_ssl );
 
     return http_id;
@@ -2867,7 +3163,7 @@ int http_post_data( http_id_t           http_id,
     }
 
     LOG( "http_id:0x%llx conn_id:0x%llx state:%d",
-         PTRID_FMT( http_id ), PTRID_FMT( http->conn_id ),
+         PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ),
          state ? *state : 0 );
 
     return 0;
@@ -2926,21 +3222,22 @@ int http_post_raw_data( http_id_t       http_id,
                        msg->raw_body,
                        msg->raw_body_len, false );
 
-    if( r )
+    if( r == -1 )
     {
         LOGE( "http_id:0x%llx conn_id:0x%llx",
               PTRID_FMT( http->http_id ),
-              PTRID_FMT( http->conn_id ) );
+              NET_ID_FMT( http->conn_id ) );
 
         G_http_errno = HTTP_ERRNO_GENERAL_ERR;
         return -1;
     }
 
-    LOG( "http_id:0x%llx conn_id:0x%llx",
+    LOG( "http_id:0x%llx conn_id:0x%llx over_high:%d",
          PTRID_FMT( http_id ),
-         PTRID_FMT( http->conn_id ) );
+         NET_ID_FMT( http->conn_id ),
+         r == NET_POST_OVER_HIGH );
 
-    return 0;
+    return r == NET_POST_OVER_HIGH ? HTTP_POST_OVER_HIGH : 0;
 }
 
 http_tmr_id_t http_make_tmr( http_id_t        http_id,
@@ -2989,7 +3286,7 @@ http_tmr_id_t http_make_tmr( http_id_t        http_id,
     if( !tmr->net_tmr_id )
     {
         LOGE( "http_id:0x%llx conn_id:0x%llx udata_id:0x%llx",
-              PTRID_FMT( http_id ), PTRID_FMT( http->conn_id ),
+              PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ),
               PTRID_FMT( udata_id ) );
 
         G_http_errno = HTTP_ERRNO_GENERAL_ERR;
@@ -3004,9 +3301,9 @@ http_tmr_id_t http_make_tmr( http_id_t        http_id,
 
     LOG( "http_id:0x%llx conn_id:0x%llx udata_id:0x%llx "
          "tmr_id:0x%llx net_tmr_id:0x%llx",
-         PTRID_FMT( http_id ), PTRID_FMT( http->conn_id ),
+         PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ),
          PTRID_FMT( udata_id ), PTRID_FMT( tmr->id ),
-         PTRID_FMT( tmr->net_tmr_id ) );
+         NET_ID_FMT( tmr->net_tmr_id ) );
 
     return http->tmr_list.tail;
 }
@@ -3055,8 +3352,8 @@ int http_del_tmr( http_id_t     http_id,
     {
         LOGE( "http_id:0x%llx conn_id:0x%llx "
               "tmr_id:0x%llx net_tmr_id:0x%llx",
-              PTRID_FMT( http_id ), PTRID_FMT( http->conn_id ),
-              PTRID_FMT( tmr_id ), PTRID_FMT( net_tmr_id ) );
+              PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ),
+              PTRID_FMT( tmr_id ), NET_ID_FMT( net_tmr_id ) );
 
         G_http_errno = HTTP_ERRNO_GENERAL_ERR;
         return -1;
@@ -3064,8 +3361,8 @@ int http_del_tmr( http_id_t     http_id,
 
     LOG( "http_id:0x%llx conn_id:0x%llx "
          "tmr_id:0x%llx net_tmr_id:0x%llx",
-         PTRID_FMT( http_id ), PTRID_FMT( http->conn_id ),
-         PTRID_FMT( tmr_id ), PTRID_FMT( net_tmr_id ) );
+         PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ),
+         PTRID_FMT( tmr_id ), NET_ID_FMT( net_tmr_id ) );
 
     return 0;
 }
@@ -3102,14 +3399,193 @@ int http_shutdown( http_id_t    http_id,
     if( r )
     {
         LOGE( "http_id:0x%llx conn_id:0x%llx",
-              PTRID_FMT( http_id ), PTRID_FMT( http->conn_id ) );
+              PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ) );
 
         G_http_errno = HTTP_ERRNO_GENERAL_ERR;
         return -1;
     }
 
     LOG( "http_id:0x%llx conn_id:0x%llx",
-         PTRID_FMT( http_id ), PTRID_FMT( http->conn_id ) );
+         PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ) );
+
+    return 0;
+}
+
+int http_set_write_watermarks( http_id_t          http_id,
+                               http_drain_uh_t    drain_cb,
+                               unsigned long      high_bytes,
+                               unsigned long      low_bytes,
+                               int                high_msgs,
+                               int                low_msgs )
+{
+    http_conn_t    *http;
+    int             r;
+
+    G_http_errno = HTTP_ERRNO_OK;
+
+    if( !http_id )
+    {
+        LOGE( "" );
+
+        G_http_errno = HTTP_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
+
+    http = PTRID_GET_PTR( http_id );
+    c_assert( http->http_id == http_id );
+
+    if( http->is_in_dup_udata )
+    {
+        LOGE( "http_id:0x%llx", PTRID_FMT( http_id ) );
+
+        G_http_errno = HTTP_ERRNO_WRONG_STATE;
+        return -1;
+    }
+
+    http->drain_cb = drain_cb;
+
+    r = net_set_write_watermarks( http->conn_id,
+                                  drain_cb ? __drain_cb : NULL,
+                                  high_bytes, low_bytes,
+                                  high_msgs, low_msgs );
+
+    if( r )
+    {
+        LOGE( "http_id:0x%llx conn_id:0x%llx",
+              PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ) );
+
+        G_http_errno = HTTP_ERRNO_GENERAL_ERR;
+        return -1;
+    }
+
+    return 0;
+}
+
+int http_pause_read( http_id_t      http_id,
+                     bool           pause )
+{
+    http_conn_t    *http;
+    int             r;
+
+    G_http_errno = HTTP_ERRNO_OK;
+
+    if( !http_id )
+    {
+        LOGE( "" );
+
+        G_http_errno = HTTP_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
+
+    http = PTRID_GET_PTR( http_id );
+    c_assert( http->http_id == http_id );
+
+    r = net_pause_read( http->conn_id, pause );
+
+    if( r )
+    {
+        LOGE( "http_id:0x%llx conn_id:0x%llx",
+              PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ) );
+
+        G_http_errno = HTTP_ERRNO_GENERAL_ERR;
+        return -1;
+    }
+
+    LOG( "http_id:0x%llx conn_id:0x%llx pause:%d",
+         PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ), pause );
+
+    return 0;
+}
+
+int http_get_rx_timestamp( http_id_t      http_id,
+                           net_rx_ts_t   *ts )
+{
+    http_conn_t    *http;
+    int             r;
+
+    G_http_errno = HTTP_ERRNO_OK;
+
+    if( !http_id || !ts )
+    {
+        LOGE( "" );
+
+        G_http_errno = HTTP_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
+
+    http = PTRID_GET_PTR( http_id );
+    c_assert( http->http_id == http_id );
+
+    r = net_get_rx_timestamp( http->conn_id, ts );
+
+    if( r )
+    {
+        LOGE( "http_id:0x%llx conn_id:0x%llx",
+              PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ) );
+
+        G_http_errno = HTTP_ERRNO_GENERAL_ERR;
+        return -1;
+    }
+
+    return 0;
+}
+
+int http_tunnel_raw( http_id_t      http_id,
+                     conn_id_t      conn_id )
+{
+    http_conn_t    *http;
+    int             r;
+
+    G_http_errno = HTTP_ERRNO_OK;
+
+    if( !http_id || !conn_id )
+    {
+        LOGE( "" );
+
+        G_http_errno = HTTP_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
+
+    http = PTRID_GET_PTR( http_id );
+    c_assert( http->http_id == http_id );
+
+    if( http->client_r_cb )
+    {
+        LOGE( "http_id:0x%llx", PTRID_FMT( http_id ) );
+
+        G_http_errno = HTTP_ERRNO_WRONG_CONN;
+        return -1;
+    }
+
+    if( http->is_in_dup_udata ||
+        http->sent_close      ||
+        !http->tunneling_mode )
+    {
+        LOGE( "http_id:0x%llx", PTRID_FMT( http_id ) );
+
+        G_http_errno = HTTP_ERRNO_WRONG_STATE;
+        return -1;
+    }
+
+    c_assert( !http->messages_queue.total );
+
+    r = net_tunnel_conns( http->conn_id, conn_id );
+
+    if( r )
+    {
+        LOG( "http_id:0x%llx conn_id:0x%llx net_errno:%u",
+             PTRID_FMT( http_id ), NET_ID_FMT( conn_id ), G_net_errno );
+
+        G_http_errno = HTTP_ERRNO_GENERAL_ERR;
+        return -1;
+    }
+
+    /* NOTE: net moves bytes since this moment */
+    http->drain_cb = NULL;
+
+    LOG( "http_id:0x%llx conn_id:0x%llx raw_conn_id:0x%llx",
+         PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ),
+         NET_ID_FMT( conn_id ) );
 
     return 0;
 }
@@ -3145,14 +3621,14 @@ http_state_t http_is_est( http_id_t http_id )
     if( net_r == NET_STATE_ERROR )
     {
         LOGE( "http_id:0x%llx conn_id:0x%llx",
-              PTRID_FMT( http_id ), PTRID_FMT( http->conn_id ) );
+              PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ) );
 
         G_http_errno = HTTP_ERRNO_GENERAL_ERR;
         return HTTP_STATE_ERROR;
     }
 
     LOGD( "http_id:0x%llx conn_id:0x%llx is_est:%d",
-          PTRID_FMT( http_id ), PTRID_FMT( http->conn_id ), net_r );
+          PTRID_FMT( http_id ), NET_ID_FMT( http->conn_id ), net_r );
 
     switch( net_r )
     {
@@ -3783,6 +4259,130 @@ hash_table_t *http_parse_www_form( char    *form,
     return hash_table;
 }
 
+/******************* Warm-up functions ****************************************/
+
+static void __warm_up_client_r_cb( http_id_t        http_id,
+                                   ptr_id_t         udata_id,
+                                   http_msg_t      *http_msg )
+{
+    c_assert( http_msg->status_code == 200 );
+}
+
+static void __warm_up_server_r_cb( http_id_t        http_id,
+                                   ptr_id_t         udata_id,
+                                   ptr_id_t         msg_id,
+                                   http_msg_t      *http_msg )
+{
+    c_assert( msg_id && http_msg->url_len );
+}
+
+static http_conn_t *__warm_up_http( bool client )
+{
+    http_conn_t        *http;
+
+    http = malloc( sizeof(http_conn_t) );
+    memset( http, 0, sizeof(http_conn_t) );
+
+    http->http_id = PTRID( http );
+
+    if( client )
+        http->client_r_cb = __warm_up_client_r_cb;
+    else
+        http->server_r_cb = __warm_up_server_r_cb;
+
+    http_state_init( &http->read_state, client );
+
+    return http;
+}
+
+/* NOTE: hdr is static in __make_hdr, so it's copied with body */
+static int __warm_up_serialize( char           *buf,
+                                int             size,
+                                http_conn_t    *http,
+                                http_msg_t     *msg )
+{
+    unsigned long       hdr_len;
+    char               *hdr;
+
+    hdr = __make_hdr( &hdr_len, http, msg );
+    c_assert( hdr && hdr_len + msg->raw_body_len <= (unsigned long) size );
+
+    memcpy( buf, hdr, hdr_len );
+    memcpy( buf + hdr_len, msg->raw_body, msg->raw_body_len );
+
+    return hdr_len + msg->raw_body_len;
+}
+
+/* NOTE: there are no sockets here, client and server aren't *
+ *       net conns, messages go from __make_hdr straight to  *
+ *       __parse_message of the other side                   */
+void http_warm_up()
+{
+    http_conn_t        *client;
+    http_conn_t        *server;
+    http_msg_t          req;
+    http_msg_t          resp;
+    char                body[HTTP_WARM_UP_BODY_LEN];
+    char               *buf;
+    int                 len;
+    int                 r;
+    int                 i;
+
+    if( !*cfg_net_warm_up || *cfg_http_warm_up_rounds <= 0 )
+        return;
+
+    client = __warm_up_http( true );
+    server = __warm_up_http( false );
+
+    memset( body, 'w', sizeof(body) );
+
+    memset( &req, 0, sizeof(req) );
+
+    req.url = HTTP_WARM_UP_URL;
+    req.url_len = strlen( req.url );
+    req.host = HTTP_WARM_UP_HOST;
+    req.host_len = strlen( req.host );
+    req.raw_body = body;
+    req.raw_body_len = sizeof(body);
+
+    memset( &resp, 0, sizeof(resp) );
+
+    resp.status_code = 200;
+    resp.raw_body = body;
+    resp.raw_body_len = sizeof(body);
+
+    buf = malloc( HTTP_HDR_MAX_LEN + sizeof(body) );
+
+    for( i = 0; i < *cfg_http_warm_up_rounds; i++ )
+    {
+        len = __warm_up_serialize( buf, HTTP_HDR_MAX_LEN + sizeof(body),
+                                   client, &req );
+
+        r = __parse_message( server, buf, len, false );
+        c_assert( r == len );
+
+        r = __messages_queue_pop( server );
+        c_assert( !r );
+
+        len = __warm_up_serialize( buf, HTTP_HDR_MAX_LEN + sizeof(body),
+                                   server, &resp );
+
+        __messages_queue_push( client, false, false );
+
+        r = __parse_message( client, buf, len, false );
+        c_assert( r == len );
+    }
+
+    LOG( "rounds:%d client_handled:%d server_handled:%d",
+         *cfg_http_warm_up_rounds,
+         client->messages_handled, server->messages_handled );
+
+    free( buf );
+
+    __free_http( client );
+    __free_http( server );
+}
+
 /******************* Init *****************************************************/
 
 static void __init_percent_encoding_map()
@@ -3860,6 +4460,27 @@ static void __default_config_init()
         cfg_http_check_messages_queue_interval->tv_sec = 5;
         cfg_http_check_messages_queue_interval->tv_usec = 0;
     }
+
+    if( !cfg_http_offload_inflate_size )
+    {
+        cfg_http_offload_inflate_size = malloc( sizeof(int) );
+
+        *cfg_http_offload_inflate_size = 0;
+    }
+
+    if( !cfg_http_warm_up_rounds )
+    {
+        cfg_http_warm_up_rounds = malloc( sizeof(int) );
+
+        *cfg_http_warm_up_rounds = 0;
+    }
+
+    if( !cfg_http_overload_shed )
+    {
+        cfg_http_overload_shed = malloc( sizeof(int) );
+
+        *cfg_http_overload_shed = 0;
+    }
 }
 
 void http_init()
@@ -186,10 +186,21 @@ typedef void ( *http_tmr_cb_t )( http_id_t              http_id,
 typedef ptr_id_t ( *http_dup_udata_t )( http_id_t       http_id,
                                         ptr_id_t        udata_id );
 
+typedef void ( *http_drain_uh_t )( http_id_t            http_id,
+                                   ptr_id_t             udata_id );
+
+/* NOTE: http_post_raw_data result, see NET_POST_OVER_HIGH */
+#define HTTP_POST_OVER_HIGH             1
+
 unsigned        G_http_errno;
 
 void            http_init();
 
+/* NOTE: if net_warm_up is set, it runs http_warm_up_rounds *
+ *       synthetic requests and responses through the       *
+ *       serializer and parser, before net_main_loop()      */
+void            http_warm_up();
+
 http_id_t       http_make_conn( net_host_t             *host,
                                 http_client_r_uh_t      r_uh_cb,
                                 http_est_uh_t           est_uh_cb,
@@ -203,7 +214,8 @@ http_id_t       http_make_listen( http_server_r_uh_t    child_r_cb,
                                   http_clo_uh_t         clo_uh_cb,
                                   ptr_id_t              udata_id,
                                   int                   port,
-                                  bool                  use_ssl );
+                                  bool                  use_ssl,
+                                  char                 *sock_profile );
 
 int             http_post_data( http_id_t               http_id,
                                 http_msg_t             *msg,
@@ -226,6 +238,26 @@ int             http_shutdown( http_id_t                http_id,
 
 http_state_t    http_is_est( http_id_t                  http_id );
 
+int             http_set_write_watermarks( http_id_t            http_id,
+                                           http_drain_uh_t      drain_cb,
+                                           unsigned long        high_bytes,
+                                           unsigned long        low_bytes,
+                                           int                  high_msgs,
+                                           int                  low_msgs );
+
+int             http_pause_read( http_id_t              http_id,
+                                 bool                   pause );
+
+/* NOTE: receive time of the newest bytes read before the callback, *
+ *       see net_get_rx_timestamp                                   */
+int             http_get_rx_timestamp( http_id_t        http_id,
+                                       net_rx_ts_t     *ts );
+
+/* NOTE: only for a server conn in tunneling mode, since this  *
+ *       moment server_r_cb isn't called, see net_tunnel_conns */
+int             http_tunnel_raw( http_id_t              http_id,
+                                 conn_id_t              conn_id );
+
 http_msg_t     *http_dup_msg( http_msg_t               *msg,
                               bool                      no_proxy_url );
 
@@ -253,4 +285,7 @@ hash_table_t   *http_parse_www_form( char              *form,
 
 extern struct timeval  *cfg_http_response_timeout;
 extern struct timeval  *cfg_http_check_messages_queue_interval;
+extern int             *cfg_http_offload_inflate_size;
+extern int             *cfg_http_warm_up_rounds;
+extern int             *cfg_http_overload_shed;
 
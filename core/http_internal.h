@@ -102,6 +102,17 @@
 /* NOTE: smallest form requires 2 bytes: k= */
 #define HTTP_WWW_FORM_MIN_LEN           2
 
+/* NOTE: synthetic message of http_warm_up */
+#define HTTP_WARM_UP_URL                "/warm_up"
+#define HTTP_WARM_UP_HOST               "localhost"
+#define HTTP_WARM_UP_BODY_LEN           512
+
+/* NOTE: pre-built reply to a request shed by http_overload_shed */
+#define HTTP_SHED_RESPONSE              "HTTP/1.1 503 Service Unavailable\r\n" \
+                                        "Content-Length: 0\r\n"                \
+                                        "Connection: close\r\n"                \
+                                        "Retry-After: 1\r\n\r\n"
+
 /* S_ stands for state */
 enum {
     S_HTTP_STATUS_LINE = 1,
@@ -187,6 +198,22 @@ typedef struct {
     http_tmr_cb_t           cb;
 } http_tmr_node_t;
 
+/* NOTE: gzip body inflated by net_offload, it's detached *
+ *       if the conn is closed before the completion      */
+typedef struct {
+    http_id_t               http_id;
+    bool                    is_detached;
+
+    char                   *in;
+    int                     in_len;
+
+    char                   *out;
+    int                     out_len;
+
+    int                     z_r;
+    int                     r;
+} http_inflate_job_t;
+
 typedef struct {
     conn_id_t               conn_id;
 
@@ -210,6 +237,8 @@ typedef struct {
 
     http_dup_udata_t        dup_udata_cb;
 
+    http_drain_uh_t         drain_cb;
+
     ll_t                    tmr_list;
 
     ll_t                    messages_queue;
@@ -218,6 +247,12 @@ typedef struct {
 
     http_read_state_t       read_state;
 
+    /* NOTE: the message stays in rb until its body is inflated */
+    http_inflate_job_t     *inflate_job;
+    char                   *inflated_body;
+    int                     inflated_body_len;
+    bool                    is_inflated;
+
     bool                    is_in_dup_udata;
     bool                    sent_close;
     bool                    got_connect_method;
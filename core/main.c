@@ -23,6 +23,7 @@
 #include "config.h"
 #include "network.h"
 #include "http.h"
+#include "fiber.h"
 
 _id_t           G_id = 0;
 
@@ -107,8 +108,16 @@ int main( int argc, char **argv )
 
     http_init();
 
+    fiber_init();
+
     module->init_cb();
 
+    http_warm_up();
+
+    fiber_warm_up();
+
+    net_warm_up();
+
     net_main_loop();
 
     return 0;
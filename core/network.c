@@ -16,19 +16,49 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.   *
  ********************************************************************/
 
+/* NOTE: needed for splice(), F_SETPIPE_SZ and memfd_create() */
+#define _GNU_SOURCE
+
 #include "main.h"
 #include "linked_list.h"
 #include "logger.h"
 #include "network.h"
 #include "network_internal.h"
+#include "xdp.h"
 
 static ctx_t            g_ctx_array[NET_MAX_FD + 1];
+static ctx_cold_t       g_ctx_cold_array[NET_MAX_FD + 1];
+/* NOTE: survives __reset_ctx, it's the high half of conn_id */
+static uint32_t         g_ctx_gen[NET_MAX_FD + 1];
 static uint32_t         g_ctx_total = 0;
 static int              g_epollfd;
 static SSL_CTX         *g_ssl_client_ctx;
 static SSL_CTX         *g_ssl_server_ctx;
 static ll_t             g_tmr_list = {0};
+static tmr_table_t      g_tmr_table = {0};
 static struct timeval   g_iter_time;
+static net_tfo_stats_t  g_tfo_stats = {0};
+static ll_t             g_handover_list = {0};
+static struct timeval   g_handover_adopt_until;
+static struct timeval   g_handover_drain_until;
+static tmr_id_t         g_tcp_info_tmr_id = 0;
+static async_queue_t    g_async_queue;
+static offload_pool_t   g_offload_pool;
+static defer_queue_t    g_defer_queue;
+static ll_t             g_hook_lists[NET_HOOK_TYPES];
+static bool             g_is_in_hooks = false;
+static read_batch_t     g_read_batch;
+static struct rusage    g_loop_rusage;
+static tmr_id_t         g_fault_report_tmr_id = 0;
+static load_t           g_load = {0};
+static watchdog_t       g_watchdog = {0};
+static sim_t            g_sim = {0};
+static capture_t        g_capture = {0};
+static replay_t         g_replay = {0};
+
+/* NOTE: ctxs with work for __do_scheduled, may be more *
+ *       than really, it's recounted by each sweep      */
+static uint32_t         g_sched_pending = 0;
 
 char                   *cfg_net_cert_file = NULL;
 char                   *cfg_net_key_file = NULL;
@@ -42,6 +72,54 @@ struct timeval         *cfg_net_ssl_accept_timeout = NULL;
 struct timeval         *cfg_net_establish_timeout = NULL;
 struct timeval         *cfg_net_flush_and_close_timeout = NULL;
 
+int                    *cfg_net_write_high_watermark = NULL;
+int                    *cfg_net_write_low_watermark = NULL;
+int                    *cfg_net_write_high_msgs = NULL;
+int                    *cfg_net_write_low_msgs = NULL;
+
+ll_t                   *cfg_net_sock_profiles = NULL;
+char                   *cfg_net_default_sock_profile = NULL;
+
+int                    *cfg_net_udp_recv_batch = NULL;
+ll_t                   *cfg_net_udp_endpoints = NULL;
+
+int                    *cfg_net_shm_ring_size = NULL;
+
+struct timeval         *cfg_net_tcp_info_interval = NULL;
+
+char                   *cfg_net_handover_path = NULL;
+int                    *cfg_net_handover_idle_conns = NULL;
+struct timeval         *cfg_net_handover_drain_timeout = NULL;
+
+int                    *cfg_net_offload_threads = NULL;
+
+int                    *cfg_net_warm_up = NULL;
+int                    *cfg_net_warm_up_heap_size = NULL;
+int                    *cfg_net_mlockall = NULL;
+int                    *cfg_net_huge_pages = NULL;
+struct timeval         *cfg_net_fault_report_time = NULL;
+
+struct timeval         *cfg_net_overload_lag = NULL;
+int                    *cfg_net_overload_depth = NULL;
+int                    *cfg_net_overload_pause_accept = NULL;
+
+struct timeval         *cfg_net_watchdog_budget = NULL;
+
+int                    *cfg_net_sim = NULL;
+int                    *cfg_net_sim_seed = NULL;
+struct timeval         *cfg_net_sim_latency = NULL;
+int                    *cfg_net_sim_loss = NULL;
+struct timeval         *cfg_net_sim_rto = NULL;
+struct timeval         *cfg_net_sim_duration = NULL;
+
+char                   *cfg_net_capture_file = NULL;
+int                    *cfg_net_capture_file_size = NULL;
+
+char                   *cfg_net_replay_file = NULL;
+int                    *cfg_net_replay_port = NULL;
+int                    *cfg_net_replay_paced = NULL;
+struct timeval         *cfg_net_replay_drain_timeout = NULL;
+
 /* NOTE: start at the next event from epoll_wait() */
 static bool             g_skip_cb = false;
 
@@ -62,6 +140,41 @@ static void __read_cb( ctx_t *ctx );
 static void __listen_cb( ctx_t *ctx );
 static void __connect_cb( ctx_t *ctx );
 
+static void __tunnel_read_cb( ctx_t *ctx );
+static void __tunnel_write_cb( ctx_t *ctx );
+
+static void __udp_read_cb( ctx_t *ctx );
+static void __udp_write_cb( ctx_t *ctx );
+
+static int  __shm_start_connect( ctx_t *ctx );
+static void __shm_start_accept( ctx_t *ctx );
+static void __shm_accept_cb( ctx_t *ctx );
+static void __shm_kick_cb( ctx_t *ctx );
+static void __shm_read_cb( ctx_t *ctx );
+static void __shm_write_cb( ctx_t *ctx );
+
+static void __pipe_shutdown_write( ctx_t *ctx );
+
+static void __add_to_read_batch( ctx_t *ctx );
+
+static inline void __watchdog_mark( conn_id_t conn_id, void *cb );
+
+static void __sim_send( ctx_t          *ctx,
+                        conn_id_t       dst_id,
+                        char           *data,
+                        unsigned long   len,
+                        bool            is_eof );
+
+static void __capture_write( ctx_t              *ctx,
+                             net_capture_dir_t  dir,
+                             bool               is_closed,
+                             char              *data,
+                             unsigned long      len );
+static void __capture_rx( ctx_t *ctx, bool is_closed );
+static void __capture_cut( ctx_t *ctx, unsigned long n );
+
+static void __handover_cb( ctx_t *ctx );
+
 enum {
     S_LISTENING = 0,
     S_CONNECTING,
@@ -69,7 +182,11 @@ enum {
     S_SSL_CONNECTING,
     S_SSL_ACCEPTING,
     S_SSL_ESTABLISHED,
-    S_SSL_SHUTDOWN
+    S_SSL_SHUTDOWN,
+    S_TUNNEL,
+    S_UDP,
+    S_SHM_ACCEPTING,
+    S_HANDOVER
 };
 
 /* S == STATE */
@@ -109,7 +226,27 @@ static state_t          g_ctx_state[] =
     { .st = S_SSL_SHUTDOWN,
       .ssl_rw_st = 0,
       .r_cb = __ssl_shutdown_cb,
-      .w_cb = __ssl_shutdown_cb }
+      .w_cb = __ssl_shutdown_cb },
+
+    { .st = S_TUNNEL,
+      .ssl_rw_st = 0,
+      .r_cb = __tunnel_read_cb,
+      .w_cb = __tunnel_write_cb },
+
+    { .st = S_UDP,
+      .ssl_rw_st = 0,
+      .r_cb = __udp_read_cb,
+      .w_cb = __udp_write_cb },
+
+    { .st = S_SHM_ACCEPTING,
+      .ssl_rw_st = 0,
+      .r_cb = __shm_accept_cb,
+      .w_cb = __shm_accept_cb },
+
+    { .st = S_HANDOVER,
+      .ssl_rw_st = 0,
+      .r_cb = __handover_cb,
+      .w_cb = __handover_cb }
 };
 
 /******************* Socket functions *****************************************/
@@ -144,7 +281,184 @@ static int __set_socket_params( int     fd,
     return 0;
 }
 
-static int __create_socket()
+static int __set_sock_opt( int     fd,
+                           int     level,
+                           int     optname,
+                           int     val,
+                           char   *optstr )
+{
+    if( val == NET_SOCK_OPT_UNSET )
+        return 0;
+
+    if( setsockopt( fd, level, optname, (void *) &val, sizeof(val) ) )
+    {
+        LOGE( "fd:%x opt:%s val:%d errno:%d strerror:%s",
+              fd, optstr, val, errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static int __get_sock_opt( int      fd,
+                           int      level,
+                           int      optname )
+{
+    int                 val = NET_SOCK_OPT_UNSET;
+    socklen_t           len = sizeof(val);
+
+    if( getsockopt( fd, level, optname, (void *) &val, &len ) )
+        return NET_SOCK_OPT_UNSET;
+
+    return val;
+}
+
+/* NOTE: name == NULL means cfg_net_default_sock_profile, *
+ *       returns NULL if no profile should be applied     */
+static net_sock_profile_t *__find_sock_profile( char   *name,
+                                                bool   *not_found )
+{
+    net_sock_profile_t     *profile;
+
+    *not_found = false;
+
+    if( !name )
+        name = cfg_net_default_sock_profile;
+
+    if( !name )
+        return NULL;
+
+    profile = net_get_sock_profile( name );
+
+    if( !profile )
+    {
+        LOGE( "sock_profile:%s not found", name );
+        *not_found = true;
+    }
+
+    return profile;
+}
+
+/* NOTE: kernel doubles SO_SNDBUF/SO_RCVBUF and may clamp them, *
+ *       so effective values are read back and logged           */
+static int __apply_sock_profile( int                    fd,
+                                 net_sock_profile_t    *profile,
+                                 int                    dirn )
+{
+    int                 r = 0;
+
+    if( !profile )
+        return 0;
+
+    /* NOTE: kernel accepts TFO options only before connect/listen */
+    if( dirn == D_OUTGOING )
+    {
+        r |= __set_sock_opt( fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                             profile->fastopen, "TCP_FASTOPEN_CONNECT" );
+    }
+    else
+    if( dirn == D_LISTEN )
+    {
+        r |= __set_sock_opt( fd, IPPROTO_TCP, TCP_FASTOPEN,
+                             profile->fastopen_qlen, "TCP_FASTOPEN" );
+    }
+
+    r |= __set_sock_opt( fd, IPPROTO_TCP, TCP_NODELAY,
+                         profile->nodelay, "TCP_NODELAY" );
+    r |= __set_sock_opt( fd, IPPROTO_TCP, TCP_QUICKACK,
+                         profile->quickack, "TCP_QUICKACK" );
+    r |= __set_sock_opt( fd, SOL_SOCKET, SO_SNDBUF,
+                         profile->sndbuf, "SO_SNDBUF" );
+    r |= __set_sock_opt( fd, SOL_SOCKET, SO_RCVBUF,
+                         profile->rcvbuf, "SO_RCVBUF" );
+    r |= __set_sock_opt( fd, IPPROTO_TCP, TCP_USER_TIMEOUT,
+                         profile->user_timeout, "TCP_USER_TIMEOUT" );
+    r |= __set_sock_opt( fd, IPPROTO_IP, IP_TOS,
+                         profile->tos, "IP_TOS" );
+    r |= __set_sock_opt( fd, SOL_SOCKET, SO_PRIORITY,
+                         profile->priority, "SO_PRIORITY" );
+
+    /* NOTE: accepted socket gets it from the profile again */
+    if( profile->rx_timestamping > 0 )
+    {
+        r |= __set_sock_opt( fd, SOL_SOCKET, SO_TIMESTAMPING,
+                             RX_TIMESTAMPING_FLAGS, "SO_TIMESTAMPING" );
+    }
+
+    if( r )
+        return -1;
+
+    LOG( "fd:%x dirn:%d sock_profile:%s nodelay:%d quickack:%d sndbuf:%d "
+         "rcvbuf:%d user_timeout:%d tos:0x%x priority:%d fastopen:%d "
+         "timestamping:0x%x",
+         fd, dirn, profile->name,
+         __get_sock_opt( fd, IPPROTO_TCP, TCP_NODELAY ),
+         __get_sock_opt( fd, IPPROTO_TCP, TCP_QUICKACK ),
+         __get_sock_opt( fd, SOL_SOCKET, SO_SNDBUF ),
+         __get_sock_opt( fd, SOL_SOCKET, SO_RCVBUF ),
+         __get_sock_opt( fd, IPPROTO_TCP, TCP_USER_TIMEOUT ),
+         __get_sock_opt( fd, IPPROTO_IP, IP_TOS ),
+         __get_sock_opt( fd, SOL_SOCKET, SO_PRIORITY ),
+         dirn == D_LISTEN ?
+            __get_sock_opt( fd, IPPROTO_TCP, TCP_FASTOPEN ) :
+            __get_sock_opt( fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT ),
+         __get_sock_opt( fd, SOL_SOCKET, SO_TIMESTAMPING ) );
+
+    return 0;
+}
+
+/* NOTE: TCPI_OPT_SYN_DATA means that SYN carried data and   *
+ *       it was acked (outgoing) or accepted (incoming) by   *
+ *       the other side, i.e. one RTT was saved              */
+static bool __is_syn_data( int fd )
+{
+    struct tcp_info     info;
+    socklen_t           len = sizeof(info);
+
+    memset( &info, 0, sizeof(info) );
+
+    if( getsockopt( fd, IPPROTO_TCP, TCP_INFO, (void *) &info, &len ) )
+        return false;
+
+    return !!(info.tcpi_options & TCPI_OPT_SYN_DATA);
+}
+
+static void __check_tfo( ctx_t *ctx )
+{
+    bool                syn_data;
+
+    if( !ctx->is_tfo_pending )
+        return;
+
+    ctx->is_tfo_pending = false;
+
+    syn_data = __is_syn_data( ctx->fd );
+
+    if( ctx->dirn == D_OUTGOING )
+    {
+        if( syn_data )
+            g_tfo_stats.out_syn_data_acked++;
+    }
+    else
+    {
+        g_tfo_stats.in_total++;
+
+        if( syn_data )
+            g_tfo_stats.in_syn_data++;
+    }
+
+    LOG( "id:0x%llx host:%s:%s dirn:%d syn_data:%d "
+         "out:%llu/%llu in:%llu/%llu",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         ctx->dirn, syn_data,
+         (unsigned long long) g_tfo_stats.out_syn_data_acked,
+         (unsigned long long) g_tfo_stats.out_attempts,
+         (unsigned long long) g_tfo_stats.in_syn_data,
+         (unsigned long long) g_tfo_stats.in_total );
+}
+
+static int __create_socket( int domain, int sock_type )
 {
     int                 fd;
     int                 type;
@@ -153,17 +467,17 @@ static int __create_socket()
     /* NOTE: Since Linux 2.6.27, SOCK_NONBLOCK is available */
 #ifdef SOCK_NONBLOCK
 
-    type = SOCK_STREAM | SOCK_NONBLOCK;
+    type = sock_type | SOCK_NONBLOCK;
     set_nonblock_by_fcntl = false;
 
 #else
 
-    type = SOCK_STREAM;
+    type = sock_type;
     set_nonblock_by_fcntl = true;
 
 #endif
 
-    if( (fd = socket(AF_INET, type, 0)) == -1 )
+    if( (fd = socket(domain, type, 0)) == -1 )
     {
         LOGE( "fd:%x errno:%d strerror:%s",
               fd, errno, strerror( errno ) );
@@ -192,1472 +506,1745 @@ static int __create_socket()
     return fd;
 }
 
-static void __shutdown_write( ctx_t *ctx )
-{
-    if( shutdown( ctx->fd, SHUT_WR ) == -1 )
-    {
-        LOGE( "id:0x%llx fd:%x host:%s:%s state:%d errno:%d strerror:%s",
-              PTRID_FMT( ctx->id ), ctx->fd, ctx->host, ctx->port,
-              ctx->state->st, errno, strerror( errno ) );
-    }
+/******************* Unix socket functions ************************************/
 
-    ctx->is_shut_wr_done = true;
+static bool __is_unix_host( net_host_t *host )
+{
+    return host->hostname && host->hostname[0] == '/';
 }
 
-/******************* ctx_t misc functions *************************************/
+static bool __is_pipe_host( net_host_t *host )
+{
+    return host->hostname && host->hostname[0] == '@';
+}
 
-static ctx_t *__init_new_ctx( int fd )
+static int __get_unix_sock_type( char *type )
 {
-    ctx_t                  *ctx;
+    if( !strcmp( type, "stream" ) )
+        return SOCK_STREAM;
 
-    c_assert( fd >= 0 && fd <= NET_MAX_FD );
+    if( !strcmp( type, "seqpacket" ) )
+        return SOCK_SEQPACKET;
 
-    ctx = &g_ctx_array[fd];
-    c_assert( !ctx->id );
+    /* NOTE: shm conn does the handshake over a stream socket */
+    if( !strcmp( type, "shm" ) )
+        return SOCK_STREAM;
 
-    ctx->fd = fd;
+    LOGE( "type:%s", type );
 
-    ctx->id = PTRID( ctx );
+    return -1;
+}
 
-    g_ctx_total++;
-    c_assert( g_ctx_total <= NET_MAX_FD );
+static struct sockaddr_un *__make_unix_addr( char *path )
+{
+    struct sockaddr_un     *addr;
 
-    return ctx;
+    if( strlen( path ) >= sizeof(addr->sun_path) )
+    {
+        LOGE( "path:%s", path );
+        return NULL;
+    }
+
+    addr = malloc( sizeof(struct sockaddr_un) );
+    memset( addr, 0, sizeof(struct sockaddr_un) );
+
+    addr->sun_family = AF_UNIX;
+    strcpy( addr->sun_path, path );
+
+    return addr;
 }
 
-static ctx_t *__get_ctx( conn_id_t conn_id )
+/* NOTE: socket file is left after a crash, it's removed *
+ *       only if nobody accepts connections on it        */
+static int __remove_stale_unix_path( struct sockaddr_un *addr,
+                                     int                 sock_type )
 {
-    ctx_t          *ctx;
+    struct stat         st;
+    int                 fd;
+    int                 r;
 
-    ctx = PTRID_GET_PTR( conn_id );
+    if( stat( addr->sun_path, &st ) )
+        return 0;
 
-    c_assert( ctx >= g_ctx_array &&
-              ctx <= g_ctx_array + sizeof(ctx_t) * NET_MAX_FD );
+    if( !S_ISSOCK( st.st_mode ) )
+    {
+        LOGE( "path:%s not a socket", addr->sun_path );
+        return -1;
+    }
 
-    c_assert( ctx->id == conn_id );
+    fd = socket( AF_UNIX, sock_type | SOCK_NONBLOCK, 0 );
+    if( fd == -1 )
+    {
+        LOGE( "path:%s errno:%d strerror:%s",
+              addr->sun_path, errno, strerror( errno ) );
 
-    c_assert( ctx->fd >= 0 && ctx->fd <= NET_MAX_FD &&
-              ctx == &g_ctx_array[ctx->fd] && ctx->id );
+        return -1;
+    }
 
-    return ctx;
+    r = connect( fd, (struct sockaddr *) addr, sizeof(struct sockaddr_un) );
+
+    if( !r || errno != ECONNREFUSED )
+    {
+        LOGE( "path:%s is in use", addr->sun_path );
+
+        PROPER_CLOSE_FD( fd );
+        return -1;
+    }
+
+    PROPER_CLOSE_FD( fd );
+
+    if( unlink( addr->sun_path ) )
+    {
+        LOGE( "path:%s errno:%d strerror:%s",
+              addr->sun_path, errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    LOG( "path:%s", addr->sun_path );
+
+    return 0;
 }
 
-static void __cancel_ctx( ctx_t *ctx )
+static void __shutdown_write( ctx_t *ctx )
 {
-    memset( ctx, 0, sizeof(ctx_t) );
+    if( ctx->is_pipe )
+        __pipe_shutdown_write( ctx );
+    else
+    if( shutdown( ctx->fd, SHUT_WR ) == -1 )
+    {
+        LOGE( "id:0x%llx fd:%x host:%s:%s state:%d errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->fd, ctx->cold->host, ctx->cold->port,
+              ctx->state->st, errno, strerror( errno ) );
+    }
 
-    g_ctx_total--;
-    c_assert( g_ctx_total >= 0 );
+    ctx->is_shut_wr_done = true;
 }
 
-/******************* epoll functions ******************************************/
+/******************* Shared memory functions **********************************/
 
-static void __add_to_epoll( ctx_t *ctx )
+static bool __is_shm_ring_size( uint64_t size )
 {
-    struct epoll_event      event;
-
-    /* NOTE: EPOLLOUT will be disabled after established */
-    ctx->ev = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    return size >= SHM_MIN_RING_SIZE && size <= SHM_MAX_RING_SIZE &&
+           !(size & (size - 1));
+}
 
-    event.events = ctx->ev;
-    event.data.fd = ctx->fd;
+static void __shm_close_fds( int *fds, int n )
+{
+    int                 i;
 
-    if( epoll_ctl( g_epollfd,
-                   EPOLL_CTL_ADD,
-                   event.data.fd,
-                   &event ) )
+    for( i = 0; i < n; i++ )
     {
-        LOGE( "id:0x%llx host:%s:%s ev:0x%x errno:%d strerror:%s",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-              ctx->ev, errno, strerror( errno ) );
+        if( fds[i] != -1 )
+            PROPER_CLOSE_FD( fds[i] );
     }
+}
 
-    LOGD( "id:0x%llx host:%s:%s ev:0x%x",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port, ctx->ev );
+static void __shm_ring_init( shm_ring_t    *ring,
+                             char          *base,
+                             uint32_t       size )
+{
+    ring->hdr = (shm_ring_hdr_t *) base;
+    ring->data = base + sizeof(shm_ring_hdr_t);
+    ring->size = size;
 }
 
-static void __del_from_epoll( ctx_t *ctx )
+/* NOTE: the first ring is client to server, the second is *
+ *       server to client                                  */
+static shm_t *__shm_map( int        memfd,
+                         uint32_t   ring_size,
+                         int        dirn )
 {
-    if( epoll_ctl( g_epollfd,
-                   EPOLL_CTL_DEL,
-                   ctx->fd,
-                   NULL ) )
+    shm_t              *shm;
+    void               *map;
+    char               *c2s, *s2c;
+    size_t              map_size = SHM_MAP_SIZE( ring_size );
+
+    map = mmap( NULL, map_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, memfd, 0 );
+
+    if( map == MAP_FAILED )
     {
-        LOGE( "id:0x%llx host:%s:%s ev:0x%x errno:%d strerror:%s",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-              ctx->ev, errno, strerror( errno ) );
+        LOGE( "ring_size:%u errno:%d strerror:%s",
+              ring_size, errno, strerror( errno ) );
+
+        return NULL;
     }
 
-    LOGD( "id:0x%llx host:%s:%s ev:0x%x",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port, ctx->ev );
+    shm = malloc( sizeof(shm_t) );
+    memset( shm, 0, sizeof(shm_t) );
+
+    shm->map = map;
+    shm->map_size = map_size;
+
+    shm->kick_fd = -1;
+    shm->peer_kick_fd = -1;
+
+    c2s = map;
+    s2c = c2s + sizeof(shm_ring_hdr_t) + ring_size;
+
+    __shm_ring_init( &shm->tx, dirn == D_OUTGOING ? c2s : s2c, ring_size );
+    __shm_ring_init( &shm->rx, dirn == D_OUTGOING ? s2c : c2s, ring_size );
+
+    return shm;
 }
 
-static void __enable_write( ctx_t *ctx )
+static void __shm_kick( shm_t *shm, int fd )
 {
-    struct epoll_event      event;
-
-    if( ctx->ev & EPOLLOUT )
-        return;
+    uint64_t            one = 1;
+    int                 r;
 
-    event.events = ( ctx->ev | EPOLLOUT );
-    event.data.fd = ctx->fd;
+    errno = 0;
+    while( (r = write( fd, &one, sizeof(one) )) == -1 && errno == EINTR )
+        errno = 0;
 
-    if( epoll_ctl( g_epollfd,
-                   EPOLL_CTL_MOD,
-                   event.data.fd,
-                   &event ) )
+    /* NOTE: EAGAIN means the counter is full, it's still readable */
+    if( r == -1 && errno != EAGAIN )
     {
-        LOGE( "id:0x%llx host:%s:%s ev:0x%x errno:%d strerror:%s",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-              ctx->ev, errno, strerror( errno ) );
+        LOGE( "fd:%x errno:%d strerror:%s", fd, errno, strerror( errno ) );
     }
-    else
-        ctx->ev = event.events;
 
-    LOGD( "id:0x%llx host:%s:%s ev:0x%x",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port, ctx->ev );
+    shm->total_kicks++;
 }
 
-static void __disable_write( ctx_t *ctx )
+static int __shm_add_kick_to_epoll( ctx_t *ctx )
 {
     struct epoll_event      event;
 
-    if( !(ctx->ev & EPOLLOUT) )
-    {
-        /* NOTE: it may happens because of EPOLLRDHUP etc, *
-         * so use LOGD instead of LOGE here                */
-        LOGD( "id:0x%llx host:%s:%s ev:0x%x state:%d",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-              ctx->ev, ctx->state->st );
-
-        return;
-    }
-
-    event.events = (ctx->ev & ~EPOLLOUT);
-    event.data.fd = ctx->fd;
+    event.events = EPOLLIN;
+    event.data.fd = SHM_KICK_EPOLL_FD( ctx->fd );
 
     if( epoll_ctl( g_epollfd,
-                   EPOLL_CTL_MOD,
-                   event.data.fd,
+                   EPOLL_CTL_ADD,
+                   ctx->cold->shm->kick_fd,
                    &event ) )
     {
-        /* NOTE: it's a catastrofic error, but don't use *
-         * assert for sys calls, so just logging without *
-         * handling an error                             */
-        LOGE( "id:0x%llx host:%s:%s ev:0x%x errno:%d strerror:%s",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-              ctx->ev, errno, strerror( errno ) );
+        LOGE( "id:0x%llx host:%s:%s kick_fd:%x errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ctx->cold->shm->kick_fd, errno, strerror( errno ) );
+
+        return -1;
     }
-    else
-        ctx->ev = event.events;
 
-    LOGD( "id:0x%llx host:%s:%s ev:0x%x",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port, ctx->ev );
+    return 0;
 }
 
-/******************* tmr_t misc functions *************************************/
+/* NOTE: head and tail are in memory the peer can write,  *
+ *       -1 means a broken ring, the conn must be closed  */
+static int64_t __shm_ring_space( shm_ring_t *ring )
+{
+    uint64_t            used;
 
-static tmr_t *__make_timer( net_tmr_cb_t    cb,
-                            struct timeval *timeout )
-{
-    tmr_t                  *tmr;
-    struct timeval          tv = G_now;
-
-    tmr = malloc( sizeof(tmr_t) );
-    memset( tmr, 0, sizeof(tmr_t) );
-
-    tmr->uh_cb = cb;
-
-    timeradd( &tv, timeout, &tv );
-
-    tmr->timeout.tv_sec = tv.tv_sec;
-    tmr->timeout.tv_usec = tv.tv_usec;
+    used = ring->hdr->head - __atomic_load_n( &ring->hdr->tail,
+                                              __ATOMIC_ACQUIRE );
 
-    tmr->shift.tv_sec = timeout->tv_sec;
-    tmr->shift.tv_usec = timeout->tv_usec;
+    if( used > ring->size )
+        return -1;
 
-    return tmr;
+    return ring->size - used;
 }
 
-/*  Can be used for internal network timers  *
- *  and user level timers.                   *
- *  Example of user level connection timers: *
- *      to control last read time            *
- *      to control last write time           */
-
-static tmr_id_t __make_conn_tmr( ctx_t           *ctx,
-                                 ptr_id_t         udata_id,
-                                 net_tmr_cb_t     cb,
-                                 struct timeval  *timeout )
+/* NOTE: it copies as much as fits, partial write is ok for *
+ *       byte stream, head is published after the copy      */
+static int64_t __shm_ring_write( shm_ring_t    *ring,
+                                 char          *ptr,
+                                 uint64_t       len )
 {
-    tmr_t                  *tmr;
+    uint64_t            head = ring->hdr->head;
+    uint64_t            off, n, part;
+    int64_t             space;
 
-    if( ctx->tmr_list.total > MAX_TIMERS )
-    {
-        LOGE( "ctx_id:0x%llx", PTRID_FMT( ctx->id ) );
+    space = __shm_ring_space( ring );
+    if( space == -1 )
+        return -1;
 
-        G_net_errno = NET_ERRNO_TMR_MAX;
+    n = space;
+    if( n > len )
+        n = len;
+
+    if( !n )
         return 0;
-    }
 
-    tmr = __make_timer( cb, timeout );
+    off = head & (ring->size - 1);
 
-    LL_ADD_NODE( &ctx->tmr_list, tmr );
+    part = ring->size - off;
+    if( part > n )
+        part = n;
 
-    tmr->udata_id = udata_id;
+    memcpy( ring->data + off, ptr, part );
+    memcpy( ring->data, ptr + part, n - part );
 
-    LOG( "id:0x%llx host:%s:%s tmr:0x%llx "
-         "timeout.tv_sec:%ld timeout.tv_usec:%ld "
-         "shift.tv_sec:%ld shift.tv_usec:%ld",
-         PTRID_FMT( ctx->id ), ctx->host, ctx->port, PTRID_FMT( tmr->id ),
-         tmr->timeout.tv_sec, tmr->timeout.tv_usec,
-         tmr->shift.tv_sec, tmr->shift.tv_usec );
+    __atomic_store_n( &ring->hdr->head, head + n, __ATOMIC_RELEASE );
 
-    return tmr->id;
+    return n;
 }
 
-static int __del_timer( tmr_t      *tmr,
-                        ll_t       *list )
+/* NOTE: everything available is moved to rb, ring size *
+ *       limits how much rb grows, -1 as for space      */
+static int64_t __shm_ring_read( shm_ring_t     *ring,
+                                buf_t          *b )
 {
-    if( tmr->locked && !tmr->to_delete )
-    {
-        LOG( "tmr:0x%llx", PTRID_FMT( tmr->id ) );
-
-        tmr->to_delete = true;
+    uint64_t            tail = ring->hdr->tail;
+    uint64_t            off, n, part;
 
-        return 0;
-    }
-    else
-    if( tmr->locked && tmr->to_delete )
-    {
-        LOGE( "tmr:0x%llx", PTRID_FMT( tmr->id ) );
+    n = __atomic_load_n( &ring->hdr->head, __ATOMIC_ACQUIRE ) - tail;
 
-        G_net_errno = NET_ERRNO_GENERAL_ERR;
+    if( n > ring->size )
         return -1;
-    }
 
-    LL_DEL_NODE( list, tmr->id );
+    if( !n )
+        return 0;
 
-    /* NOTE: delete tmr label and pointers before free(), *
-     * so asserts can work if something goes wrong        */
-    memset( tmr, 0, sizeof(tmr_t) );
-    free( tmr );
+    if( B_REMAINDER_SIZE( *b ) < n )
+        B_INCREASE_BUF( *b, n - B_REMAINDER_SIZE( *b ) );
 
-    return 0;
-}
+    off = tail & (ring->size - 1);
 
-static int __del_conn_tmr( ctx_t      *ctx,
-                           tmr_id_t    tmr_id )
-{
-    tmr_t                  *tmr;
+    part = ring->size - off;
+    if( part > n )
+        part = n;
 
-    tmr = PTRID_GET_PTR( tmr_id );
+    memcpy( B_REMAINDER_PTR( *b ), ring->data + off, part );
+    memcpy( B_REMAINDER_PTR( *b ) + part, ring->data, n - part );
 
-    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
-         PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-         PTRID_FMT( tmr_id ) );
+    B_INCREASE_USED( *b, n );
 
-    return __del_timer( tmr,
-                        &ctx->tmr_list );
-}
+    __atomic_store_n( &ring->hdr->tail, tail + n, __ATOMIC_RELEASE );
 
-/******************* Destroy ctx functions ************************************/
+    return n;
+}
 
-static void __cleanup_timers( ctx_t *ctx )
+/* NOTE: the other side sleeps only after it sets the flag *
+ *       and rechecks the ring, so a flag seen after the   *
+ *       fence isn't lost, exchange makes only one kick    */
+static void __shm_kick_if_waiting( shm_t       *shm,
+                                   uint32_t    *waiting )
 {
-    tmr_t                  *tmr, *tmr_next;
-    int                     r;
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
 
-    if( !ctx->tmr_list.total )
+    if( __atomic_load_n( waiting, __ATOMIC_RELAXED ) &&
+        __atomic_exchange_n( waiting, 0, __ATOMIC_SEQ_CST ) )
     {
-        c_assert( !ctx->tmr_list.head &&
-                  !ctx->tmr_list.tail );
-
-        return;
+        __shm_kick( shm, shm->peer_kick_fd );
     }
+}
 
-    LL_CHECK( &ctx->tmr_list, ctx->tmr_list.head );
-    tmr = PTRID_GET_PTR( ctx->tmr_list.head );
+static void __shm_free( ctx_t *ctx )
+{
+    shm_t              *shm = ctx->cold->shm;
 
-    while( tmr )
-    {
-        LOGD( "id:0x%llx host:%s:%s tmr:0x%llx",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-              PTRID_FMT( tmr->id ) );
+    LOG( "id:0x%llx host:%s:%s rx_bytes:%llu tx_bytes:%llu "
+         "kicks:%llu wakeups:%llu tx_blocks:%llu",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         (unsigned long long) shm->total_rx_bytes,
+         (unsigned long long) shm->total_tx_bytes,
+         (unsigned long long) shm->total_kicks,
+         (unsigned long long) shm->total_wakeups,
+         (unsigned long long) shm->total_tx_blocks );
 
-        tmr_next = PTRID_GET_PTR( tmr->next );
+    /* NOTE: close() removes kick_fd from epoll */
+    __shm_close_fds( &shm->kick_fd, 1 );
+    __shm_close_fds( &shm->peer_kick_fd, 1 );
 
-        r = __del_conn_tmr( ctx, tmr->id );
-        c_assert( !r );
+    munmap( shm->map, shm->map_size );
 
-        tmr = tmr_next;
-    }
+    memset( shm, 0, sizeof(shm_t) );
+    free( shm );
 
-    c_assert( !ctx->tmr_list.total &&
-              !ctx->tmr_list.head &&
-              !ctx->tmr_list.tail );
+    ctx->cold->shm = NULL;
 }
 
-/* NOTE: can not call r_uh_cb because of *
- * destructor clo_uh_cb before           */
-static void __cleanup_buffers( ctx_t *ctx )
-{
-    wbuf_t             *wbuf;
-    wbuf_t             *wbuf_next;
+/******************* ctx_t misc functions *************************************/
 
-    if( ctx->rb.buf )
-    {
-        B_GENERAL_CHECK( ctx->rb );
+/* NOTE: ctx->cold is bound to the slot, so it survives */
+static void __reset_ctx( ctx_t *ctx )
+{
+    ctx_cold_t         *cold = ctx->cold;
 
-        if( B_HAS_USED( ctx->rb ) )
-        {
-            LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu", 
-                 PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-                 B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
-        }
+    c_assert( cold == &g_ctx_cold_array[ctx - g_ctx_array] );
 
-        B_FREE( ctx->rb );
-    }
+    memset( cold, 0, sizeof(ctx_cold_t) );
+    memset( ctx, 0, sizeof(ctx_t) );
 
-    if( !ctx->wb_list.total )
-    {
-        c_assert( !ctx->wb_list.head &&
-                  !ctx->wb_list.tail );
+    ctx->cold = cold;
+}
 
-        return;
-    }
+static ctx_t *__init_new_ctx( int fd )
+{
+    ctx_t                  *ctx;
 
-    LL_CHECK( &ctx->wb_list, ctx->wb_list.head );
-    wbuf = PTRID_GET_PTR( ctx->wb_list.head );
+    c_assert( fd >= 0 && fd <= NET_MAX_FD );
 
-    while( wbuf )
-    {
-        LOGD( "id:0x%llx host:%s:%s msg_id:%llx",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-              PTRID_FMT( wbuf->id ) );
+    ctx = &g_ctx_array[fd];
+    c_assert( !ctx->id );
 
-        wbuf_next = PTRID_GET_PTR( wbuf->next );
+    ctx->fd = fd;
 
-        LL_DEL_NODE( &ctx->wb_list, wbuf->id );
+    /* NOTE: generation 0 would make a zero id for fd 0 */
+    if( !++g_ctx_gen[fd] )
+        g_ctx_gen[fd] = 1;
 
-        B_FREE( wbuf->b );
+    ctx->id = NET_ID( fd, g_ctx_gen[fd] );
 
-        memset( wbuf, 0, sizeof(wbuf_t) );
-        free( wbuf );
+    ctx->wb_high_bytes = *cfg_net_write_high_watermark;
+    ctx->wb_low_bytes = *cfg_net_write_low_watermark;
+    ctx->wb_high_msgs = *cfg_net_write_high_msgs;
+    ctx->wb_low_msgs = *cfg_net_write_low_msgs;
 
-        wbuf = wbuf_next;
-    }
+    g_ctx_total++;
+    c_assert( g_ctx_total <= NET_MAX_FD );
 
-    c_assert( !ctx->wb_list.total &&
-              !ctx->wb_list.head &&
-              !ctx->wb_list.tail );
+    return ctx;
 }
 
-static void __cleanup_ctx( ctx_t *ctx )
+static ctx_t *__get_ctx( conn_id_t conn_id )
 {
-    __cleanup_buffers( ctx );
-    __cleanup_timers( ctx );
+    ctx_t          *ctx;
 
-    if( ctx->ssl )
-        SSL_free( ctx->ssl );
+    c_assert( NET_ID_SLOT( conn_id ) <= NET_MAX_FD );
 
-    memset( ctx, 0, sizeof(ctx_t) );
+    ctx = &g_ctx_array[NET_ID_SLOT( conn_id )];
+
+    c_assert( ctx->id == conn_id );
+
+    c_assert( ctx->fd >= 0 && ctx->fd <= NET_MAX_FD &&
+              ctx == &g_ctx_array[ctx->fd] && ctx->id );
+
+    return ctx;
 }
 
-static void __destroy_ctx( ctx_t *ctx, int code )
+/* NOTE: unlike __get_ctx, conn_id may be stale */
+static ctx_t *__find_ctx( conn_id_t conn_id )
 {
-    conn_id_t           prev_id = ctx->id;
-    int                 how_shutdown;
+    ctx_t          *ctx;
 
-    c_assert( ctx->id && !ctx->is_in_destroying );
-    c_assert( !ctx->is_clo_uh_done || ctx->ssl );
+    if( !conn_id || NET_ID_SLOT( conn_id ) > NET_MAX_FD )
+        return NULL;
 
-    ctx->is_in_destroying = true;
+    ctx = &g_ctx_array[NET_ID_SLOT( conn_id )];
 
-    LOG( "id:0x%llx fd:%x host:%s:%s state:%d code:%d",
-         PTRID_FMT( ctx->id ), ctx->fd, ctx->host, ctx->port,
-         ctx->state->st, code );
+    if( ctx->id != conn_id )
+        return NULL;
 
-    if( !ctx->is_clo_uh_done && ctx->clo_uh_cb )
-    {
-        ctx->clo_uh_cb( ctx->id, ctx->udata_id, code );
+    return ctx;
+}
 
-        c_assert( ctx->id == prev_id );
-    }
-    else
-    if( !ctx->clo_uh_cb )
-    {
-        /* NOTE: only accepted and uninitialized *
-         * conn don't have clo_uh_cb             */
-        c_assert( ctx->dirn == D_INCOMING );
-    }
+static bool __is_tcp_conn( ctx_t *ctx )
+{
+    return ( ctx->dirn == D_OUTGOING || ctx->dirn == D_INCOMING ) &&
+           !ctx->cold->unix_addr && !ctx->is_pipe && ctx->state &&
+           ctx->state->st != S_CONNECTING;
+}
 
-    __del_from_epoll( ctx );
+static void __sample_tcp_info( ctx_t *ctx )
+{
+    net_conn_stats_t       *stats = &ctx->cold->tcp_stats;
+    struct tcp_info         info;
+    socklen_t               len = sizeof(info);
+    int                     outq = 0;
 
-    if( ctx->is_shut_wr_done )
+    if( getsockopt( ctx->fd, IPPROTO_TCP, TCP_INFO, &info, &len ) )
     {
-#ifdef  DEBUG
-        int siocoutq = 0;
-        ioctl( ctx->fd, SIOCOUTQ, &siocoutq );
-
-        if( siocoutq )
-        {
-            LOGE( "SIOCOUTQ:%d", siocoutq );
-        }
-#endif
+        LOGE( "id:0x%llx host:%s:%s errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              errno, strerror( errno ) );
 
-        how_shutdown = SHUT_RD;
+        return;
     }
-    else
-        how_shutdown = SHUT_RDWR;
 
-    if( shutdown( ctx->fd, how_shutdown ) == -1 )
+    if( ioctl( ctx->fd, SIOCOUTQ, &outq ) )
+        outq = 0;
+
+    stats->sampled = G_now;
+    stats->rtt_us = info.tcpi_rtt;
+    stats->rttvar_us = info.tcpi_rttvar;
+    stats->rto_us = info.tcpi_rto;
+    stats->snd_cwnd = info.tcpi_snd_cwnd;
+    stats->snd_mss = info.tcpi_snd_mss;
+    stats->unacked = info.tcpi_unacked;
+    stats->lost = info.tcpi_lost;
+    stats->retransmits = info.tcpi_retransmits;
+    stats->total_retrans = info.tcpi_total_retrans;
+    stats->send_queue = outq;
+
+    LOGD( "id:0x%llx host:%s:%s rtt_us:%u rttvar_us:%u cwnd:%u "
+          "total_retrans:%u send_queue:%u",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          stats->rtt_us, stats->rttvar_us, stats->snd_cwnd,
+          stats->total_retrans, stats->send_queue );
+}
+
+/* NOTE: work for the next __do_scheduled, pipe read *
+ *       stays pending while reading is paused       */
+static bool __has_scheduled_work( ctx_t *ctx )
+{
+    if( ctx->to_shutdown || ctx->cold->is_handover_pending ||
+        ctx->cold->is_pipe_est_pending ||
+        ctx->is_read_resumed || ctx->is_drain_pending )
     {
-        LOGE( "id:0x%llx fd:%x host:%s:%s state:%d errno:%d strerror:%s",
-              PTRID_FMT( ctx->id ), ctx->fd, ctx->host, ctx->port,
-              ctx->state->st, errno, strerror( errno ) );
+        return true;
     }
 
-    /* NOTE: close() can not be before clo_uh_cb because clo_uh_cb  *
-     * can make a new connection which has the same 'fd' number,    *
-     * so 'ctx' will be rewritten before it's completely cleaned up */
-    PROPER_CLOSE_FD( ctx->fd );
+    return ctx->cold->is_pipe_rd_pending && !ctx->is_read_paused &&
+           ctx->state && ctx->state->st == S_ESTABLISHED;
+}
 
-    __cleanup_ctx( ctx );
+static void __cancel_ctx( ctx_t *ctx )
+{
+    __reset_ctx( ctx );
 
     g_ctx_total--;
     c_assert( g_ctx_total >= 0 );
 }
 
-static void __shutdown_ctx( ctx_t *ctx, int code )
-{
-    if( ctx->state->st == S_SSL_ESTABLISHED )
-        __ssl_start_shutdown( ctx, code );
-    else
-        __destroy_ctx( ctx, code );
-}
-
-/******************* Timeout functions ****************************************/
+/******************* epoll functions ******************************************/
 
-static void __ssl_shutdown_timeout_cb( conn_id_t    conn_id,
-                                       ptr_id_t     conn_udata_id,
-                                       tmr_id_t     tmr_id,
-                                       ptr_id_t     tmr_udata_id )
+static void __add_to_epoll( ctx_t *ctx )
 {
-    ctx_t      *ctx;
+    struct epoll_event      event;
 
-    ctx = __get_ctx( conn_id );
+    /* NOTE: EPOLLOUT will be disabled after established */
+    ctx->ev = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
 
-    c_assert( ctx->dirn != D_LISTEN &&
-              ctx->state->st == S_SSL_SHUTDOWN &&
-              ctx->ssl && tmr_id == ctx->state_tmr_id );
+    event.events = ctx->ev;
+    event.data.fd = ctx->fd;
 
-    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
-         PTRID_FMT( ctx->id ), ctx->host,
-         ctx->port, PTRID_FMT( tmr_id ) );
+    if( epoll_ctl( g_epollfd,
+                   EPOLL_CTL_ADD,
+                   event.data.fd,
+                   &event ) )
+    {
+        LOGE( "id:0x%llx host:%s:%s ev:0x%x errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ctx->ev, errno, strerror( errno ) );
+    }
 
-    ctx->to_shutdown = true;
+    LOGD( "id:0x%llx host:%s:%s ev:0x%x",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, ctx->ev );
 }
 
-static void __establish_timeout_cb( conn_id_t   conn_id,
-                                    ptr_id_t    conn_udata_id,
-                                    tmr_id_t    tmr_id,
-                                    ptr_id_t    tmr_udata_id )
+static void __del_from_epoll( ctx_t *ctx )
 {
-    ctx_t      *ctx;
-
-    ctx = __get_ctx( conn_id );
-
-    c_assert( ctx->dirn != D_LISTEN &&
-              tmr_id == ctx->state_tmr_id );
-
-    c_assert( ctx->state->st == S_CONNECTING ||
-              ctx->state->st == S_SSL_CONNECTING ||
-              ctx->state->st == S_SSL_ACCEPTING );
-
-    LOG( "id:0x%llx host:%s:%s state:%d tmr:0x%llx",
-         PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-         ctx->state->st, PTRID_FMT( tmr_id ) );
+    if( epoll_ctl( g_epollfd,
+                   EPOLL_CTL_DEL,
+                   ctx->fd,
+                   NULL ) )
+    {
+        LOGE( "id:0x%llx host:%s:%s ev:0x%x errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ctx->ev, errno, strerror( errno ) );
+    }
 
-    ctx->to_shutdown = true;
+    LOGD( "id:0x%llx host:%s:%s ev:0x%x",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, ctx->ev );
 }
 
-static void __flush_and_close_timeout_cb( conn_id_t     conn_id,
-                                          ptr_id_t      conn_udata_id,
-                                          tmr_id_t      tmr_id,
-                                          ptr_id_t      tmr_udata_id )
+static void __enable_write( ctx_t *ctx )
 {
-    ctx_t      *ctx;
-
-    ctx = __get_ctx( conn_id );
+    struct epoll_event      event;
 
-    c_assert( ctx->dirn != D_LISTEN &&
-              tmr_id == ctx->state_tmr_id );
+    if( ctx->ev & EPOLLOUT )
+        return;
 
-    c_assert( ctx->state->st == S_ESTABLISHED ||
-              ctx->state->st == S_SSL_ESTABLISHED ||
-              ctx->state->st == S_SSL_SHUTDOWN );
+    event.events = ( ctx->ev | EPOLLOUT );
+    event.data.fd = ctx->fd;
 
-    LOG( "id:0x%llx host:%s:%s state:%d tmr:0x%llx",
-         PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-         ctx->state->st, PTRID_FMT( tmr_id ) );
+    if( epoll_ctl( g_epollfd,
+                   EPOLL_CTL_MOD,
+                   event.data.fd,
+                   &event ) )
+    {
+        LOGE( "id:0x%llx host:%s:%s ev:0x%x errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ctx->ev, errno, strerror( errno ) );
+    }
+    else
+        ctx->ev = event.events;
 
-    ctx->to_shutdown = true;
+    LOGD( "id:0x%llx host:%s:%s ev:0x%x",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, ctx->ev );
 }
 
-/******************* Buffer RW functions **************************************/
-
-static int __call_read_handler( ctx_t      *ctx,
-                                bool        is_closed )
+static void __disable_write( ctx_t *ctx )
 {
-    conn_id_t       prev_id = ctx->id;
-    char           *host = ctx->host;
-    char           *port = ctx->port;
-    int             r;
-
-    LOGD( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-          B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
-
-    r = ctx->r_uh_cb( ctx->id, ctx->udata_id,
-                      B_USED_PTR( ctx->rb ),
-                      B_USED_SIZE( ctx->rb ), is_closed );
-
-    c_assert( ctx->id == prev_id );
-
-    c_assert( (!ctx->ssl && ctx->state->st == S_ESTABLISHED) ||
-              (ctx->ssl && ctx->state->st == S_SSL_ESTABLISHED) );
+    struct epoll_event      event;
 
-    if( ctx->to_shutdown )
+    if( !(ctx->ev & EPOLLOUT) )
     {
-        if( is_closed )
-        {
-            LOGE( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
-                  PTRID_FMT( ctx->id ), host, port,
-                  B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
-        }
-        else
-        {
-            LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
-                 PTRID_FMT( ctx->id ), host, port,
-                 B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
-        }
+        /* NOTE: it may happens because of EPOLLRDHUP etc, *
+         * so use LOGD instead of LOGE here                */
+        LOGD( "id:0x%llx host:%s:%s ev:0x%x state:%d",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ctx->ev, ctx->state->st );
 
-        return -1;
+        return;
     }
 
-    if( r > 0 && r <= B_USED_SIZE( ctx->rb ) )
+    event.events = (ctx->ev & ~EPOLLOUT);
+    event.data.fd = ctx->fd;
+
+    if( epoll_ctl( g_epollfd,
+                   EPOLL_CTL_MOD,
+                   event.data.fd,
+                   &event ) )
     {
-        B_CUT_USED( ctx->rb, r );
+        /* NOTE: it's a catastrofic error, but don't use *
+         * assert for sys calls, so just logging without *
+         * handling an error                             */
+        LOGE( "id:0x%llx host:%s:%s ev:0x%x errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ctx->ev, errno, strerror( errno ) );
     }
     else
-    if( r )
-    {
-        LOGE( "id:0x%llx host:%s:%s "
-              "rb.used:%lu rb.size:%lu ret:%d",
-              PTRID_FMT( ctx->id ), host, port,
-              B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ), r );
-    }
+        ctx->ev = event.events;
 
-    return 0;
+    LOGD( "id:0x%llx host:%s:%s ev:0x%x",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, ctx->ev );
 }
 
-static void __handle_write_buf( ctx_t *ctx )
+static void __set_read_events( ctx_t *ctx, bool enable )
 {
-    wbuf_t         *wbuf;
-    char           *host = ctx->host, *port = ctx->port;
+    struct epoll_event      event;
 
-    LL_CHECK( &ctx->wb_list, ctx->wb_list.head );
-    wbuf = PTRID_GET_PTR( ctx->wb_list.head );
+    if( enable )
+        event.events = ( ctx->ev | EPOLLIN | EPOLLRDHUP );
+    else
+        event.events = ( ctx->ev & ~(EPOLLIN | EPOLLRDHUP) );
 
-    B_GENERAL_CHECK( wbuf->b );
+    if( event.events == ctx->ev )
+        return;
 
-    wbuf->tries++;
+    event.data.fd = ctx->fd;
 
-    if( wbuf->tries > MAX_WRITE_TRIES )
+    if( epoll_ctl( g_epollfd,
+                   EPOLL_CTL_MOD,
+                   event.data.fd,
+                   &event ) )
     {
-        LOGE( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx",
-              PTRID_FMT( ctx->id ), host, port,
-              B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
-              PTRID_FMT( wbuf->id ) );
+        LOGE( "id:0x%llx host:%s:%s ev:0x%x errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ctx->ev, errno, strerror( errno ) );
     }
     else
-    {
-        LOGD( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx",
-              PTRID_FMT( ctx->id ), host, port,
-              B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
-              PTRID_FMT( wbuf->id ) );
-    }
+        ctx->ev = event.events;
 
-    if( B_HAS_REMAINDER( wbuf->b ) )
-        return;
+    /* NOTE: the ring may be filled while read was paused */
+    if( ctx->is_shm && ctx->cold->shm && enable )
+        __shm_kick( ctx->cold->shm, ctx->cold->shm->kick_fd );
 
-    LOG( "id:0x%llx host:%s:%s msg_id:%llx wb_total:%d",
-         PTRID_FMT( ctx->id ), host, port,
-         PTRID_FMT( wbuf->id ), ctx->wb_list.total );
+    LOGD( "id:0x%llx host:%s:%s ev:0x%x",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, ctx->ev );
+}
 
-    LL_DEL_NODE( &ctx->wb_list, wbuf->id );
+/******************* tmr_t misc functions *************************************/
 
-    B_FREE( wbuf->b );
+static void __grow_tmr_table()
+{
+    tmr_table_t            *t = &g_tmr_table;
+    uint32_t                size;
+    uint32_t                i;
 
-    memset( wbuf, 0, sizeof(wbuf_t) );
-    free( wbuf );
+    size = t->size ? t->size * 2 : TMR_SLOTS_INIT;
 
-    if( !ctx->wb_list.total )
-    {
-        c_assert( !ctx->wb_list.head &&
-                  !ctx->wb_list.tail );
+    t->slots = realloc( t->slots, size * sizeof(tmr_slot_t) );
+    c_assert( t->slots );
 
-        __disable_write( ctx );
+    memset( t->slots + t->size, 0, (size - t->size) * sizeof(tmr_slot_t) );
 
-        if( ctx->flush_and_close )
-            __shutdown_write( ctx );
-    }
-}
+    /* NOTE: it's called only when the free list is empty */
+    for( i = t->size; i < size; i++ )
+        t->slots[i].next_free = i + 1 < size ? i + 1 : TMR_SLOT_NONE;
 
-/******************* SSL RW calls *********************************************/
+    t->free_head = t->size;
+    t->size = size;
+}
 
-static void __call_ssl_read( ctx_t *ctx )
+static tmr_id_t __alloc_tmr_id( tmr_t *tmr )
 {
-    int                 r, e, syserr, i = 0, more = 1;
-    char               *host = ctx->host, *port = ctx->port;
-    unsigned long       ssl_e;
-    char               *ssl_strerror;
+    tmr_table_t            *t = &g_tmr_table;
+    tmr_slot_t             *slot;
+    uint32_t                i;
 
-    B_GENERAL_CHECK( ctx->rb );
+    if( !t->size || t->free_head == TMR_SLOT_NONE )
+        __grow_tmr_table();
 
-    c_assert( B_HAS_REMAINDER( ctx->rb ) );
+    i = t->free_head;
+    slot = &t->slots[i];
 
-    c_assert( !ctx->state->ssl_rw_st ||
-              ctx->state->ssl_rw_st == SSL_R_WANT_W );
+    t->free_head = slot->next_free;
 
-    ctx->state->ssl_rw_st = 0;
+    if( !++slot->gen )
+        slot->gen = 1;
 
-    /* nginx-1.2.2 source says that:
-     * SSL_read() may return data in parts, so try to read
-     * until SSL_read() would return no data
-     */
+    slot->tmr = tmr;
+    slot->next_free = TMR_SLOT_NONE;
 
-    while( more && B_HAS_REMAINDER( ctx->rb ) )
-    {
-        do
-        {
-            errno = 0;
-            r = SSL_read( ctx->ssl,
-                          B_REMAINDER_PTR( ctx->rb ),
-                          B_REMAINDER_SIZE( ctx->rb ) );
+    return NET_ID( i, slot->gen );
+}
 
-            syserr = errno;
-            e = SSL_get_error( ctx->ssl, r );
-        }
-        while( r < 0 && e == SSL_ERROR_SYSCALL && syserr == EINTR );
+static void __free_tmr_id( tmr_id_t tmr_id )
+{
+    tmr_table_t            *t = &g_tmr_table;
+    tmr_slot_t             *slot;
 
-        ssl_e = ERR_get_error();
-        ssl_strerror = ssl_e ? ERR_error_string(ssl_e, NULL) : "-";
+    slot = &t->slots[NET_ID_SLOT( tmr_id )];
 
-        more = SSL_pending( ctx->ssl );
+    c_assert( slot->gen == NET_ID_GEN( tmr_id ) && slot->tmr );
 
-        /* NOTE: consider r == 0 as closed by peer */
-        if( r >= 0 )
-        {
-            if( r > 0 )
-            {
-                B_INCREASE_USED( ctx->rb, r );
-            }
+    slot->tmr = NULL;
+    slot->next_free = t->free_head;
+    t->free_head = NET_ID_SLOT( tmr_id );
+}
 
-            LOGD( "id:0x%llx host:%s:%s rb.used:%lu "
-                  "rb.size:%lu iter:%d",
-                  PTRID_FMT( ctx->id ), host, port,
-                  B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ), i );
+/* NOTE: NULL if tmr_id is stale or wasn't made here */
+static tmr_t *__find_tmr( tmr_id_t tmr_id )
+{
+    tmr_slot_t             *slot;
 
-            if( B_REMAINDER_SIZE( ctx->rb ) < B_MIN_RDBUF_REMAINDER( ctx->rb ) )
-            {
-                B_INCREASE_BUF( ctx->rb, READ_BUFFER_SIZE );
+    if( !tmr_id || NET_ID_SLOT( tmr_id ) >= g_tmr_table.size )
+        return NULL;
 
-                LOG( "id:0x%llx host:%s:%s rb.used:%lu "
-                     "rb.size:%lu iter:%d",
-                     PTRID_FMT( ctx->id ), host, port,
-                     B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ), i );
-            }
+    slot = &g_tmr_table.slots[NET_ID_SLOT( tmr_id )];
 
-            if( __call_read_handler( ctx, !r ) )
-            {
-                LOG( "id:0x%llx host:%s:%s iter:%d",
-                     PTRID_FMT( ctx->id ), host, port, i );
+    if( !slot->tmr || slot->gen != NET_ID_GEN( tmr_id ) )
+        return NULL;
 
-                return;
-            }
+    c_assert( slot->tmr->tmr_id == tmr_id );
 
-            if( !r )
-            {
-                LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu "
-                     "iter:%d ssl_err:%d ssl_strerror:%s errno:%d strerror:%s",
-                     PTRID_FMT( ctx->id ), host, port,
-                     B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ),
-                     i, e, ssl_strerror, syserr, strerror( syserr ) );
+    return slot->tmr;
+}
 
-                __shutdown_ctx( ctx, NET_CODE_SUCCESS );
-                return;
-            }
+static tmr_t *__make_timer( net_tmr_cb_t    cb,
+                            struct timeval *timeout )
+{
+    tmr_t                  *tmr;
+    struct timeval          tv = G_now;
 
-            i++;
-            continue;
-        }
+    tmr = malloc( sizeof(tmr_t) );
+    memset( tmr, 0, sizeof(tmr_t) );
 
-        LOGD( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu iter:%d "
-              "ret:%d ssl_err:%d ssl_strerror:%s errno:%d strerror:%s",
-              PTRID_FMT( ctx->id ), host, port,
-              B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ),
-              i, r, e, ssl_strerror, syserr, strerror( syserr ) );
+    tmr->uh_cb = cb;
+    tmr->tmr_id = __alloc_tmr_id( tmr );
 
-        switch( e )
-        {
-            case SSL_ERROR_WANT_READ:
+    timeradd( &tv, timeout, &tv );
 
-                return;
+    tmr->timeout.tv_sec = tv.tv_sec;
+    tmr->timeout.tv_usec = tv.tv_usec;
 
-            case SSL_ERROR_WANT_WRITE:
+    tmr->shift.tv_sec = timeout->tv_sec;
+    tmr->shift.tv_usec = timeout->tv_usec;
 
-                ctx->state->ssl_rw_st = SSL_R_WANT_W;
+    return tmr;
+}
 
-                if( !(ctx->ev & EPOLLOUT) )
-                {
-                    LOGD( "id:0x%llx", PTRID_FMT( ctx->id ) );
+/*  Can be used for internal network timers  *
+ *  and user level timers.                   *
+ *  Example of user level connection timers: *
+ *      to control last read time            *
+ *      to control last write time           */
 
-                    __enable_write( ctx );
-                }
+static tmr_id_t __make_conn_tmr( ctx_t           *ctx,
+                                 ptr_id_t         udata_id,
+                                 net_tmr_cb_t     cb,
+                                 struct timeval  *timeout )
+{
+    tmr_t                  *tmr;
 
-                return;
+    if( ctx->tmr_list.total > MAX_TIMERS )
+    {
+        LOGE( "ctx_id:0x%llx", NET_ID_FMT( ctx->id ) );
 
-            case SSL_ERROR_SYSCALL:
+        G_net_errno = NET_ERRNO_TMR_MAX;
+        return 0;
+    }
 
-                if( syserr == EAGAIN )
-                    return;
+    tmr = __make_timer( cb, timeout );
 
-                /* fall through */
+    LL_ADD_NODE( &ctx->tmr_list, tmr );
 
-            default:
+    tmr->udata_id = udata_id;
 
-                LOGE( "id:0x%llx host:%s:%s "
-                      "rb.used:%lu rb.size:%lu iter:%d ret:%d ssl_err:%d "
-                      "ssl_strerror:%s errno:%d strerror:%s",
-                      PTRID_FMT( ctx->id ), host, port,
-                      B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ),
-                      i, r, e, ssl_strerror, syserr, strerror( syserr ) );
+    LOG( "id:0x%llx host:%s:%s tmr:0x%llx "
+         "timeout.tv_sec:%ld timeout.tv_usec:%ld "
+         "shift.tv_sec:%ld shift.tv_usec:%ld",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         NET_ID_FMT( tmr->tmr_id ),
+         tmr->timeout.tv_sec, tmr->timeout.tv_usec,
+         tmr->shift.tv_sec, tmr->shift.tv_usec );
 
-                __shutdown_ctx( ctx, NET_CODE_ERR_READ );
-                return;
-        }
-    }
+    return tmr->tmr_id;
 }
 
-static void __call_ssl_write( ctx_t *ctx )
+static int __del_timer( tmr_t      *tmr,
+                        ll_t       *list )
 {
-    wbuf_t             *wbuf;
-    int                 r, e, syserr;
-    unsigned long       ssl_e;
-    char               *ssl_strerror;
-
-    /* NOTE: it may happened because of *
-     * EPOLLRDHUP or after SSL_R_WANT_W */
-    if( !ctx->wb_list.total )
+    if( tmr->locked && !tmr->to_delete )
     {
-        c_assert( !ctx->wb_list.head &&
-                  !ctx->wb_list.tail );
+        LOG( "tmr:0x%llx", NET_ID_FMT( tmr->tmr_id ) );
 
-        LOGD( "id:0x%llx host:%s:%s",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port );
+        tmr->to_delete = true;
 
-        __disable_write( ctx );
-        return;
+        return 0;
     }
+    else
+    if( tmr->locked && tmr->to_delete )
+    {
+        LOGE( "tmr:0x%llx", NET_ID_FMT( tmr->tmr_id ) );
 
-    LL_CHECK( &ctx->wb_list, ctx->wb_list.head );
-    wbuf = PTRID_GET_PTR( ctx->wb_list.head );
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return -1;
+    }
 
-    B_GENERAL_CHECK( wbuf->b );
+    LL_DEL_NODE( list, tmr->id );
 
-    c_assert( B_HAS_REMAINDER( wbuf->b ) );
+    __free_tmr_id( tmr->tmr_id );
 
-    c_assert( !ctx->state->ssl_rw_st ||
-              ctx->state->ssl_rw_st == SSL_W_WANT_R );
+    /* NOTE: delete tmr label and pointers before free(), *
+     * so asserts can work if something goes wrong        */
+    memset( tmr, 0, sizeof(tmr_t) );
+    free( tmr );
 
-    ctx->state->ssl_rw_st = 0;
+    return 0;
+}
 
-    do
+static int __del_conn_tmr( ctx_t      *ctx,
+                           tmr_id_t    tmr_id )
+{
+    tmr_t                  *tmr;
+
+    tmr = __find_tmr( tmr_id );
+
+    if( !tmr )
     {
-        errno = 0;
-        r = SSL_write( ctx->ssl,
-                       B_REMAINDER_PTR( wbuf->b ),
-                       B_REMAINDER_SIZE( wbuf->b ) );
+        LOGE( "id:0x%llx host:%s:%s stale tmr:0x%llx",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              NET_ID_FMT( tmr_id ) );
 
-        syserr = errno;
-        e = SSL_get_error( ctx->ssl, r );
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
     }
-    while( r < 0 && e == SSL_ERROR_SYSCALL && syserr == EINTR );
 
-    ssl_e = ERR_get_error();
-    ssl_strerror = ssl_e ? ERR_error_string(ssl_e, NULL) : "-";
+    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         NET_ID_FMT( tmr_id ) );
 
-    if( r > 0 )
-    {
-        B_INCREASE_USED( wbuf->b, r );
+    return __del_timer( tmr,
+                        &ctx->tmr_list );
+}
 
-        LOGD( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-              B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
-              PTRID_FMT( wbuf->id ) );
+/******************* Destroy ctx functions ************************************/
+
+static void __cleanup_timers( ctx_t *ctx )
+{
+    tmr_t                  *tmr, *tmr_next;
+    int                     r;
+
+    if( !ctx->tmr_list.total )
+    {
+        c_assert( !ctx->tmr_list.head &&
+                  !ctx->tmr_list.tail );
 
-        __handle_write_buf( ctx );
         return;
     }
 
-    LOGD( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx "
-          "ret:%d ssl_err:%d ssl_strerror:%s errno:%d strerror:%s",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-          B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
-          PTRID_FMT( wbuf->id ), r, e, ssl_strerror,
-          syserr, strerror( syserr ) );
+    LL_CHECK( &ctx->tmr_list, ctx->tmr_list.head );
+    tmr = PTRID_GET_PTR( ctx->tmr_list.head );
 
-    switch( e )
+    while( tmr )
     {
-        case SSL_ERROR_WANT_READ:
+        LOGD( "id:0x%llx host:%s:%s tmr:0x%llx",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              NET_ID_FMT( tmr->tmr_id ) );
 
-            ctx->state->ssl_rw_st = SSL_W_WANT_R;
-            return;
+        tmr_next = PTRID_GET_PTR( tmr->next );
 
-        case SSL_ERROR_WANT_WRITE:
+        r = __del_conn_tmr( ctx, tmr->tmr_id );
+        c_assert( !r );
 
-            return;
+        tmr = tmr_next;
+    }
 
-        case SSL_ERROR_SYSCALL:
+    c_assert( !ctx->tmr_list.total &&
+              !ctx->tmr_list.head &&
+              !ctx->tmr_list.tail );
+}
 
-            if( syserr == EAGAIN )
-                return;
+/* NOTE: can not call r_uh_cb because of *
+ * destructor clo_uh_cb before           */
+static void __cleanup_wbuf_list( ctx_t *ctx, ll_t *list )
+{
+    wbuf_t             *wbuf;
+    wbuf_t             *wbuf_next;
 
-        /* fall through */
+    if( !list->total )
+    {
+        c_assert( !list->head &&
+                  !list->tail );
 
-        default:
+        return;
+    }
 
-            LOGE( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx"
-                  "ret:%d ssl_err:%d ssl_strerror:%s errno:%d strerror:%s",
-                  PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-                  B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
-                  PTRID_FMT( wbuf->id ), r, e, ssl_strerror,
-                  syserr, strerror( syserr ) );
+    LL_CHECK( list, list->head );
+    wbuf = PTRID_GET_PTR( list->head );
 
-            __shutdown_ctx( ctx, NET_CODE_ERR_WRITE );
+    while( wbuf )
+    {
+        LOGD( "id:0x%llx host:%s:%s msg_id:%llx prio:%d",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              PTRID_FMT( wbuf->id ), wbuf->prio );
+
+        wbuf_next = PTRID_GET_PTR( wbuf->next );
+
+        LL_DEL_NODE( list, wbuf->id );
+
+        B_FREE( wbuf->b );
+
+        memset( wbuf, 0, sizeof(wbuf_t) );
+        free( wbuf );
+
+        wbuf = wbuf_next;
     }
+
+    c_assert( !list->total &&
+              !list->head &&
+              !list->tail );
 }
 
-static void __ssl_gen_rw_call( ctx_t      *ctx,
-                               void     ( *primary_call )( ctx_t *ctx ),
-                               void     ( *secondary_call )( ctx_t *ctx ),
-                               int         primary_rw_state,
-                               int         secondary_rw_state )
+static void __cleanup_buffers( ctx_t *ctx )
 {
-    c_assert( !ctx->state->ssl_rw_st ||
-              ctx->state->ssl_rw_st == SSL_R_WANT_W ||
-              ctx->state->ssl_rw_st == SSL_W_WANT_R );
+    int                 prio;
 
-    LOGD( "id:0x%llx host:%s:%s rw_state:%d",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-          ctx->state->ssl_rw_st );
+    if( ctx->rb.buf )
+    {
+        B_GENERAL_CHECK( ctx->rb );
 
-    if( ctx->state->ssl_rw_st == secondary_rw_state )
-        return;
-    else
-    if( ctx->state->ssl_rw_st == primary_rw_state )
-        secondary_call( ctx );
+        if( B_HAS_USED( ctx->rb ) )
+        {
+            LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu", 
+                 NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                 B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+        }
 
-    if( !ctx->id ||
-        ctx->state->ssl_rw_st == primary_rw_state ||
-        ctx->to_shutdown )
-    {
-        return;
+        B_FREE( ctx->rb );
     }
 
-    c_assert( ctx->state->st == S_SSL_ESTABLISHED );
+    __cleanup_wbuf_list( ctx, &ctx->wb_list );
 
-    primary_call( ctx );
+    for( prio = 0; prio < NET_PRIO_MAX; prio++ )
+        __cleanup_wbuf_list( ctx, &ctx->wb_lanes[prio] );
 }
 
-/******************* Changing state est/act functions *************************/
-
-static void __call_est_handler( ctx_t *ctx )
+static void __free_udp_rx( udp_rx_t *rx )
 {
-    conn_id_t           prev_id = ctx->id;
-
-    /* NOTE: user handler est_uh_cb may enable write by adding *
-     * to write buffer, so disable EPOLLOUT before             */
-    __disable_write( ctx );
+    free( rx->bufs );
+    free( rx->cmsgs );
+    free( rx->msgs );
+    free( rx->iovs );
+    free( rx->addrs );
+    free( rx->dgrams );
+
+    memset( rx, 0, sizeof(udp_rx_t) );
+    free( rx );
+}
 
-    ctx->est_uh_cb( ctx->id, ctx->udata_id );
+static void __cleanup_ctx( ctx_t *ctx )
+{
+    __cleanup_buffers( ctx );
+    __cleanup_timers( ctx );
 
-    c_assert( ctx->id == prev_id );
+    if( ctx->cold->udp_rx )
+    {
+        LOG( "id:0x%llx host:%s:%s dgrams:%llu batches:%llu truncated:%llu",
+             NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+             (unsigned long long) ctx->cold->udp_rx->total_dgrams,
+             (unsigned long long) ctx->cold->udp_rx->total_batches,
+             (unsigned long long) ctx->cold->udp_rx->total_truncated );
 
-    c_assert( ctx->state->st == S_ESTABLISHED ||
-              ctx->state->st == S_SSL_ESTABLISHED );
+        __free_udp_rx( ctx->cold->udp_rx );
+    }
 
-    if( ctx->to_shutdown )
+    if( ctx->cold->xsk )
     {
-        LOG( "id:0x%llx host:%s:%s",
-             PTRID_FMT( ctx->id ),
-             ctx->host, ctx->port );
+        xdp_close( ctx->cold->xsk );
 
-        return;
+        PROPER_CLOSE_FD( ctx->cold->xsk_join_fd );
     }
 
-    /* close uninitialized accepted conn */
-    if( !ctx->r_uh_cb || !ctx->clo_uh_cb || !ctx->udata_id )
+    if( ctx->is_shm && ctx->cold->shm )
+        __shm_free( ctx );
+
+    if( ctx->cold->unix_addr )
     {
-        c_assert( ctx->dirn == D_INCOMING );
+        if( ctx->dirn == D_LISTEN )
+            unlink( ctx->cold->unix_addr->sun_path );
 
-        __shutdown_ctx( ctx, NET_CODE_ERR_EST );
+        free( ctx->cold->unix_addr );
     }
+
+    if( ctx->ssl )
+        SSL_free( ctx->ssl );
+
+    __reset_ctx( ctx );
 }
 
-static void __ssl_established( ctx_t *ctx )
+/* NOTE: the peer is shut down too, data left in pipes is lost */
+static void __detach_tunnel( ctx_t *ctx )
 {
-    int                 r;
-
-    c_assert( (ctx->dirn == D_OUTGOING &&
-               ctx->state->st == S_SSL_CONNECTING) ||
-              (ctx->dirn == D_INCOMING &&
-               ctx->state->st == S_SSL_ACCEPTING) );
+    ctx_t              *peer;
 
-    LOG( "id:0x%llx host:%s:%s",
-         PTRID_FMT( ctx->id ),
-         ctx->host, ctx->port );
+    if( !ctx->cold->tunnel_peer_id )
+        return;
 
-    r = __del_conn_tmr( ctx, ctx->state_tmr_id );
-    c_assert( !r );
+    peer = __get_ctx( ctx->cold->tunnel_peer_id );
+    c_assert( peer->cold->tunnel_peer_id == ctx->id );
 
-    ctx->state_tmr_id = 0;
+    LOG( "id:0x%llx host:%s:%s peer_id:0x%llx pipe_used:%lu "
+         "peer_pipe_used:%lu",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         NET_ID_FMT( peer->id ), ctx->cold->tunnel_pipe_used,
+         peer->cold->tunnel_pipe_used );
 
-    g_skip_cb = true;
+    ctx->cold->tunnel_peer_id = 0;
+    peer->cold->tunnel_peer_id = 0;
 
-    ctx->state = &g_ctx_state[S_SSL_ESTABLISHED];
-    c_assert( ctx->state->st == S_SSL_ESTABLISHED );
+    if( !peer->is_in_destroying )
+        peer->to_shutdown = true;
 
-    __call_est_handler( ctx );
+    PROPER_CLOSE_FD( ctx->cold->tunnel_pipe[0] );
+    PROPER_CLOSE_FD( ctx->cold->tunnel_pipe[1] );
+    PROPER_CLOSE_FD( peer->cold->tunnel_pipe[0] );
+    PROPER_CLOSE_FD( peer->cold->tunnel_pipe[1] );
 }
 
-static void __established( ctx_t *ctx )
+/* NOTE: the peer reads what is left in its rb and then EOF */
+static void __detach_pipe( ctx_t *ctx )
 {
-    int                 r;
+    ctx_t              *peer;
 
-    c_assert( ctx->dirn != D_LISTEN );
+    if( !ctx->cold->pipe_peer_id )
+        return;
 
-    if( ctx->dirn == D_OUTGOING )
-    {
-        r = __del_conn_tmr( ctx, ctx->state_tmr_id );
-        c_assert( !r );
+    peer = __get_ctx( ctx->cold->pipe_peer_id );
+    c_assert( peer->cold->pipe_peer_id == ctx->id );
 
-        ctx->state_tmr_id = 0;
-    }
-    else
+    LOG( "id:0x%llx host:%s:%s peer_id:0x%llx peer_rb.used:%lu",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         NET_ID_FMT( peer->id ), B_USED_SIZE( peer->rb ) );
+
+    ctx->cold->pipe_peer_id = 0;
+    peer->cold->pipe_peer_id = 0;
+
+    /* NOTE: data in flight comes first */
+    if( g_sim.is_on )
     {
-        c_assert( !ctx->state_tmr_id );
+        __sim_send( ctx, peer->id, NULL, 0, true );
+        return;
     }
 
-    if( ctx->ssl && ctx->dirn == D_OUTGOING )
-    {
-        LOG( "id:0x%llx host:%s:%s",
-             PTRID_FMT( ctx->id ),
-             ctx->host, ctx->port );
+    peer->cold->is_pipe_rd_eof = true;
+    peer->cold->is_pipe_rd_pending = true;
 
-        __ssl_start_connect( ctx );
-    }
-    else
-    if( ctx->ssl && ctx->dirn == D_INCOMING )
-    {
-        LOG( "id:0x%llx host:%s:%s",
-             PTRID_FMT( ctx->id ),
-             ctx->host, ctx->port );
+    g_sched_pending++;
+}
 
-        __ssl_start_accept( ctx );
-    }
-    else
-    if( !ctx->ssl )
-    {
-        LOG( "id:0x%llx host:%s:%s",
-             PTRID_FMT( ctx->id ),
-             ctx->host, ctx->port );
+static void __log_lane_stats( ctx_t *ctx )
+{
+    net_lane_stats_t   *stats;
+    int                 prio;
 
-        ctx->state = &g_ctx_state[S_ESTABLISHED];
-        c_assert( ctx->state->st == S_ESTABLISHED );
+    for( prio = 0; prio < NET_PRIO_MAX; prio++ )
+    {
+        stats = &ctx->cold->wb_lane_stats[prio];
 
-        g_skip_cb = true;
+        if( !stats->msgs )
+            continue;
 
-        __call_est_handler( ctx );
+        LOG( "id:0x%llx host:%s:%s prio:%d msgs:%llu "
+             "delay_avg_us:%llu delay_max_us:%llu",
+             NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, prio,
+             (unsigned long long) stats->msgs,
+             (unsigned long long) (stats->delay_sum_us / stats->msgs),
+             (unsigned long long) stats->delay_max_us );
     }
 }
 
-static void __call_dup_udata( ctx_t    *ctx,
-                              ctx_t    *listen_ctx )
+static void __log_rx_latency( ctx_t *ctx )
 {
-    conn_id_t           listen_prev_id = listen_ctx->id;
-    conn_id_t           prev_id = ctx->id;
+    net_rx_latency_stats_t     *stats = &ctx->cold->rx_latency;
+    char                        buf[NET_RX_LATENCY_BUCKETS * 24];
+    int                         len = 0;
+    int                         i;
 
-    c_assert( !ctx->udata_id && listen_ctx->udata_id );
+    if( !stats->reads )
+        return;
 
-    ctx->is_in_dup_udata = true;
-    listen_ctx->is_in_dup_udata = true;
+    buf[0] = '\0';
 
-    ctx->udata_id = listen_ctx->dup_udata_cb( ctx->id,
-                                              listen_ctx->udata_id );
+    for( i = 0; i < NET_RX_LATENCY_BUCKETS; i++ )
+    {
+        if( !stats->buckets[i] )
+            continue;
 
-    c_assert( listen_ctx->id == listen_prev_id &&
-              listen_ctx->state->st == S_LISTENING &&
-              ctx->id == prev_id && !ctx->state &&
-              ctx->udata_id != listen_ctx->udata_id );
+        len += snprintf( buf + len, sizeof(buf) - len, " %lluus:%llu",
+                         1ULL << i, (unsigned long long) stats->buckets[i] );
+    }
 
-    ctx->is_in_dup_udata = false;
-    listen_ctx->is_in_dup_udata = false;
+    LOG( "id:0x%llx host:%s:%s reads:%llu avg_us:%llu max_us:%llu "
+         "buckets:%s",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         (unsigned long long) stats->reads,
+         (unsigned long long) (stats->sum_us / stats->reads),
+         (unsigned long long) stats->max_us, buf );
 }
 
-static void __create_accepted( ctx_t               *listen_ctx,
-                               int                  fd,
-                               struct sockaddr_in  *peer )
+static void __log_tcp_stats( ctx_t *ctx )
 {
-    ctx_t                  *ctx;
-    SSL                    *ssl;
-
-    if( fd > NET_MAX_FD )
-    {
-        LOGE( "listen_id:0x%llx listen_port:%d new_fd:%x",
-              PTRID_FMT( listen_ctx->id ),
-              listen_ctx->listen_port, fd );
+    net_conn_stats_t       *stats = &ctx->cold->tcp_stats;
 
-        PROPER_CLOSE_FD( fd );
+    if( !timerisset( &stats->sampled ) )
         return;
-    }
 
-    /* NOTE: O_NONBLOCK should be set explicitly */
-    if( __set_socket_params( fd, true ) )
-    {
-        LOGE( "listen_id:0x%llx listen_port:%d new_fd:%x",
-              PTRID_FMT( listen_ctx->id ),
-              listen_ctx->listen_port, fd );
+    LOG( "id:0x%llx host:%s:%s rtt_us:%u rttvar_us:%u cwnd:%u "
+         "lost:%u total_retrans:%u",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         stats->rtt_us, stats->rttvar_us, stats->snd_cwnd,
+         stats->lost, stats->total_retrans );
+}
 
-        PROPER_CLOSE_FD( fd );
-        return;
-    }
+static void __destroy_ctx( ctx_t *ctx, int code )
+{
+    conn_id_t           prev_id = ctx->id;
+    int                 how_shutdown;
 
-    ctx = __init_new_ctx( fd );
-    c_assert( ctx );
+    c_assert( ctx->id && !ctx->is_in_destroying );
+    c_assert( !ctx->is_clo_uh_done || ctx->ssl );
 
-    if( listen_ctx->child_use_ssl )
-    {
-        ssl = SSL_new( g_ssl_server_ctx );
-        c_assert( ssl );
+    ctx->is_in_destroying = true;
 
-        SSL_set_fd( ssl, ctx->fd );
-        SSL_set_accept_state( ssl ); /* means doing as server */
+    LOG( "id:0x%llx fd:%x host:%s:%s state:%d code:%d",
+         NET_ID_FMT( ctx->id ), ctx->fd, ctx->cold->host, ctx->cold->port,
+         ctx->state->st, code );
 
-        ctx->ssl = ssl;
-    }
+    __log_lane_stats( ctx );
 
-    if( peer )
+    __log_rx_latency( ctx );
+
+    __log_tcp_stats( ctx );
+
+    if( !ctx->is_clo_uh_done && ctx->clo_uh_cb )
     {
-        inet_ntop( AF_INET, &peer->sin_addr,
-                   ctx->host, sizeof(ctx->host) );
+        ctx->clo_uh_cb( ctx->id, ctx->udata_id, code );
 
-        snprintf( ctx->port, sizeof(ctx->port), "%d",
-                  ntohs(peer->sin_port) );
+        c_assert( ctx->id == prev_id );
     }
     else
+    if( !ctx->clo_uh_cb )
     {
-        ctx->host[0] = '\0';
-        ctx->port[0] = '\0';
+        /* NOTE: only accepted and uninitialized *
+         * conn don't have clo_uh_cb             */
+        c_assert( ctx->dirn == D_INCOMING );
     }
 
-    B_ALLOC( ctx->rb, READ_BUFFER_SIZE );
+    __detach_tunnel( ctx );
 
-    ctx->r_uh_cb = listen_ctx->child_r_uh_cb;
-    ctx->est_uh_cb = listen_ctx->child_est_uh_cb;
-    ctx->clo_uh_cb = listen_ctx->child_clo_uh_cb;
+    __detach_pipe( ctx );
 
-    ctx->dirn = D_INCOMING;
+    __del_from_epoll( ctx );
 
-    __call_dup_udata( ctx, listen_ctx );
+    __check_tfo( ctx );
 
-    LOG( "listen_id:0x%llx new_id:0x%llx new_fd:%x "
-         "host:%s:%s use_ssl:%d",
-         PTRID_FMT( listen_ctx->id ), PTRID_FMT( ctx->id ),
-         ctx->fd, ctx->host, ctx->port, !!ctx->ssl );
+    if( ctx->is_shut_wr_done )
+    {
+#ifdef  DEBUG
+        int siocoutq = 0;
+        ioctl( ctx->fd, SIOCOUTQ, &siocoutq );
 
-    /* NOTE: EPOLLOUT was enabled during EPOLL_CTL_ADD */
-    __add_to_epoll( ctx );
+        if( siocoutq )
+        {
+            LOGE( "SIOCOUTQ:%d", siocoutq );
+        }
+#endif
 
-    __established( ctx );
-}
+        how_shutdown = SHUT_RD;
+    }
+    else
+        how_shutdown = SHUT_RDWR;
 
-/******************* SSL changing state functions *****************************/
+    /* NOTE: finished tunnel is closed in both directions,  *
+     *       UDP socket and pipe have nothing to shut down, *
+     *       handed over socket is used by the new process  */
+    if( !(ctx->is_shut_wr_done && ctx->cold->is_tunnel_rd_eof) &&
+        ctx->dirn != D_UDP && !ctx->is_pipe && !ctx->is_handed_over &&
+        shutdown( ctx->fd, how_shutdown ) == -1 )
+    {
+        LOGE( "id:0x%llx fd:%x host:%s:%s state:%d errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->fd, ctx->cold->host, ctx->cold->port,
+              ctx->state->st, errno, strerror( errno ) );
+    }
 
-/* NOTE: it deletes all timers and makes one timer */
+    /* NOTE: close() can not be before clo_uh_cb because clo_uh_cb  *
+     * can make a new connection which has the same 'fd' number,    *
+     * so 'ctx' will be rewritten before it's completely cleaned up */
+    PROPER_CLOSE_FD( ctx->fd );
 
-static void __ssl_start_shutdown( ctx_t *ctx, int code )
+    __cleanup_ctx( ctx );
+
+    g_ctx_total--;
+    c_assert( g_ctx_total >= 0 );
+}
+
+static void __shutdown_ctx( ctx_t *ctx, int code )
 {
-    conn_id_t           prev_id = ctx->id;
+    if( ctx->state->st == S_SSL_ESTABLISHED )
+        __ssl_start_shutdown( ctx, code );
+    else
+        __destroy_ctx( ctx, code );
+}
 
-    c_assert( ctx->ssl && ctx->state->st == S_SSL_ESTABLISHED &&
-              !ctx->is_clo_uh_done && ctx->dirn != D_LISTEN &&
-              !ctx->to_shutdown );
+/******************* Timeout functions ****************************************/
 
-    /* NOTE: in case of flush_and_close, state_tmr_id will be rewritten */
-    c_assert( !ctx->state_tmr_id || ctx->flush_and_close );
+static void __ssl_shutdown_timeout_cb( conn_id_t    conn_id,
+                                       ptr_id_t     conn_udata_id,
+                                       tmr_id_t     tmr_id,
+                                       ptr_id_t     tmr_udata_id )
+{
+    ctx_t      *ctx;
 
-    g_skip_cb = true;
+    ctx = __get_ctx( conn_id );
 
-    ctx->state = &g_ctx_state[S_SSL_SHUTDOWN];
-    c_assert( ctx->state->st == S_SSL_SHUTDOWN );
+    c_assert( ctx->dirn != D_LISTEN &&
+              ctx->state->st == S_SSL_SHUTDOWN &&
+              ctx->ssl && tmr_id == ctx->state_tmr_id );
 
-    /* NOTE: only __ssl_shutdown_timeout_cb is needed during shutdown  */
-    /* NOTE: also, to prevent to invoke __establish_timeout_cb several *
-     * times during shutdown                                           */
-    __cleanup_timers( ctx );
+    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
+         NET_ID_FMT( ctx->id ), ctx->cold->host,
+         ctx->cold->port, NET_ID_FMT( tmr_id ) );
 
-    ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
-                                         __ssl_shutdown_timeout_cb,
-                                         cfg_net_ssl_shutdown_timeout );
+    ctx->to_shutdown = true;
+}
 
-    c_assert( ctx->state_tmr_id );
+static void __establish_timeout_cb( conn_id_t   conn_id,
+                                    ptr_id_t    conn_udata_id,
+                                    tmr_id_t    tmr_id,
+                                    ptr_id_t    tmr_udata_id )
+{
+    ctx_t      *ctx;
 
-    __enable_write( ctx );
+    ctx = __get_ctx( conn_id );
 
-    LOG( "id:0x%llx host:%s:%s code:%d",
-         PTRID_FMT( ctx->id ), ctx->host, ctx->port, code );
+    c_assert( ctx->dirn != D_LISTEN &&
+              tmr_id == ctx->state_tmr_id );
 
-    if( ctx->clo_uh_cb )
-    {
-        /* NOTE: clo_uh_cb should not call  *
-         * close conn and another functions */
-        ctx->clo_uh_cb( ctx->id, ctx->udata_id, code );
+    c_assert( ctx->state->st == S_CONNECTING ||
+              ctx->state->st == S_SSL_CONNECTING ||
+              ctx->state->st == S_SSL_ACCEPTING ||
+              ctx->state->st == S_SHM_ACCEPTING );
 
-        /* NOTE: it's impossible to set to_shutdown *
-         * with S_SSL_SHUTDOWN                      */
-        c_assert( ctx->id == prev_id && !ctx->to_shutdown );
+    LOG( "id:0x%llx host:%s:%s state:%d tmr:0x%llx",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         ctx->state->st, NET_ID_FMT( tmr_id ) );
 
-        ctx->is_clo_uh_done = true;
-    }
-    else
-    {
-        /* NOTE: only accepted and uninitialized *
-         * conn don't have clo_uh_cb             */
-        c_assert( ctx->dirn == D_INCOMING );
-    }
+    ctx->to_shutdown = true;
 }
 
-/* NOTE: don't need to enable write because it was enabled */
-static void __ssl_start_accept( ctx_t *ctx )
+/* NOTE: Warning - O(n), once per net_tcp_info_interval */
+static void __tcp_info_tmr_cb( conn_id_t    conn_id,
+                               ptr_id_t     conn_udata_id,
+                               tmr_id_t     tmr_id,
+                               ptr_id_t     tmr_udata_id )
 {
-    c_assert( ctx->ssl && ctx->dirn == D_INCOMING &&
-              !ctx->state && !ctx->state_tmr_id );
-
-    ctx->state = &g_ctx_state[S_SSL_ACCEPTING];
-    c_assert( ctx->state->st == S_SSL_ACCEPTING );
+    ctx_t      *ctx;
+    int         fd;
 
-    ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
-                                         __establish_timeout_cb,
-                                         cfg_net_ssl_accept_timeout );
+    c_assert( !conn_id && tmr_id == g_tcp_info_tmr_id );
 
-    c_assert( ctx->state_tmr_id );
+    for( fd = 0; fd <= NET_MAX_FD; fd++ )
+    {
+        ctx = &g_ctx_array[fd];
 
-    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
-         PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-         PTRID_FMT( ctx->state_tmr_id ) );
+        if( ctx->id && !ctx->to_shutdown && __is_tcp_conn( ctx ) )
+            __sample_tcp_info( ctx );
+    }
 }
 
-/* NOTE: don't need to enable write because it was enabled */
-static void __ssl_start_connect( ctx_t *ctx )
+static void __flush_and_close_timeout_cb( conn_id_t     conn_id,
+                                          ptr_id_t      conn_udata_id,
+                                          tmr_id_t      tmr_id,
+                                          ptr_id_t      tmr_udata_id )
 {
-    c_assert( ctx->ssl && ctx->dirn == D_OUTGOING && !ctx->state_tmr_id );
+    ctx_t      *ctx;
 
-    g_skip_cb = true;
+    ctx = __get_ctx( conn_id );
 
-    ctx->state = &g_ctx_state[S_SSL_CONNECTING];
-    c_assert( ctx->state->st = S_SSL_CONNECTING );
+    c_assert( ctx->dirn != D_LISTEN &&
+              tmr_id == ctx->state_tmr_id );
 
-    ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
-                                         __establish_timeout_cb,
-                                         cfg_net_ssl_establish_timeout );
+    c_assert( ctx->state->st == S_ESTABLISHED ||
+              ctx->state->st == S_SSL_ESTABLISHED ||
+              ctx->state->st == S_SSL_SHUTDOWN );
 
-    c_assert( ctx->state_tmr_id );
+    LOG( "id:0x%llx host:%s:%s state:%d tmr:0x%llx",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         ctx->state->st, NET_ID_FMT( tmr_id ) );
 
-    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
-         PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-         PTRID_FMT( ctx->state_tmr_id ) );
+    ctx->to_shutdown = true;
 }
 
-/******************* non-SSL changing state functions *************************/
+/******************* Buffer RW functions **************************************/
 
-static void __start_listen( ctx_t *ctx )
+static void __add_rx_latency( ctx_t                    *ctx,
+                              struct timespec          *now )
 {
-    c_assert( !ctx->ssl && ctx->dirn == D_LISTEN &&
-              !ctx->state && !ctx->state_tmr_id );
+    net_rx_latency_stats_t     *stats = &ctx->cold->rx_latency;
+    int64_t                     us;
+    int                         i = 0;
 
-    ctx->state = &g_ctx_state[S_LISTENING];
-    c_assert( ctx->state->st == S_LISTENING );
+    us = ( now->tv_sec - ctx->cold->rx_ts.sw.tv_sec ) * 1000000LL +
+         ( now->tv_nsec - ctx->cold->rx_ts.sw.tv_nsec ) / 1000;
 
-    /* NOTE: EPOLLOUT was enabled during EPOLL_CTL_ADD */
-    __add_to_epoll( ctx );
+    /* NOTE: clock can step back */
+    if( us < 0 )
+        us = 0;
 
-    /* NOTE: EPOLL_CTL_ADD adds EPOLLOUT, so disable it by        *
-     * excessive call. If EPOLLOUT is not added by EPOLL_CTL_ADD  *
-     * then regular connection should make excessive call.        *
-     * So it would be better to make excessive call at listening. */
-    __disable_write( ctx );
+    if( us > 0 )
+        i = 63 - __builtin_clzll( us );
 
-    LOG( "id:0x%llx listen_port:%d",
-         PTRID_FMT( ctx->id ), ctx->listen_port );
+    if( i >= NET_RX_LATENCY_BUCKETS )
+        i = NET_RX_LATENCY_BUCKETS - 1;
+
+    stats->reads++;
+    stats->sum_us += us;
+    stats->buckets[i]++;
+
+    if( (uint64_t) us > stats->max_us )
+        stats->max_us = us;
 }
 
-static void __start_connect( ctx_t *ctx )
+/* NOTE: TCP reports the timestamp of the last skb which is read, *
+ *       so it's the newest bytes in the buffer                   */
+static int __recv( ctx_t   *ctx,
+                   int      flags )
 {
-    c_assert( ctx->dirn == D_OUTGOING &&
-              !ctx->state && !ctx->state_tmr_id );
-
-    ctx->state = &g_ctx_state[S_CONNECTING];
-    c_assert( ctx->state->st == S_CONNECTING );
+    struct msghdr               msg;
+    struct iovec                iov;
+    struct cmsghdr             *cmsg;
+    struct scm_timestamping    *tss;
+    struct timespec             now;
+    char                        cbuf[CMSG_SPACE(sizeof(*tss))];
+    int                         r;
+
+    if( !ctx->sock_profile || ctx->sock_profile->rx_timestamping <= 0 )
+    {
+        return recv( ctx->fd,
+                     B_REMAINDER_PTR( ctx->rb ),
+                     B_REMAINDER_SIZE( ctx->rb ),
+                     flags );
+    }
 
-    ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
-                                         __establish_timeout_cb,
-                                         cfg_net_establish_timeout );
+    iov.iov_base = B_REMAINDER_PTR( ctx->rb );
+    iov.iov_len = B_REMAINDER_SIZE( ctx->rb );
 
-    c_assert( ctx->state_tmr_id );
+    memset( &msg, 0, sizeof(msg) );
 
-    /* NOTE: EPOLLOUT was enabled during EPOLL_CTL_ADD */
-    __add_to_epoll( ctx );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
 
-    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
-         PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-         PTRID_FMT( ctx->state_tmr_id ) );
-}
+    r = recvmsg( ctx->fd, &msg, flags );
 
-/******************* SSL event callbacks **************************************/
+    if( r <= 0 )
+        return r;
 
-static void __ssl_write_cb( ctx_t *ctx )
-{
-    __ssl_gen_rw_call( ctx,
-                       __call_ssl_write,
-                       __call_ssl_read,
-                       SSL_R_WANT_W,
-                       SSL_W_WANT_R );
-}
+    for( cmsg = CMSG_FIRSTHDR( &msg ); cmsg;
+         cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+    {
+        if( cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_TIMESTAMPING )
+        {
+            continue;
+        }
 
-static void __ssl_read_cb( ctx_t *ctx )
-{
-    __ssl_gen_rw_call( ctx,
-                       __call_ssl_read,
-                       __call_ssl_write,
-                       SSL_W_WANT_R,
-                       SSL_R_WANT_W );
-}
+        tss = (struct scm_timestamping *) CMSG_DATA( cmsg );
 
-static void __ssl_shutdown_cb( ctx_t *ctx )
-{
-    int                 r, e, syserr;
-    unsigned long       ssl_e;
-    char               *ssl_strerror;
+        /* NOTE: ts[1] is deprecated, ts[2] is raw hardware */
+        ctx->cold->rx_ts.sw = tss->ts[0];
+        ctx->cold->rx_ts.hw = tss->ts[2];
 
-    do
-    {
-        errno = 0;
-        r = SSL_shutdown( ctx->ssl );
+        if( ctx->cold->rx_ts.sw.tv_sec )
+        {
+            clock_gettime( CLOCK_REALTIME, &now );
 
-        syserr = errno;
-        e = SSL_get_error( ctx->ssl, r );
+            __add_rx_latency( ctx, &now );
+        }
     }
-    while( r < 0 && e == SSL_ERROR_SYSCALL && syserr == EINTR );
 
-    ssl_e = ERR_get_error();
-    ssl_strerror = ssl_e ? ERR_error_string(ssl_e, NULL) : "-";
+    return r;
+}
 
-    if( r == 1 )
-    {
-        LOG( "id:0x%llx host:%s:%s",
-             PTRID_FMT( ctx->id ), ctx->host, ctx->port );
+static int __call_read_handler( ctx_t      *ctx,
+                                bool        is_closed )
+{
+    conn_id_t       prev_id = ctx->id;
+    char           *host = ctx->cold->host;
+    char           *port = ctx->cold->port;
+    int             r;
 
-        __shutdown_ctx( ctx, NET_CODE_SUCCESS );
-        return;
-    }
+    LOGD( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
 
-    LOGD( "id:0x%llx host:%s:%s ssl_err:%d "
-          "ssl_strerror:%s errno:%d strerror:%s",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-          e, ssl_strerror, syserr, strerror( syserr ) );
+    if( g_capture.is_on )
+        __capture_rx( ctx, is_closed );
 
-    switch( e )
+    /* NOTE: data waits for the batch, EOF goes to r_uh_cb */
+    if( ctx->batch_r_uh_cb && !is_closed )
     {
-        case SSL_ERROR_WANT_READ:
-        case SSL_ERROR_WANT_WRITE:
+        __add_to_read_batch( ctx );
+        return 0;
+    }
 
-            g_skip_cb = true;
-            return;
+    __watchdog_mark( ctx->id, ctx->r_uh_cb );
 
-        case SSL_ERROR_SYSCALL:
+    r = ctx->r_uh_cb( ctx->id, ctx->udata_id,
+                      B_USED_PTR( ctx->rb ),
+                      B_USED_SIZE( ctx->rb ), is_closed );
 
-            if( syserr == EAGAIN )
-            {
-                g_skip_cb = true;
-                return;
-            }
+    c_assert( ctx->id == prev_id );
 
-            /* fall through */
+    c_assert( (!ctx->ssl && ctx->state->st == S_ESTABLISHED) ||
+              (ctx->ssl && ctx->state->st == S_SSL_ESTABLISHED) );
 
-        default:
+    if( ctx->to_shutdown )
+    {
+        if( is_closed )
+        {
+            LOGE( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
+                  NET_ID_FMT( ctx->id ), host, port,
+                  B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+        }
+        else
+        {
+            LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
+                 NET_ID_FMT( ctx->id ), host, port,
+                 B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+        }
 
-            LOGE( "id:0x%llx host:%s:%s ssl_err:%d "
-                  "ssl_strerror:%s errno:%d strerror:%s",
-                  PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-                  e, ssl_strerror, syserr, strerror( syserr ) );
+        return -1;
+    }
 
-            __shutdown_ctx( ctx, NET_CODE_ERR_SHUT );
+    if( r > 0 && r <= B_USED_SIZE( ctx->rb ) )
+    {
+        B_CUT_USED( ctx->rb, r );
+
+        if( g_capture.is_on )
+            __capture_cut( ctx, r );
+    }
+    else
+    if( r )
+    {
+        LOGE( "id:0x%llx host:%s:%s "
+              "rb.used:%lu rb.size:%lu ret:%d",
+              NET_ID_FMT( ctx->id ), host, port,
+              B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ), r );
     }
+
+    return 0;
 }
 
-static void __ssl_accept_cb( ctx_t *ctx )
+/* NOTE: it moves the head of the highest non-empty lane  *
+ *       to wb_list, so a partially written wbuf is never *
+ *       preempted, SSL_write also needs the same buffer  */
+static void __next_write_buf( ctx_t *ctx )
 {
-    int                 r, e, syserr;
-    unsigned long       ssl_e;
-    char               *ssl_strerror;
+    wbuf_t             *wbuf;
+    int                 prio;
 
-    do
-    {
-        errno = 0;
-        r = SSL_accept( ctx->ssl );
+    if( ctx->wb_list.total )
+        return;
 
-        syserr = errno;
-        e = SSL_get_error( ctx->ssl, r );
+    for( prio = 0; prio < NET_PRIO_MAX; prio++ )
+    {
+        if( ctx->wb_lanes[prio].total )
+            break;
     }
-    while( r < 0 && e == SSL_ERROR_SYSCALL && syserr == EINTR );
 
-    ssl_e = ERR_get_error();
-    ssl_strerror = ssl_e ? ERR_error_string(ssl_e, NULL) : "-";
+    if( prio == NET_PRIO_MAX )
+        return;
 
-    if( r == 1 )
-    {
-        LOG( "id:0x%llx host:%s:%s",
-             PTRID_FMT( ctx->id ), ctx->host, ctx->port );
+    LL_CHECK( &ctx->wb_lanes[prio], ctx->wb_lanes[prio].head );
+    wbuf = PTRID_GET_PTR( ctx->wb_lanes[prio].head );
 
-        __ssl_established( ctx );
-        return;
-    }
+    /* NOTE: LL_DEL_NODE keeps the link of a head node */
+    LL_DEL_NODE( &ctx->wb_lanes[prio], wbuf->id );
 
-    LOGD( "id:0x%llx host:%s:%s ret:%d ssl_err:%d "
-          "ssl_strerror:%s errno:%d strerror:%s",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-          r, e, ssl_strerror, syserr, strerror( syserr ) );
+    wbuf->prev = 0;
+    wbuf->next = 0;
 
-    switch( e )
-    {
-        case SSL_ERROR_WANT_READ:
-        case SSL_ERROR_WANT_WRITE:
+    LL_ADD_NODE( &ctx->wb_list, wbuf );
+}
 
-            g_skip_cb = true;
-            return;
+/* NOTE: it's called when the first bytes of wbuf are sent */
+static void __sample_lane_delay( ctx_t *ctx, wbuf_t *wbuf )
+{
+    net_lane_stats_t   *stats;
+    struct timespec     now;
+    uint64_t            delay_us;
 
-        case SSL_ERROR_SYSCALL:
+    clock_gettime( CLOCK_MONOTONIC, &now );
 
-            if( syserr == EAGAIN )
-            {
-                g_skip_cb = true;
-                return;
-            }
+    delay_us = (now.tv_sec - wbuf->queued.tv_sec) * 1000000ULL +
+               (now.tv_nsec - wbuf->queued.tv_nsec) / 1000;
 
-            /* fall through */
+    stats = &ctx->cold->wb_lane_stats[wbuf->prio];
 
-        default:
+    stats->msgs++;
+    stats->delay_sum_us += delay_us;
 
-            LOGE( "id:0x%llx host:%s:%s ret:%d ssl_err:%d "
-                  "ssl_strerror:%s errno:%d strerror:%s",
-                  PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-                  r, e, ssl_strerror, syserr, strerror( syserr ) );
+    if( delay_us > stats->delay_max_us )
+        stats->delay_max_us = delay_us;
 
-            /* NOTE: close accepted conn */
-            __shutdown_ctx( ctx, NET_CODE_ERR_ACCEPT );
-    }
+    LOGD( "id:0x%llx host:%s:%s msg_id:%llx prio:%d delay_us:%llu",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          PTRID_FMT( wbuf->id ), wbuf->prio,
+          (unsigned long long) delay_us );
 }
 
-static void __ssl_connect_cb( ctx_t *ctx )
+static void __handle_write_buf( ctx_t *ctx )
 {
-    int                 r, e, syserr;
-    unsigned long       ssl_e;
-    char               *ssl_strerror;
+    wbuf_t         *wbuf;
+    char           *host = ctx->cold->host, *port = ctx->cold->port;
 
-    do
-    {
-        errno = 0;
-        r = SSL_connect( ctx->ssl );
+    LL_CHECK( &ctx->wb_list, ctx->wb_list.head );
+    wbuf = PTRID_GET_PTR( ctx->wb_list.head );
 
-        syserr = errno;
-        e = SSL_get_error( ctx->ssl, r );
-    }
-    while( r < 0 && e == SSL_ERROR_SYSCALL && syserr == EINTR );
+    B_GENERAL_CHECK( wbuf->b );
 
-    ssl_e = ERR_get_error();
-    ssl_strerror = ssl_e ? ERR_error_string(ssl_e, NULL) : "-";
+    wbuf->tries++;
 
-    if( r == 1 )
+    if( wbuf->tries == 1 )
+        __sample_lane_delay( ctx, wbuf );
+
+    if( wbuf->tries > MAX_WRITE_TRIES )
     {
-        LOG( "id:0x%llx host:%s:%s",
-             PTRID_FMT( ctx->id ), ctx->host, ctx->port );
+        LOGE( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx",
+              NET_ID_FMT( ctx->id ), host, port,
+              B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
+              PTRID_FMT( wbuf->id ) );
+    }
+    else
+    {
+        LOGD( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx",
+              NET_ID_FMT( ctx->id ), host, port,
+              B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
+              PTRID_FMT( wbuf->id ) );
+    }
 
-        __ssl_established( ctx );
+    if( B_HAS_REMAINDER( wbuf->b ) )
         return;
-    }
 
-    LOGD( "id:0x%llx host:%s:%s ret:%d ssl_err:%d "
-          "ssl_strerror:%s errno:%d strerror:%s",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-          r, e, ssl_strerror, syserr, strerror( syserr ) );
+    /* NOTE: per-message lines don't touch ctx->cold */
+    LOG( "id:0x%llx msg_id:%llx wb_total:%d",
+         NET_ID_FMT( ctx->id ),
+         PTRID_FMT( wbuf->id ), ctx->wb_list.total );
 
-    switch( e )
-    {
-        case SSL_ERROR_WANT_READ:
-        case SSL_ERROR_WANT_WRITE:
+    LL_DEL_NODE( &ctx->wb_list, wbuf->id );
 
-            g_skip_cb = true;
-            return;
+    c_assert( ctx->wb_bytes >= B_SIZE( wbuf->b ) && ctx->wb_msgs > 0 );
+    ctx->wb_bytes -= B_SIZE( wbuf->b );
+    ctx->wb_msgs--;
 
-        case SSL_ERROR_SYSCALL:
+    B_FREE( wbuf->b );
 
-            if( syserr == EAGAIN )
-            {
-                g_skip_cb = true;
-                return;
-            }
+    memset( wbuf, 0, sizeof(wbuf_t) );
+    free( wbuf );
 
-            /* fall through */
+    __next_write_buf( ctx );
 
-        default:
+    /* NOTE: drain_uh_cb is called from __do_scheduled, *
+     *       so the user can do anything in it          */
+    if( ctx->is_wb_over_high &&
+        ctx->wb_bytes <= ctx->wb_low_bytes &&
+        ctx->wb_msgs <= ctx->wb_low_msgs )
+    {
+        ctx->is_wb_over_high = false;
 
-            LOGE( "id:0x%llx host:%s:%s ret:%d ssl_err:%d "
-                  "ssl_strerror:%s errno:%d strerror:%s",
-                  PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-                  r, e, ssl_strerror, syserr, strerror( syserr ) );
+        if( ctx->drain_uh_cb )
+        {
+            ctx->is_drain_pending = true;
+            g_sched_pending++;
+        }
 
-            __shutdown_ctx( ctx, NET_CODE_ERR_EST );
+        LOG( "id:0x%llx host:%s:%s wb_bytes:%lu wb_msgs:%d",
+             NET_ID_FMT( ctx->id ), host, port,
+             ctx->wb_bytes, ctx->wb_msgs );
     }
-}
-
-/******************* non-SSL event callbacks **********************************/
-
-static void __write_cb( ctx_t *ctx )
-{
-    wbuf_t     *wbuf;
-    int         r, syserr;
 
-    /* NOTE: it may happened because of EPOLLRDHUP */
     if( !ctx->wb_list.total )
     {
         c_assert( !ctx->wb_list.head &&
-                  !ctx->wb_list.tail );
+                  !ctx->wb_list.tail &&
+                  !ctx->wb_bytes && !ctx->wb_msgs );
+
+        __disable_write( ctx );
+
+        if( ctx->flush_and_close )
+            __shutdown_write( ctx );
+    }
+}
+
+/******************* SSL RW calls *********************************************/
+
+static void __call_ssl_read( ctx_t *ctx )
+{
+    int                 r, e, syserr, i = 0, more = 1;
+    char               *host = ctx->cold->host, *port = ctx->cold->port;
+    unsigned long       ssl_e;
+    char               *ssl_strerror;
+
+    B_GENERAL_CHECK( ctx->rb );
+
+    c_assert( B_HAS_REMAINDER( ctx->rb ) );
+
+    c_assert( !ctx->state->ssl_rw_st ||
+              ctx->state->ssl_rw_st == SSL_R_WANT_W );
+
+    ctx->state->ssl_rw_st = 0;
+
+    /* nginx-1.2.2 source says that:
+     * SSL_read() may return data in parts, so try to read
+     * until SSL_read() would return no data
+     */
+
+    while( more && B_HAS_REMAINDER( ctx->rb ) && !ctx->is_read_paused )
+    {
+        do
+        {
+            errno = 0;
+            r = SSL_read( ctx->ssl,
+                          B_REMAINDER_PTR( ctx->rb ),
+                          B_REMAINDER_SIZE( ctx->rb ) );
+
+            syserr = errno;
+            e = SSL_get_error( ctx->ssl, r );
+        }
+        while( r < 0 && e == SSL_ERROR_SYSCALL && syserr == EINTR );
+
+        ssl_e = ERR_get_error();
+        ssl_strerror = ssl_e ? ERR_error_string(ssl_e, NULL) : "-";
+
+        more = SSL_pending( ctx->ssl );
+
+        /* NOTE: consider r == 0 as closed by peer */
+        if( r >= 0 )
+        {
+            if( r > 0 )
+            {
+                B_INCREASE_USED( ctx->rb, r );
+            }
+
+            LOGD( "id:0x%llx host:%s:%s rb.used:%lu "
+                  "rb.size:%lu iter:%d",
+                  NET_ID_FMT( ctx->id ), host, port,
+                  B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ), i );
+
+            if( B_REMAINDER_SIZE( ctx->rb ) < B_MIN_RDBUF_REMAINDER( ctx->rb ) )
+            {
+                B_INCREASE_BUF( ctx->rb, READ_BUFFER_SIZE );
+
+                LOG( "id:0x%llx host:%s:%s rb.used:%lu "
+                     "rb.size:%lu iter:%d",
+                     NET_ID_FMT( ctx->id ), host, port,
+                     B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ), i );
+            }
+
+            if( __call_read_handler( ctx, !r ) )
+            {
+                LOG( "id:0x%llx host:%s:%s iter:%d",
+                     NET_ID_FMT( ctx->id ), host, port, i );
+
+                return;
+            }
+
+            if( !r )
+            {
+                LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu "
+                     "iter:%d ssl_err:%d ssl_strerror:%s errno:%d strerror:%s",
+                     NET_ID_FMT( ctx->id ), host, port,
+                     B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ),
+                     i, e, ssl_strerror, syserr, strerror( syserr ) );
+
+                __shutdown_ctx( ctx, NET_CODE_SUCCESS );
+                return;
+            }
+
+            i++;
+            continue;
+        }
+
+        LOGD( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu iter:%d "
+              "ret:%d ssl_err:%d ssl_strerror:%s errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), host, port,
+              B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ),
+              i, r, e, ssl_strerror, syserr, strerror( syserr ) );
+
+        switch( e )
+        {
+            case SSL_ERROR_WANT_READ:
+
+                return;
+
+            case SSL_ERROR_WANT_WRITE:
+
+                ctx->state->ssl_rw_st = SSL_R_WANT_W;
+
+                if( !(ctx->ev & EPOLLOUT) )
+                {
+                    LOGD( "id:0x%llx", NET_ID_FMT( ctx->id ) );
+
+                    __enable_write( ctx );
+                }
+
+                return;
+
+            case SSL_ERROR_SYSCALL:
+
+                if( syserr == EAGAIN )
+                    return;
+
+                /* fall through */
+
+            default:
+
+                LOGE( "id:0x%llx host:%s:%s "
+                      "rb.used:%lu rb.size:%lu iter:%d ret:%d ssl_err:%d "
+                      "ssl_strerror:%s errno:%d strerror:%s",
+                      NET_ID_FMT( ctx->id ), host, port,
+                      B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ),
+                      i, r, e, ssl_strerror, syserr, strerror( syserr ) );
+
+                __shutdown_ctx( ctx, NET_CODE_ERR_READ );
+                return;
+        }
+    }
+}
+
+static void __call_ssl_write( ctx_t *ctx )
+{
+    wbuf_t             *wbuf;
+    int                 r, e, syserr;
+    unsigned long       ssl_e;
+    char               *ssl_strerror;
+
+    /* NOTE: it may happened because of *
+     * EPOLLRDHUP or after SSL_R_WANT_W */
+    if( !ctx->wb_list.total )
+    {
+        c_assert( !ctx->wb_list.head &&
+                  !ctx->wb_list.tail );
 
         LOGD( "id:0x%llx host:%s:%s",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port );
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
 
         __disable_write( ctx );
         return;
@@ -1670,21 +2257,32 @@ static void __write_cb( ctx_t *ctx )
 
     c_assert( B_HAS_REMAINDER( wbuf->b ) );
 
-    errno = 0;
-    while( (r = send( ctx->fd,
-                      B_REMAINDER_PTR( wbuf->b ),
-                      B_REMAINDER_SIZE( wbuf->b ),
-                      MSG_DONTWAIT )) == -1 && errno == EINTR )
+    c_assert( !ctx->state->ssl_rw_st ||
+              ctx->state->ssl_rw_st == SSL_W_WANT_R );
+
+    ctx->state->ssl_rw_st = 0;
+
+    do
+    {
         errno = 0;
+        r = SSL_write( ctx->ssl,
+                       B_REMAINDER_PTR( wbuf->b ),
+                       B_REMAINDER_SIZE( wbuf->b ) );
 
-    syserr = errno;
+        syserr = errno;
+        e = SSL_get_error( ctx->ssl, r );
+    }
+    while( r < 0 && e == SSL_ERROR_SYSCALL && syserr == EINTR );
+
+    ssl_e = ERR_get_error();
+    ssl_strerror = ssl_e ? ERR_error_string(ssl_e, NULL) : "-";
 
     if( r > 0 )
     {
         B_INCREASE_USED( wbuf->b, r );
 
         LOGD( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port,
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
               B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
               PTRID_FMT( wbuf->id ) );
 
@@ -1692,600 +2290,6953 @@ static void __write_cb( ctx_t *ctx )
         return;
     }
 
-    if( syserr == EAGAIN )
+    LOGD( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx "
+          "ret:%d ssl_err:%d ssl_strerror:%s errno:%d strerror:%s",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
+          PTRID_FMT( wbuf->id ), r, e, ssl_strerror,
+          syserr, strerror( syserr ) );
+
+    switch( e )
     {
-        LOGD( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-              B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
-              PTRID_FMT( wbuf->id ) );
+        case SSL_ERROR_WANT_READ:
 
-        return;
-    }
+            ctx->state->ssl_rw_st = SSL_W_WANT_R;
+            return;
 
-    LOGE( "id:0x%llx host:%s:%s used:%lu size:%lu "
-          "msg_id:%llx errno:%d strerror:%s",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-          B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
-          PTRID_FMT( wbuf->id ), syserr, strerror( syserr ) );
+        case SSL_ERROR_WANT_WRITE:
 
-    __shutdown_ctx( ctx, NET_CODE_ERR_WRITE );
+            return;
+
+        case SSL_ERROR_SYSCALL:
+
+            if( syserr == EAGAIN )
+                return;
+
+        /* fall through */
+
+        default:
+
+            LOGE( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx"
+                  "ret:%d ssl_err:%d ssl_strerror:%s errno:%d strerror:%s",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
+                  PTRID_FMT( wbuf->id ), r, e, ssl_strerror,
+                  syserr, strerror( syserr ) );
+
+            __shutdown_ctx( ctx, NET_CODE_ERR_WRITE );
+    }
 }
 
-static void __read_cb( ctx_t *ctx )
+static void __ssl_gen_rw_call( ctx_t      *ctx,
+                               void     ( *primary_call )( ctx_t *ctx ),
+                               void     ( *secondary_call )( ctx_t *ctx ),
+                               int         primary_rw_state,
+                               int         secondary_rw_state )
 {
-    int                 r, syserr;
-    char               *host = ctx->host;
-    char               *port = ctx->port;
-
-    B_GENERAL_CHECK( ctx->rb );
-    c_assert( B_HAS_REMAINDER( ctx->rb ) );
+    c_assert( !ctx->state->ssl_rw_st ||
+              ctx->state->ssl_rw_st == SSL_R_WANT_W ||
+              ctx->state->ssl_rw_st == SSL_W_WANT_R );
 
-    errno = 0;
-    while( (r = recv( ctx->fd,
-                      B_REMAINDER_PTR( ctx->rb ),
-                      B_REMAINDER_SIZE( ctx->rb ),
-                      MSG_DONTWAIT )) == -1 && errno == EINTR )
-        errno = 0;
+    LOGD( "id:0x%llx host:%s:%s rw_state:%d",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          ctx->state->ssl_rw_st );
 
-    syserr = errno;
+    if( ctx->state->ssl_rw_st == secondary_rw_state )
+        return;
+    else
+    if( ctx->state->ssl_rw_st == primary_rw_state )
+        secondary_call( ctx );
 
-    if( r == -1 )
+    if( !ctx->id ||
+        ctx->state->ssl_rw_st == primary_rw_state ||
+        ctx->to_shutdown )
     {
-        if( syserr == EAGAIN )
-        {
-            LOGD( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu "
-                  "errno:%d strerror:%s",
-                  PTRID_FMT( ctx->id ), host, port,
-                  B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ),
-                  syserr, strerror( syserr ) );
+        return;
+    }
 
-            return;
-        }
+    c_assert( ctx->state->st == S_SSL_ESTABLISHED );
 
-        LOGE( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu "
-              "errno:%d strerror:%s",
-              PTRID_FMT( ctx->id ), host, port,
-              B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ),
-              syserr, strerror( syserr ) );
+    primary_call( ctx );
+}
+
+/******************* Changing state est/act functions *************************/
+
+static void __call_est_handler( ctx_t *ctx )
+{
+    conn_id_t           prev_id = ctx->id;
+
+    /* NOTE: user handler est_uh_cb may enable write by adding *
+     * to write buffer, so disable EPOLLOUT before             */
+    __disable_write( ctx );
+
+    ctx->est_uh_cb( ctx->id, ctx->udata_id );
+
+    c_assert( ctx->id == prev_id );
+
+    c_assert( ctx->state->st == S_ESTABLISHED ||
+              ctx->state->st == S_SSL_ESTABLISHED ||
+              ctx->state->st == S_TUNNEL );
+
+    if( ctx->to_shutdown )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ),
+             ctx->cold->host, ctx->cold->port );
+
+        return;
+    }
+
+    /* close uninitialized accepted conn */
+    if( !ctx->r_uh_cb || !ctx->clo_uh_cb || !ctx->udata_id )
+    {
+        c_assert( ctx->dirn == D_INCOMING );
+
+        __shutdown_ctx( ctx, NET_CODE_ERR_EST );
+    }
+}
+
+static void __ssl_established( ctx_t *ctx )
+{
+    int                 r;
+
+    c_assert( (ctx->dirn == D_OUTGOING &&
+               ctx->state->st == S_SSL_CONNECTING) ||
+              (ctx->dirn == D_INCOMING &&
+               ctx->state->st == S_SSL_ACCEPTING) );
+
+    LOG( "id:0x%llx host:%s:%s",
+         NET_ID_FMT( ctx->id ),
+         ctx->cold->host, ctx->cold->port );
+
+    r = __del_conn_tmr( ctx, ctx->state_tmr_id );
+    c_assert( !r );
+
+    ctx->state_tmr_id = 0;
+
+    g_skip_cb = true;
+
+    ctx->state = &g_ctx_state[S_SSL_ESTABLISHED];
+    c_assert( ctx->state->st == S_SSL_ESTABLISHED );
+
+    __call_est_handler( ctx );
+}
+
+static void __established( ctx_t *ctx )
+{
+    int                 r;
+
+    c_assert( ctx->dirn != D_LISTEN );
+
+    if( ctx->dirn == D_OUTGOING )
+    {
+        r = __del_conn_tmr( ctx, ctx->state_tmr_id );
+        c_assert( !r );
+
+        ctx->state_tmr_id = 0;
+    }
+    else
+    {
+        c_assert( !ctx->state_tmr_id );
+    }
+
+    if( ctx->ssl && ctx->dirn == D_OUTGOING )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ),
+             ctx->cold->host, ctx->cold->port );
+
+        __ssl_start_connect( ctx );
+    }
+    else
+    if( ctx->ssl && ctx->dirn == D_INCOMING )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ),
+             ctx->cold->host, ctx->cold->port );
+
+        __ssl_start_accept( ctx );
+    }
+    else
+    if( ctx->is_shm && !ctx->cold->shm && ctx->dirn == D_INCOMING )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ),
+             ctx->cold->host, ctx->cold->port );
+
+        __shm_start_accept( ctx );
+    }
+    else
+    if( !ctx->ssl )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ),
+             ctx->cold->host, ctx->cold->port );
+
+        /* NOTE: the client passes the rings before established */
+        if( ctx->is_shm && !ctx->cold->shm && __shm_start_connect( ctx ) )
+        {
+            __shutdown_ctx( ctx, NET_CODE_ERR_EST );
+            return;
+        }
+
+        ctx->state = &g_ctx_state[S_ESTABLISHED];
+        c_assert( ctx->state->st == S_ESTABLISHED );
+
+        g_skip_cb = true;
+
+        __call_est_handler( ctx );
+    }
+}
+
+static void __call_dup_udata( ctx_t    *ctx,
+                              ctx_t    *listen_ctx )
+{
+    conn_id_t           listen_prev_id = listen_ctx->id;
+    conn_id_t           prev_id = ctx->id;
+
+    c_assert( !ctx->udata_id && listen_ctx->udata_id );
+
+    ctx->is_in_dup_udata = true;
+    listen_ctx->is_in_dup_udata = true;
+
+    ctx->udata_id = listen_ctx->cold->dup_udata_cb( ctx->id,
+                                              listen_ctx->udata_id );
+
+    c_assert( listen_ctx->id == listen_prev_id &&
+              listen_ctx->state->st == S_LISTENING &&
+              ctx->id == prev_id && !ctx->state &&
+              ctx->udata_id != listen_ctx->udata_id );
+
+    ctx->is_in_dup_udata = false;
+    listen_ctx->is_in_dup_udata = false;
+}
+
+static void __create_accepted( ctx_t               *listen_ctx,
+                               int                  fd,
+                               struct sockaddr_in  *peer )
+{
+    ctx_t                  *ctx;
+    SSL                    *ssl;
+
+    if( fd > NET_MAX_FD )
+    {
+        LOGE( "listen_id:0x%llx listen_port:%d new_fd:%x",
+              NET_ID_FMT( listen_ctx->id ),
+              listen_ctx->cold->listen_port, fd );
+
+        PROPER_CLOSE_FD( fd );
+        return;
+    }
+
+    /* NOTE: O_NONBLOCK should be set explicitly */
+    if( __set_socket_params( fd, true ) )
+    {
+        LOGE( "listen_id:0x%llx listen_port:%d new_fd:%x",
+              NET_ID_FMT( listen_ctx->id ),
+              listen_ctx->cold->listen_port, fd );
+
+        PROPER_CLOSE_FD( fd );
+        return;
+    }
+
+    /* NOTE: some options (TCP_QUICKACK, TCP_USER_TIMEOUT) *
+     *       aren't inherited from listen socket           */
+    if( __apply_sock_profile( fd, listen_ctx->sock_profile, D_INCOMING ) )
+    {
+        LOGE( "listen_id:0x%llx listen_port:%d new_fd:%x",
+              NET_ID_FMT( listen_ctx->id ),
+              listen_ctx->cold->listen_port, fd );
+
+        PROPER_CLOSE_FD( fd );
+        return;
+    }
+
+    ctx = __init_new_ctx( fd );
+    c_assert( ctx );
+
+    ctx->sock_profile = listen_ctx->sock_profile;
+
+    if( ctx->sock_profile && ctx->sock_profile->fastopen_qlen > 0 )
+        ctx->is_tfo_pending = true;
+
+    if( listen_ctx->cold->child_use_ssl )
+    {
+        ssl = SSL_new( g_ssl_server_ctx );
+        c_assert( ssl );
+
+        SSL_set_fd( ssl, ctx->fd );
+        SSL_set_accept_state( ssl ); /* means doing as server */
+
+        ctx->ssl = ssl;
+    }
+
+    if( listen_ctx->cold->unix_addr )
+    {
+        snprintf( ctx->cold->host, sizeof(ctx->cold->host), "%s",
+                  listen_ctx->cold->unix_addr->sun_path );
+
+        snprintf( ctx->cold->port, sizeof(ctx->cold->port), "%s",
+                  listen_ctx->cold->port );
+
+        ctx->is_seqpacket = listen_ctx->is_seqpacket;
+        ctx->is_shm = listen_ctx->is_shm;
+    }
+    else
+    if( peer )
+    {
+        inet_ntop( AF_INET, &peer->sin_addr,
+                   ctx->cold->host, sizeof(ctx->cold->host) );
+
+        snprintf( ctx->cold->port, sizeof(ctx->cold->port), "%d",
+                  ntohs(peer->sin_port) );
+    }
+    else
+    {
+        ctx->cold->host[0] = '\0';
+        ctx->cold->port[0] = '\0';
+    }
+
+    B_ALLOC( ctx->rb, READ_BUFFER_SIZE );
+
+    ctx->r_uh_cb = listen_ctx->cold->child_r_uh_cb;
+    ctx->est_uh_cb = listen_ctx->cold->child_est_uh_cb;
+    ctx->clo_uh_cb = listen_ctx->cold->child_clo_uh_cb;
+
+    ctx->dirn = D_INCOMING;
+
+    __check_tfo( ctx );
+
+    __call_dup_udata( ctx, listen_ctx );
+
+    LOG( "listen_id:0x%llx new_id:0x%llx new_fd:%x "
+         "host:%s:%s use_ssl:%d",
+         NET_ID_FMT( listen_ctx->id ), NET_ID_FMT( ctx->id ),
+         ctx->fd, ctx->cold->host, ctx->cold->port, !!ctx->ssl );
+
+    /* NOTE: EPOLLOUT was enabled during EPOLL_CTL_ADD */
+    __add_to_epoll( ctx );
+
+    __established( ctx );
+}
+
+/******************* SSL changing state functions *****************************/
+
+/* NOTE: it deletes all timers and makes one timer */
+
+static void __ssl_start_shutdown( ctx_t *ctx, int code )
+{
+    conn_id_t           prev_id = ctx->id;
+
+    c_assert( ctx->ssl && ctx->state->st == S_SSL_ESTABLISHED &&
+              !ctx->is_clo_uh_done && ctx->dirn != D_LISTEN &&
+              !ctx->to_shutdown );
+
+    /* NOTE: in case of flush_and_close, state_tmr_id will be rewritten */
+    c_assert( !ctx->state_tmr_id || ctx->flush_and_close );
+
+    g_skip_cb = true;
+
+    ctx->state = &g_ctx_state[S_SSL_SHUTDOWN];
+    c_assert( ctx->state->st == S_SSL_SHUTDOWN );
+
+    /* NOTE: SSL shutdown needs to read close_notify */
+    if( ctx->is_read_paused )
+    {
+        ctx->is_read_paused = false;
+        __set_read_events( ctx, true );
+    }
+
+    /* NOTE: only __ssl_shutdown_timeout_cb is needed during shutdown  */
+    /* NOTE: also, to prevent to invoke __establish_timeout_cb several *
+     * times during shutdown                                           */
+    __cleanup_timers( ctx );
+
+    ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
+                                         __ssl_shutdown_timeout_cb,
+                                         cfg_net_ssl_shutdown_timeout );
+
+    c_assert( ctx->state_tmr_id );
+
+    __enable_write( ctx );
+
+    LOG( "id:0x%llx host:%s:%s code:%d",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, code );
+
+    if( ctx->clo_uh_cb )
+    {
+        /* NOTE: clo_uh_cb should not call  *
+         * close conn and another functions */
+        ctx->clo_uh_cb( ctx->id, ctx->udata_id, code );
+
+        /* NOTE: it's impossible to set to_shutdown *
+         * with S_SSL_SHUTDOWN                      */
+        c_assert( ctx->id == prev_id && !ctx->to_shutdown );
+
+        ctx->is_clo_uh_done = true;
+    }
+    else
+    {
+        /* NOTE: only accepted and uninitialized *
+         * conn don't have clo_uh_cb             */
+        c_assert( ctx->dirn == D_INCOMING );
+    }
+}
+
+/* NOTE: don't need to enable write because it was enabled */
+static void __ssl_start_accept( ctx_t *ctx )
+{
+    c_assert( ctx->ssl && ctx->dirn == D_INCOMING &&
+              !ctx->state && !ctx->state_tmr_id );
+
+    ctx->state = &g_ctx_state[S_SSL_ACCEPTING];
+    c_assert( ctx->state->st == S_SSL_ACCEPTING );
+
+    ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
+                                         __establish_timeout_cb,
+                                         cfg_net_ssl_accept_timeout );
+
+    c_assert( ctx->state_tmr_id );
+
+    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         NET_ID_FMT( ctx->state_tmr_id ) );
+}
+
+/* NOTE: don't need to enable write because it was enabled */
+static void __ssl_start_connect( ctx_t *ctx )
+{
+    c_assert( ctx->ssl && ctx->dirn == D_OUTGOING && !ctx->state_tmr_id );
+
+    g_skip_cb = true;
+
+    ctx->state = &g_ctx_state[S_SSL_CONNECTING];
+    c_assert( ctx->state->st == S_SSL_CONNECTING );
+
+    ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
+                                         __establish_timeout_cb,
+                                         cfg_net_ssl_establish_timeout );
+
+    c_assert( ctx->state_tmr_id );
+
+    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         NET_ID_FMT( ctx->state_tmr_id ) );
+}
+
+/******************* non-SSL changing state functions *************************/
+
+static void __start_listen( ctx_t *ctx )
+{
+    c_assert( !ctx->ssl && ctx->dirn == D_LISTEN &&
+              !ctx->state && !ctx->state_tmr_id );
+
+    ctx->state = &g_ctx_state[S_LISTENING];
+    c_assert( ctx->state->st == S_LISTENING );
+
+    /* NOTE: EPOLLOUT was enabled during EPOLL_CTL_ADD */
+    __add_to_epoll( ctx );
+
+    /* NOTE: EPOLL_CTL_ADD adds EPOLLOUT, so disable it by        *
+     * excessive call. If EPOLLOUT is not added by EPOLL_CTL_ADD  *
+     * then regular connection should make excessive call.        *
+     * So it would be better to make excessive call at listening. */
+    __disable_write( ctx );
+
+    LOG( "id:0x%llx listen_port:%d",
+         NET_ID_FMT( ctx->id ), ctx->cold->listen_port );
+}
+
+static void __start_connect( ctx_t *ctx )
+{
+    c_assert( ctx->dirn == D_OUTGOING &&
+              !ctx->state && !ctx->state_tmr_id );
+
+    ctx->state = &g_ctx_state[S_CONNECTING];
+    c_assert( ctx->state->st == S_CONNECTING );
+
+    ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
+                                         __establish_timeout_cb,
+                                         cfg_net_establish_timeout );
+
+    c_assert( ctx->state_tmr_id );
+
+    /* NOTE: EPOLLOUT was enabled during EPOLL_CTL_ADD */
+    __add_to_epoll( ctx );
+
+    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         NET_ID_FMT( ctx->state_tmr_id ) );
+}
+
+/******************* SSL event callbacks **************************************/
+
+static void __ssl_write_cb( ctx_t *ctx )
+{
+    __ssl_gen_rw_call( ctx,
+                       __call_ssl_write,
+                       __call_ssl_read,
+                       SSL_R_WANT_W,
+                       SSL_W_WANT_R );
+}
+
+static void __ssl_read_cb( ctx_t *ctx )
+{
+    __ssl_gen_rw_call( ctx,
+                       __call_ssl_read,
+                       __call_ssl_write,
+                       SSL_W_WANT_R,
+                       SSL_R_WANT_W );
+}
+
+static void __ssl_shutdown_cb( ctx_t *ctx )
+{
+    int                 r, e, syserr;
+    unsigned long       ssl_e;
+    char               *ssl_strerror;
+
+    do
+    {
+        errno = 0;
+        r = SSL_shutdown( ctx->ssl );
+
+        syserr = errno;
+        e = SSL_get_error( ctx->ssl, r );
+    }
+    while( r < 0 && e == SSL_ERROR_SYSCALL && syserr == EINTR );
+
+    ssl_e = ERR_get_error();
+    ssl_strerror = ssl_e ? ERR_error_string(ssl_e, NULL) : "-";
+
+    if( r == 1 )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        __shutdown_ctx( ctx, NET_CODE_SUCCESS );
+        return;
+    }
+
+    LOGD( "id:0x%llx host:%s:%s ssl_err:%d "
+          "ssl_strerror:%s errno:%d strerror:%s",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          e, ssl_strerror, syserr, strerror( syserr ) );
+
+    switch( e )
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+
+            g_skip_cb = true;
+            return;
+
+        case SSL_ERROR_SYSCALL:
+
+            if( syserr == EAGAIN )
+            {
+                g_skip_cb = true;
+                return;
+            }
+
+            /* fall through */
+
+        default:
+
+            LOGE( "id:0x%llx host:%s:%s ssl_err:%d "
+                  "ssl_strerror:%s errno:%d strerror:%s",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  e, ssl_strerror, syserr, strerror( syserr ) );
+
+            __shutdown_ctx( ctx, NET_CODE_ERR_SHUT );
+    }
+}
+
+static void __ssl_accept_cb( ctx_t *ctx )
+{
+    int                 r, e, syserr;
+    unsigned long       ssl_e;
+    char               *ssl_strerror;
+
+    do
+    {
+        errno = 0;
+        r = SSL_accept( ctx->ssl );
+
+        syserr = errno;
+        e = SSL_get_error( ctx->ssl, r );
+    }
+    while( r < 0 && e == SSL_ERROR_SYSCALL && syserr == EINTR );
+
+    ssl_e = ERR_get_error();
+    ssl_strerror = ssl_e ? ERR_error_string(ssl_e, NULL) : "-";
+
+    if( r == 1 )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        __ssl_established( ctx );
+        return;
+    }
+
+    LOGD( "id:0x%llx host:%s:%s ret:%d ssl_err:%d "
+          "ssl_strerror:%s errno:%d strerror:%s",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          r, e, ssl_strerror, syserr, strerror( syserr ) );
+
+    switch( e )
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+
+            g_skip_cb = true;
+            return;
+
+        case SSL_ERROR_SYSCALL:
+
+            if( syserr == EAGAIN )
+            {
+                g_skip_cb = true;
+                return;
+            }
+
+            /* fall through */
+
+        default:
+
+            LOGE( "id:0x%llx host:%s:%s ret:%d ssl_err:%d "
+                  "ssl_strerror:%s errno:%d strerror:%s",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  r, e, ssl_strerror, syserr, strerror( syserr ) );
+
+            /* NOTE: close accepted conn */
+            __shutdown_ctx( ctx, NET_CODE_ERR_ACCEPT );
+    }
+}
+
+static void __ssl_connect_cb( ctx_t *ctx )
+{
+    int                 r, e, syserr;
+    unsigned long       ssl_e;
+    char               *ssl_strerror;
+
+    do
+    {
+        errno = 0;
+        r = SSL_connect( ctx->ssl );
+
+        syserr = errno;
+        e = SSL_get_error( ctx->ssl, r );
+    }
+    while( r < 0 && e == SSL_ERROR_SYSCALL && syserr == EINTR );
+
+    ssl_e = ERR_get_error();
+    ssl_strerror = ssl_e ? ERR_error_string(ssl_e, NULL) : "-";
+
+    if( r == 1 )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        __ssl_established( ctx );
+        return;
+    }
+
+    LOGD( "id:0x%llx host:%s:%s ret:%d ssl_err:%d "
+          "ssl_strerror:%s errno:%d strerror:%s",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          r, e, ssl_strerror, syserr, strerror( syserr ) );
+
+    switch( e )
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+
+            g_skip_cb = true;
+            return;
+
+        case SSL_ERROR_SYSCALL:
+
+            if( syserr == EAGAIN )
+            {
+                g_skip_cb = true;
+                return;
+            }
+
+            /* fall through */
+
+        default:
+
+            LOGE( "id:0x%llx host:%s:%s ret:%d ssl_err:%d "
+                  "ssl_strerror:%s errno:%d strerror:%s",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  r, e, ssl_strerror, syserr, strerror( syserr ) );
+
+            __shutdown_ctx( ctx, NET_CODE_ERR_EST );
+    }
+}
+
+/******************* non-SSL event callbacks **********************************/
+
+static void __write_cb( ctx_t *ctx )
+{
+    wbuf_t     *wbuf;
+    int         r, syserr;
+
+    /* NOTE: it may happened because of EPOLLRDHUP */
+    if( !ctx->wb_list.total )
+    {
+        c_assert( !ctx->wb_list.head &&
+                  !ctx->wb_list.tail );
+
+        LOGD( "id:0x%llx host:%s:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        __disable_write( ctx );
+        return;
+    }
+
+    if( ctx->is_shm && ctx->cold->shm )
+    {
+        __shm_write_cb( ctx );
+        return;
+    }
+
+    LL_CHECK( &ctx->wb_list, ctx->wb_list.head );
+    wbuf = PTRID_GET_PTR( ctx->wb_list.head );
+
+    B_GENERAL_CHECK( wbuf->b );
+
+    c_assert( B_HAS_REMAINDER( wbuf->b ) );
+
+    errno = 0;
+    while( (r = send( ctx->fd,
+                      B_REMAINDER_PTR( wbuf->b ),
+                      B_REMAINDER_SIZE( wbuf->b ),
+                      MSG_DONTWAIT )) == -1 && errno == EINTR )
+        errno = 0;
+
+    syserr = errno;
+
+    if( r > 0 )
+    {
+        B_INCREASE_USED( wbuf->b, r );
+
+        LOGD( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
+              PTRID_FMT( wbuf->id ) );
+
+        __handle_write_buf( ctx );
+        return;
+    }
+
+    /* NOTE: EINPROGRESS is returned by TCP Fast Open socket *
+     *       when there is no cookie and only SYN was sent   */
+    if( syserr == EAGAIN || syserr == EINPROGRESS )
+    {
+        LOGD( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
+              PTRID_FMT( wbuf->id ) );
+
+        return;
+    }
+
+    LOGE( "id:0x%llx host:%s:%s used:%lu size:%lu "
+          "msg_id:%llx errno:%d strerror:%s",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
+          PTRID_FMT( wbuf->id ), syserr, strerror( syserr ) );
+
+    __shutdown_ctx( ctx, NET_CODE_ERR_WRITE );
+}
+
+static void __read_cb( ctx_t *ctx )
+{
+    int                 r, syserr;
+    int                 flags = MSG_DONTWAIT;
+    char               *host = ctx->cold->host;
+    char               *port = ctx->cold->port;
+
+    B_GENERAL_CHECK( ctx->rb );
+    c_assert( B_HAS_REMAINDER( ctx->rb ) );
+
+    if( ctx->is_shm && ctx->cold->shm )
+    {
+        __shm_read_cb( ctx );
+        return;
+    }
+
+    /* NOTE: MSG_TRUNC returns the real length of a message */
+    if( ctx->is_seqpacket )
+    {
+        if( B_REMAINDER_SIZE( ctx->rb ) < UNIX_MAX_MSG_SIZE )
+            B_INCREASE_BUF( ctx->rb, UNIX_MAX_MSG_SIZE );
+
+        flags |= MSG_TRUNC;
+    }
+
+    errno = 0;
+    while( (r = __recv( ctx, flags )) == -1 && errno == EINTR )
+        errno = 0;
+
+    syserr = errno;
+
+    if( r > 0 && r > B_REMAINDER_SIZE( ctx->rb ) )
+    {
+        LOGE( "id:0x%llx host:%s:%s len:%d rb.used:%lu rb.size:%lu",
+              NET_ID_FMT( ctx->id ), host, port, r,
+              B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+
+        __shutdown_ctx( ctx, NET_CODE_ERR_READ );
+        return;
+    }
+
+    if( r == -1 )
+    {
+        if( syserr == EAGAIN )
+        {
+            LOGD( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu "
+                  "errno:%d strerror:%s",
+                  NET_ID_FMT( ctx->id ), host, port,
+                  B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ),
+                  syserr, strerror( syserr ) );
+
+            return;
+        }
+
+        LOGE( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu "
+              "errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), host, port,
+              B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ),
+              syserr, strerror( syserr ) );
+
+        /* unexpected error occured */
+        __shutdown_ctx( ctx, NET_CODE_ERR_READ );
+        return;
+    }
+
+    /* NOTE: consider r == 0 as closed by peer */
+
+    if( r > 0 )
+    {
+        B_INCREASE_USED( ctx->rb, r );
+
+        __check_tfo( ctx );
+
+        /* NOTE: kernel resets TCP_QUICKACK, so it's re-armed */
+        if( ctx->sock_profile && ctx->sock_profile->quickack > 0 )
+        {
+            __set_sock_opt( ctx->fd, IPPROTO_TCP, TCP_QUICKACK,
+                            ctx->sock_profile->quickack, "TCP_QUICKACK" );
+        }
+    }
+
+    if( B_REMAINDER_SIZE( ctx->rb ) < B_MIN_RDBUF_REMAINDER( ctx->rb ) )
+    {
+        B_INCREASE_BUF( ctx->rb, READ_BUFFER_SIZE );
+
+        LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
+             NET_ID_FMT( ctx->id ), host, port,
+             B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+    }
+
+    LOGD( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
+          NET_ID_FMT( ctx->id ), host, port,
+          B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+
+    if( __call_read_handler( ctx, !r ) )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ), host, port );
+
+        return;
+    }
+
+    if( !r )
+    {
+        LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
+             NET_ID_FMT( ctx->id ), host, port,
+             B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+
+        __shutdown_ctx( ctx, NET_CODE_SUCCESS );
+    }
+}
+
+static void __listen_cb( ctx_t *ctx )
+{
+    struct sockaddr_in      peer;
+    socklen_t               peer_len = sizeof(peer);
+    int                     fd;
+    int                     syserr;
+
+    errno = 0;
+    while( (fd = accept( ctx->fd,
+                         (struct sockaddr *) &peer,
+                         &peer_len )) == -1 && errno == EINTR )
+        errno = 0;
+
+    syserr = errno;
+
+    if( fd >= 0 )
+    {
+        LOG( "id:0x%llx listen_port:%d new_fd:%x",
+             NET_ID_FMT( ctx->id ), ctx->cold->listen_port, fd );
+
+        /* NOTE: AF_UNIX client is usually unnamed */
+        if( ctx->cold->unix_addr )
+        {
+            __create_accepted( ctx, fd, NULL );
+        }
+        else
+        if( peer_len == sizeof(peer) )
+        {
+            __create_accepted( ctx, fd, &peer );
+        }
+        else
+        {
+            LOGE( "id:0x%llx listen_port:%d",
+                  NET_ID_FMT( ctx->id ), ctx->cold->listen_port );
+
+            __create_accepted( ctx, fd, NULL );
+        }
+
+        g_skip_cb = true;
+        return;
+    }
+
+    switch( syserr )
+    {
+        /* transient errors */
+        case EAGAIN:
+        case ECONNABORTED:
+        case ENETDOWN:
+        case EPROTO:
+        case ENOPROTOOPT:
+        case EHOSTDOWN:
+        case ENONET:
+        case EHOSTUNREACH:
+        case EOPNOTSUPP:
+        case ENETUNREACH:
+
+            LOGD( "id:0x%llx listen_port:%d ret:%d "
+                  "errno:%d strerror:%s",
+                  NET_ID_FMT( ctx->id ), ctx->cold->listen_port,
+                  fd, syserr, strerror( syserr ) );
+
+            g_skip_cb = true;
+            return;
+
+        /* fatal errors */
+        default:
+
+            LOGE( "id:0x%llx listen_port:%d ret:%d "
+                  "errno:%d strerror:%s",
+                  NET_ID_FMT( ctx->id ), ctx->cold->listen_port,
+                  fd, syserr, strerror( syserr ) );
+
+            /* NOTE: close listen conn */
+            __shutdown_ctx( ctx, NET_CODE_ERR_ACCEPT );
+    }
+}
+
+static void __connect_cb( ctx_t *ctx )
+{
+    struct sockaddr        *addr = (struct sockaddr *) &ctx->cold->peer;
+    socklen_t               addr_len = sizeof(ctx->cold->peer);
+    int                     r, syserr;
+
+    if( ctx->cold->unix_addr )
+    {
+        addr = (struct sockaddr *) ctx->cold->unix_addr;
+        addr_len = sizeof(struct sockaddr_un);
+    }
+
+    errno = 0;
+    while( (r = connect( ctx->fd, addr, addr_len )) == -1 &&
+           errno == EINTR )
+        errno = 0;
+
+    syserr = errno;
+
+    if( !r || syserr == EISCONN )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        __established( ctx );
+        return;
+    }
+
+    if( syserr == EINPROGRESS || syserr == EALREADY )
+    {
+        LOGD( "id:0x%llx host:%s:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        g_skip_cb = true;
+        return;
+    }
+
+    LOGE( "id:0x%llx host:%s:%s ret:%d errno:%d strerror:%s",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          r, syserr, strerror( syserr ) );
+
+    __shutdown_ctx( ctx, NET_CODE_ERR_EST );
+}
+
+/******************* Shared memory callbacks **********************************/
+
+/* NOTE: fresh memfd is zeroed, readers start as waiting, *
+ *       so the first write to a ring kicks its reader    */
+static int __shm_start_connect( ctx_t *ctx )
+{
+    shm_hello_t         hello;
+    struct msghdr       msg;
+    struct iovec        iov;
+    struct cmsghdr     *cmsg;
+    char                cbuf[CMSG_SPACE( 3 * sizeof(int) )];
+    int                 fds[3]; /* memfd, server kick, client kick */
+    uint32_t            ring_size = *cfg_net_shm_ring_size;
+    shm_t              *shm = NULL;
+    int                 r;
+
+    c_assert( ctx->is_shm && !ctx->cold->shm && ctx->dirn == D_OUTGOING );
+
+    if( !__is_shm_ring_size( ring_size ) )
+    {
+        LOGE( "id:0x%llx host:%s:%s ring_size:%u",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ring_size );
+
+        return -1;
+    }
+
+    fds[0] = memfd_create( "euclid_shm", MFD_CLOEXEC );
+    fds[1] = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    fds[2] = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+    if( fds[0] == -1 || fds[1] == -1 || fds[2] == -1 ||
+        ftruncate( fds[0], SHM_MAP_SIZE( ring_size ) ) ||
+        !(shm = __shm_map( fds[0], ring_size, D_OUTGOING )) )
+    {
+        LOGE( "id:0x%llx host:%s:%s ring_size:%u errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ring_size, errno, strerror( errno ) );
+
+        __shm_close_fds( fds, 3 );
+        return -1;
+    }
+
+    shm->tx.hdr->reader_waiting = 1;
+    shm->rx.hdr->reader_waiting = 1;
+
+    hello.magic = SHM_MAGIC;
+    hello.ring_size = ring_size;
+
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+
+    memset( &msg, 0, sizeof(msg) );
+    memset( cbuf, 0, sizeof(cbuf) );
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( sizeof(fds) );
+    memcpy( CMSG_DATA( cmsg ), fds, sizeof(fds) );
+
+    errno = 0;
+    while( (r = sendmsg( ctx->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL )) == -1 &&
+           errno == EINTR )
+        errno = 0;
+
+    /* NOTE: kick fds are kept by shm, memfd isn't needed after mmap */
+    shm->kick_fd = fds[2];
+    shm->peer_kick_fd = fds[1];
+
+    PROPER_CLOSE_FD( fds[0] );
+
+    ctx->cold->shm = shm;
+
+    if( r != sizeof(hello) )
+    {
+        LOGE( "id:0x%llx host:%s:%s ret:%d errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              r, errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    if( __shm_add_kick_to_epoll( ctx ) )
+        return -1;
+
+    LOG( "id:0x%llx host:%s:%s ring_size:%u",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, ring_size );
+
+    return 0;
+}
+
+static void __shm_start_accept( ctx_t *ctx )
+{
+    c_assert( ctx->is_shm && !ctx->ssl && ctx->dirn == D_INCOMING &&
+              !ctx->state && !ctx->state_tmr_id );
+
+    ctx->state = &g_ctx_state[S_SHM_ACCEPTING];
+    c_assert( ctx->state->st == S_SHM_ACCEPTING );
+
+    /* NOTE: only the client's hello is waited for */
+    __disable_write( ctx );
+
+    ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
+                                         __establish_timeout_cb,
+                                         cfg_net_establish_timeout );
+
+    c_assert( ctx->state_tmr_id );
+
+    LOG( "id:0x%llx host:%s:%s tmr:0x%llx",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         NET_ID_FMT( ctx->state_tmr_id ) );
+}
+
+static void __shm_accept_cb( ctx_t *ctx )
+{
+    shm_hello_t         hello;
+    struct msghdr       msg;
+    struct iovec        iov;
+    struct cmsghdr     *cmsg;
+    struct stat         st;
+    char                cbuf[CMSG_SPACE( 3 * sizeof(int) )];
+    int                 fds[3] = { -1, -1, -1 };
+    int                 nfds = 0;
+    shm_t              *shm = NULL;
+    int                 r, syserr;
+
+    c_assert( ctx->is_shm && !ctx->cold->shm &&
+              ctx->state->st == S_SHM_ACCEPTING );
+
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+
+    memset( &msg, 0, sizeof(msg) );
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    errno = 0;
+    while( (r = recvmsg( ctx->fd, &msg,
+                         MSG_DONTWAIT | MSG_CMSG_CLOEXEC )) == -1 &&
+           errno == EINTR )
+        errno = 0;
+
+    syserr = errno;
+
+    if( r == -1 && syserr == EAGAIN )
+    {
+        LOGD( "id:0x%llx host:%s:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        return;
+    }
+
+    cmsg = r > 0 ? CMSG_FIRSTHDR( &msg ) : NULL;
+
+    if( cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS )
+    {
+        nfds = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof(int);
+        if( nfds > 3 )
+            nfds = 3;
+
+        memcpy( fds, CMSG_DATA( cmsg ), nfds * sizeof(int) );
+    }
+
+    if( r != sizeof(hello) || nfds != 3 ||
+        (msg.msg_flags & MSG_CTRUNC) ||
+        hello.magic != SHM_MAGIC ||
+        !__is_shm_ring_size( hello.ring_size ) ||
+        fstat( fds[0], &st ) ||
+        (size_t) st.st_size != SHM_MAP_SIZE( hello.ring_size ) ||
+        !(shm = __shm_map( fds[0], hello.ring_size, D_INCOMING )) )
+    {
+        LOGE( "id:0x%llx host:%s:%s ret:%d nfds:%d errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              r, nfds, syserr, strerror( syserr ) );
+
+        __shm_close_fds( fds, 3 );
+
+        __shutdown_ctx( ctx, NET_CODE_ERR_EST );
+        return;
+    }
+
+    shm->kick_fd = fds[1];
+    shm->peer_kick_fd = fds[2];
+
+    PROPER_CLOSE_FD( fds[0] );
+
+    ctx->cold->shm = shm;
+
+    if( __shm_add_kick_to_epoll( ctx ) )
+    {
+        __shutdown_ctx( ctx, NET_CODE_ERR_EST );
+        return;
+    }
+
+    LOG( "id:0x%llx host:%s:%s ring_size:%u",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         hello.ring_size );
+
+    r = __del_conn_tmr( ctx, ctx->state_tmr_id );
+    c_assert( !r );
+
+    ctx->state_tmr_id = 0;
+    ctx->state = NULL;
+
+    __established( ctx );
+}
+
+/* NOTE: moves the ring to rb and calls the read handler, *
+ *       the reader sets the flag and rechecks the ring   *
+ *       before it sleeps, the writer kicks only then     */
+static void __shm_read( ctx_t *ctx, bool is_closed )
+{
+    shm_t              *shm = ctx->cold->shm;
+    shm_ring_hdr_t     *hdr = shm->rx.hdr;
+    char               *host = ctx->cold->host;
+    char               *port = ctx->cold->port;
+    int64_t             n;
+
+    if( __atomic_load_n( &hdr->reader_waiting, __ATOMIC_RELAXED ) )
+        __atomic_store_n( &hdr->reader_waiting, 0, __ATOMIC_RELAXED );
+
+    n = __shm_ring_read( &shm->rx, &ctx->rb );
+
+    if( n == -1 )
+    {
+        LOGE( "id:0x%llx host:%s:%s head:%lu tail:%lu size:%lu",
+              NET_ID_FMT( ctx->id ), host, port,
+              hdr->head, hdr->tail, shm->rx.size );
+
+        __shutdown_ctx( ctx, NET_CODE_ERR_READ );
+        return;
+    }
+
+    if( n )
+    {
+        shm->total_rx_bytes += n;
+
+        __shm_kick_if_waiting( shm, &hdr->writer_waiting );
+    }
+
+    if( !is_closed )
+    {
+        __atomic_store_n( &hdr->reader_waiting, 1, __ATOMIC_SEQ_CST );
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+        if( __atomic_load_n( &hdr->head, __ATOMIC_ACQUIRE ) != hdr->tail )
+            __shm_kick( shm, shm->kick_fd );
+
+        if( !n )
+            return;
+    }
+
+    if( B_REMAINDER_SIZE( ctx->rb ) < B_MIN_RDBUF_REMAINDER( ctx->rb ) )
+    {
+        B_INCREASE_BUF( ctx->rb, READ_BUFFER_SIZE );
+
+        LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
+             NET_ID_FMT( ctx->id ), host, port,
+             B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+    }
+
+    LOGD( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
+          NET_ID_FMT( ctx->id ), host, port,
+          B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+
+    if( __call_read_handler( ctx, is_closed ) )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ), host, port );
+
+        return;
+    }
+
+    if( is_closed )
+    {
+        LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
+             NET_ID_FMT( ctx->id ), host, port,
+             B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+
+        __shutdown_ctx( ctx, NET_CODE_SUCCESS );
+    }
+}
+
+/* NOTE: the peer kicks after writing to our rx ring or  *
+ *       after reading from our tx ring, kick is drained *
+ *       even when read is paused                        */
+static void __shm_kick_cb( ctx_t *ctx )
+{
+    shm_t              *shm = ctx->cold->shm;
+    uint64_t            cnt;
+
+    if( read( shm->kick_fd, &cnt, sizeof(cnt) ) != sizeof(cnt) )
+    {
+        LOGD( "id:0x%llx host:%s:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        return;
+    }
+
+    shm->total_wakeups++;
+
+    if( shm->is_tx_blocked && __shm_ring_space( &shm->tx ) )
+    {
+        shm->is_tx_blocked = false;
+
+        __enable_write( ctx );
+    }
+
+    if( ctx->is_read_paused ||
+        ctx->state->st != S_ESTABLISHED )
+    {
+        return;
+    }
+
+    __shm_read( ctx, false );
+}
+
+/* NOTE: the socket carries nothing after the handshake, *
+ *       it's readable only when the peer is closed, the *
+ *       peer's data is already in the ring then         */
+static void __shm_read_cb( ctx_t *ctx )
+{
+    char                c;
+    int                 r, syserr;
+
+    errno = 0;
+    while( (r = recv( ctx->fd, &c, 1, MSG_DONTWAIT )) == -1 &&
+           errno == EINTR )
+        errno = 0;
+
+    syserr = errno;
+
+    if( r == -1 && syserr == EAGAIN )
+    {
+        LOGD( "id:0x%llx host:%s:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        return;
+    }
+
+    if( r )
+    {
+        LOGE( "id:0x%llx host:%s:%s ret:%d errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              r, syserr, strerror( syserr ) );
+
+        __shutdown_ctx( ctx, NET_CODE_ERR_READ );
+        return;
+    }
+
+    __shm_read( ctx, true );
+}
+
+/* NOTE: unlike send(), copying to the ring is cheap, so all *
+ *       wbufs are written at once and the reader is kicked  *
+ *       once per call                                       */
+static void __shm_write_cb( ctx_t *ctx )
+{
+    shm_t              *shm = ctx->cold->shm;
+    shm_ring_hdr_t     *hdr = shm->tx.hdr;
+    wbuf_t             *wbuf;
+    uint64_t            total = 0;
+    int64_t             n;
+
+    while( ctx->wb_list.total )
+    {
+        LL_CHECK( &ctx->wb_list, ctx->wb_list.head );
+        wbuf = PTRID_GET_PTR( ctx->wb_list.head );
+
+        B_GENERAL_CHECK( wbuf->b );
+
+        c_assert( B_HAS_REMAINDER( wbuf->b ) );
+
+        n = __shm_ring_write( &shm->tx,
+                              B_REMAINDER_PTR( wbuf->b ),
+                              B_REMAINDER_SIZE( wbuf->b ) );
+
+        if( n == -1 )
+        {
+            LOGE( "id:0x%llx host:%s:%s head:%lu tail:%lu size:%lu",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  hdr->head, hdr->tail, shm->tx.size );
+
+            __shutdown_ctx( ctx, NET_CODE_ERR_READ );
+            return;
+        }
+
+        if( !n )
+        {
+            /* NOTE: the same recheck as the reader does */
+            __atomic_store_n( &hdr->writer_waiting, 1, __ATOMIC_SEQ_CST );
+            __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+            if( __shm_ring_space( &shm->tx ) )
+            {
+                __atomic_store_n( &hdr->writer_waiting, 0,
+                                  __ATOMIC_RELAXED );
+                continue;
+            }
+
+            LOGD( "id:0x%llx host:%s:%s used:%lu size:%lu msg_id:%llx",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  B_USED_SIZE( wbuf->b ), B_SIZE( wbuf->b ),
+                  PTRID_FMT( wbuf->id ) );
+
+            shm->is_tx_blocked = true;
+            shm->total_tx_blocks++;
+
+            __disable_write( ctx );
+            break;
+        }
+
+        total += n;
+
+        B_INCREASE_USED( wbuf->b, n );
+
+        __handle_write_buf( ctx );
+    }
+
+    if( total )
+    {
+        shm->total_tx_bytes += total;
+
+        __shm_kick_if_waiting( shm, &hdr->reader_waiting );
+    }
+}
+
+/******************* Pipe functions *******************************************/
+
+/* NOTE: eventfd is never written, it's in epoll without *
+ *       events only to keep epoll helpers unchanged     */
+static int __make_pipe_fd()
+{
+    struct epoll_event      event;
+    int                     fd;
+
+    fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if( fd == -1 )
+    {
+        LOGE( "errno:%d strerror:%s", errno, strerror( errno ) );
+
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return -1;
+    }
+
+    if( fd > NET_MAX_FD )
+    {
+        LOGE( "fd:%x", fd );
+
+        PROPER_CLOSE_FD( fd );
+
+        G_net_errno = NET_ERRNO_CONN_MAX;
+        return -1;
+    }
+
+    event.events = 0;
+    event.data.fd = fd;
+
+    if( epoll_ctl( g_epollfd, EPOLL_CTL_ADD, fd, &event ) )
+    {
+        LOGE( "fd:%x errno:%d strerror:%s", fd, errno, strerror( errno ) );
+
+        PROPER_CLOSE_FD( fd );
+
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return -1;
+    }
+
+    return fd;
+}
+
+static ctx_t *__find_pipe_listener( int port )
+{
+    ctx_t              *ctx;
+    int                 fd;
+
+    /* NOTE: Warning - O(n), only once per pipe conn */
+    for( fd = 0; fd <= NET_MAX_FD; fd++ )
+    {
+        ctx = &g_ctx_array[fd];
+
+        if( ctx->id && ctx->dirn == D_LISTEN && !ctx->cold->unix_addr &&
+            ctx->cold->listen_port == port && !ctx->to_shutdown &&
+            ctx->state && ctx->state->st == S_LISTENING )
+        {
+            return ctx;
+        }
+    }
+
+    return NULL;
+}
+
+/* NOTE: rb of the reader is the only buffer, *
+ *       so it's also the writer's watermark  */
+static int __pipe_write( ctx_t         *ctx,
+                         char          *data,
+                         unsigned long  len )
+{
+    ctx_t              *peer;
+
+    if( !ctx->cold->pipe_peer_id )
+    {
+        LOG( "id:0x%llx host:%s:%s len:%lu peer is closed",
+             NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, len );
+
+        return 0;
+    }
+
+    peer = __get_ctx( ctx->cold->pipe_peer_id );
+    c_assert( peer->cold->pipe_peer_id == ctx->id && !peer->cold->is_pipe_rd_eof );
+
+    if( g_sim.is_on )
+        __sim_send( ctx, peer->id, data, len, false );
+    else
+    {
+        if( B_REMAINDER_SIZE( peer->rb ) < len )
+            B_INCREASE_BUF( peer->rb, len + READ_BUFFER_SIZE );
+
+        memcpy( B_REMAINDER_PTR( peer->rb ), data, len );
+        B_INCREASE_USED( peer->rb, len );
+
+        peer->cold->is_pipe_rd_pending = true;
+        peer->cold->is_pipe_rd_data = true;
+
+        g_sched_pending++;
+    }
+
+    LOGD( "id:0x%llx host:%s:%s len:%lu peer_rb.used:%lu",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          len, B_USED_SIZE( peer->rb ) );
+
+    /* NOTE: the cold record is read only in net_sim */
+    if( B_USED_SIZE( peer->rb ) +
+        (g_sim.is_on ? ctx->cold->sim_inflight : 0) > ctx->wb_high_bytes )
+    {
+        if( !ctx->is_wb_over_high )
+        {
+            LOG( "id:0x%llx host:%s:%s peer_rb.used:%lu "
+                 "over high watermark",
+                 NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                 B_USED_SIZE( peer->rb ) );
+        }
+
+        ctx->is_wb_over_high = true;
+        ctx->is_drain_pending = false;
+
+        return NET_POST_OVER_HIGH;
+    }
+
+    return 0;
+}
+
+static void __pipe_shutdown_write( ctx_t *ctx )
+{
+    ctx_t              *peer;
+
+    if( !ctx->cold->pipe_peer_id )
+        return;
+
+    peer = __get_ctx( ctx->cold->pipe_peer_id );
+
+    if( g_sim.is_on )
+    {
+        __sim_send( ctx, peer->id, NULL, 0, true );
+        return;
+    }
+
+    peer->cold->is_pipe_rd_eof = true;
+    peer->cold->is_pipe_rd_pending = true;
+
+    g_sched_pending++;
+}
+
+/* NOTE: called from __do_scheduled, it stays pending   *
+ *       until the conn is established and not paused,  *
+ *       like a socket, EOF comes after the data in the *
+ *       next iteration                                 */
+static void __pipe_read( ctx_t *ctx )
+{
+    char               *host = ctx->cold->host;
+    char               *port = ctx->cold->port;
+    ctx_t              *peer;
+    bool                is_closed = false;
+
+    if( ctx->is_read_paused || ctx->state->st != S_ESTABLISHED )
+        return;
+
+    if( ctx->cold->is_pipe_rd_data )
+        ctx->cold->is_pipe_rd_data = false;
+    else
+        is_closed = ctx->cold->is_pipe_rd_eof;
+
+    ctx->cold->is_pipe_rd_pending = ctx->cold->is_pipe_rd_eof && !is_closed;
+
+    if( !B_HAS_USED( ctx->rb ) && !is_closed )
+        return;
+
+    if( __call_read_handler( ctx, is_closed ) )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( ctx->id ), host, port );
+
+        return;
+    }
+
+    if( ctx->cold->pipe_peer_id )
+    {
+        peer = __get_ctx( ctx->cold->pipe_peer_id );
+
+        if( peer->is_wb_over_high &&
+            B_USED_SIZE( ctx->rb ) + peer->cold->sim_inflight <=
+            peer->wb_low_bytes )
+        {
+            peer->is_wb_over_high = false;
+
+            if( peer->drain_uh_cb )
+            {
+                peer->is_drain_pending = true;
+                g_sched_pending++;
+            }
+
+            LOG( "id:0x%llx host:%s:%s rb.used:%lu",
+                 NET_ID_FMT( peer->id ), peer->cold->host, peer->cold->port,
+                 B_USED_SIZE( ctx->rb ) );
+        }
+    }
+
+    if( is_closed )
+    {
+        LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
+             NET_ID_FMT( ctx->id ), host, port,
+             B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+
+        __shutdown_ctx( ctx, NET_CODE_SUCCESS );
+    }
+}
+
+/* NOTE: accepted end is made like __create_accepted does, *
+ *       both ends are established in this call            */
+static void __pipe_connect( ctx_t *ctx )
+{
+    ctx_t              *listen_ctx;
+    ctx_t              *peer;
+    int                 fd;
+
+    c_assert( ctx->is_pipe && ctx->dirn == D_OUTGOING &&
+              ctx->state->st == S_CONNECTING );
+
+    ctx->cold->is_pipe_est_pending = false;
+
+    listen_ctx = __find_pipe_listener( atoi( ctx->cold->port ) );
+
+    if( !listen_ctx || listen_ctx->cold->child_use_ssl )
+    {
+        LOGE( "id:0x%llx host:%s:%s no plain listener",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        __shutdown_ctx( ctx, NET_CODE_ERR_EST );
+        return;
+    }
+
+    fd = __make_pipe_fd();
+    if( fd == -1 )
+    {
+        LOGE( "id:0x%llx host:%s:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        __shutdown_ctx( ctx, NET_CODE_ERR_EST );
+        return;
+    }
+
+    peer = __init_new_ctx( fd );
+    c_assert( peer );
+
+    peer->is_pipe = true;
+
+    snprintf( peer->cold->host, sizeof(peer->cold->host), "%s",
+              ctx->cold->host );
+    snprintf( peer->cold->port, sizeof(peer->cold->port), "pipe" );
+
+    B_ALLOC( peer->rb, READ_BUFFER_SIZE );
+
+    peer->r_uh_cb = listen_ctx->cold->child_r_uh_cb;
+    peer->est_uh_cb = listen_ctx->cold->child_est_uh_cb;
+    peer->clo_uh_cb = listen_ctx->cold->child_clo_uh_cb;
+
+    peer->dirn = D_INCOMING;
+
+    ctx->cold->pipe_peer_id = peer->id;
+    peer->cold->pipe_peer_id = ctx->id;
+
+    __call_dup_udata( peer, listen_ctx );
+
+    LOG( "listen_id:0x%llx id:0x%llx new_id:0x%llx new_fd:%x host:%s:%s",
+         NET_ID_FMT( listen_ctx->id ), NET_ID_FMT( ctx->id ),
+         NET_ID_FMT( peer->id ), peer->fd, ctx->cold->host, ctx->cold->port );
+
+    __established( peer );
+
+    __established( ctx );
+}
+
+static conn_id_t __make_pipe_conn( net_host_t    *host,
+                                   net_r_uh_t     r_uh_cb,
+                                   net_est_uh_t   est_uh_cb,
+                                   net_clo_uh_t   clo_uh_cb,
+                                   ptr_id_t       udata_id )
+{
+    ctx_t                  *ctx;
+    int                     fd;
+
+    if( host->use_ssl || atoi( host->port ) <= 0 )
+    {
+        LOGE( "host:%s:%s use_ssl:%d",
+              host->hostname, host->port, host->use_ssl );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    fd = __make_pipe_fd();
+    if( fd == -1 )
+    {
+        LOGE( "host:%s:%s", host->hostname, host->port );
+        return 0;
+    }
+
+    ctx = __init_new_ctx( fd );
+    c_assert( ctx );
+
+    ctx->is_pipe = true;
+
+    snprintf( ctx->cold->host, sizeof(ctx->cold->host), "%s", host->hostname );
+    snprintf( ctx->cold->port, sizeof(ctx->cold->port), "%s", host->port );
+
+    B_ALLOC( ctx->rb, READ_BUFFER_SIZE );
+
+    ctx->r_uh_cb = r_uh_cb;
+    ctx->est_uh_cb = est_uh_cb;
+    ctx->clo_uh_cb = clo_uh_cb;
+
+    ctx->udata_id = udata_id;
+
+    ctx->dirn = D_OUTGOING;
+
+    ctx->state = &g_ctx_state[S_CONNECTING];
+    c_assert( ctx->state->st == S_CONNECTING );
+
+    ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
+                                         __establish_timeout_cb,
+                                         cfg_net_establish_timeout );
+
+    c_assert( ctx->state_tmr_id );
+
+    /* NOTE: the listener is looked up in __do_scheduled, *
+     *       so est_uh_cb isn't called from this function */
+    ctx->cold->is_pipe_est_pending = true;
+    g_sched_pending++;
+
+    LOG( "id:0x%llx fd:%x host:%s:%s",
+         NET_ID_FMT( ctx->id ), ctx->fd, ctx->cold->host, ctx->cold->port );
+
+    return ctx->id;
+}
+
+/******************* Tunnel functions *****************************************/
+
+static ctx_t *__get_tunnel_peer( ctx_t *ctx )
+{
+    ctx_t              *peer;
+
+    c_assert( ctx->cold->tunnel_peer_id );
+
+    peer = __get_ctx( ctx->cold->tunnel_peer_id );
+
+    c_assert( peer->cold->tunnel_peer_id == ctx->id &&
+              peer->state->st == S_TUNNEL );
+
+    return peer;
+}
+
+static void __tunnel_check_done( ctx_t *ctx, ctx_t *peer )
+{
+    if( !ctx->cold->is_tunnel_rd_eof || !peer->cold->is_tunnel_rd_eof ||
+        ctx->cold->tunnel_pipe_used || peer->cold->tunnel_pipe_used ||
+        ctx->wb_msgs || peer->wb_msgs )
+    {
+        return;
+    }
+
+    LOG( "id:0x%llx host:%s:%s peer_id:0x%llx peer_host:%s:%s",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         NET_ID_FMT( peer->id ), peer->cold->host, peer->cold->port );
+
+    /* NOTE: it's closed from __do_scheduled, because peer  *
+     *       may be in the current epoll batch, the peer is *
+     *       closed after clo_uh_cb by __detach_tunnel      */
+    ctx->to_shutdown = true;
+}
+
+/* NOTE: it moves bytes from src pipe to dst socket. dst is  *
+ *       shut down only if it's the current ctx, otherwise   *
+ *       EPOLLOUT is enabled and the error is caught by dst  *
+ *       w_cb, because dst may be in the current epoll batch */
+static void __tunnel_flush( ctx_t  *src,
+                            ctx_t  *dst,
+                            ctx_t  *cur )
+{
+    ssize_t             r;
+    int                 syserr;
+
+    /* NOTE: data posted before the tunnel is written first */
+    if( dst->wb_msgs )
+        return;
+
+    while( src->cold->tunnel_pipe_used )
+    {
+        errno = 0;
+        while( (r = splice( src->cold->tunnel_pipe[0], NULL,
+                            dst->fd, NULL,
+                            src->cold->tunnel_pipe_used,
+                            SPLICE_F_MOVE | SPLICE_F_NONBLOCK )) == -1 &&
+               errno == EINTR )
+            errno = 0;
+
+        syserr = errno;
+
+        if( r > 0 )
+        {
+            c_assert( r <= src->cold->tunnel_pipe_used );
+
+            src->cold->tunnel_pipe_used -= r;
+
+            LOGD( "id:0x%llx host:%s:%s spliced:%ld pipe_used:%lu",
+                  NET_ID_FMT( dst->id ), dst->cold->host, dst->cold->port,
+                  (long) r, src->cold->tunnel_pipe_used );
+
+            continue;
+        }
+
+        if( r == -1 && syserr == EAGAIN )
+        {
+            LOGD( "id:0x%llx host:%s:%s pipe_used:%lu",
+                  NET_ID_FMT( dst->id ), dst->cold->host, dst->cold->port,
+                  src->cold->tunnel_pipe_used );
+
+            __enable_write( dst );
+            break;
+        }
+
+        LOGE( "id:0x%llx host:%s:%s pipe_used:%lu ret:%ld "
+              "errno:%d strerror:%s",
+              NET_ID_FMT( dst->id ), dst->cold->host, dst->cold->port,
+              src->cold->tunnel_pipe_used, (long) r,
+              syserr, strerror( syserr ) );
+
+        if( dst == cur )
+            __shutdown_ctx( dst, NET_CODE_ERR_WRITE );
+        else
+            __enable_write( dst );
+
+        return;
+    }
+
+    /* NOTE: reading was stopped when the pipe got full */
+    if( !src->cold->is_tunnel_rd_eof &&
+        src->cold->tunnel_pipe_used < src->cold->tunnel_pipe_size )
+    {
+        __set_read_events( src, true );
+    }
+
+    if( src->cold->tunnel_pipe_used || !src->cold->is_tunnel_rd_eof )
+        return;
+
+    if( !dst->is_shut_wr_done )
+    {
+        LOG( "id:0x%llx host:%s:%s",
+             NET_ID_FMT( dst->id ), dst->cold->host, dst->cold->port );
+
+        __shutdown_write( dst );
+    }
+
+    __tunnel_check_done( src, dst );
+}
+
+static void __tunnel_read_cb( ctx_t *ctx )
+{
+    ctx_t              *peer;
+    ssize_t             r;
+    int                 syserr, soerr = 0;
+    socklen_t           soerr_len = sizeof(soerr);
+
+    peer = __get_tunnel_peer( ctx );
+
+    /* NOTE: EPOLLHUP and EPOLLERR are reported even if *
+     *       reading is stopped, check a pending error  */
+    if( ctx->cold->is_tunnel_rd_eof || !(ctx->ev & EPOLLIN) )
+    {
+        if( getsockopt( ctx->fd, SOL_SOCKET, SO_ERROR,
+                        &soerr, &soerr_len ) == -1 )
+        {
+            soerr = errno;
+        }
+
+        if( soerr )
+        {
+            LOGE( "id:0x%llx host:%s:%s errno:%d strerror:%s",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  soerr, strerror( soerr ) );
+
+            __shutdown_ctx( ctx, NET_CODE_ERR_READ );
+        }
+
+        return;
+    }
+
+    c_assert( ctx->cold->tunnel_pipe_used < ctx->cold->tunnel_pipe_size );
+
+    errno = 0;
+    while( (r = splice( ctx->fd, NULL,
+                        ctx->cold->tunnel_pipe[1], NULL,
+                        ctx->cold->tunnel_pipe_size - ctx->cold->tunnel_pipe_used,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK )) == -1 &&
+           errno == EINTR )
+        errno = 0;
+
+    syserr = errno;
+
+    if( r == -1 )
+    {
+        /* NOTE: pipe capacity is counted in pages, so it  *
+         *       may be full before tunnel_pipe_size bytes */
+        if( syserr == EAGAIN )
+        {
+            LOGD( "id:0x%llx host:%s:%s pipe_used:%lu",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  ctx->cold->tunnel_pipe_used );
+
+            if( ctx->cold->tunnel_pipe_used )
+                __set_read_events( ctx, false );
+
+            return;
+        }
+
+        LOGE( "id:0x%llx host:%s:%s pipe_used:%lu errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ctx->cold->tunnel_pipe_used, syserr, strerror( syserr ) );
+
+        __shutdown_ctx( ctx, NET_CODE_ERR_READ );
+        return;
+    }
+
+    /* NOTE: consider r == 0 as closed by peer */
+
+    if( r > 0 )
+    {
+        ctx->cold->tunnel_pipe_used += r;
+
+        LOGD( "id:0x%llx host:%s:%s spliced:%ld pipe_used:%lu",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              (long) r, ctx->cold->tunnel_pipe_used );
+
+        if( ctx->sock_profile && ctx->sock_profile->quickack > 0 )
+        {
+            __set_sock_opt( ctx->fd, IPPROTO_TCP, TCP_QUICKACK,
+                            ctx->sock_profile->quickack, "TCP_QUICKACK" );
+        }
+
+        if( ctx->cold->tunnel_pipe_used >= ctx->cold->tunnel_pipe_size )
+            __set_read_events( ctx, false );
+    }
+    else
+    {
+        LOG( "id:0x%llx host:%s:%s pipe_used:%lu",
+             NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+             ctx->cold->tunnel_pipe_used );
+
+        ctx->cold->is_tunnel_rd_eof = true;
+
+        __set_read_events( ctx, false );
+    }
+
+    __tunnel_flush( ctx, peer, ctx );
+}
+
+static void __tunnel_write_cb( ctx_t *ctx )
+{
+    conn_id_t           prev_id = ctx->id;
+    ctx_t              *peer;
+
+    /* NOTE: posted data is written by the generic way */
+    if( ctx->wb_list.total )
+    {
+        __write_cb( ctx );
+
+        if( ctx->id != prev_id || ctx->wb_msgs )
+            return;
+    }
+
+    peer = __get_tunnel_peer( ctx );
+
+    __tunnel_flush( peer, ctx, ctx );
+
+    if( ctx->id != prev_id )
+        return;
+
+    if( !peer->cold->tunnel_pipe_used )
+        __disable_write( ctx );
+}
+
+static int __make_tunnel_pipe( ctx_t *ctx )
+{
+    int                 r;
+
+    if( pipe2( ctx->cold->tunnel_pipe, O_NONBLOCK ) == -1 )
+    {
+        LOGE( "id:0x%llx host:%s:%s errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    if( fcntl( ctx->cold->tunnel_pipe[1], F_SETPIPE_SZ, TUNNEL_PIPE_SIZE ) == -1 )
+    {
+        /* NOTE: it's limited by /proc/sys/fs/pipe-max-size */
+        LOGE( "id:0x%llx host:%s:%s errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              errno, strerror( errno ) );
+    }
+
+    r = fcntl( ctx->cold->tunnel_pipe[1], F_GETPIPE_SZ );
+
+    if( r <= 0 )
+    {
+        LOGE( "id:0x%llx host:%s:%s errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              errno, strerror( errno ) );
+
+        PROPER_CLOSE_FD( ctx->cold->tunnel_pipe[0] );
+        PROPER_CLOSE_FD( ctx->cold->tunnel_pipe[1] );
+
+        return -1;
+    }
+
+    ctx->cold->tunnel_pipe_size = r;
+    ctx->cold->tunnel_pipe_used = 0;
+
+    return 0;
+}
+
+/******************* UDP functions ********************************************/
+
+static int __parse_ipv4( char *str, uint32_t *ip )
+{
+    struct in_addr      addr;
+
+    if( inet_pton( AF_INET, str, &addr ) != 1 )
+    {
+        LOGE( "addr:%s", str );
+        return -1;
+    }
+
+    *ip = addr.s_addr;
+
+    return 0;
+}
+
+/* NOTE: recvmmsg overwrites lengths of a filled message */
+static void __reset_udp_msg( udp_rx_t *rx, int i )
+{
+    struct msghdr      *hdr = &rx->msgs[i].msg_hdr;
+
+    hdr->msg_name = &rx->addrs[i];
+    hdr->msg_namelen = sizeof(struct sockaddr_in);
+    hdr->msg_iov = &rx->iovs[i];
+    hdr->msg_iovlen = 1;
+    hdr->msg_control = rx->cmsgs + i * UDP_CMSG_SIZE;
+    hdr->msg_controllen = UDP_CMSG_SIZE;
+    hdr->msg_flags = 0;
+
+    rx->msgs[i].msg_len = 0;
+}
+
+static udp_rx_t *__make_udp_rx( int batch, int dgram_size )
+{
+    udp_rx_t           *rx;
+    int                 i;
+
+    c_assert( batch > 0 && batch <= UDP_MAX_BATCH && dgram_size > 0 );
+
+    rx = malloc( sizeof(udp_rx_t) );
+    memset( rx, 0, sizeof(udp_rx_t) );
+
+    rx->batch = batch;
+    rx->dgram_size = dgram_size;
+
+    rx->bufs = malloc( batch * dgram_size );
+    rx->cmsgs = malloc( batch * UDP_CMSG_SIZE );
+    rx->msgs = malloc( batch * sizeof(struct mmsghdr) );
+    rx->iovs = malloc( batch * sizeof(struct iovec) );
+    rx->addrs = malloc( batch * sizeof(struct sockaddr_in) );
+    rx->dgrams = malloc( batch * sizeof(net_dgram_t) );
+
+    memset( rx->msgs, 0, batch * sizeof(struct mmsghdr) );
+
+    for( i = 0; i < batch; i++ )
+    {
+        rx->iovs[i].iov_base = rx->bufs + i * dgram_size;
+        rx->iovs[i].iov_len = dgram_size;
+
+        __reset_udp_msg( rx, i );
+    }
+
+    return rx;
+}
+
+/* NOTE: a multicast receiver binds the group address *
+ *       unless bind is set, so other groups on the   *
+ *       same port aren't delivered to this socket    */
+static int __setup_udp_socket( int                  fd,
+                               net_udp_endpoint_t  *udp,
+                               struct sockaddr_in  *serv,
+                               struct sockaddr_in  *peer )
+{
+    struct ip_mreq      mreq;
+    struct in_addr      iface;
+    int                 on = 1;
+    int                 r = 0;
+
+    memset( serv, 0, sizeof(struct sockaddr_in) );
+    memset( peer, 0, sizeof(struct sockaddr_in) );
+    memset( &mreq, 0, sizeof(mreq) );
+    memset( &iface, 0, sizeof(iface) );
+
+    serv->sin_family = AF_INET;
+    serv->sin_addr.s_addr = INADDR_ANY;
+    serv->sin_port = htons( udp->port );
+
+    if( udp->bind )
+        r |= __parse_ipv4( udp->bind, &serv->sin_addr.s_addr );
+    else
+    if( udp->group && udp->port )
+        r |= __parse_ipv4( udp->group, &serv->sin_addr.s_addr );
+
+    if( udp->iface )
+        r |= __parse_ipv4( udp->iface, &iface.s_addr );
+
+    if( udp->dest )
+    {
+        peer->sin_family = AF_INET;
+        peer->sin_port = htons( udp->dest_port );
+
+        r |= __parse_ipv4( udp->dest, &peer->sin_addr.s_addr );
+    }
+
+    if( r )
+        return -1;
+
+    r |= __set_sock_opt( fd, SOL_SOCKET, SO_RCVBUF,
+                         udp->rcvbuf, "SO_RCVBUF" );
+    r |= __set_sock_opt( fd, SOL_SOCKET, SO_SNDBUF,
+                         udp->sndbuf, "SO_SNDBUF" );
+    r |= __set_sock_opt( fd, IPPROTO_IP, IP_TOS,
+                         udp->tos, "IP_TOS" );
+    r |= __set_sock_opt( fd, IPPROTO_IP, IP_MULTICAST_TTL,
+                         udp->mcast_ttl, "IP_MULTICAST_TTL" );
+    r |= __set_sock_opt( fd, IPPROTO_IP, IP_MULTICAST_LOOP,
+                         udp->mcast_loop, "IP_MULTICAST_LOOP" );
+    r |= __set_sock_opt( fd, SOL_SOCKET, SO_TIMESTAMPNS,
+                         on, "SO_TIMESTAMPNS" );
+
+    if( r )
+        return -1;
+
+    if( udp->iface &&
+        setsockopt( fd, IPPROTO_IP, IP_MULTICAST_IF,
+                    (void *) &iface, sizeof(iface) ) )
+    {
+        LOGE( "fd:%x iface:%s errno:%d strerror:%s",
+              fd, udp->iface, errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    if( bind( fd, (struct sockaddr *) serv,
+              sizeof(struct sockaddr_in) ) == -1 )
+    {
+        LOGE( "fd:%x endpoint:%s port:%d errno:%d strerror:%s",
+              fd, udp->name, udp->port, errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    if( !udp->group || !udp->port )
+        return 0;
+
+    r = __parse_ipv4( udp->group, &mreq.imr_multiaddr.s_addr );
+    c_assert( !r );
+
+    mreq.imr_interface = iface;
+
+    if( setsockopt( fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                    (void *) &mreq, sizeof(mreq) ) )
+    {
+        LOGE( "fd:%x group:%s iface:%s errno:%d strerror:%s",
+              fd, udp->group, udp->iface ? udp->iface : "any",
+              errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    LOG( "fd:%x endpoint:%s group:%s iface:%s port:%d",
+         fd, udp->name, udp->group,
+         udp->iface ? udp->iface : "any", udp->port );
+
+    return 0;
+}
+
+static xsk_t *__open_xsk( net_udp_endpoint_t *udp )
+{
+    xsk_t              *xsk;
+    bool                drv_mode;
+
+    drv_mode = udp->xdp_mode && !strcmp( udp->xdp_mode, "drv" );
+
+    xsk = xdp_open( udp->xdp_ifname, udp->xdp_queue, udp->port, drv_mode );
+
+    if( !xsk )
+        return NULL;
+
+    if( xdp_fd( xsk ) > NET_MAX_FD )
+    {
+        LOGE( "fd:%x", xdp_fd( xsk ) );
+
+        PROPER_CLOSE_FD( xdp_fd( xsk ) );
+        xdp_close( xsk );
+
+        G_net_errno = NET_ERRNO_CONN_MAX;
+        return NULL;
+    }
+
+    return xsk;
+}
+
+static void __start_udp( ctx_t *ctx )
+{
+    c_assert( !ctx->ssl && ctx->dirn == D_UDP &&
+              !ctx->state && !ctx->state_tmr_id );
+
+    ctx->state = &g_ctx_state[S_UDP];
+    c_assert( ctx->state->st == S_UDP );
+
+    /* NOTE: EPOLLOUT was enabled during EPOLL_CTL_ADD, *
+     *       datagrams aren't queued, so it's not used  */
+    __add_to_epoll( ctx );
+    __disable_write( ctx );
+}
+
+/* NOTE: frames are returned to the kernel after the callback */
+static void __xsk_read_cb( ctx_t *ctx )
+{
+    udp_rx_t           *rx = ctx->cold->udp_rx;
+    conn_id_t           prev_id = ctx->id;
+    int                 r;
+
+    r = xdp_recv( ctx->cold->xsk, rx->dgrams, rx->batch );
+
+    if( r > 0 )
+    {
+        rx->total_dgrams += r;
+        rx->total_batches++;
+
+        LOGD( "id:0x%llx host:%s:%s dgrams:%d",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, r );
+
+        ctx->cold->dgram_uh_cb( ctx->id, ctx->udata_id, rx->dgrams, r );
+
+        c_assert( ctx->id == prev_id );
+    }
+
+    xdp_release( ctx->cold->xsk );
+}
+
+static void __udp_read_cb( ctx_t *ctx )
+{
+    udp_rx_t           *rx = ctx->cold->udp_rx;
+    conn_id_t           prev_id = ctx->id;
+    struct mmsghdr     *msg;
+    struct cmsghdr     *cmsg;
+    net_dgram_t        *dgram;
+    int                 r, syserr;
+    int                 i;
+
+    if( ctx->cold->xsk )
+    {
+        __xsk_read_cb( ctx );
+        return;
+    }
+
+    errno = 0;
+    while( (r = recvmmsg( ctx->fd, rx->msgs, rx->batch,
+                          MSG_DONTWAIT, NULL )) == -1 && errno == EINTR )
+        errno = 0;
+
+    syserr = errno;
+
+    if( r == -1 )
+    {
+        if( syserr == EAGAIN )
+        {
+            LOGD( "id:0x%llx host:%s:%s",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+            return;
+        }
+
+        /* NOTE: e.g. ICMP error for a sent datagram, it's *
+         *       reported once, so the socket is kept      */
+        LOGE( "id:0x%llx host:%s:%s errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              syserr, strerror( syserr ) );
+
+        return;
+    }
+
+    for( i = 0; i < r; i++ )
+    {
+        msg = &rx->msgs[i];
+        dgram = &rx->dgrams[i];
+
+        dgram->buf = rx->iovs[i].iov_base;
+        dgram->len = msg->msg_len;
+        dgram->ip = rx->addrs[i].sin_addr.s_addr;
+        dgram->port = rx->addrs[i].sin_port;
+        dgram->is_truncated = !!(msg->msg_hdr.msg_flags & MSG_TRUNC);
+
+        memset( &dgram->ts, 0, sizeof(dgram->ts) );
+
+        for( cmsg = CMSG_FIRSTHDR( &msg->msg_hdr );
+             cmsg;
+             cmsg = CMSG_NXTHDR( &msg->msg_hdr, cmsg ) )
+        {
+            if( cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_TIMESTAMPNS )
+            {
+                memcpy( &dgram->ts, CMSG_DATA( cmsg ),
+                        sizeof(dgram->ts) );
+            }
+        }
+
+        if( dgram->is_truncated )
+        {
+            rx->total_truncated++;
+
+            LOGE( "id:0x%llx host:%s:%s len:%d dgram_size:%d",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  dgram->len, rx->dgram_size );
+        }
+
+        __reset_udp_msg( rx, i );
+    }
+
+    rx->total_dgrams += r;
+    rx->total_batches++;
+
+    LOGD( "id:0x%llx host:%s:%s dgrams:%d",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, r );
+
+    ctx->cold->dgram_uh_cb( ctx->id, ctx->udata_id, rx->dgrams, r );
+
+    c_assert( ctx->id == prev_id );
+}
+
+static void __udp_write_cb( ctx_t *ctx )
+{
+    LOGD( "id:0x%llx host:%s:%s",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+    __disable_write( ctx );
+}
+
+/******************* Handover functions ***************************************/
+
+/* NOTE: SSL state can't be passed to another process, so only *
+ *       plain TCP listeners and idle plain TCP conns are sent */
+static bool __is_handover_ctx( ctx_t *ctx )
+{
+    if( !ctx->id || ctx->to_shutdown || ctx->is_in_destroying ||
+        !ctx->state || ctx->ssl || ctx->cold->unix_addr || ctx->is_pipe )
+    {
+        return false;
+    }
+
+    if( ctx->dirn == D_LISTEN )
+        return ctx->state->st == S_LISTENING;
+
+    if( !*cfg_net_handover_idle_conns )
+        return false;
+
+    /* NOTE: nothing may be left in buffers of the old process */
+    if( ( ctx->dirn != D_OUTGOING && ctx->dirn != D_INCOMING ) ||
+        ctx->state->st != S_ESTABLISHED || ctx->cold->tunnel_peer_id ||
+        ctx->flush_and_close || ctx->is_shut_wr_done ||
+        ctx->is_read_paused || ctx->is_read_resumed ||
+        B_HAS_USED( ctx->rb ) || ctx->wb_msgs )
+    {
+        return false;
+    }
+
+    /* NOTE: nor in the upper layer, e.g. a request waiting *
+     *       for its response                               */
+    if( ctx->cold->idle_uh_cb &&
+        !ctx->cold->idle_uh_cb( ctx->id, ctx->udata_id ) )
+    {
+        LOGD( "id:0x%llx host:%s:%s busy",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port );
+
+        return false;
+    }
+
+    return true;
+}
+
+static int __fill_handover_rec( ctx_t           *ctx,
+                                handover_rec_t  *rec )
+{
+    struct sockaddr_in      serv;
+    socklen_t               len;
+
+    memset( rec, 0, sizeof(handover_rec_t) );
+
+    rec->dirn = ctx->dirn;
+    rec->listen_port = ctx->cold->listen_port;
+    rec->use_ssl = ctx->cold->child_use_ssl;
+
+    snprintf( rec->host, sizeof(rec->host), "%s", ctx->cold->host );
+    snprintf( rec->port, sizeof(rec->port), "%s", ctx->cold->port );
+
+    if( ctx->dirn != D_INCOMING )
+        return 0;
+
+    /* NOTE: accepted conn knows its listener only by local port */
+    len = sizeof(serv);
+    if( getsockname( ctx->fd, (struct sockaddr *) &serv, &len ) )
+    {
+        LOGE( "id:0x%llx host:%s:%s errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    rec->listen_port = ntohs(serv.sin_port);
+
+    len = sizeof(rec->peer);
+    if( getpeername( ctx->fd, (struct sockaddr *) &rec->peer, &len ) )
+    {
+        LOGE( "id:0x%llx host:%s:%s errno:%d strerror:%s",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static int __send_handover_msg( int             fd,
+                                handover_msg_t *ho_msg,
+                                int            *fds )
+{
+    struct msghdr       msg;
+    struct iovec        iov;
+    struct cmsghdr     *cmsg;
+    char                cbuf[CMSG_SPACE(sizeof(int) * HANDOVER_BATCH)];
+    ssize_t             r;
+
+    ho_msg->magic = HANDOVER_MAGIC;
+
+    iov.iov_base = ho_msg;
+    iov.iov_len = offsetof( handover_msg_t, recs ) +
+                  ho_msg->total * sizeof(handover_rec_t);
+
+    memset( &msg, 0, sizeof(msg) );
+    memset( cbuf, 0, sizeof(cbuf) );
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if( ho_msg->total )
+    {
+        msg.msg_control = cbuf;
+        msg.msg_controllen = CMSG_SPACE( sizeof(int) * ho_msg->total );
+
+        cmsg = CMSG_FIRSTHDR( &msg );
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN( sizeof(int) * ho_msg->total );
+        memcpy( CMSG_DATA( cmsg ), fds, sizeof(int) * ho_msg->total );
+    }
+
+    /* NOTE: the socket is blocking, accept() doesn't inherit O_NONBLOCK */
+    errno = 0;
+    while( (r = sendmsg( fd, &msg, MSG_NOSIGNAL )) == -1 &&
+           errno == EINTR )
+        errno = 0;
+
+    if( r != (ssize_t) iov.iov_len )
+    {
+        LOGE( "fd:%x total:%u ret:%zd errno:%d strerror:%s",
+              fd, ho_msg->total, r, errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/* NOTE: sockets of a sent batch are closed here without shutdown() */
+static void __mark_handed_over( ctx_t **items, int total )
+{
+    int                 i;
+
+    for( i = 0; i < total; i++ )
+    {
+        LOG( "id:0x%llx fd:%x host:%s:%s dirn:%d listen_port:%d",
+             NET_ID_FMT( items[i]->id ), items[i]->fd,
+             items[i]->cold->host, items[i]->cold->port,
+             items[i]->dirn, items[i]->cold->listen_port );
+
+        items[i]->is_handed_over = true;
+        items[i]->to_shutdown = true;
+    }
+}
+
+/* NOTE: a new process connects here at start, it gets listeners *
+ *       and idle conns, and this process drains the rest        */
+/* NOTE: fds of all conns go over the socket, so only a  *
+ *       process of the same user may be the other side  */
+static int __check_handover_peer( int fd )
+{
+    struct ucred            cred;
+    socklen_t               len = sizeof(cred);
+
+    if( getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &cred, &len ) )
+    {
+        LOGE( "fd:%x errno:%d strerror:%s", fd, errno, strerror( errno ) );
+        return -1;
+    }
+
+    if( cred.uid != geteuid() )
+    {
+        LOGE( "fd:%x peer_pid:%d peer_uid:%u euid:%u",
+              fd, cred.pid, cred.uid, geteuid() );
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static void __handover_cb( ctx_t *ctx )
+{
+    ctx_t              *items[HANDOVER_BATCH];
+    int                 fds[HANDOVER_BATCH];
+    handover_msg_t     *ho_msg;
+    ctx_t              *item;
+    int                 handed = 0;
+    int                 r = 0;
+    int                 fd, n;
+
+    errno = 0;
+    while( (fd = accept4( ctx->fd, NULL, NULL, SOCK_CLOEXEC )) == -1 &&
+           errno == EINTR )
+        errno = 0;
+
+    if( fd == -1 )
+    {
+        if( errno != EAGAIN && errno != EWOULDBLOCK )
+        {
+            LOGE( "id:0x%llx path:%s errno:%d strerror:%s",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host,
+                  errno, strerror( errno ) );
+        }
+
+        return;
+    }
+
+    LOG( "id:0x%llx path:%s new_fd:%x",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, fd );
+
+    /* NOTE: keep listening, the right process may come next */
+    if( __check_handover_peer( fd ) )
+    {
+        PROPER_CLOSE_FD( fd );
+        return;
+    }
+
+    /* NOTE: the new process binds the path after the last message, *
+     *       so it mustn't be unlinked at cleanup after that        */
+    unlink( ctx->cold->unix_addr->sun_path );
+
+    free( ctx->cold->unix_addr );
+    ctx->cold->unix_addr = NULL;
+
+    ctx->to_shutdown = true;
+
+    ho_msg = malloc( sizeof(handover_msg_t) );
+    ho_msg->total = 0;
+
+    /* NOTE: Warning - O(n), only once per process */
+    for( n = 0; n <= NET_MAX_FD && !r; n++ )
+    {
+        item = &g_ctx_array[n];
+
+        if( !__is_handover_ctx( item ) ||
+            __fill_handover_rec( item, &ho_msg->recs[ho_msg->total] ) )
+        {
+            continue;
+        }
+
+        items[ho_msg->total] = item;
+        fds[ho_msg->total] = item->fd;
+
+        if( ++ho_msg->total < HANDOVER_BATCH )
+            continue;
+
+        r = __send_handover_msg( fd, ho_msg, fds );
+
+        if( !r )
+        {
+            __mark_handed_over( items, ho_msg->total );
+            handed += ho_msg->total;
+        }
+
+        ho_msg->total = 0;
+    }
+
+    if( !r && ho_msg->total )
+    {
+        r = __send_handover_msg( fd, ho_msg, fds );
+
+        if( !r )
+        {
+            __mark_handed_over( items, ho_msg->total );
+            handed += ho_msg->total;
+        }
+    }
+
+    /* NOTE: message without records is the end */
+    if( !r )
+    {
+        ho_msg->total = 0;
+        r = __send_handover_msg( fd, ho_msg, fds );
+    }
+
+    free( ho_msg );
+
+    PROPER_CLOSE_FD( fd );
+
+    /* NOTE: what's not handed over is still served by this process */
+    if( r )
+    {
+        LOGE( "id:0x%llx handed:%d", NET_ID_FMT( ctx->id ), handed );
+        return;
+    }
+
+    timeradd( &G_now, cfg_net_handover_drain_timeout,
+              &g_handover_drain_until );
+
+    LOG( "id:0x%llx handed:%d ctx_total:%d drain_timeout:%ld:%ld",
+         NET_ID_FMT( ctx->id ), handed, g_ctx_total,
+         cfg_net_handover_drain_timeout->tv_sec,
+         cfg_net_handover_drain_timeout->tv_usec );
+}
+
+static void __handover_clo_cb( conn_id_t    conn_id,
+                               ptr_id_t     udata_id,
+                               int          code )
+{
+    LOG( "conn_id:0x%llx code:%d", NET_ID_FMT( conn_id ), code );
+}
+
+/* NOTE: it's not an error if the path is unusable, *
+ *       the next process just starts from scratch  */
+static void __handover_listen()
+{
+    ctx_t                  *ctx;
+    struct sockaddr_un     *addr;
+    int                     fd;
+
+    addr = __make_unix_addr( cfg_net_handover_path );
+    if( !addr )
+        return;
+
+    if( __remove_stale_unix_path( addr, SOCK_SEQPACKET ) )
+    {
+        free( addr );
+        return;
+    }
+
+    fd = __create_socket( AF_UNIX, SOCK_SEQPACKET );
+    if( fd == -1 )
+    {
+        LOGE( "path:%s", cfg_net_handover_path );
+
+        free( addr );
+        return;
+    }
+
+    /* NOTE: bind creates the path with the socket inode mode, *
+     *       so other users can't even connect to it           */
+    if( fchmod( fd, S_IRUSR | S_IWUSR ) == -1 ||
+        bind( fd, (struct sockaddr *) addr,
+              sizeof(struct sockaddr_un) ) == -1 ||
+        listen( fd, BACKLOG ) == -1 )
+    {
+        LOGE( "path:%s errno:%d strerror:%s",
+              cfg_net_handover_path, errno, strerror( errno ) );
+
+        PROPER_CLOSE_FD( fd );
+        free( addr );
+        return;
+    }
+
+    ctx = __init_new_ctx( fd );
+    c_assert( ctx );
+
+    ctx->cold->unix_addr = addr;
+    ctx->is_seqpacket = true;
+
+    snprintf( ctx->cold->host, sizeof(ctx->cold->host), "%s",
+              cfg_net_handover_path );
+    snprintf( ctx->cold->port, sizeof(ctx->cold->port), "%s", "seqp" );
+
+    ctx->clo_uh_cb = __handover_clo_cb;
+
+    ctx->dirn = D_LISTEN;
+
+    ctx->state = &g_ctx_state[S_HANDOVER];
+    c_assert( ctx->state->st == S_HANDOVER );
+
+    __add_to_epoll( ctx );
+
+    /* NOTE: the same excessive call as in __start_listen */
+    __disable_write( ctx );
+
+    LOG( "id:0x%llx fd:%x path:%s",
+         NET_ID_FMT( ctx->id ), ctx->fd, cfg_net_handover_path );
+}
+
+static void __add_handover_node( int                fd,
+                                 handover_rec_t    *rec )
+{
+    handover_node_t    *node;
+
+    LOG( "fd:%x dirn:%d listen_port:%d use_ssl:%d host:%s:%s",
+         fd, rec->dirn, rec->listen_port, rec->use_ssl,
+         rec->host, rec->port );
+
+    if( fd > NET_MAX_FD ||
+        (rec->dirn != D_LISTEN && rec->dirn != D_OUTGOING &&
+         rec->dirn != D_INCOMING) )
+    {
+        LOGE( "fd:%x dirn:%d", fd, rec->dirn );
+
+        PROPER_CLOSE_FD( fd );
+        return;
+    }
+
+    node = malloc( sizeof(handover_node_t) );
+    memset( node, 0, sizeof(handover_node_t) );
+
+    node->fd = fd;
+    node->rec = *rec;
+
+    node->rec.host[sizeof(node->rec.host) - 1] = '\0';
+    node->rec.port[sizeof(node->rec.port) - 1] = '\0';
+
+    LL_ADD_NODE( &g_handover_list, node );
+}
+
+static void __del_handover_node( handover_node_t *node )
+{
+    LL_DEL_NODE( &g_handover_list, node->id );
+
+    memset( node, 0, sizeof(handover_node_t) );
+    free( node );
+}
+
+/* NOTE: blocking, it's called from net_init before the main loop */
+static void __handover_receive()
+{
+    struct sockaddr_un     *addr;
+    handover_msg_t         *ho_msg;
+    struct msghdr           msg;
+    struct iovec            iov;
+    struct cmsghdr         *cmsg;
+    char                    cbuf[CMSG_SPACE(sizeof(int) * HANDOVER_BATCH)];
+    int                     fds[HANDOVER_BATCH];
+    struct timeval          tv = { HANDOVER_RECV_TIMEOUT, 0 };
+    struct timeval          now;
+    bool                    is_end = false;
+    ssize_t                 r;
+    int                     nfds, i;
+    int                     fd;
+
+    addr = __make_unix_addr( cfg_net_handover_path );
+    if( !addr )
+        return;
+
+    fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+    if( fd == -1 )
+    {
+        LOGE( "path:%s errno:%d strerror:%s",
+              cfg_net_handover_path, errno, strerror( errno ) );
+
+        free( addr );
+        return;
+    }
+
+    if( setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) ) ||
+        connect( fd, (struct sockaddr *) addr, sizeof(struct sockaddr_un) ) )
+    {
+        /* NOTE: ENOENT or ECONNREFUSED, nobody to take over from */
+        LOG( "path:%s errno:%d strerror:%s",
+             cfg_net_handover_path, errno, strerror( errno ) );
+
+        PROPER_CLOSE_FD( fd );
+        free( addr );
+        return;
+    }
+
+    free( addr );
+
+    if( __check_handover_peer( fd ) )
+    {
+        PROPER_CLOSE_FD( fd );
+        return;
+    }
+
+    ho_msg = malloc( sizeof(handover_msg_t) );
+
+    while( !is_end )
+    {
+        iov.iov_base = ho_msg;
+        iov.iov_len = sizeof(handover_msg_t);
+
+        memset( &msg, 0, sizeof(msg) );
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+
+        errno = 0;
+        while( (r = recvmsg( fd, &msg, MSG_CMSG_CLOEXEC )) == -1 &&
+               errno == EINTR )
+            errno = 0;
+
+        nfds = 0;
+        cmsg = r > 0 ? CMSG_FIRSTHDR( &msg ) : NULL;
+
+        if( cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS )
+        {
+            nfds = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof(int);
+            memcpy( fds, CMSG_DATA( cmsg ), nfds * sizeof(int) );
+        }
+
+        if( r < (ssize_t) offsetof( handover_msg_t, recs ) ||
+            (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+            ho_msg->magic != HANDOVER_MAGIC ||
+            ho_msg->total > HANDOVER_BATCH ||
+            r != (ssize_t) (offsetof( handover_msg_t, recs ) +
+                            ho_msg->total * sizeof(handover_rec_t)) ||
+            nfds != (int) ho_msg->total )
+        {
+            LOGE( "path:%s ret:%zd nfds:%d errno:%d strerror:%s",
+                  cfg_net_handover_path, r, nfds,
+                  errno, strerror( errno ) );
+
+            for( i = 0; i < nfds; i++ )
+                PROPER_CLOSE_FD( fds[i] );
+
+            break;
+        }
+
+        for( i = 0; i < nfds; i++ )
+            __add_handover_node( fds[i], &ho_msg->recs[i] );
+
+        is_end = !ho_msg->total;
+    }
+
+    free( ho_msg );
+
+    PROPER_CLOSE_FD( fd );
+
+    r = gettimeofday( &now, NULL );
+    c_assert( !r );
+
+    g_handover_adopt_until = now;
+    g_handover_adopt_until.tv_sec += HANDOVER_ADOPT_TIMEOUT;
+
+    LOG( "path:%s inherited:%d is_end:%d",
+         cfg_net_handover_path, g_handover_list.total, is_end );
+}
+
+/* NOTE: D_LISTEN is matched by port and ssl, D_OUTGOING by host */
+static int __take_handover_fd( int      dirn,
+                               int      listen_port,
+                               bool     use_ssl,
+                               char    *host,
+                               char    *port )
+{
+    handover_node_t    *node;
+    int                 fd;
+
+    if( !g_handover_list.total )
+        return -1;
+
+    LL_CHECK( &g_handover_list, g_handover_list.head );
+    node = PTRID_GET_PTR( g_handover_list.head );
+
+    while( node )
+    {
+        LL_CHECK( &g_handover_list, node->id );
+
+        if( node->rec.dirn == dirn &&
+            (dirn != D_LISTEN ||
+             (node->rec.listen_port == listen_port &&
+              node->rec.use_ssl == use_ssl)) &&
+            (dirn != D_OUTGOING ||
+             (!strcmp( node->rec.host, host ) &&
+              !strcmp( node->rec.port, port ))) )
+        {
+            fd = node->fd;
+
+            LOG( "fd:%x dirn:%d listen_port:%d host:%s:%s",
+                 fd, dirn, node->rec.listen_port,
+                 node->rec.host, node->rec.port );
+
+            __del_handover_node( node );
+
+            return fd;
+        }
+
+        node = PTRID_GET_PTR( node->next );
+    }
+
+    return -1;
+}
+
+static void __adopt_handover_accepted( ctx_t *listen_ctx )
+{
+    handover_node_t    *node;
+    handover_rec_t      rec;
+    int                 fd;
+
+    if( !g_handover_list.total )
+        return;
+
+    LL_CHECK( &g_handover_list, g_handover_list.head );
+    node = PTRID_GET_PTR( g_handover_list.head );
+
+    while( node )
+    {
+        LL_CHECK( &g_handover_list, node->id );
+
+        if( node->rec.dirn == D_INCOMING &&
+            node->rec.listen_port == listen_ctx->cold->listen_port )
+        {
+            fd = node->fd;
+            rec = node->rec;
+
+            __del_handover_node( node );
+
+            /* NOTE: it's established, so est_uh_cb is called at once */
+            __create_accepted( listen_ctx, fd, &rec.peer );
+
+            if( listen_ctx->to_shutdown )
+                return;
+
+            /* NOTE: user handlers could take other nodes */
+            node = PTRID_GET_PTR( g_handover_list.head );
+            continue;
+        }
+
+        node = PTRID_GET_PTR( node->next );
+    }
+}
+
+static void __expire_handover_list()
+{
+    handover_node_t    *node;
+    handover_node_t    *node_next;
+
+    if( !g_handover_list.total ||
+        timercmp( &G_now, &g_handover_adopt_until, < ) )
+    {
+        return;
+    }
+
+    LL_CHECK( &g_handover_list, g_handover_list.head );
+    node = PTRID_GET_PTR( g_handover_list.head );
+
+    while( node )
+    {
+        LL_CHECK( &g_handover_list, node->id );
+        node_next = PTRID_GET_PTR( node->next );
+
+        LOG( "fd:%x dirn:%d listen_port:%d host:%s:%s is not adopted",
+             node->fd, node->rec.dirn, node->rec.listen_port,
+             node->rec.host, node->rec.port );
+
+        PROPER_CLOSE_FD( node->fd );
+
+        __del_handover_node( node );
+
+        node = node_next;
+    }
+}
+
+static bool __is_handover_drained()
+{
+    if( !timerisset( &g_handover_drain_until ) )
+        return false;
+
+    if( g_ctx_total && timercmp( &G_now, &g_handover_drain_until, < ) )
+        return false;
+
+    LOG( "ctx_total:%d", g_ctx_total );
+
+    return true;
+}
+
+/******************* Async queue functions ************************************/
+
+/* NOTE: it can be called from any thread, so no logging */
+static void __async_wakeup( async_queue_t *q )
+{
+    uint64_t            one = 1;
+
+    if( __atomic_exchange_n( &q->is_wakeup_pending, 1, __ATOMIC_SEQ_CST ) )
+        return;
+
+    while( write( q->wakeup_fd, &one, sizeof(one) ) == -1 &&
+           errno == EINTR )
+        ;
+}
+
+static void __async_push( async_queue_t *q, async_node_t *node )
+{
+    async_node_t       *prev;
+
+    __atomic_store_n( &node->next, NULL, __ATOMIC_RELAXED );
+
+    prev = __atomic_exchange_n( &q->head, node, __ATOMIC_ACQ_REL );
+
+    /* NOTE: the loop can't see node until this store */
+    __atomic_store_n( &prev->next, node, __ATOMIC_RELEASE );
+}
+
+/* NOTE: loop thread only, NULL may also mean that a producer *
+ *       is between two stores, it wakes the loop after that  */
+static async_node_t *__async_pop( async_queue_t *q )
+{
+    async_node_t       *tail = q->tail;
+    async_node_t       *next;
+
+    next = __atomic_load_n( &tail->next, __ATOMIC_ACQUIRE );
+
+    if( tail == &q->stub )
+    {
+        if( !next )
+            return NULL;
+
+        q->tail = next;
+        tail = next;
+
+        next = __atomic_load_n( &tail->next, __ATOMIC_ACQUIRE );
+    }
+
+    if( next )
+    {
+        q->tail = next;
+        return tail;
+    }
+
+    if( tail != __atomic_load_n( &q->head, __ATOMIC_ACQUIRE ) )
+        return NULL;
+
+    /* NOTE: the last node is taken, stub becomes the tail */
+    __async_push( q, &q->stub );
+
+    next = __atomic_load_n( &tail->next, __ATOMIC_ACQUIRE );
+
+    if( next )
+    {
+        q->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+static int __async_enqueue( async_cmd_t *cmd )
+{
+    __async_push( &g_async_queue, &cmd->node );
+
+    __async_wakeup( &g_async_queue );
+
+    return 0;
+}
+
+static void __call_async_cmd( async_cmd_t *cmd )
+{
+    ctx_t              *ctx = NULL;
+
+    if( cmd->type == ASYNC_CALL )
+    {
+        __watchdog_mark( 0, cmd->cb );
+
+        cmd->cb( cmd->udata_id );
+        return;
+    }
+
+    if( cmd->type == ASYNC_OFFLOAD )
+    {
+        cmd->done_cb( cmd->arg );
+        return;
+    }
+
+    if( cmd->conn_id )
+        ctx = __find_ctx( cmd->conn_id );
+
+    if( !ctx || !ctx->state || ctx->to_shutdown ||
+        ctx->is_in_destroying || ctx->flush_and_close ||
+        (cmd->type == ASYNC_POST &&
+         ctx->state->st != S_ESTABLISHED &&
+         ctx->state->st != S_SSL_ESTABLISHED) ||
+        (cmd->type == ASYNC_SHUTDOWN &&
+         ctx->state->st == S_SSL_SHUTDOWN) )
+    {
+        LOG( "id:0x%llx type:%d len:%lu is dropped",
+             NET_ID_FMT( cmd->conn_id ), cmd->type, cmd->len );
+
+        return;
+    }
+
+    if( cmd->type == ASYNC_POST )
+    {
+        net_post_data_prio( cmd->conn_id, cmd->data, cmd->len,
+                            cmd->flush_and_close, cmd->prio );
+    }
+    else
+    {
+        c_assert( cmd->type == ASYNC_SHUTDOWN );
+
+        net_shutdown_conn( cmd->conn_id, cmd->flush_and_close );
+    }
+}
+
+/* NOTE: at most ASYNC_BATCH commands per iteration, *
+ *       so the reactor isn't starved by producers   */
+static void __call_async_cmds()
+{
+    async_queue_t      *q = &g_async_queue;
+    async_node_t       *node;
+    uint64_t            val;
+    int                 i;
+
+    if( read( q->wakeup_fd, &val, sizeof(val) ) == -1 && errno != EAGAIN )
+    {
+        LOGE( "fd:%x errno:%d strerror:%s",
+              q->wakeup_fd, errno, strerror( errno ) );
+    }
+
+    /* NOTE: it's cleared before pop, so a producer *
+     *       which comes later wakes the loop again */
+    __atomic_store_n( &q->is_wakeup_pending, 0, __ATOMIC_SEQ_CST );
+
+    for( i = 0; i < ASYNC_BATCH; i++ )
+    {
+        node = __async_pop( q );
+        if( !node )
+            break;
+
+        __call_async_cmd( (async_cmd_t *) node );
+
+        free( node );
+    }
+
+    if( i == ASYNC_BATCH )
+        __async_wakeup( q );
+
+    LOGD( "cmds:%d", i );
+}
+
+static void __init_async_queue()
+{
+    async_queue_t      *q = &g_async_queue;
+    struct epoll_event  event;
+    int                 r;
+
+    memset( q, 0, sizeof(async_queue_t) );
+
+    q->head = &q->stub;
+    q->tail = &q->stub;
+
+    q->wakeup_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    c_assert( q->wakeup_fd >= 0 );
+
+    event.events = EPOLLIN;
+    event.data.fd = ASYNC_EPOLL_FD;
+
+    r = epoll_ctl( g_epollfd, EPOLL_CTL_ADD, q->wakeup_fd, &event );
+    c_assert( !r );
+
+    LOG( "wakeup_fd:%x", q->wakeup_fd );
+}
+
+/******************* Offload pool functions ***********************************/
+
+/* NOTE: offload threads never log, logger isn't thread safe */
+static void __offload_ring_push( offload_worker_t  *w,
+                                 async_cmd_t       *cmd )
+{
+    async_cmd_t       **jobs;
+    unsigned            i, n;
+
+    pthread_mutex_lock( &w->lock );
+
+    n = w->tail - w->head;
+
+    if( n == w->size )
+    {
+        jobs = malloc( 2 * w->size * sizeof(async_cmd_t *) );
+        c_assert( jobs );
+
+        for( i = 0; i < n; i++ )
+            jobs[i] = w->jobs[(w->head + i) & (w->size - 1)];
+
+        free( w->jobs );
+
+        w->jobs = jobs;
+        w->size *= 2;
+        w->head = 0;
+        w->tail = n;
+    }
+
+    w->jobs[w->tail & (w->size - 1)] = cmd;
+    w->tail++;
+
+    pthread_mutex_unlock( &w->lock );
+}
+
+static async_cmd_t *__offload_ring_pop( offload_worker_t   *w,
+                                        bool                is_steal )
+{
+    async_cmd_t        *cmd = NULL;
+
+    pthread_mutex_lock( &w->lock );
+
+    if( w->head != w->tail )
+    {
+        if( is_steal )
+        {
+            w->tail--;
+            cmd = w->jobs[w->tail & (w->size - 1)];
+        }
+        else
+        {
+            cmd = w->jobs[w->head & (w->size - 1)];
+            w->head++;
+        }
+    }
+
+    pthread_mutex_unlock( &w->lock );
+
+    return cmd;
+}
+
+static async_cmd_t *__offload_take( offload_worker_t *w )
+{
+    offload_pool_t     *pool = &g_offload_pool;
+    async_cmd_t        *cmd;
+    int                 i;
+
+    cmd = __offload_ring_pop( w, false );
+
+    /* NOTE: a long job mustn't hold the jobs queued behind it */
+    for( i = 1; !cmd && i < pool->total; i++ )
+    {
+        cmd = __offload_ring_pop( &pool->workers[(w->ndx + i) % pool->total],
+                                  true );
+
+        if( cmd )
+            __atomic_add_fetch( &pool->total_steals, 1, __ATOMIC_RELAXED );
+    }
+
+    if( cmd )
+        __atomic_sub_fetch( &pool->queued, 1, __ATOMIC_SEQ_CST );
+
+    return cmd;
+}
+
+static void *__offload_thread( void *arg )
+{
+    offload_pool_t     *pool = &g_offload_pool;
+    offload_worker_t   *w = arg;
+    async_cmd_t        *cmd;
+
+    while( true )
+    {
+        cmd = __offload_take( w );
+
+        if( !cmd )
+        {
+            pthread_mutex_lock( &pool->idle_lock );
+
+            pool->idle++;
+
+            while( !__atomic_load_n( &pool->queued, __ATOMIC_SEQ_CST ) )
+                pthread_cond_wait( &pool->idle_cond, &pool->idle_lock );
+
+            pool->idle--;
+
+            pthread_mutex_unlock( &pool->idle_lock );
+            continue;
+        }
+
+        cmd->fn( cmd->arg );
+
+        /* NOTE: completion goes back the same way as net_async_call */
+        __async_enqueue( cmd );
+    }
+
+    return NULL;
+}
+
+static void __offload_submit( async_cmd_t *cmd )
+{
+    offload_pool_t     *pool = &g_offload_pool;
+    offload_worker_t   *w;
+
+    w = &pool->workers[pool->next];
+    pool->next = ( pool->next + 1 ) % pool->total;
+
+    __offload_ring_push( w, cmd );
+
+    pool->total_jobs++;
+
+    /* NOTE: it's counted before the check under idle_lock, *
+     *       so a thread going to sleep can't miss the job  */
+    __atomic_add_fetch( &pool->queued, 1, __ATOMIC_SEQ_CST );
+
+    pthread_mutex_lock( &pool->idle_lock );
+
+    if( pool->idle )
+        pthread_cond_signal( &pool->idle_cond );
+
+    pthread_mutex_unlock( &pool->idle_lock );
+}
+
+static void __init_offload_pool()
+{
+    offload_pool_t     *pool = &g_offload_pool;
+    offload_worker_t   *w;
+    sigset_t            all, old;
+    int                 r, i;
+
+    memset( pool, 0, sizeof(offload_pool_t) );
+
+    c_assert( *cfg_net_offload_threads >= 0 &&
+              *cfg_net_offload_threads <= OFFLOAD_MAX_THREADS );
+
+    if( !*cfg_net_offload_threads )
+        return;
+
+    pool->total = *cfg_net_offload_threads;
+
+    pool->workers = aligned_alloc( CACHE_LINE_SIZE,
+                                   pool->total * sizeof(offload_worker_t) );
+    c_assert( pool->workers );
+
+    memset( pool->workers, 0, pool->total * sizeof(offload_worker_t) );
+
+    pthread_mutex_init( &pool->idle_lock, NULL );
+    pthread_cond_init( &pool->idle_cond, NULL );
+
+    /* NOTE: signals are handled by the loop thread only */
+    sigfillset( &all );
+    pthread_sigmask( SIG_BLOCK, &all, &old );
+
+    for( i = 0; i < pool->total; i++ )
+    {
+        w = &pool->workers[i];
+
+        pthread_mutex_init( &w->lock, NULL );
+
+        w->ndx = i;
+        w->size = OFFLOAD_RING_SIZE;
+        w->jobs = malloc( w->size * sizeof(async_cmd_t *) );
+        c_assert( w->jobs );
+
+        r = pthread_create( &w->thread, NULL, __offload_thread, w );
+        c_assert( !r );
+    }
+
+    pthread_sigmask( SIG_SETMASK, &old, NULL );
+
+    LOG( "threads:%d", pool->total );
+}
+
+/******************* Defer and hook functions *********************************/
+
+static bool __has_deferred()
+{
+    return g_defer_queue.head != g_defer_queue.tail;
+}
+
+static void __defer_push( net_defer_cb_t    cb,
+                          ptr_id_t          udata_id )
+{
+    defer_queue_t      *q = &g_defer_queue;
+    defer_task_t       *tasks;
+    unsigned            i, n;
+
+    n = q->tail - q->head;
+
+    if( n == q->size )
+    {
+        tasks = malloc( 2 * q->size * sizeof(defer_task_t) );
+        c_assert( tasks );
+
+        for( i = 0; i < n; i++ )
+            tasks[i] = q->tasks[(q->head + i) & (q->size - 1)];
+
+        free( q->tasks );
+
+        q->tasks = tasks;
+        q->size *= 2;
+        q->head = 0;
+        q->tail = n;
+
+        LOG( "size:%u", q->size );
+    }
+
+    q->tasks[q->tail & (q->size - 1)].cb = cb;
+    q->tasks[q->tail & (q->size - 1)].udata_id = udata_id;
+    q->tail++;
+}
+
+/* NOTE: tasks deferred by these ones wait for the next iteration */
+static void __call_deferred()
+{
+    defer_queue_t      *q = &g_defer_queue;
+    defer_task_t        task;
+    unsigned            n;
+
+    n = q->tail - q->head;
+
+    while( n-- )
+    {
+        task = q->tasks[q->head & (q->size - 1)];
+        q->head++;
+
+        __watchdog_mark( 0, task.cb );
+
+        task.cb( task.udata_id );
+    }
+}
+
+static void __call_loop_hooks( net_hook_type_t type )
+{
+    ll_t               *list = &g_hook_lists[type];
+    hook_t             *hook;
+    hook_t             *hook_next;
+
+    if( !list->total )
+        return;
+
+    g_is_in_hooks = true;
+
+    LL_CHECK( list, list->head );
+    hook = PTRID_GET_PTR( list->head );
+
+    /* NOTE: hooks added by a hook are called as well */
+    while( hook )
+    {
+        if( !hook->to_delete )
+        {
+            __watchdog_mark( 0, hook->cb );
+
+            hook->cb( hook->id, hook->udata_id );
+        }
+
+        hook = PTRID_GET_PTR( hook->next );
+    }
+
+    g_is_in_hooks = false;
+
+    hook = PTRID_GET_PTR( list->head );
+
+    while( hook )
+    {
+        hook_next = PTRID_GET_PTR( hook->next );
+
+        if( hook->to_delete )
+        {
+            LL_DEL_NODE( list, hook->id );
+
+            memset( hook, 0, sizeof(hook_t) );
+            free( hook );
+        }
+
+        hook = hook_next;
+    }
+}
+
+static void __init_defer_queue()
+{
+    defer_queue_t      *q = &g_defer_queue;
+
+    memset( q, 0, sizeof(defer_queue_t) );
+    memset( g_hook_lists, 0, sizeof(g_hook_lists) );
+
+    q->size = DEFER_QUEUE_SIZE;
+    q->tasks = malloc( q->size * sizeof(defer_task_t) );
+    c_assert( q->tasks );
+}
+
+/******************* Read batch functions *************************************/
+
+static void __add_to_read_batch( ctx_t *ctx )
+{
+    read_batch_t       *b = &g_read_batch;
+
+    if( ctx->is_in_read_batch )
+        return;
+
+    c_assert( b->total < READ_BATCH_SIZE );
+
+    b->ids[b->total++] = ctx->id;
+    ctx->is_in_read_batch = true;
+}
+
+/* NOTE: conn which is gone, shut down or paused is skipped */
+static ctx_t *__find_batch_ctx( conn_id_t conn_id )
+{
+    ctx_t              *ctx;
+
+    ctx = __find_ctx( conn_id );
+
+    if( !ctx || ctx->to_shutdown || ctx->is_read_paused ||
+        !ctx->batch_r_uh_cb || !B_HAS_USED( ctx->rb ) )
+    {
+        return NULL;
+    }
+
+    return ctx;
+}
+
+/****************************************************************
+ *  NOTE: conns added during the callbacks (e.g. by another     *
+ *        conn's read) stay for the next call, a callback may   *
+ *        close or consume any conn, so ctxs are looked up      *
+ *        again before each group                               *
+ ****************************************************************/
+static void __dispatch_read_batch()
+{
+    read_batch_t       *b = &g_read_batch;
+    net_batch_r_uh_t    cb;
+    ctx_t              *ctx;
+    int                 total = b->total;
+    int                 cnt;
+    int                 i, j;
+
+    if( !total )
+        return;
+
+    for( i = 0; i < total; i++ )
+    {
+        ctx = __find_ctx( b->ids[i] );
+
+        if( ctx )
+            ctx->is_in_read_batch = false;
+    }
+
+    for( i = 0; i < total; i++ )
+    {
+        ctx = __find_batch_ctx( b->ids[i] );
+
+        if( !ctx )
+            continue;
+
+        cb = ctx->batch_r_uh_cb;
+        cnt = 0;
+
+        for( j = i; j < total; j++ )
+        {
+            ctx = __find_batch_ctx( b->ids[j] );
+
+            if( !ctx || ctx->batch_r_uh_cb != cb )
+                continue;
+
+            b->entries[cnt].conn_id = ctx->id;
+            b->entries[cnt].udata_id = ctx->udata_id;
+            b->entries[cnt].buf = B_USED_PTR( ctx->rb );
+            b->entries[cnt].len = B_USED_SIZE( ctx->rb );
+            cnt++;
+
+            b->ids[j] = 0;
+        }
+
+        LOGD( "cnt:%d total:%d", cnt, total );
+
+        __watchdog_mark( 0, cb );
+
+        cb( b->entries, cnt );
+    }
+
+    b->total -= total;
+
+    memmove( b->ids, b->ids + total, b->total * sizeof(conn_id_t) );
+}
+
+static void __init_read_batch()
+{
+    read_batch_t       *b = &g_read_batch;
+
+    b->total = 0;
+
+    b->ids = malloc( READ_BATCH_SIZE * sizeof(conn_id_t) );
+    c_assert( b->ids );
+
+    b->entries = malloc( READ_BATCH_SIZE * sizeof(net_batch_entry_t) );
+    c_assert( b->entries );
+}
+
+/******************* Warm-up functions ****************************************/
+
+/* NOTE: THP only, the range is shrunk to whole huge pages */
+static void __advise_huge_pages( void *addr, unsigned long len )
+{
+    uintptr_t           begin;
+    uintptr_t           end;
+
+    begin = ( (uintptr_t) addr + HUGE_PAGE_SIZE - 1 ) &
+            ~(uintptr_t) (HUGE_PAGE_SIZE - 1);
+    end = ( (uintptr_t) addr + len ) & ~(uintptr_t) (HUGE_PAGE_SIZE - 1);
+
+    if( end <= begin )
+        return;
+
+    if( madvise( (void *) begin, end - begin, MADV_HUGEPAGE ) )
+    {
+        LOGE( "len:%lu errno:%d strerror:%s",
+              (unsigned long) (end - begin), errno, strerror( errno ) );
+    }
+}
+
+/****************************************************************
+ *  NOTE: the heap is never trimmed and big buffers don't get   *
+ *        their own mmap, so the pages faulted in here are      *
+ *        reused by later mallocs of the loop thread            *
+ ****************************************************************/
+static void __warm_up_heap()
+{
+    char               *heap;
+
+    if( *cfg_net_warm_up_heap_size <= 0 )
+        return;
+
+    mallopt( M_MMAP_MAX, 0 );
+    mallopt( M_TRIM_THRESHOLD, -1 );
+
+    heap = malloc( *cfg_net_warm_up_heap_size );
+    c_assert( heap );
+
+    if( *cfg_net_huge_pages )
+        __advise_huge_pages( heap, *cfg_net_warm_up_heap_size );
+
+    memset( heap, 0, *cfg_net_warm_up_heap_size );
+
+    free( heap );
+}
+
+static void __log_faults( char *phase, struct rusage *from )
+{
+    struct rusage       now;
+
+    getrusage( RUSAGE_SELF, &now );
+
+    LOG( "%s major_faults:%ld minor_faults:%ld",
+         phase,
+         now.ru_majflt - from->ru_majflt,
+         now.ru_minflt - from->ru_minflt );
+}
+
+/* NOTE: it fires once, net_fault_report_time after the loop start */
+static void __fault_report_tmr_cb( conn_id_t    conn_id,
+                                   ptr_id_t     conn_udata_id,
+                                   tmr_id_t     tmr_id,
+                                   ptr_id_t     tmr_udata_id )
+{
+    int         r;
+
+    c_assert( !conn_id && tmr_id == g_fault_report_tmr_id );
+
+    __log_faults( "main loop", &g_loop_rusage );
+
+    r = net_del_global_tmr( tmr_id );
+    c_assert( !r );
+
+    g_fault_report_tmr_id = 0;
+}
+
+/******************* Load shedding functions **********************************/
+
+/* NOTE: busy time isn't measured by the virtual clock of net_sim */
+static bool __is_load_tracked()
+{
+    if( g_sim.is_on )
+        return false;
+
+    return timerisset( cfg_net_overload_lag ) || *cfg_net_overload_depth > 0;
+}
+
+/* NOTE: Warning - O(n), only when the overload state changes */
+static void __pause_accept( bool pause )
+{
+    ctx_t              *ctx;
+    int                 fd;
+
+    for( fd = 0; fd <= NET_MAX_FD; fd++ )
+    {
+        ctx = &g_ctx_array[fd];
+
+        if( !ctx->id || ctx->dirn != D_LISTEN || ctx->cold->unix_addr ||
+            ctx->to_shutdown || !ctx->state ||
+            ctx->state->st != S_LISTENING ||
+            ctx->is_read_paused == pause )
+        {
+            continue;
+        }
+
+        ctx->is_read_paused = pause;
+
+        __set_read_events( ctx, !pause );
+
+        LOG( "id:0x%llx listen_port:%d pause:%d",
+             NET_ID_FMT( ctx->id ), ctx->cold->listen_port, pause );
+    }
+}
+
+/****************************************************************
+ *  NOTE: the sample is the busy part of iter_time_diff, from   *
+ *        epoll_wait() return to the end of the iteration, so   *
+ *        an idle loop doesn't look loaded by WAIT_TIMEOUT.     *
+ *        Overload ends below a half of the thresholds, so the  *
+ *        state doesn't flap around them.                       *
+ ****************************************************************/
+static void __update_load( int depth )
+{
+    load_t             *l = &g_load;
+    struct timeval      busy;
+    long                max_lag;
+    long                lag;
+    bool                is_over;
+    bool                is_under;
+
+    timersub( &G_now, &l->poll_end, &busy );
+
+    l->lag_sum += busy.tv_sec * 1000000 + busy.tv_usec -
+                  ( l->lag_sum >> LOAD_EWMA_SHIFT );
+    l->depth_sum += depth - ( l->depth_sum >> LOAD_EWMA_SHIFT );
+
+    lag = l->lag_sum >> LOAD_EWMA_SHIFT;
+    depth = l->depth_sum >> LOAD_EWMA_SHIFT;
+
+    max_lag = cfg_net_overload_lag->tv_sec * 1000000 +
+              cfg_net_overload_lag->tv_usec;
+
+    is_over = ( max_lag && lag > max_lag ) ||
+              ( *cfg_net_overload_depth > 0 &&
+                depth > *cfg_net_overload_depth );
+
+    is_under = ( !max_lag || lag < max_lag / 2 ) &&
+               ( *cfg_net_overload_depth <= 0 ||
+                 depth < *cfg_net_overload_depth / 2 );
+
+    if( !l->is_overloaded && is_over )
+    {
+        l->is_overloaded = true;
+        l->overloads++;
+    }
+    else if( l->is_overloaded && is_under )
+        l->is_overloaded = false;
+    else
+        return;
+
+    LOG( "overloaded:%d lag:%ld depth:%d overloads:%llu",
+         l->is_overloaded, lag, depth,
+         (unsigned long long) l->overloads );
+
+    if( *cfg_net_overload_pause_accept )
+        __pause_accept( l->is_overloaded );
+}
+
+/******************* Watchdog functions ***************************************/
+
+/* NOTE: loop thread only, it's a plain pair of stores */
+static inline void __watchdog_mark( conn_id_t conn_id, void *cb )
+{
+    __atomic_store_n( &g_watchdog.conn_id, conn_id, __ATOMIC_RELAXED );
+    __atomic_store_n( &g_watchdog.cb, cb, __ATOMIC_RELAXED );
+}
+
+/****************************************************************
+ *  NOTE: it runs in the loop thread during the stall, so only  *
+ *        write() and backtrace_symbols_fd() are used. The      *
+ *        report goes before lines buffered in G_log_fh, it     *
+ *        starts with a new line as it may cut a buffered one.  *
+ *        Frames are raw addresses of ./euclid, see addr2line.  *
+ ****************************************************************/
+static void __watchdog_sig_handler( int sig )
+{
+    watchdog_t         *w = &g_watchdog;
+    int                 saved_errno = errno;
+    void               *cb;
+    int                 fd;
+    int                 n;
+
+    fd = fileno( G_log_fh );
+
+    if( write( fd, w->report, w->report_len ) == -1 )
+    {
+        errno = saved_errno;
+        return;
+    }
+
+    cb = __atomic_load_n( &w->cb, __ATOMIC_RELAXED );
+
+    if( cb )
+        backtrace_symbols_fd( &cb, 1, fd );
+
+    n = backtrace( w->frames, WATCHDOG_MAX_FRAMES );
+
+    backtrace_symbols_fd( w->frames, n, fd );
+
+    errno = saved_errno;
+}
+
+static void __watchdog_report( uint64_t iter, long stalled_us )
+{
+    watchdog_t         *w = &g_watchdog;
+    struct timeval      now;
+
+    gettimeofday( &now, NULL );
+
+    w->report_len = snprintf( w->report, sizeof(w->report),
+                              "\n%ld:%ld %.8s %s:%d %s ALERT => "
+                              "stalled_ms:%ld iter:%llu conn_id:0x%llx "
+                              "last cb and stack:\n",
+                              now.tv_sec, now.tv_usec, G_gitrev,
+                              __FILE__, __LINE__, __FUNCTION__,
+                              stalled_us / 1000,
+                              (unsigned long long) iter,
+                              NET_ID_FMT( __atomic_load_n( &w->conn_id,
+                                                    __ATOMIC_RELAXED ) ) );
+
+    if( w->report_len >= (int) sizeof(w->report) )
+        w->report_len = sizeof(w->report) - 1;
+
+    __atomic_store_n( &w->reported_iter, iter, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &w->stalls, 1, __ATOMIC_RELAXED );
+
+    pthread_kill( w->loop_thread, WATCHDOG_SIGNAL );
+}
+
+/* NOTE: a stall is reported once, when the loop doesn't finish *
+ *       an iteration within net_watchdog_budget                */
+static void *__watchdog_thread( void *arg )
+{
+    watchdog_t         *w = arg;
+    struct timespec     period;
+    struct timespec     since;
+    struct timespec     now;
+    long                budget_us;
+    long                stalled_us;
+    uint64_t            last_iter = 0;
+    uint64_t            iter;
+
+    budget_us = cfg_net_watchdog_budget->tv_sec * 1000000 +
+                cfg_net_watchdog_budget->tv_usec;
+
+    period.tv_sec = budget_us / WATCHDOG_CHECKS / 1000000;
+    period.tv_nsec = budget_us / WATCHDOG_CHECKS % 1000000 * 1000;
+
+    clock_gettime( CLOCK_MONOTONIC, &since );
+
+    while( !__atomic_load_n( &w->to_stop, __ATOMIC_RELAXED ) )
+    {
+        nanosleep( &period, NULL );
+
+        iter = __atomic_load_n( &w->iter, __ATOMIC_RELAXED );
+
+        clock_gettime( CLOCK_MONOTONIC, &now );
+
+        if( iter != last_iter )
+        {
+            last_iter = iter;
+            since = now;
+            continue;
+        }
+
+        if( iter == __atomic_load_n( &w->reported_iter, __ATOMIC_RELAXED ) )
+            continue;
+
+        stalled_us = (now.tv_sec - since.tv_sec) * 1000000 +
+                     (now.tv_nsec - since.tv_nsec) / 1000;
+
+        if( stalled_us >= budget_us )
+            __watchdog_report( iter, stalled_us );
+    }
+
+    return NULL;
+}
+
+static void __start_watchdog()
+{
+    watchdog_t         *w = &g_watchdog;
+    struct sigaction    sa;
+    sigset_t            all, old;
+    int                 r;
+    long                budget_us;
+
+    if( !timerisset( cfg_net_watchdog_budget ) )
+        return;
+
+    budget_us = cfg_net_watchdog_budget->tv_sec * 1000000 +
+                cfg_net_watchdog_budget->tv_usec;
+
+    /* NOTE: otherwise every idle iteration looks like a stall */
+    if( budget_us <= WAIT_TIMEOUT * 1000 )
+    {
+        LOGE( "budget:%ld:%ld must be above %d ms, clamped to %d ms",
+              cfg_net_watchdog_budget->tv_sec,
+              cfg_net_watchdog_budget->tv_usec,
+              WAIT_TIMEOUT, WATCHDOG_MIN_BUDGET_MS );
+
+        cfg_net_watchdog_budget->tv_sec = 0;
+        cfg_net_watchdog_budget->tv_usec = WATCHDOG_MIN_BUDGET_MS * 1000;
+    }
+
+    /* NOTE: the first call loads libgcc, it mallocs */
+    backtrace( w->frames, WATCHDOG_MAX_FRAMES );
+
+    memset( &sa, 0, sizeof(sa) );
+    sa.sa_handler = __watchdog_sig_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset( &sa.sa_mask );
+
+    r = sigaction( WATCHDOG_SIGNAL, &sa, NULL );
+    c_assert( !r );
+
+    w->loop_thread = pthread_self();
+    w->iter = 1;
+
+    /* NOTE: signals are handled by the loop thread only */
+    sigfillset( &all );
+    pthread_sigmask( SIG_BLOCK, &all, &old );
+
+    r = pthread_create( &w->thread, NULL, __watchdog_thread, w );
+    c_assert( !r );
+
+    pthread_sigmask( SIG_SETMASK, &old, NULL );
+
+    w->is_running = true;
+
+    LOG( "budget:%ld:%ld",
+         cfg_net_watchdog_budget->tv_sec, cfg_net_watchdog_budget->tv_usec );
+}
+
+/* NOTE: the loop returns on handover, so it mustn't look stalled */
+static void __stop_watchdog()
+{
+    watchdog_t         *w = &g_watchdog;
+
+    if( !w->is_running )
+        return;
+
+    __atomic_store_n( &w->to_stop, true, __ATOMIC_RELAXED );
+
+    pthread_join( w->thread, NULL );
+
+    w->is_running = false;
+
+    LOG( "stalls:%llu", (unsigned long long) w->stalls );
+}
+
+/* NOTE: the stalled iteration is logged again once it's done */
+static void __watchdog_iter_done( struct timeval *iter_time_diff )
+{
+    watchdog_t         *w = &g_watchdog;
+
+    if( __atomic_load_n( &w->reported_iter, __ATOMIC_RELAXED ) == w->iter )
+    {
+        LOGE( "stalled iter:%llu iter_time_diff:%ld:%ld",
+              (unsigned long long) w->iter,
+              iter_time_diff->tv_sec, iter_time_diff->tv_usec );
+    }
+
+    __atomic_store_n( &w->iter, w->iter + 1, __ATOMIC_RELAXED );
+}
+
+/******************* Simulation functions *************************************/
+
+/* NOTE: xorshift64*, the sequence depends only on net_sim_seed */
+static uint64_t __sim_rand()
+{
+    g_sim.rng ^= g_sim.rng >> 12;
+    g_sim.rng ^= g_sim.rng << 25;
+    g_sim.rng ^= g_sim.rng >> 27;
+
+    return g_sim.rng * 0x2545F4914F6CDD1DULL;
+}
+
+/****************************************************************
+ *  NOTE: a lost chunk comes net_sim_rto later and next chunks  *
+ *        of the same direction wait for it like in TCP, so     *
+ *        the stream keeps its order. EOF is a chunk too.       *
+ ****************************************************************/
+static void __sim_send( ctx_t          *ctx,
+                        conn_id_t       dst_id,
+                        char           *data,
+                        unsigned long   len,
+                        bool            is_eof )
+{
+    sim_chunk_t        *chunk;
+    struct timeval      due;
+
+    chunk = malloc( sizeof(sim_chunk_t) );
+    memset( chunk, 0, sizeof(sim_chunk_t) );
+
+    if( len )
+    {
+        chunk->data = malloc( len );
+        memcpy( chunk->data, data, len );
+    }
+
+    chunk->src_id = ctx->id;
+    chunk->dst_id = dst_id;
+    chunk->is_eof = is_eof;
+    chunk->len = len;
+
+    timeradd( &G_now, cfg_net_sim_latency, &due );
+
+    if( *cfg_net_sim_loss > 0 &&
+        (int) (__sim_rand() % 1000) < *cfg_net_sim_loss )
+    {
+        timeradd( &due, cfg_net_sim_rto, &due );
+        g_sim.lost++;
+    }
+
+    if( timercmp( &due, &ctx->cold->sim_due, < ) )
+        due = ctx->cold->sim_due;
+
+    chunk->due = due;
+
+    ctx->cold->sim_due = due;
+    ctx->cold->sim_inflight += len;
+
+    LL_ADD_NODE( &g_sim.chunks, chunk );
+
+    LOGD( "id:0x%llx dst_id:0x%llx len:%lu is_eof:%d due:%ld:%ld",
+          NET_ID_FMT( ctx->id ), NET_ID_FMT( dst_id ), len, is_eof,
+          due.tv_sec, due.tv_usec );
+}
+
+/* NOTE: called from __do_scheduled, a chunk to a gone conn *
+ *       is dropped like data after RST                     */
+static void __sim_deliver()
+{
+    sim_chunk_t        *chunk;
+    sim_chunk_t        *chunk_next;
+    ctx_t              *src;
+    ctx_t              *dst;
+
+    if( !g_sim.chunks.total )
+        return;
+
+    LL_CHECK( &g_sim.chunks, g_sim.chunks.head );
+    chunk = PTRID_GET_PTR( g_sim.chunks.head );
+
+    while( chunk )
+    {
+        chunk_next = PTRID_GET_PTR( chunk->next );
+
+        if( timercmp( &chunk->due, &G_now, > ) )
+        {
+            chunk = chunk_next;
+            continue;
+        }
+
+        src = __find_ctx( chunk->src_id );
+
+        if( src )
+            src->cold->sim_inflight -= chunk->len;
+
+        dst = __find_ctx( chunk->dst_id );
+
+        if( dst && !dst->is_in_destroying )
+        {
+            if( chunk->len )
+            {
+                if( B_REMAINDER_SIZE( dst->rb ) < chunk->len )
+                    B_INCREASE_BUF( dst->rb, chunk->len + READ_BUFFER_SIZE );
+
+                memcpy( B_REMAINDER_PTR( dst->rb ), chunk->data, chunk->len );
+                B_INCREASE_USED( dst->rb, chunk->len );
+
+                dst->cold->is_pipe_rd_data = true;
+            }
+
+            if( chunk->is_eof )
+                dst->cold->is_pipe_rd_eof = true;
+
+            dst->cold->is_pipe_rd_pending = true;
+            g_sched_pending++;
+
+            g_sim.delivered++;
+            g_sim.bytes += chunk->len;
+        }
+
+        LL_DEL_NODE( &g_sim.chunks, chunk->id );
+
+        free( chunk->data );
+        free( chunk );
+
+        chunk = chunk_next;
+    }
+}
+
+/* NOTE: Warning - O(n), there is work for the next iteration */
+static bool __sim_is_busy( int nfds )
+{
+    ctx_t              *ctx;
+    int                 fd;
+
+    if( nfds || __has_deferred() || g_read_batch.total )
+        return true;
+
+    for( fd = 0; fd <= NET_MAX_FD; fd++ )
+    {
+        ctx = &g_ctx_array[fd];
+
+        if( !ctx->id )
+            continue;
+
+        if( __has_scheduled_work( ctx ) )
+            return true;
+    }
+
+    return false;
+}
+
+static void __sim_min_tmr( ll_t            *list,
+                           struct timeval  *next,
+                           bool            *is_found )
+{
+    tmr_t              *tmr;
+
+    if( !list->total )
+        return;
+
+    LL_CHECK( list, list->head );
+    tmr = PTRID_GET_PTR( list->head );
+
+    while( tmr )
+    {
+        if( !tmr->to_delete &&
+            (!*is_found || timercmp( &tmr->timeout, next, < )) )
+        {
+            *next = tmr->timeout;
+            *is_found = true;
+        }
+
+        tmr = PTRID_GET_PTR( tmr->next );
+    }
+}
+
+/* NOTE: Warning - O(n + timers + chunks) */
+static bool __sim_next_deadline( struct timeval *next )
+{
+    sim_chunk_t        *chunk;
+    bool                is_found = false;
+    int                 fd;
+
+    __sim_min_tmr( &g_tmr_list, next, &is_found );
+
+    for( fd = 0; fd <= NET_MAX_FD; fd++ )
+    {
+        if( g_ctx_array[fd].id )
+            __sim_min_tmr( &g_ctx_array[fd].tmr_list, next, &is_found );
+    }
+
+    chunk = PTRID_GET_PTR( g_sim.chunks.head );
+
+    while( chunk )
+    {
+        if( !is_found || timercmp( &chunk->due, next, < ) )
+        {
+            *next = chunk->due;
+            is_found = true;
+        }
+
+        chunk = PTRID_GET_PTR( chunk->next );
+    }
+
+    return is_found;
+}
+
+/****************************************************************
+ *  NOTE: it's called at the end of an iteration instead of     *
+ *        waiting in epoll_wait(), the virtual clock moves by   *
+ *        SIM_TICK_USEC while there is work, otherwise it jumps *
+ *        straight to the next timer or chunk. It returns false *
+ *        when net_sim_duration is over or nothing is left.     *
+ ****************************************************************/
+static bool __sim_advance( int nfds )
+{
+    struct timeval      tick = { 0, SIM_TICK_USEC };
+    struct timeval      next;
+    struct timeval      elapsed;
+
+    g_sim.iters++;
+
+    timeradd( &g_sim.now, &tick, &g_sim.now );
+
+    if( !__sim_is_busy( nfds ) )
+    {
+        if( !__sim_next_deadline( &next ) )
+        {
+            LOG( "nothing is scheduled" );
+            return false;
+        }
+
+        if( timercmp( &next, &g_sim.now, > ) )
+        {
+            g_sim.now = next;
+            g_sim.jumps++;
+        }
+    }
+
+    G_now = g_sim.now;
+
+    timersub( &g_sim.now, &g_sim.start, &elapsed );
+
+    return !timerisset( cfg_net_sim_duration ) ||
+           timercmp( &elapsed, cfg_net_sim_duration, < );
+}
+
+static void __sim_report()
+{
+    struct timespec     wall_end;
+    struct timeval      elapsed;
+    long                wall_us;
+
+    clock_gettime( CLOCK_MONOTONIC, &wall_end );
+
+    wall_us = (wall_end.tv_sec - g_sim.wall_start.tv_sec) * 1000000 +
+              (wall_end.tv_nsec - g_sim.wall_start.tv_nsec) / 1000;
+
+    timersub( &g_sim.now, &g_sim.start, &elapsed );
+
+    LOG( "seed:%d virtual:%ld:%ld wall_us:%ld iters:%llu jumps:%llu "
+         "iters_per_sec:%llu chunks:%llu bytes:%llu lost:%llu "
+         "in_flight:%d",
+         *cfg_net_sim_seed, elapsed.tv_sec, elapsed.tv_usec, wall_us,
+         (unsigned long long) g_sim.iters,
+         (unsigned long long) g_sim.jumps,
+         (unsigned long long) ( wall_us ?
+                                g_sim.iters * 1000000 / wall_us : 0 ),
+         (unsigned long long) g_sim.delivered,
+         (unsigned long long) g_sim.bytes,
+         (unsigned long long) g_sim.lost,
+         g_sim.chunks.total );
+}
+
+static void __init_sim()
+{
+    if( !*cfg_net_sim )
+        return;
+
+    g_sim.is_on = true;
+    g_sim.now = G_now;
+    g_sim.start = G_now;
+    g_sim.rng = (uint64_t) *cfg_net_sim_seed * 0x9E3779B97F4A7C15ULL | 1;
+
+    /* NOTE: for modules, e.g. selftest */
+    srand( *cfg_net_sim_seed );
+
+    /* NOTE: offload threads would complete jobs in random order */
+    *cfg_net_offload_threads = 0;
+
+    LOG( "seed:%d latency:%ld:%ld loss:%d rto:%ld:%ld duration:%ld:%ld",
+         *cfg_net_sim_seed,
+         cfg_net_sim_latency->tv_sec, cfg_net_sim_latency->tv_usec,
+         *cfg_net_sim_loss,
+         cfg_net_sim_rto->tv_sec, cfg_net_sim_rto->tv_usec,
+         cfg_net_sim_duration->tv_sec, cfg_net_sim_duration->tv_usec );
+}
+
+/******************* Capture functions ****************************************/
+
+static void __capture_close()
+{
+    unsigned long       used = g_capture.hdr->used;
+
+    if( munmap( g_capture.map, g_capture.size ) )
+        LOGE( "errno:%d strerror:%s", errno, strerror( errno ) );
+
+    /* NOTE: the zeroed tail isn't needed in a closed file */
+    if( ftruncate( g_capture.fd, used ) )
+        LOGE( "errno:%d strerror:%s", errno, strerror( errno ) );
+
+    close( g_capture.fd );
+
+    g_capture.fd = -1;
+    g_capture.map = NULL;
+    g_capture.hdr = NULL;
+}
+
+/* NOTE: the previous file is kept as .prev like the log */
+static int __capture_open()
+{
+    char                prev_file[CAPTURE_MAX_FILE_LEN + 8];
+    char               *map;
+    int                 fd;
+
+    snprintf( prev_file, sizeof(prev_file), "%s.prev", cfg_net_capture_file );
+
+    if( rename( cfg_net_capture_file, prev_file ) && errno != ENOENT )
+    {
+        LOGE( "filename:%s prev_filename:%s errno:%d strerror:%s",
+              cfg_net_capture_file, prev_file, errno, strerror( errno ) );
+    }
+
+    fd = open( cfg_net_capture_file, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( fd == -1 )
+    {
+        LOGE( "filename:%s errno:%d strerror:%s",
+              cfg_net_capture_file, errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    if( ftruncate( fd, g_capture.size ) )
+    {
+        LOGE( "filename:%s size:%lu errno:%d strerror:%s",
+              cfg_net_capture_file, g_capture.size,
+              errno, strerror( errno ) );
+
+        close( fd );
+        return -1;
+    }
+
+    map = mmap( NULL, g_capture.size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0 );
+
+    if( map == MAP_FAILED )
+    {
+        LOGE( "filename:%s size:%lu errno:%d strerror:%s",
+              cfg_net_capture_file, g_capture.size,
+              errno, strerror( errno ) );
+
+        close( fd );
+        return -1;
+    }
+
+    g_capture.fd = fd;
+    g_capture.map = map;
+    g_capture.hdr = (net_capture_hdr_t *) map;
+
+    memcpy( g_capture.hdr->magic, NET_CAPTURE_MAGIC,
+            sizeof(g_capture.hdr->magic) );
+
+    g_capture.hdr->used = sizeof(net_capture_hdr_t);
+
+    LOG( "filename:%s size:%lu records:%llu bytes:%llu rotations:%llu "
+         "dropped:%llu",
+         cfg_net_capture_file, g_capture.size,
+         (unsigned long long) g_capture.records,
+         (unsigned long long) g_capture.bytes,
+         (unsigned long long) g_capture.rotations,
+         (unsigned long long) g_capture.dropped );
+
+    return 0;
+}
+
+/* NOTE: a full file is rotated, a record which doesn't fit *
+ *       into an empty one is dropped                       */
+static void __capture_write( ctx_t              *ctx,
+                             net_capture_dir_t  dir,
+                             bool               is_closed,
+                             char              *data,
+                             unsigned long      len )
+{
+    net_capture_rec_t  *rec;
+    struct timespec     ts;
+    unsigned long       rec_len;
+
+    rec_len = sizeof(net_capture_rec_t) + CAPTURE_ALIGN( len );
+
+    if( sizeof(net_capture_hdr_t) + rec_len > g_capture.size )
+    {
+        LOGE( "id:0x%llx dir:%d len:%lu size:%lu",
+              NET_ID_FMT( ctx->id ), dir, len, g_capture.size );
+
+        g_capture.dropped++;
+        return;
+    }
+
+    if( g_capture.hdr->used + rec_len > g_capture.size )
+    {
+        __capture_close();
+
+        g_capture.rotations++;
+
+        if( __capture_open() )
+        {
+            LOGE( "capture is off" );
+
+            g_capture.is_on = false;
+            return;
+        }
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    rec = (net_capture_rec_t *) ( g_capture.map + g_capture.hdr->used );
+
+    rec->conn_id = ctx->id;
+    rec->ts = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->len = len;
+    rec->dir = dir;
+    rec->is_closed = is_closed;
+    rec->is_accepted = ctx->dirn == D_INCOMING;
+
+    if( len )
+        memcpy( rec + 1, data, len );
+
+    g_capture.hdr->used += rec_len;
+
+    g_capture.records++;
+    g_capture.bytes += len;
+}
+
+/* NOTE: only bytes which came after the previous call, *
+ *       unconsumed ones are passed to r_uh_cb again    */
+static void __capture_rx( ctx_t    *ctx,
+                          bool      is_closed )
+{
+    unsigned long       used = B_USED_SIZE( ctx->rb );
+    unsigned long       cap_used = ctx->cold->cap_used;
+
+    if( used > cap_used || is_closed )
+    {
+        __capture_write( ctx, NET_CAPTURE_RX, is_closed,
+                         B_USED_PTR( ctx->rb ) + cap_used,
+                         used > cap_used ? used - cap_used : 0 );
+    }
+
+    ctx->cold->cap_used = used;
+}
+
+/* NOTE: n bytes are cut from the head of rb */
+static void __capture_cut( ctx_t           *ctx,
+                           unsigned long    n )
+{
+    if( n < ctx->cold->cap_used )
+        ctx->cold->cap_used -= n;
+    else
+        ctx->cold->cap_used = 0;
+}
+
+static void __init_capture()
+{
+    if( !cfg_net_capture_file )
+        return;
+
+    c_assert( strlen( cfg_net_capture_file ) <= CAPTURE_MAX_FILE_LEN );
+
+    /* NOTE: replayed conns would be captured again */
+    if( cfg_net_replay_file )
+    {
+        LOGE( "filename:%s capture is off in replay", cfg_net_capture_file );
+        return;
+    }
+
+    g_capture.size = *cfg_net_capture_file_size;
+
+    c_assert( *cfg_net_capture_file_size > 0 &&
+              g_capture.size > sizeof(net_capture_hdr_t) );
+
+    if( __capture_open() )
+        return;
+
+    g_capture.is_on = true;
+}
+
+/******************* Replay functions *****************************************/
+
+static uint64_t __ts_diff_ns( struct timespec *from, struct timespec *to )
+{
+    int64_t             diff;
+
+    diff = (int64_t) (to->tv_sec - from->tv_sec) * 1000000000LL +
+           (to->tv_nsec - from->tv_nsec);
+
+    return ( diff > 0 ) ? (uint64_t) diff : 0;
+}
+
+/* NOTE: Warning - O(n), there is a conn per captured one at most */
+static replay_conn_t *__find_replay_conn( conn_id_t cap_id )
+{
+    replay_conn_t      *rc;
+
+    if( !g_replay.conns.total )
+        return NULL;
+
+    LL_CHECK( &g_replay.conns, g_replay.conns.head );
+    rc = PTRID_GET_PTR( g_replay.conns.head );
+
+    while( rc )
+    {
+        if( rc->cap_id == cap_id )
+            return rc;
+
+        rc = PTRID_GET_PTR( rc->next );
+    }
+
+    return NULL;
+}
+
+static void __replay_add_latency( replay_conn_t    *rc,
+                                  struct timespec  *now )
+{
+    uint64_t            ns = __ts_diff_ns( &rc->pending, now );
+    int                 i = 0;
+
+    if( ns )
+        i = 63 - __builtin_clzll( ns );
+
+    if( i >= REPLAY_LAT_BUCKETS )
+        i = REPLAY_LAT_BUCKETS - 1;
+
+    g_replay.replies++;
+    g_replay.lat_sum += ns;
+    g_replay.lat_buckets[i]++;
+
+    if( ns > g_replay.lat_max )
+        g_replay.lat_max = ns;
+
+    rc->pending.tv_sec = 0;
+    rc->pending.tv_nsec = 0;
+
+    rc->is_reply_due = false;
+}
+
+/* NOTE: the first bytes after a fed chunk are its reply */
+static int __replay_r_cb( conn_id_t     conn_id,
+                          ptr_id_t      udata_id,
+                          char         *buf,
+                          int           len,
+                          bool          is_closed )
+{
+    replay_conn_t      *rc = PTRID_GET_PTR( udata_id );
+    struct timespec     now;
+
+    c_assert( rc->conn_id == conn_id );
+
+    g_replay.reply_bytes += len;
+
+    if( !len || (!rc->pending.tv_sec && !rc->pending.tv_nsec) )
+        return len;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    __replay_add_latency( rc, &now );
+
+    g_replay.last_reply = now;
+
+    /* NOTE: the captured peer closed after this reply */
+    if( rc->is_eof && !is_closed )
+        net_shutdown_conn( conn_id, false );
+
+    return len;
+}
+
+static void __replay_drain_cb( conn_id_t    conn_id,
+                               ptr_id_t     udata_id )
+{
+    replay_conn_t      *rc = PTRID_GET_PTR( udata_id );
+
+    rc->is_over_high = false;
+}
+
+static void __replay_est_cb( conn_id_t      conn_id,
+                             ptr_id_t       udata_id )
+{
+    replay_conn_t      *rc = PTRID_GET_PTR( udata_id );
+    int                 r;
+
+    rc->is_est = true;
+
+    r = net_set_write_watermarks( conn_id, __replay_drain_cb, 0, 0, 0, 0 );
+    c_assert( !r );
+}
+
+static void __replay_clo_cb( conn_id_t      conn_id,
+                             ptr_id_t       udata_id,
+                             int            code )
+{
+    replay_conn_t      *rc = PTRID_GET_PTR( udata_id );
+
+    LOGD( "id:0x%llx cap_id:0x%llx code:%d",
+          NET_ID_FMT( conn_id ), NET_ID_FMT( rc->cap_id ), code );
+
+    /* NOTE: nothing listens on net_replay_port */
+    if( !rc->is_est )
+    {
+        LOGE( "id:0x%llx port:%d code:%d",
+              NET_ID_FMT( conn_id ), *cfg_net_replay_port, code );
+
+        g_replay.is_done = true;
+    }
+
+    LL_DEL_NODE( &g_replay.conns, rc->id );
+
+    free( rc );
+}
+
+static replay_conn_t *__make_replay_conn( conn_id_t cap_id )
+{
+    replay_conn_t      *rc;
+    net_host_t          host;
+    char                port[MAX_PORT_STR_LEN];
+
+    snprintf( port, sizeof(port), "%d", *cfg_net_replay_port );
+
+    memset( &host, 0, sizeof(host) );
+
+    host.hostname = REPLAY_HOST;
+    host.port = port;
+
+    rc = malloc( sizeof(replay_conn_t) );
+    memset( rc, 0, sizeof(replay_conn_t) );
+
+    rc->cap_id = cap_id;
+
+    LL_ADD_NODE( &g_replay.conns, rc );
+
+    rc->conn_id = net_make_conn( &host, __replay_r_cb, __replay_est_cb,
+                                 __replay_clo_cb, rc->id );
+
+    if( !rc->conn_id )
+    {
+        LOGE( "cap_id:0x%llx net_errno:%u",
+              NET_ID_FMT( cap_id ), G_net_errno );
+
+        LL_DEL_NODE( &g_replay.conns, rc->id );
+
+        free( rc );
+        return NULL;
+    }
+
+    return rc;
+}
+
+/* NOTE: it returns -1 if the record must wait for its conn */
+static int __replay_record( net_capture_rec_t *rec )
+{
+    replay_conn_t      *rc;
+    bool                is_pending;
+    int                 r;
+
+    if( !rec->is_accepted )
+    {
+        g_replay.skipped++;
+        return 0;
+    }
+
+    rc = __find_replay_conn( rec->conn_id );
+
+    /* NOTE: the next chunk waits for the reply like in capture */
+    if( rec->dir == NET_CAPTURE_TX )
+    {
+        if( rc )
+            rc->is_reply_due = true;
+
+        g_replay.skipped++;
+        return 0;
+    }
+
+    if( !rc )
+    {
+        /* NOTE: EOF of a conn which is closed already */
+        if( !rec->len || !__make_replay_conn( rec->conn_id ) )
+        {
+            g_replay.skipped++;
+            return 0;
+        }
+
+        /* NOTE: the pipe is established in __do_scheduled */
+        return -1;
+    }
+
+    is_pending = rc->pending.tv_sec || rc->pending.tv_nsec;
+
+    if( !rc->is_est || rc->is_over_high ||
+        (rc->is_reply_due && is_pending) )
+    {
+        return -1;
+    }
+
+    if( rec->len )
+    {
+        if( !is_pending )
+            clock_gettime( CLOCK_MONOTONIC, &rc->pending );
+
+        r = net_post_data( rc->conn_id, (char *) (rec + 1), rec->len, false );
+
+        if( r == -1 )
+        {
+            LOGE( "id:0x%llx cap_id:0x%llx len:%u",
+                  NET_ID_FMT( rc->conn_id ), NET_ID_FMT( rec->conn_id ),
+                  rec->len );
+
+            g_replay.skipped++;
+            return 0;
+        }
+
+        if( r == NET_POST_OVER_HIGH )
+            rc->is_over_high = true;
+
+        g_replay.chunks++;
+        g_replay.bytes += rec->len;
+    }
+
+    if( rec->is_closed && !rc->is_eof )
+    {
+        rc->is_eof = true;
+
+        if( !is_pending && !rec->len )
+            net_shutdown_conn( rc->conn_id, false );
+    }
+
+    return 0;
+}
+
+/* NOTE: per mille, it's the upper bound of the bucket */
+static uint64_t __replay_percentile( int pm )
+{
+    uint64_t            target;
+    uint64_t            cnt = 0;
+    int                 i;
+
+    target = ( g_replay.replies * pm + 999 ) / 1000;
+
+    for( i = 0; i < REPLAY_LAT_BUCKETS; i++ )
+    {
+        cnt += g_replay.lat_buckets[i];
+
+        if( cnt && cnt >= target )
+            return 1ULL << (i + 1);
+    }
+
+    return 0;
+}
+
+/* NOTE: rates are per the time from the start to the last *
+ *       fed record or reply, without the drain wait       */
+static void __replay_report()
+{
+    struct timespec    *end = &g_replay.last_feed;
+    uint64_t            wall_us;
+    uint64_t            replies = g_replay.replies;
+
+    if( __ts_diff_ns( end, &g_replay.last_reply ) )
+        end = &g_replay.last_reply;
+
+    wall_us = __ts_diff_ns( &g_replay.start, end ) / 1000;
+
+    LOG( "filename:%s paced:%d wall_us:%llu chunks:%llu bytes:%llu "
+         "skipped:%llu chunks_per_sec:%llu bytes_per_sec:%llu "
+         "replies:%llu reply_bytes:%llu left:%d",
+         cfg_net_replay_file, *cfg_net_replay_paced,
+         (unsigned long long) wall_us,
+         (unsigned long long) g_replay.chunks,
+         (unsigned long long) g_replay.bytes,
+         (unsigned long long) g_replay.skipped,
+         (unsigned long long) ( wall_us ?
+                                g_replay.chunks * 1000000 / wall_us : 0 ),
+         (unsigned long long) ( wall_us ?
+                                g_replay.bytes * 1000000 / wall_us : 0 ),
+         (unsigned long long) replies,
+         (unsigned long long) g_replay.reply_bytes,
+         g_replay.conns.total );
+
+    LOG( "latency avg:%llu p50:<%llu p99:<%llu p999:<%llu max:%llu (nsec)",
+         (unsigned long long) ( replies ? g_replay.lat_sum / replies : 0 ),
+         (unsigned long long) __replay_percentile( 500 ),
+         (unsigned long long) __replay_percentile( 990 ),
+         (unsigned long long) __replay_percentile( 999 ),
+         (unsigned long long) g_replay.lat_max );
+}
+
+/* NOTE: it's over when all records are fed and all replies    *
+ *       came, it waits net_replay_drain_timeout at most since *
+ *       the last fed record for the rest of them or for a     *
+ *       reply which the next record waits for                 */
+static bool __replay_is_over( struct timespec *now )
+{
+    replay_conn_t      *rc;
+    uint64_t            drain_ns;
+
+    drain_ns = cfg_net_replay_drain_timeout->tv_sec * 1000000000ULL +
+               cfg_net_replay_drain_timeout->tv_usec * 1000ULL;
+
+    if( (g_replay.is_done || g_replay.is_waiting) &&
+        __ts_diff_ns( &g_replay.last_feed, now ) >= drain_ns )
+    {
+        if( !g_replay.is_done )
+            LOGE( "off:%lu size:%lu stalled", g_replay.off, g_replay.size );
+
+        return true;
+    }
+
+    if( !g_replay.is_done )
+        return false;
+
+    rc = PTRID_GET_PTR( g_replay.conns.head );
+
+    while( rc )
+    {
+        if( rc->pending.tv_sec || rc->pending.tv_nsec )
+            return false;
+
+        rc = PTRID_GET_PTR( rc->next );
+    }
+
+    return true;
+}
+
+/****************************************************************
+ *  NOTE: it's a deferred task which defers itself again, so    *
+ *        the loop doesn't sleep during replay. Records are     *
+ *        fed in the captured order, a record of a conn which   *
+ *        isn't established yet or is over the high watermark   *
+ *        stops the feed till the next iteration. Paced replay  *
+ *        waits for the captured time of a record since the     *
+ *        start. Only rx of accepted conns is fed, the module   *
+ *        makes replies.                                        *
+ ****************************************************************/
+static void __replay_feed( ptr_id_t udata_id )
+{
+    net_capture_rec_t  *rec;
+    struct timespec     now;
+    unsigned long       rec_len;
+    int                 i;
+    int                 r;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    for( i = 0; i < REPLAY_BATCH && !g_replay.is_done; i++ )
+    {
+        rec = (net_capture_rec_t *) ( g_replay.map + g_replay.off );
+
+        /* NOTE: the zeroed tail of a file which wasn't closed */
+        if( g_replay.off + sizeof(net_capture_rec_t) > g_replay.size ||
+            !rec->conn_id )
+        {
+            g_replay.is_done = true;
+            break;
+        }
+
+        rec_len = sizeof(net_capture_rec_t) + CAPTURE_ALIGN( rec->len );
+
+        if( g_replay.off + rec_len > g_replay.size )
+        {
+            LOGE( "off:%lu len:%u size:%lu truncated record",
+                  g_replay.off, rec->len, g_replay.size );
+
+            g_replay.is_done = true;
+            break;
+        }
+
+        if( *cfg_net_replay_paced && rec->ts > g_replay.first_ts &&
+            __ts_diff_ns( &g_replay.start, &now ) <
+            rec->ts - g_replay.first_ts )
+        {
+            break;
+        }
+
+        g_replay.is_waiting = __replay_record( rec ) != 0;
+
+        if( g_replay.is_waiting )
+            break;
+
+        g_replay.off += rec_len;
+        g_replay.last_feed = now;
+    }
+
+    if( !__replay_is_over( &now ) )
+    {
+        r = net_defer( __replay_feed, udata_id );
+        c_assert( !r );
+
+        return;
+    }
+
+    __replay_report();
+
+    munmap( g_replay.map, g_replay.size );
+
+    g_replay.is_over = true;
+}
+
+static void __start_replay()
+{
+    int                 r;
+
+    clock_gettime( CLOCK_MONOTONIC, &g_replay.start );
+
+    g_replay.last_feed = g_replay.start;
+
+    r = net_defer( __replay_feed, PTRID( &g_replay ) );
+    c_assert( !r );
+}
+
+static void __init_replay()
+{
+    net_capture_hdr_t  *hdr;
+    net_capture_rec_t  *rec;
+    struct stat         st;
+    char               *map;
+    int                 fd;
+    int                 r;
+
+    if( !cfg_net_replay_file )
+        return;
+
+    c_assert( *cfg_net_replay_port > 0 );
+
+    fd = open( cfg_net_replay_file, O_RDONLY );
+    if( fd == -1 )
+    {
+        LOGE( "filename:%s errno:%d strerror:%s",
+              cfg_net_replay_file, errno, strerror( errno ) );
+    }
+
+    c_assert( fd != -1 );
+
+    r = fstat( fd, &st );
+    c_assert( !r &&
+              (unsigned long) st.st_size >= sizeof(net_capture_hdr_t) );
+
+    map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    c_assert( map != MAP_FAILED );
+
+    close( fd );
+
+    hdr = (net_capture_hdr_t *) map;
+
+    c_assert( !memcmp( hdr->magic, NET_CAPTURE_MAGIC,
+                       sizeof(hdr->magic) ) );
+
+    g_replay.map = map;
+    g_replay.size = st.st_size;
+
+    if( hdr->used < g_replay.size )
+        g_replay.size = hdr->used;
+
+    g_replay.off = sizeof(net_capture_hdr_t);
+
+    if( g_replay.off + sizeof(net_capture_rec_t) <= g_replay.size )
+    {
+        rec = (net_capture_rec_t *) ( map + g_replay.off );
+        g_replay.first_ts = rec->ts;
+    }
+
+    g_replay.is_on = true;
+
+    LOG( "filename:%s size:%lu port:%d paced:%d",
+         cfg_net_replay_file, g_replay.size,
+         *cfg_net_replay_port, *cfg_net_replay_paced );
+}
+
+/******************* Do-scheduled functions ***********************************/
+
+static void __call_timers( ll_t    *list,
+                           ctx_t   *ctx )
+{
+    tmr_t              *tmr;
+    tmr_t              *tmr_next;
+    int                 tmr_total;
+    int                 i = 0;
+    int                 r;
+
+    c_assert( list->total > 0 && list->total <= MAX_TIMERS );
+
+    LL_CHECK( list, list->head );
+    tmr = PTRID_GET_PTR( list->head );
+
+    tmr_total = list->total;
+
+    /* NOTE: tmr->uh_cb can create new tmrs, *
+     * but don't call timers >= tmr_total    *
+     * at this iteration.                    */
+    while( tmr && i < tmr_total )
+    {
+        i++;
+
+        c_assert( ctx || tmr->udata_id );
+        c_assert( !tmr->locked && !tmr->to_delete );
+
+        LOGD( "tmr:0x%llx timeout.tv_sec:%ld timeout.tv_usec:%ld "
+              "shift.tv_sec:%ld shift.tv_usec:%ld",
+              NET_ID_FMT( tmr->tmr_id ), tmr->timeout.tv_sec,
+              tmr->timeout.tv_usec, tmr->shift.tv_sec, tmr->shift.tv_usec );
+
+        if( (tmr->timeout.tv_sec == G_now.tv_sec &&
+             tmr->timeout.tv_usec == G_now.tv_usec) ||
+            timercmp( &tmr->timeout, &G_now, < ) )
+        {
+            LOGD( "tmr:0x%llx", NET_ID_FMT( tmr->tmr_id ) );
+
+            tmr->locked = true;
+
+            __watchdog_mark( ctx ? ctx->id : 0, tmr->uh_cb );
+
+            tmr->uh_cb( ctx ? ctx->id : 0,
+                        ctx ? ctx->udata_id : 0,
+                        tmr->tmr_id,
+                        tmr->udata_id );
+
+            tmr->locked = false;
+
+            if( ctx && ctx->to_shutdown )
+            {
+                LOG( "tmr:0x%llx", NET_ID_FMT( tmr->tmr_id ) );
+
+                return;
+            }
+
+            /* NOTE: tmr->next can be freed and replaced after *
+             * tmr->uh_cb, so save tmr->next after tmr->uh_cb  */
+            LL_CHECK( list, tmr->id );
+            tmr_next = PTRID_GET_PTR( tmr->next );
+
+            if( tmr->to_delete )
+            {
+                if( ctx )
+                    r = __del_conn_tmr( ctx, tmr->tmr_id );
+                else
+                    r = net_del_global_tmr( tmr->tmr_id );
+
+                c_assert( !r );
+            }
+            else
+            {
+                timeradd( &tmr->timeout, &tmr->shift, &tmr->timeout );
+            }
+        }
+        else
+        {
+            LL_CHECK( list, tmr->id );
+            tmr_next = PTRID_GET_PTR( tmr->next );
+        }
+
+        tmr = tmr_next;
+    }
+}
+
+static void __call_conn_timers( ctx_t *ctx )
+{
+    conn_id_t           prev_id = ctx->id;
+
+    if( !ctx->tmr_list.total )
+    {
+        c_assert( !ctx->tmr_list.head &&
+                  !ctx->tmr_list.tail );
+
+        return;
+    }
+
+    LOGD( "id:0x%llx host:%s:%s state:%d tmr_total:%d",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          ctx->state->st, ctx->tmr_list.total );
+
+    __call_timers( &ctx->tmr_list, ctx );
+
+    c_assert( ctx->id == prev_id );
+
+    if( ctx->to_shutdown )
+    {
+        LOG( "id:0x%llx host:%s:%s state:%d",
+             NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+             ctx->state->st );
+
+        ctx->to_shutdown = false;
+
+        __shutdown_ctx( ctx, NET_CODE_SUCCESS );
+    }
+}
+
+static void __call_global_timers()
+{
+    if( !g_tmr_list.total )
+    {
+        c_assert( !g_tmr_list.head &&
+                  !g_tmr_list.tail );
+
+        return;
+    }
+
+    LOGD( "tmr_total:%d", g_tmr_list.total );
+
+    __call_timers( &g_tmr_list, NULL );
+}
+
+/* NOTE: data in rb (and in SSL buffers) doesn't produce   *
+ *       epoll events, so after resume it's delivered here *
+ *       the same way as after recv                        */
+static void __call_resumed_handlers( ctx_t *ctx )
+{
+    conn_id_t           prev_id = ctx->id;
+    bool                is_est;
+
+    is_est = ( (!ctx->ssl && ctx->state->st == S_ESTABLISHED) ||
+               (ctx->ssl && ctx->state->st == S_SSL_ESTABLISHED) );
+
+    if( ctx->is_drain_pending )
+    {
+        ctx->is_drain_pending = false;
+
+        c_assert( ctx->drain_uh_cb );
+
+        LOGD( "id:0x%llx host:%s:%s wb_bytes:%lu",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ctx->wb_bytes );
+
+        ctx->drain_uh_cb( ctx->id, ctx->udata_id );
+
+        if( ctx->id != prev_id || ctx->to_shutdown )
+            return;
+    }
+
+    if( !ctx->is_read_resumed )
+        return;
+
+    ctx->is_read_resumed = false;
+
+    if( !is_est || ctx->is_read_paused )
+        return;
+
+    if( B_HAS_USED( ctx->rb ) )
+    {
+        if( __call_read_handler( ctx, false ) )
+            return;
+
+        if( ctx->is_read_paused )
+            return;
+    }
+
+    if( ctx->ssl && SSL_pending( ctx->ssl ) > 0 )
+        ctx->state->r_cb( ctx );
+}
+
+static void __do_scheduled()
+{
+    ctx_t              *ctx;
+    conn_id_t           prev_id;
+    int                 fd;
+
+    LOGD( "" );
+
+    g_sched_pending = 0;
+
+    if( g_sim.is_on )
+        __sim_deliver();
+
+    /* NOTE: Warning - O(n) */
+    for( fd = 0; fd <= NET_MAX_FD; fd++ )
+    {
+        ctx = &g_ctx_array[fd];
+
+        if( !ctx->id )
+            continue;
+
+        c_assert( ctx->id && ctx->fd == fd );
+
+        prev_id = ctx->id;
+
+        if( ctx->to_shutdown )
+        {
+            ctx->to_shutdown = false;
+
+            __shutdown_ctx( ctx, ctx->is_handed_over ? NET_CODE_HANDOVER :
+                                                       NET_CODE_SUCCESS );
+            continue;
+        }
+
+        if( ctx->cold->is_handover_pending )
+        {
+            ctx->cold->is_handover_pending = false;
+
+            __adopt_handover_accepted( ctx );
+
+            if( ctx->id != prev_id || ctx->to_shutdown )
+                continue;
+        }
+
+        if( ctx->cold->is_pipe_est_pending )
+        {
+            __pipe_connect( ctx );
+
+            if( ctx->id != prev_id || ctx->to_shutdown )
+                continue;
+        }
+
+        if( ctx->cold->is_pipe_rd_pending )
+        {
+            __pipe_read( ctx );
+
+            if( ctx->id != prev_id || ctx->to_shutdown )
+                continue;
+        }
+
+        if( ctx->is_read_resumed || ctx->is_drain_pending )
+        {
+            __call_resumed_handlers( ctx );
+
+            if( ctx->id != prev_id || ctx->to_shutdown )
+                continue;
+        }
+
+        __call_conn_timers( ctx );
+
+        if( ctx->id == prev_id && __has_scheduled_work( ctx ) )
+            g_sched_pending++;
+    }
+
+    __expire_handover_list();
+
+    __call_global_timers();
+}
+
+/******************* Interface functions **************************************/
+
+/* NOTE: this function can be called without a timer callback,  *
+ * it's needed to call this function before first net_make_conn */
+
+void net_update_main_hosts( conn_id_t    conn_id,
+                            ptr_id_t     conn_udata_id,
+                            tmr_id_t     tmr_id,
+                            ptr_id_t     tmr_udata_id )
+{
+    net_host_node_t        *node;
+    net_host_node_t        *node_next;
+    ll_t                   *list;
+    struct addrinfo         hints;
+    struct addrinfo        *result;
+    struct addrinfo        *addr;
+    struct sockaddr_in     *ai_addr;
+    int                     r, i = 0;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    c_assert( !conn_id && !conn_udata_id && tmr_udata_id );
+
+    list = PTRID_GET_PTR( tmr_udata_id );
+
+    LL_CHECK( list, list->head );
+    node = PTRID_GET_PTR( list->head );
+
+    while( node )
+    {
+        LL_CHECK( list, node->id );
+        node_next = PTRID_GET_PTR( node->next );
+
+        i++;
+        c_assert( node->host.hostname &&
+                  node->host.port && i <= list->total );
+
+        if( __is_unix_host( &node->host ) ||
+            __is_pipe_host( &node->host ) )
+        {
+            node = node_next;
+            continue;
+        }
+
+        addr = (struct addrinfo *) node->host.addr;
+
+        if( addr )
+        {
+            ai_addr = (struct sockaddr_in *)(addr->ai_addr);
+
+            LOGD( "tmr:0x%llx host:%s:%s ip:%s",
+                  NET_ID_FMT( tmr_id ),
+                  node->host.hostname,
+                  node->host.port,
+                  inet_ntoa( ai_addr->sin_addr ) );
+
+            freeaddrinfo( addr );
+
+            node->host.addr = NULL;
+        }
+
+        memset( &hints, 0, sizeof(struct addrinfo) );
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+
+        r = getaddrinfo( node->host.hostname,
+                         node->host.port,
+                         &hints, &result );
+
+        if( r )
+        {
+            LOGE( "tmr:0x%llx host:%s:%s error:%s",
+                  NET_ID_FMT( tmr_id ),
+                  node->host.hostname,
+                  node->host.port,
+                  gai_strerror( r ) );
+
+            node = node_next;
+            continue;
+        }
+
+        node->host.addr = (void *) result;
+        ai_addr = (struct sockaddr_in *)(result->ai_addr);
+
+        LOG( "tmr:0x%llx host:%s:%s ip:%s",
+             NET_ID_FMT( tmr_id ),
+             node->host.hostname,
+             node->host.port,
+             inet_ntoa( ai_addr->sin_addr ) );
+
+        node = node_next;
+    }
+
+    c_assert( i == list->total );
+}
+
+void net_update_host( net_host_t   *host )
+{
+    struct addrinfo     hints;
+    struct addrinfo    *result;
+    int                 r;
+
+    c_assert( host );
+
+    if( __is_unix_host( host ) || __is_pipe_host( host ) )
+        return;
+
+    if( host->addr )
+    {
+        freeaddrinfo( host->addr );
+        host->addr = NULL;
+    }
+
+    memset( &hints, 0, sizeof(struct addrinfo) );
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    r = getaddrinfo( host->hostname,
+                     host->port,
+                     &hints, &result );
+
+    if( r )
+    {
+        LOGE( "host:%s:%s error:%s",
+              host->hostname,
+              host->port,
+              gai_strerror( r ) );
+
+        return;
+    }
+
+    host->addr = (void *) result;
+}
+
+void net_free_host( net_host_t     *host )
+{
+    c_assert( host->hostname && host->port );
+
+    free( host->hostname );
+    free( host->port );
+
+    if( host->label )
+        free( host->label );
+
+    if( host->sock_profile )
+        free( host->sock_profile );
+
+    if( host->addr )
+        freeaddrinfo( host->addr );
+}
+
+net_host_t *net_get_host( ll_t     *host_list,
+                          char     *label )
+{
+    net_host_node_t        *node;
+    net_host_node_t        *node_next;
+    net_host_t             *host = NULL;
+    int                     i = 0;
+
+    c_assert( host_list && label );
+
+    G_net_errno = NET_ERRNO_OK;
+
+    LL_CHECK( host_list, host_list->head );
+    node = PTRID_GET_PTR( host_list->head );
+
+    while( node )
+    {
+        LL_CHECK( host_list, node->id );
+        node_next = PTRID_GET_PTR( node->next );
+
+        i++;
+        c_assert( node->host.hostname &&
+                  node->host.port &&
+                  i <= host_list->total );
+
+        if( node->host.label &&
+            !strcasecmp( node->host.label, label ) )
+        {
+            host = &node->host;
+            break;
+        }
+
+        node = node_next;
+    }
+
+    return host;
+}
+
+net_sock_profile_t *net_get_sock_profile( char *name )
+{
+    net_sock_profile_t     *profile;
+    net_sock_profile_t     *profile_next;
+    int                     i = 0;
+
+    c_assert( name );
+
+    if( !cfg_net_sock_profiles )
+        return NULL;
+
+    LL_CHECK( cfg_net_sock_profiles, cfg_net_sock_profiles->head );
+    profile = PTRID_GET_PTR( cfg_net_sock_profiles->head );
+
+    while( profile )
+    {
+        LL_CHECK( cfg_net_sock_profiles, profile->id );
+        profile_next = PTRID_GET_PTR( profile->next );
+
+        i++;
+        c_assert( profile->name && i <= cfg_net_sock_profiles->total );
+
+        if( !strcasecmp( profile->name, name ) )
+            return profile;
+
+        profile = profile_next;
+    }
+
+    return NULL;
+}
+
+net_udp_endpoint_t *net_get_udp_endpoint( char *name )
+{
+    net_udp_endpoint_t     *udp;
+    net_udp_endpoint_t     *udp_next;
+    int                     i = 0;
+
+    c_assert( name );
+
+    if( !cfg_net_udp_endpoints )
+        return NULL;
+
+    LL_CHECK( cfg_net_udp_endpoints, cfg_net_udp_endpoints->head );
+    udp = PTRID_GET_PTR( cfg_net_udp_endpoints->head );
+
+    while( udp )
+    {
+        LL_CHECK( cfg_net_udp_endpoints, udp->id );
+        udp_next = PTRID_GET_PTR( udp->next );
+
+        i++;
+        c_assert( udp->name && i <= cfg_net_udp_endpoints->total );
+
+        if( !strcasecmp( udp->name, name ) )
+            return udp;
+
+        udp = udp_next;
+    }
+
+    return NULL;
+}
+
+void net_get_tfo_stats( net_tfo_stats_t *stats )
+{
+    c_assert( stats );
+
+    *stats = g_tfo_stats;
+}
+
+bool net_is_overloaded()
+{
+    return g_load.is_overloaded;
+}
+
+void net_get_load_stats( net_load_stats_t *stats )
+{
+    long        lag;
+
+    c_assert( stats );
+
+    lag = g_load.lag_sum >> LOAD_EWMA_SHIFT;
+
+    stats->lag.tv_sec = lag / 1000000;
+    stats->lag.tv_usec = lag % 1000000;
+    stats->depth = g_load.depth_sum >> LOAD_EWMA_SHIFT;
+    stats->is_overloaded = g_load.is_overloaded;
+    stats->overloads = g_load.overloads;
+}
+
+/*  It can be used for internal timers and user level timers.  *
+ *  Example of user level global timers: to update main_hosts. */
+
+tmr_id_t net_make_global_tmr( ptr_id_t           udata_id,
+                              net_tmr_cb_t       cb,
+                              struct timeval    *timeout )
+{
+    tmr_t                  *tmr;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !udata_id || !cb || !timeout )
+    {
+        LOGE( "" );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    if( g_tmr_list.total > MAX_TIMERS )
+    {
+        LOGE( "udata_id:0x%llx", PTRID_FMT( udata_id ) );
+
+        G_net_errno = NET_ERRNO_TMR_MAX;
+        return 0;
+    }
+
+    tmr = __make_timer( cb, timeout );
+
+    LL_ADD_NODE( &g_tmr_list, tmr );
+
+    tmr->udata_id = udata_id;
+
+    LOG( "tmr:0x%llx udata_id:0x%llx timeout.tv_sec:%ld timeout.tv_usec:%ld "
+         "shift.tv_sec:%ld shift.tv_usec:%ld",
+         NET_ID_FMT( tmr->tmr_id ), PTRID_FMT( udata_id ),
+         tmr->timeout.tv_sec, tmr->timeout.tv_usec,
+         tmr->shift.tv_sec, tmr->shift.tv_usec );
+
+    return tmr->tmr_id;
+}
+
+int net_del_global_tmr( tmr_id_t tmr_id )
+{
+    tmr_t                  *tmr;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !tmr_id )
+    {
+        LOGE( "" );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
+
+    tmr = __find_tmr( tmr_id );
+
+    if( !tmr )
+    {
+        LOGE( "stale tmr:0x%llx", NET_ID_FMT( tmr_id ) );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
+
+    LOG( "tmr:0x%llx", NET_ID_FMT( tmr->tmr_id ) );
+
+    return __del_timer( tmr, &g_tmr_list );
+}
+
+tmr_id_t net_make_conn_tmr( conn_id_t        conn_id,
+                            ptr_id_t         udata_id,
+                            net_tmr_cb_t     cb,
+                            struct timeval  *timeout )
+{
+    ctx_t                  *ctx;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !conn_id || !cb || !timeout )
+    {
+        LOGE( "" );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    ctx = __get_ctx( conn_id );
+
+    if( !ctx->state || ctx->is_in_dup_udata ||
+        ctx->state->st == S_SSL_SHUTDOWN ||
+        ctx->state->st == S_LISTENING ||
+        ctx->state->st == S_SSL_ACCEPTING ||
+        ctx->to_shutdown || ctx->is_in_destroying ||
+        ctx->flush_and_close )
+    {
+        LOGE( "id:0x%llx state:%d",
+              NET_ID_FMT( conn_id ), ctx->state->st );
+
+        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
+        return 0;
+    }
+
+    return __make_conn_tmr( ctx, udata_id, cb, timeout );
+}
+
+int net_del_conn_tmr( conn_id_t       conn_id,
+                      tmr_id_t        tmr_id )
+{
+    ctx_t                  *ctx;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !conn_id || !tmr_id )
+    {
+        LOGE( "" );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
+
+    ctx = __get_ctx( conn_id );
+
+    if( !ctx->state || ctx->is_in_dup_udata ||
+        ctx->state->st == S_SSL_SHUTDOWN ||
+        ctx->state->st == S_LISTENING ||
+        ctx->state->st == S_SSL_ACCEPTING ||
+        ctx->to_shutdown || ctx->is_in_destroying ||
+        ctx->flush_and_close )
+    {
+        LOGE( "id:0x%llx state:%d",
+              NET_ID_FMT( conn_id ), ctx->state->st );
+
+        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
+        return -1;
+    }
+
+    return __del_conn_tmr( ctx, tmr_id );
+}
+
+int net_post_data( conn_id_t        conn_id,
+                   char            *data,
+                   unsigned long    len,
+                   bool             flush_and_close )
+{
+    return net_post_data_prio( conn_id, data, len,
+                               flush_and_close, NET_PRIO_NORMAL );
+}
+
+int net_post_data_prio( conn_id_t       conn_id,
+                        char           *data,
+                        unsigned long   len,
+                        bool            flush_and_close,
+                        net_prio_t      prio )
+{
+    ctx_t                  *ctx;
+    wbuf_t                 *wbuf;
+    int                     r;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !conn_id || !data || !len ||
+        prio < 0 || prio >= NET_PRIO_MAX )
+    {
+        LOGE( "" );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
+
+    ctx = __get_ctx( conn_id );
+
+    if( ctx->is_seqpacket && len > UNIX_MAX_MSG_SIZE )
+    {
+        LOGE( "id:0x%llx len:%lu", NET_ID_FMT( conn_id ), len );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
+
+    if( !ctx->state || ctx->is_in_dup_udata ||
+        (ctx->state->st != S_ESTABLISHED &&
+         ctx->state->st != S_SSL_ESTABLISHED) ||
+        ctx->to_shutdown || ctx->is_in_destroying ||
+        ctx->flush_and_close )
+    {
+        LOGE( "id:0x%llx state:%d",
+              NET_ID_FMT( conn_id ), ctx->state->st );
+
+        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
+        return -1;
+    }
+
+    c_assert( !ctx->state_tmr_id );
+
+    if( g_capture.is_on )
+        __capture_write( ctx, NET_CAPTURE_TX, false, data, len );
+
+    if( flush_and_close )
+    {
+        /* NOTE: since this moment, no app timers is needed */
+        __cleanup_timers( ctx );
+
+        ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
+                                             __flush_and_close_timeout_cb,
+                                             cfg_net_flush_and_close_timeout );
+
+        c_assert( ctx->state_tmr_id );
+
+        ctx->flush_and_close = true;
+    }
+
+    /* NOTE: pipe end queues nothing, data is in peer's rb */
+    if( ctx->is_pipe )
+    {
+        r = __pipe_write( ctx, data, len );
+
+        if( flush_and_close )
+            __shutdown_write( ctx );
+
+        return r;
+    }
+
+    wbuf = malloc( sizeof(wbuf_t) );
+    memset( wbuf, 0, sizeof(wbuf_t) );
+
+    B_ALLOC_FILL( wbuf->b, data, len );
+
+    wbuf->prio = prio;
+    clock_gettime( CLOCK_MONOTONIC, &wbuf->queued );
+
+    LL_ADD_NODE( &ctx->wb_lanes[prio], wbuf );
+
+    ctx->wb_bytes += len;
+    ctx->wb_msgs++;
+
+    __next_write_buf( ctx );
+
+    __enable_write( ctx );
+
+    /* NOTE: per-message lines don't touch ctx->cold */
+    LOG( "id:0x%llx size:%lu msg_id:%llx prio:%d "
+         "wb_bytes:%lu wb_msgs:%d",
+         NET_ID_FMT( ctx->id ),
+         B_SIZE( wbuf->b ), PTRID_FMT( wbuf->id ), prio,
+         ctx->wb_bytes, ctx->wb_msgs );
+
+    if( ctx->wb_bytes > ctx->wb_high_bytes ||
+        ctx->wb_msgs > ctx->wb_high_msgs )
+    {
+        if( !ctx->is_wb_over_high )
+        {
+            LOG( "id:0x%llx host:%s:%s wb_bytes:%lu wb_msgs:%d "
+                 "over high watermark",
+                 NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                 ctx->wb_bytes, ctx->wb_msgs );
+        }
+
+        ctx->is_wb_over_high = true;
+        ctx->is_drain_pending = false;
+
+        return NET_POST_OVER_HIGH;
+    }
+
+    return 0;
+}
+
+conn_id_t net_make_listen( net_r_uh_t       child_r_uh_cb,
+                           net_est_uh_t     child_est_uh_cb,
+                           net_clo_uh_t     child_clo_uh_cb,
+                           net_dup_udata_t  dup_udata_cb,
+                           net_clo_uh_t     clo_uh_cb,
+                           ptr_id_t         udata_id,
+                           int              port,
+                           bool             use_ssl,
+                           char            *sock_profile )
+{
+    ctx_t                  *ctx;
+    net_sock_profile_t     *profile;
+    bool                    not_found;
+    bool                    is_inherited;
+    int                     fd;
+    int                     r;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !child_r_uh_cb || !child_est_uh_cb ||
+        !child_clo_uh_cb || !dup_udata_cb ||
+        !clo_uh_cb || !udata_id || port <= 0 )
+    {
+        LOGE( "" );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    profile = __find_sock_profile( sock_profile, &not_found );
+    if( not_found )
+    {
+        LOGE( "listen_port:%d use_ssl:%d", port, use_ssl );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    /* NOTE: socket from the previous process is already bound *
+     *       and listening with its options                    */
+    fd = __take_handover_fd( D_LISTEN, port, use_ssl, NULL, NULL );
+    is_inherited = ( fd != -1 );
+
+    if( !is_inherited )
+        fd = __create_socket( AF_INET, SOCK_STREAM );
+
+    if( fd == -1 )
+    {
+        LOGE( "listen_port:%d use_ssl:%d", port, use_ssl );
+
+        if( G_net_errno == NET_ERRNO_OK )
+            G_net_errno = NET_ERRNO_GENERAL_ERR;
+
+        return 0;
+    }
+
+    if( !is_inherited && __apply_sock_profile( fd, profile, D_LISTEN ) )
+    {
+        LOGE( "listen_port:%d use_ssl:%d", port, use_ssl );
+
+        PROPER_CLOSE_FD( fd );
+
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return 0;
+    }
+
+    ctx = __init_new_ctx( fd );
+    c_assert( ctx );
+
+    ctx->sock_profile = profile;
+
+    ctx->cold->serv.sin_family = AF_INET;
+    ctx->cold->serv.sin_addr.s_addr = INADDR_ANY;
+    ctx->cold->serv.sin_port = htons(port);
+
+    r = is_inherited ? 0 : bind( ctx->fd,
+                                 (struct sockaddr *) &ctx->cold->serv,
+                                 sizeof(ctx->cold->serv) );
+
+    if( r == -1 )
+    {
+        LOGE( "listen_port:%d use_ssl:%d errno:%d strerror:%s",
+              port, use_ssl, errno, strerror( errno ) );
+
+        PROPER_CLOSE_FD( ctx->fd );
+        __cancel_ctx( ctx );
+
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return 0;
+    }
+
+    r = is_inherited ? 0 : listen( ctx->fd, BACKLOG );
+
+    if( r == -1 )
+    {
+        LOGE( "listen_port:%d use_ssl:%d errno:%d strerror:%s",
+              port, use_ssl, errno, strerror( errno ) );
+
+        PROPER_CLOSE_FD( ctx->fd );
+        __cancel_ctx( ctx );
+
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return 0;
+    }
+
+    ctx->cold->child_use_ssl = use_ssl;
+
+    ctx->cold->host[0] = '\0';
+    ctx->cold->port[0] = '\0';
+
+    ctx->cold->listen_port = port;
+
+    ctx->cold->child_r_uh_cb = child_r_uh_cb;
+    ctx->cold->child_est_uh_cb = child_est_uh_cb;
+    ctx->cold->child_clo_uh_cb = child_clo_uh_cb;
+
+    ctx->cold->dup_udata_cb = dup_udata_cb;
+
+    ctx->clo_uh_cb = clo_uh_cb;
+
+    ctx->udata_id = udata_id;
+
+    ctx->dirn = D_LISTEN;
+
+    LOG( "id:0x%llx fd:%x listen_port:%d use_ssl:%d is_inherited:%d",
+         NET_ID_FMT( ctx->id ), ctx->fd,
+         ctx->cold->listen_port, use_ssl, is_inherited );
+
+    __start_listen( ctx );
+
+    /* NOTE: inherited accepted conns are adopted in __do_scheduled, *
+     *       user doesn't expect child handlers before return        */
+    ctx->cold->is_handover_pending = is_inherited;
+
+    return ctx->id;
+}
+
+conn_id_t net_make_unix_listen( net_r_uh_t         child_r_uh_cb,
+                                net_est_uh_t       child_est_uh_cb,
+                                net_clo_uh_t       child_clo_uh_cb,
+                                net_dup_udata_t    dup_udata_cb,
+                                net_clo_uh_t       clo_uh_cb,
+                                ptr_id_t           udata_id,
+                                char              *path,
+                                char              *type )
+{
+    ctx_t                  *ctx;
+    struct sockaddr_un     *addr;
+    int                     sock_type;
+    int                     fd;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !child_r_uh_cb || !child_est_uh_cb ||
+        !child_clo_uh_cb || !dup_udata_cb ||
+        !clo_uh_cb || !udata_id || !path || path[0] != '/' || !type )
+    {
+        LOGE( "" );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    sock_type = __get_unix_sock_type( type );
+    if( sock_type == -1 )
+    {
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    addr = __make_unix_addr( path );
+    if( !addr )
+    {
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    if( __remove_stale_unix_path( addr, sock_type ) )
+    {
+        free( addr );
+
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return 0;
+    }
+
+    fd = __create_socket( AF_UNIX, sock_type );
+    if( fd == -1 )
+    {
+        LOGE( "path:%s type:%s", path, type );
+
+        free( addr );
+
+        if( G_net_errno == NET_ERRNO_OK )
+            G_net_errno = NET_ERRNO_GENERAL_ERR;
+
+        return 0;
+    }
+
+    if( bind( fd, (struct sockaddr *) addr,
+              sizeof(struct sockaddr_un) ) == -1 ||
+        listen( fd, BACKLOG ) == -1 )
+    {
+        LOGE( "path:%s type:%s errno:%d strerror:%s",
+              path, type, errno, strerror( errno ) );
+
+        PROPER_CLOSE_FD( fd );
+        free( addr );
+
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return 0;
+    }
+
+    ctx = __init_new_ctx( fd );
+    c_assert( ctx );
+
+    ctx->cold->unix_addr = addr;
+    ctx->is_seqpacket = ( sock_type == SOCK_SEQPACKET );
+    ctx->is_shm = !strcmp( type, "shm" );
+
+    snprintf( ctx->cold->host, sizeof(ctx->cold->host), "%s", path );
+    snprintf( ctx->cold->port, sizeof(ctx->cold->port), "%s",
+              ctx->is_shm ? "shm" :
+              ctx->is_seqpacket ? "seqp" : "strm" );
+
+    ctx->cold->child_r_uh_cb = child_r_uh_cb;
+    ctx->cold->child_est_uh_cb = child_est_uh_cb;
+    ctx->cold->child_clo_uh_cb = child_clo_uh_cb;
+
+    ctx->cold->dup_udata_cb = dup_udata_cb;
+
+    ctx->clo_uh_cb = clo_uh_cb;
+
+    ctx->udata_id = udata_id;
+
+    ctx->dirn = D_LISTEN;
+
+    LOG( "id:0x%llx fd:%x path:%s type:%s",
+         NET_ID_FMT( ctx->id ), ctx->fd, path, type );
+
+    __start_listen( ctx );
+
+    return ctx->id;
+}
+
+conn_id_t net_make_conn( net_host_t    *host,
+                         net_r_uh_t     r_uh_cb,
+                         net_est_uh_t   est_uh_cb,
+                         net_clo_uh_t   clo_uh_cb,
+                         ptr_id_t       udata_id )
+{
+    ctx_t                  *ctx;
+    net_sock_profile_t     *profile = NULL;
+    struct sockaddr_un     *unix_addr = NULL;
+    bool                    not_found;
+    SSL                    *ssl;
+    int                     sock_type = SOCK_STREAM;
+    int                     fd = -1;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !host || !host->hostname || !host->port )
+    {
+        LOGE( "" );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    if( !host->addr && !__is_unix_host( host ) &&
+        !__is_pipe_host( host ) )
+    {
+        LOGE( "host:%s:%s", host->hostname, host->port );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    if( !r_uh_cb || !est_uh_cb || !clo_uh_cb || !udata_id )
+    {
+        LOGE( "host:%s:%s", host->hostname, host->port );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    if( __is_pipe_host( host ) )
+    {
+        return __make_pipe_conn( host, r_uh_cb, est_uh_cb,
+                                 clo_uh_cb, udata_id );
+    }
+
+    /* NOTE: sock profiles are TCP options, AF_UNIX conns *
+     *       don't use them                               */
+    if( __is_unix_host( host ) )
+    {
+        sock_type = __get_unix_sock_type( host->port );
+
+        if( sock_type == -1 || host->use_ssl ||
+            !(unix_addr = __make_unix_addr( host->hostname )) )
+        {
+            LOGE( "host:%s:%s use_ssl:%d",
+                  host->hostname, host->port, host->use_ssl );
+
+            G_net_errno = NET_ERRNO_WRONG_PARAMS;
+            return 0;
+        }
+    }
+    else
+    {
+        profile = __find_sock_profile( host->sock_profile, &not_found );
+        if( not_found )
+        {
+            LOGE( "host:%s:%s", host->hostname, host->port );
+
+            G_net_errno = NET_ERRNO_WRONG_PARAMS;
+            return 0;
+        }
+    }
+
+    /* NOTE: idle conn from the previous process is established, *
+     *       so connect() in __connect_cb returns EISCONN        */
+    if( !unix_addr && !host->use_ssl )
+    {
+        fd = __take_handover_fd( D_OUTGOING, 0, false,
+                                 host->hostname, host->port );
+
+        if( fd != -1 )
+            profile = NULL;
+    }
+
+    if( fd == -1 )
+        fd = __create_socket( unix_addr ? AF_UNIX : AF_INET, sock_type );
+
+    if( fd == -1 )
+    {
+        LOGE( "host:%s:%s", host->hostname, host->port );
+
+        free( unix_addr );
+
+        if( G_net_errno == NET_ERRNO_OK )
+            G_net_errno = NET_ERRNO_GENERAL_ERR;
+
+        return 0;
+    }
+
+    if( __apply_sock_profile( fd, profile, D_OUTGOING ) )
+    {
+        LOGE( "host:%s:%s", host->hostname, host->port );
+
+        PROPER_CLOSE_FD( fd );
+
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return 0;
+    }
+
+    ctx = __init_new_ctx( fd );
+    c_assert( ctx );
+
+    ctx->sock_profile = profile;
+
+    ctx->cold->unix_addr = unix_addr;
+    ctx->is_seqpacket = ( sock_type == SOCK_SEQPACKET );
+    ctx->is_shm = ( unix_addr && !strcmp( host->port, "shm" ) );
+
+    /* NOTE: with TCP_FASTOPEN_CONNECT connect() returns at once *
+     *       and SYN is sent with the first write (first         *
+     *       net_post_data or SSL ClientHello), so it fits only  *
+     *       protocols where the client speaks first             */
+    if( profile && profile->fastopen > 0 )
+    {
+        ctx->is_tfo_pending = true;
+        g_tfo_stats.out_attempts++;
+    }
+
+    if( host->use_ssl )
+    {
+        ssl = SSL_new( g_ssl_client_ctx );
+        c_assert( ssl );
+
+        SSL_set_fd( ssl, ctx->fd );
+        SSL_set_connect_state( ssl ); /* means doing as client */
+
+        ctx->ssl = ssl;
+    }
+
+    strncpy( ctx->cold->host, host->hostname, sizeof(ctx->cold->host) );
+    strncpy( ctx->cold->port, host->port, sizeof(ctx->cold->port) );
+    ctx->cold->host[sizeof(ctx->cold->host) - 1] = '\0';
+    ctx->cold->port[sizeof(ctx->cold->port) - 1] = '\0';
+
+    if( unix_addr )
+    {
+        snprintf( ctx->cold->port, sizeof(ctx->cold->port), "%s",
+                  ctx->is_shm ? "shm" :
+                  ctx->is_seqpacket ? "seqp" : "strm" );
+    }
+    else
+    {
+        ctx->cold->peer = *(struct sockaddr_in *)
+                    (((struct addrinfo *)host->addr)->ai_addr);
+    }
+
+    B_ALLOC( ctx->rb, READ_BUFFER_SIZE );
+
+    ctx->r_uh_cb = r_uh_cb;
+    ctx->est_uh_cb = est_uh_cb;
+    ctx->clo_uh_cb = clo_uh_cb;
+
+    ctx->udata_id = udata_id;
+
+    ctx->dirn = D_OUTGOING;
+
+    LOG( "id:0x%llx udata_id:0x%llx fd:%x "
+         "host:%s:%s use_ssl:%d",
+         NET_ID_FMT( ctx->id ), PTRID_FMT( udata_id ),
+         ctx->fd, ctx->cold->host, ctx->cold->port, host->use_ssl );
+
+    __start_connect( ctx );
+
+    return ctx->id;
+}
+
+conn_id_t net_make_udp( char               *endpoint,
+                        net_dgram_uh_t      dgram_uh_cb,
+                        net_clo_uh_t        clo_uh_cb,
+                        ptr_id_t            udata_id )
+{
+    ctx_t                  *ctx;
+    net_udp_endpoint_t     *udp;
+    xsk_t                  *xsk;
+    struct sockaddr_in      serv, peer;
+    int                     batch, dgram_size;
+    int                     fd;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !endpoint || !dgram_uh_cb || !clo_uh_cb || !udata_id )
+    {
+        LOGE( "" );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    udp = net_get_udp_endpoint( endpoint );
+    if( !udp )
+    {
+        LOGE( "endpoint:%s", endpoint );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return 0;
+    }
+
+    fd = __create_socket( AF_INET, SOCK_DGRAM );
+    if( fd == -1 )
+    {
+        LOGE( "endpoint:%s", endpoint );
+
+        if( G_net_errno == NET_ERRNO_OK )
+            G_net_errno = NET_ERRNO_GENERAL_ERR;
+
+        return 0;
+    }
+
+    if( __setup_udp_socket( fd, udp, &serv, &peer ) )
+    {
+        LOGE( "endpoint:%s", endpoint );
+
+        PROPER_CLOSE_FD( fd );
+
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return 0;
+    }
+
+    /* NOTE: the UDP socket is kept for the multicast join, *
+     *       it doesn't receive redirected datagrams        */
+    if( udp->xdp_ifname )
+    {
+        xsk = __open_xsk( udp );
+
+        if( !xsk )
+        {
+            LOGE( "endpoint:%s", endpoint );
+
+            PROPER_CLOSE_FD( fd );
+
+            if( G_net_errno == NET_ERRNO_OK )
+                G_net_errno = NET_ERRNO_GENERAL_ERR;
+
+            return 0;
+        }
+
+        ctx = __init_new_ctx( xdp_fd( xsk ) );
+        c_assert( ctx );
+
+        ctx->cold->xsk = xsk;
+        ctx->cold->xsk_join_fd = fd;
+    }
+    else
+    {
+        ctx = __init_new_ctx( fd );
+        c_assert( ctx );
+    }
+
+    ctx->cold->serv = serv;
+    ctx->cold->peer = peer;
+
+    snprintf( ctx->cold->host, sizeof(ctx->cold->host), "%s",
+              udp->group ? udp->group :
+              (udp->dest ? udp->dest : endpoint) );
+
+    snprintf( ctx->cold->port, sizeof(ctx->cold->port), "%d",
+              udp->port ? udp->port : udp->dest_port );
+
+    batch = *cfg_net_udp_recv_batch;
+
+    if( batch <= 0 || batch > UDP_MAX_BATCH )
+        batch = UDP_MAX_BATCH;
+
+    dgram_size = ( udp->dgram_size > 0 ) ?
+                 udp->dgram_size : UDP_DGRAM_SIZE;
+
+    ctx->cold->udp_rx = __make_udp_rx( batch, dgram_size );
+
+    ctx->cold->udp = udp;
+    ctx->cold->dgram_uh_cb = dgram_uh_cb;
+    ctx->clo_uh_cb = clo_uh_cb;
+
+    ctx->udata_id = udata_id;
+
+    ctx->dirn = D_UDP;
+
+    LOG( "id:0x%llx fd:%x endpoint:%s host:%s:%s batch:%d "
+         "dgram_size:%d rcvbuf:%d xdp:%d",
+         NET_ID_FMT( ctx->id ), ctx->fd, endpoint,
+         ctx->cold->host, ctx->cold->port, batch, dgram_size,
+         __get_sock_opt( ctx->cold->xsk ? ctx->cold->xsk_join_fd : ctx->fd,
+                         SOL_SOCKET, SO_RCVBUF ),
+         !!ctx->cold->xsk );
+
+    __start_udp( ctx );
 
-        /* unexpected error occured */
-        __shutdown_ctx( ctx, NET_CODE_ERR_READ );
-        return;
-    }
+    return ctx->id;
+}
 
-    /* NOTE: consider r == 0 as closed by peer */
+int net_send_dgrams( conn_id_t      conn_id,
+                     net_dgram_t   *dgrams,
+                     int            cnt )
+{
+    ctx_t                  *ctx;
+    net_dgram_t            *dgram;
+    struct mmsghdr          msgs[UDP_MAX_BATCH];
+    struct iovec            iovs[UDP_MAX_BATCH];
+    struct sockaddr_in      addrs[UDP_MAX_BATCH];
+    int                     sent = 0, n;
+    int                     r, syserr;
+    int                     i;
 
-    if( r > 0 )
-    {
-        B_INCREASE_USED( ctx->rb, r );
-    }
+    G_net_errno = NET_ERRNO_OK;
 
-    if( B_REMAINDER_SIZE( ctx->rb ) < B_MIN_RDBUF_REMAINDER( ctx->rb ) )
+    if( !conn_id || !dgrams || cnt <= 0 )
     {
-        B_INCREASE_BUF( ctx->rb, READ_BUFFER_SIZE );
+        LOGE( "" );
 
-        LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
-             PTRID_FMT( ctx->id ), host, port,
-             B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
     }
 
-    LOGD( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
-          PTRID_FMT( ctx->id ), host, port,
-          B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+    ctx = __get_ctx( conn_id );
 
-    if( __call_read_handler( ctx, !r ) )
+    if( !ctx->state || ctx->state->st != S_UDP || ctx->cold->xsk ||
+        ctx->to_shutdown || ctx->is_in_destroying )
     {
-        LOG( "id:0x%llx host:%s:%s",
-             PTRID_FMT( ctx->id ), host, port );
+        LOGE( "id:0x%llx state:%d",
+              NET_ID_FMT( conn_id ),
+              ctx->state ? ctx->state->st : 0 );
 
-        return;
+        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
+        return -1;
     }
 
-    if( !r )
+    for( i = 0; i < cnt; i++ )
     {
-        LOG( "id:0x%llx host:%s:%s rb.used:%lu rb.size:%lu",
-             PTRID_FMT( ctx->id ), host, port,
-             B_USED_SIZE( ctx->rb ), B_SIZE( ctx->rb ) );
+        dgram = &dgrams[i];
 
-        __shutdown_ctx( ctx, NET_CODE_SUCCESS );
-    }
-}
+        if( !dgram->buf || dgram->len <= 0 ||
+            (!dgram->port && !ctx->cold->peer.sin_port) )
+        {
+            LOGE( "id:0x%llx host:%s:%s dgram:%d len:%d",
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  i, dgram->len );
 
-static void __listen_cb( ctx_t *ctx )
-{
-    struct sockaddr_in      peer;
-    socklen_t               peer_len = sizeof(peer);
-    int                     fd;
-    int                     syserr;
+            G_net_errno = NET_ERRNO_WRONG_PARAMS;
+            return -1;
+        }
+    }
 
-    errno = 0;
-    while( (fd = accept( ctx->fd,
-                         (struct sockaddr *) &peer,
-                         &peer_len )) == -1 && errno == EINTR )
-        errno = 0;
+    while( sent < cnt )
+    {
+        n = cnt - sent;
 
-    syserr = errno;
+        if( n > UDP_MAX_BATCH )
+            n = UDP_MAX_BATCH;
 
-    if( fd >= 0 )
-    {
-        LOG( "id:0x%llx listen_port:%d new_fd:%x",
-             PTRID_FMT( ctx->id ), ctx->listen_port, fd );
+        memset( msgs, 0, n * sizeof(struct mmsghdr) );
 
-        if( peer_len == sizeof(peer) )
-        {
-            __create_accepted( ctx, fd, &peer );
-        }
-        else
+        for( i = 0; i < n; i++ )
         {
-            LOGE( "id:0x%llx listen_port:%d",
-                  PTRID_FMT( ctx->id ), ctx->listen_port );
+            dgram = &dgrams[sent + i];
 
-            __create_accepted( ctx, fd, NULL );
+            iovs[i].iov_base = dgram->buf;
+            iovs[i].iov_len = dgram->len;
+
+            if( dgram->port )
+            {
+                memset( &addrs[i], 0, sizeof(struct sockaddr_in) );
+
+                addrs[i].sin_family = AF_INET;
+                addrs[i].sin_addr.s_addr = dgram->ip;
+                addrs[i].sin_port = dgram->port;
+            }
+            else
+                addrs[i] = ctx->cold->peer;
+
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
         }
 
-        g_skip_cb = true;
-        return;
-    }
+        errno = 0;
+        while( (r = sendmmsg( ctx->fd, msgs, n,
+                              MSG_DONTWAIT )) == -1 && errno == EINTR )
+            errno = 0;
 
-    switch( syserr )
-    {
-        /* transient errors */
-        case EAGAIN:
-        case ECONNABORTED:
-        case ENETDOWN:
-        case EPROTO:
-        case ENOPROTOOPT:
-        case EHOSTDOWN:
-        case ENONET:
-        case EHOSTUNREACH:
-        case EOPNOTSUPP:
-        case ENETUNREACH:
+        syserr = errno;
 
-            LOGD( "id:0x%llx listen_port:%d ret:%d "
+        if( r == -1 )
+        {
+            if( syserr == EAGAIN )
+            {
+                LOGD( "id:0x%llx host:%s:%s sent:%d cnt:%d",
+                      NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                      sent, cnt );
+
+                break;
+            }
+
+            LOGE( "id:0x%llx host:%s:%s sent:%d cnt:%d "
                   "errno:%d strerror:%s",
-                  PTRID_FMT( ctx->id ), ctx->listen_port,
-                  fd, syserr, strerror( syserr ) );
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+                  sent, cnt, syserr, strerror( syserr ) );
 
-            g_skip_cb = true;
-            return;
+            if( sent )
+                break;
 
-        /* fatal errors */
-        default:
+            G_net_errno = NET_ERRNO_GENERAL_ERR;
+            return -1;
+        }
 
-            LOGE( "id:0x%llx listen_port:%d ret:%d "
-                  "errno:%d strerror:%s",
-                  PTRID_FMT( ctx->id ), ctx->listen_port,
-                  fd, syserr, strerror( syserr ) );
+        sent += r;
 
-            /* NOTE: close listen conn */
-            __shutdown_ctx( ctx, NET_CODE_ERR_ACCEPT );
+        if( r < n )
+            break;
     }
+
+    LOGD( "id:0x%llx host:%s:%s sent:%d cnt:%d",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port, sent, cnt );
+
+    return sent;
 }
 
-static void __connect_cb( ctx_t *ctx )
+int net_shutdown_conn( conn_id_t    conn_id,
+                       bool         flush_and_close )
 {
-    int                     r, syserr;
-
-    errno = 0;
-    while( (r = connect( ctx->fd,
-                         (struct sockaddr *) &ctx->peer,
-                         sizeof(ctx->peer) )) == -1 && errno == EINTR )
-        errno = 0;
+    ctx_t                  *ctx;
 
-    syserr = errno;
+    G_net_errno = NET_ERRNO_OK;
 
-    if( !r || syserr == EISCONN )
+    if( !conn_id )
     {
-        LOG( "id:0x%llx host:%s:%s",
-             PTRID_FMT( ctx->id ), ctx->host, ctx->port );
+        LOGE( "" );
 
-        __established( ctx );
-        return;
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
     }
 
-    if( syserr == EINPROGRESS || syserr == EALREADY )
+    ctx = __get_ctx( conn_id );
+
+    if( !ctx->state || ctx->is_in_dup_udata ||
+        ctx->state->st == S_SSL_SHUTDOWN ||
+        ctx->to_shutdown || ctx->is_in_destroying ||
+        ctx->flush_and_close )
     {
-        LOGD( "id:0x%llx host:%s:%s",
-              PTRID_FMT( ctx->id ), ctx->host, ctx->port );
+        if( ctx->flush_and_close )
+        {
+            LOG( "id:0x%llx", NET_ID_FMT( conn_id ) );
+        }
+        else
+        {
+            LOGE( "id:0x%llx state:%d",
+                  NET_ID_FMT( conn_id ),
+                  ctx->state ? ctx->state->st : 0 );
+        }
 
-        g_skip_cb = true;
-        return;
+        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
+        return -1;
     }
 
-    LOGE( "id:0x%llx host:%s:%s ret:%d errno:%d strerror:%s",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-          r, syserr, strerror( syserr ) );
-
-    __shutdown_ctx( ctx, NET_CODE_ERR_EST );
-}
-
-/******************* Do-scheduled functions ***********************************/
+    /* NOTE: tunnel half-close is done by the tunnel itself, *
+     *       so there is nothing to flush by the user        */
+    if( flush_and_close && ctx->state->st != S_TUNNEL )
+    {
+        /* NOTE: since this moment, no app timers is needed */
+        __cleanup_timers( ctx );
 
-static void __call_timers( ll_t    *list,
-                           ctx_t   *ctx )
-{
-    tmr_t              *tmr;
-    tmr_t              *tmr_next;
-    int                 tmr_total;
-    int                 i = 0;
-    int                 r;
+        ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
+                                             __flush_and_close_timeout_cb,
+                                             cfg_net_flush_and_close_timeout );
 
-    c_assert( list->total > 0 && list->total <= MAX_TIMERS );
+        c_assert( ctx->state_tmr_id );
 
-    LL_CHECK( list, list->head );
-    tmr = PTRID_GET_PTR( list->head );
+        ctx->flush_and_close = true;
+    }
+    else
+        ctx->to_shutdown = true;
 
-    tmr_total = list->total;
+    LOG( "id:0x%llx flush_and_close:%d",
+         NET_ID_FMT( conn_id ), flush_and_close );
 
-    /* NOTE: tmr->uh_cb can create new tmrs, *
-     * but don't call timers >= tmr_total    *
-     * at this iteration.                    */
-    while( tmr && i < tmr_total )
-    {
-        i++;
+    return 0;
+}
 
-        c_assert( ctx || tmr->udata_id );
-        c_assert( !tmr->locked && !tmr->to_delete );
+net_state_t net_is_est_conn( conn_id_t conn_id )
+{
+    ctx_t                  *ctx;
 
-        LOGD( "tmr:0x%llx timeout.tv_sec:%ld timeout.tv_usec:%ld "
-              "shift.tv_sec:%ld shift.tv_usec:%ld",
-              PTRID_FMT( tmr->id ), tmr->timeout.tv_sec,
-              tmr->timeout.tv_usec, tmr->shift.tv_sec, tmr->shift.tv_usec );
+    G_net_errno = NET_ERRNO_OK;
 
-        if( (tmr->timeout.tv_sec == G_now.tv_sec &&
-             tmr->timeout.tv_usec == G_now.tv_usec) ||
-            timercmp( &tmr->timeout, &G_now, < ) )
-        {
-            LOGD( "tmr:0x%llx", PTRID_FMT( tmr->id ) );
+    if( !conn_id )
+    {
+        LOGE( "" );
 
-            tmr->locked = true;
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return NET_STATE_ERROR;
+    }
 
-            tmr->uh_cb( ctx ? ctx->id : 0,
-                        ctx ? ctx->udata_id : 0,
-                        tmr->id,
-                        tmr->udata_id );
+    ctx = __get_ctx( conn_id );
 
-            tmr->locked = false;
+    if( !ctx->state || ctx->is_in_dup_udata )
+    {
+        LOGE( "id:0x%llx", NET_ID_FMT( conn_id ) );
 
-            if( ctx && ctx->to_shutdown )
-            {
-                LOG( "tmr:0x%llx", PTRID_FMT( tmr->id ) );
+        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
+        return NET_STATE_ERROR;
+    }
 
-                return;
-            }
+    if( ctx->to_shutdown || ctx->is_in_destroying )
+    {
+        LOGD( "id:0x%llx state:%d",
+              NET_ID_FMT( conn_id ), ctx->state->st );
 
-            /* NOTE: tmr->next can be freed and replaced after *
-             * tmr->uh_cb, so save tmr->next after tmr->uh_cb  */
-            LL_CHECK( list, tmr->id );
-            tmr_next = PTRID_GET_PTR( tmr->next );
+        return NET_STATE_NOT_EST;
+    }
 
-            if( tmr->to_delete )
-            {
-                if( ctx )
-                    r = __del_conn_tmr( ctx, tmr->id );
-                else
-                    r = net_del_global_tmr( tmr->id );
+    if( ctx->state->st == S_ESTABLISHED     ||
+        ctx->state->st == S_SSL_ESTABLISHED ||
+        ctx->state->st == S_TUNNEL          ||
+        ctx->state->st == S_UDP             ||
+        ctx->state->st == S_LISTENING )
+    {
+        if( ctx->flush_and_close )
+        {
+            LOGD( "id:0x%llx state:%d",
+                  NET_ID_FMT( conn_id ), ctx->state->st );
 
-                c_assert( !r );
-            }
-            else
-            {
-                timeradd( &tmr->timeout, &tmr->shift, &tmr->timeout );
-            }
+            return NET_STATE_FLUSH_AND_CLOSE;
         }
         else
         {
-            LL_CHECK( list, tmr->id );
-            tmr_next = PTRID_GET_PTR( tmr->next );
-        }
+            LOGD( "id:0x%llx state:%d",
+                  NET_ID_FMT( conn_id ), ctx->state->st );
 
-        tmr = tmr_next;
+            return NET_STATE_EST;
+        }
     }
+
+    LOGD( "id:0x%llx state:%d",
+          NET_ID_FMT( conn_id ), ctx->state->st );
+
+    return NET_STATE_NOT_EST;
 }
 
-static void __call_conn_timers( ctx_t *ctx )
+int net_set_write_watermarks( conn_id_t        conn_id,
+                              net_drain_uh_t   drain_uh_cb,
+                              unsigned long    high_bytes,
+                              unsigned long    low_bytes,
+                              int              high_msgs,
+                              int              low_msgs )
 {
-    conn_id_t           prev_id = ctx->id;
+    ctx_t                  *ctx;
 
-    if( !ctx->tmr_list.total )
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !conn_id || high_msgs < 0 || low_msgs < 0 )
     {
-        c_assert( !ctx->tmr_list.head &&
-                  !ctx->tmr_list.tail );
+        LOGE( "" );
 
-        return;
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
     }
 
-    LOGD( "id:0x%llx host:%s:%s state:%d tmr_total:%d",
-          PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-          ctx->state->st, ctx->tmr_list.total );
+    ctx = __get_ctx( conn_id );
 
-    __call_timers( &ctx->tmr_list, ctx );
+    if( ctx->dirn == D_LISTEN || ctx->is_in_destroying )
+    {
+        LOGE( "id:0x%llx", NET_ID_FMT( conn_id ) );
 
-    c_assert( ctx->id == prev_id );
+        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
+        return -1;
+    }
 
-    if( ctx->to_shutdown )
-    {
-        LOG( "id:0x%llx host:%s:%s state:%d",
-             PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-             ctx->state->st );
+    if( high_bytes )
+        ctx->wb_high_bytes = high_bytes;
 
-        ctx->to_shutdown = false;
+    if( low_bytes )
+        ctx->wb_low_bytes = low_bytes;
 
-        __shutdown_ctx( ctx, NET_CODE_SUCCESS );
+    if( high_msgs )
+        ctx->wb_high_msgs = high_msgs;
+
+    if( low_msgs )
+        ctx->wb_low_msgs = low_msgs;
+
+    if( ctx->wb_low_bytes > ctx->wb_high_bytes ||
+        ctx->wb_low_msgs > ctx->wb_high_msgs )
+    {
+        LOGE( "id:0x%llx high_bytes:%lu low_bytes:%lu "
+              "high_msgs:%d low_msgs:%d",
+              NET_ID_FMT( conn_id ),
+              ctx->wb_high_bytes, ctx->wb_low_bytes,
+              ctx->wb_high_msgs, ctx->wb_low_msgs );
+
+        ctx->wb_low_bytes = ctx->wb_high_bytes;
+        ctx->wb_low_msgs = ctx->wb_high_msgs;
     }
+
+    ctx->drain_uh_cb = drain_uh_cb;
+
+    LOG( "id:0x%llx host:%s:%s high_bytes:%lu low_bytes:%lu "
+         "high_msgs:%d low_msgs:%d",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         ctx->wb_high_bytes, ctx->wb_low_bytes,
+         ctx->wb_high_msgs, ctx->wb_low_msgs );
+
+    return 0;
 }
 
-static void __call_global_timers()
+int net_get_lane_stats( conn_id_t          conn_id,
+                        net_lane_stats_t  *stats )
 {
-    if( !g_tmr_list.total )
+    ctx_t                  *ctx;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !conn_id || !stats )
     {
-        c_assert( !g_tmr_list.head &&
-                  !g_tmr_list.tail );
+        LOGE( "" );
 
-        return;
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
     }
 
-    LOGD( "tmr_total:%d", g_tmr_list.total );
+    ctx = __get_ctx( conn_id );
 
-    __call_timers( &g_tmr_list, NULL );
+    memcpy( stats, ctx->cold->wb_lane_stats,
+            sizeof(net_lane_stats_t) * NET_PRIO_MAX );
+
+    return 0;
 }
 
-static void __do_scheduled()
+int net_get_rx_timestamp( conn_id_t     conn_id,
+                          net_rx_ts_t  *ts )
 {
-    ctx_t              *ctx;
-    int                 fd;
+    ctx_t                  *ctx;
 
-    LOGD( "" );
+    G_net_errno = NET_ERRNO_OK;
 
-    /* NOTE: Warning - O(n) */
-    for( fd = 0; fd <= NET_MAX_FD; fd++ )
+    if( !conn_id || !ts )
     {
-        ctx = &g_ctx_array[fd];
+        LOGE( "" );
 
-        if( !ctx->id )
-            continue;
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
 
-        c_assert( ctx->id && ctx->fd == fd );
+    ctx = __get_ctx( conn_id );
 
-        if( ctx->to_shutdown )
-        {
-            ctx->to_shutdown = false;
+    *ts = ctx->cold->rx_ts;
 
-            __shutdown_ctx( ctx, NET_CODE_SUCCESS );
-            continue;
-        }
+    return 0;
+}
 
-        __call_conn_timers( ctx );
-    }
+int net_get_rx_latency_stats( conn_id_t                 conn_id,
+                              net_rx_latency_stats_t   *stats )
+{
+    ctx_t                  *ctx;
 
-    __call_global_timers();
-}
+    G_net_errno = NET_ERRNO_OK;
 
-/******************* Interface functions **************************************/
+    if( !conn_id || !stats )
+    {
+        LOGE( "" );
 
-/* NOTE: this function can be called without a timer callback,  *
- * it's needed to call this function before first net_make_conn */
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
 
-void net_update_main_hosts( conn_id_t    conn_id,
-                            ptr_id_t     conn_udata_id,
-                            tmr_id_t     tmr_id,
-                            ptr_id_t     tmr_udata_id )
-{
-    net_host_node_t        *node;
-    net_host_node_t        *node_next;
-    ll_t                   *list;
-    struct addrinfo         hints;
-    struct addrinfo        *result;
-    struct addrinfo        *addr;
-    struct sockaddr_in     *ai_addr;
-    int                     r, i = 0;
+    ctx = __get_ctx( conn_id );
 
-    G_net_errno = NET_ERRNO_OK;
+    *stats = ctx->cold->rx_latency;
 
-    c_assert( !conn_id && !conn_udata_id && tmr_udata_id );
+    return 0;
+}
 
-    list = PTRID_GET_PTR( tmr_udata_id );
+int net_get_conn_stats( conn_id_t           conn_id,
+                        net_conn_stats_t   *stats )
+{
+    ctx_t                  *ctx;
 
-    LL_CHECK( list, list->head );
-    node = PTRID_GET_PTR( list->head );
+    G_net_errno = NET_ERRNO_OK;
 
-    while( node )
+    if( !conn_id || !stats )
     {
-        LL_CHECK( list, node->id );
-        node_next = PTRID_GET_PTR( node->next );
+        LOGE( "" );
 
-        i++;
-        c_assert( node->host.hostname &&
-                  node->host.port && i <= list->total );
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
 
-        addr = (struct addrinfo *) node->host.addr;
+    ctx = __get_ctx( conn_id );
 
-        if( addr )
-        {
-            ai_addr = (struct sockaddr_in *)(addr->ai_addr);
+    if( !__is_tcp_conn( ctx ) )
+    {
+        LOGE( "id:0x%llx host:%s:%s state:%d dirn:%d",
+              NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+              ctx->state ? ctx->state->st : -1, ctx->dirn );
 
-            LOGD( "tmr:0x%llx host:%s:%s ip:%s",
-                  PTRID_FMT( tmr_id ),
-                  node->host.hostname,
-                  node->host.port,
-                  inet_ntoa( ai_addr->sin_addr ) );
+        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
+        return -1;
+    }
 
-            freeaddrinfo( addr );
+    if( !g_tcp_info_tmr_id )
+        __sample_tcp_info( ctx );
 
-            node->host.addr = NULL;
-        }
+    *stats = ctx->cold->tcp_stats;
+    stats->wb_bytes = ctx->wb_bytes;
 
-        memset( &hints, 0, sizeof(struct addrinfo) );
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
+    return 0;
+}
 
-        r = getaddrinfo( node->host.hostname,
-                         node->host.port,
-                         &hints, &result );
+int net_async_post_data( conn_id_t      conn_id,
+                         char          *data,
+                         unsigned long  len,
+                         bool           flush_and_close,
+                         net_prio_t     prio )
+{
+    async_cmd_t            *cmd;
 
-        if( r )
-        {
-            LOGE( "tmr:0x%llx host:%s:%s error:%s",
-                  PTRID_FMT( tmr_id ),
-                  node->host.hostname,
-                  node->host.port,
-                  gai_strerror( r ) );
+    if( !conn_id || !data || !len || prio < 0 || prio >= NET_PRIO_MAX )
+        return -1;
 
-            node = node_next;
-            continue;
-        }
+    cmd = malloc( sizeof(async_cmd_t) + len );
+    if( !cmd )
+        return -1;
 
-        node->host.addr = (void *) result;
-        ai_addr = (struct sockaddr_in *)(result->ai_addr);
+    memset( cmd, 0, sizeof(async_cmd_t) );
 
-        LOG( "tmr:0x%llx host:%s:%s ip:%s",
-             PTRID_FMT( tmr_id ),
-             node->host.hostname,
-             node->host.port,
-             inet_ntoa( ai_addr->sin_addr ) );
+    cmd->type = ASYNC_POST;
+    cmd->conn_id = conn_id;
+    cmd->flush_and_close = flush_and_close;
+    cmd->prio = prio;
+    cmd->len = len;
 
-        node = node_next;
-    }
+    memcpy( cmd->data, data, len );
 
-    c_assert( i == list->total );
+    return __async_enqueue( cmd );
 }
 
-void net_update_host( net_host_t   *host )
+int net_async_shutdown_conn( conn_id_t  conn_id,
+                             bool       flush_and_close )
 {
-    struct addrinfo     hints;
-    struct addrinfo    *result;
-    int                 r;
-
-    c_assert( host );
-
-    if( host->addr )
-    {
-        freeaddrinfo( host->addr );
-        host->addr = NULL;
-    }
+    async_cmd_t            *cmd;
 
-    memset( &hints, 0, sizeof(struct addrinfo) );
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
+    if( !conn_id )
+        return -1;
 
-    r = getaddrinfo( host->hostname,
-                     host->port,
-                     &hints, &result );
+    cmd = malloc( sizeof(async_cmd_t) );
+    if( !cmd )
+        return -1;
 
-    if( r )
-    {
-        LOGE( "host:%s:%s error:%s",
-              host->hostname,
-              host->port,
-              gai_strerror( r ) );
+    memset( cmd, 0, sizeof(async_cmd_t) );
 
-        return;
-    }
+    cmd->type = ASYNC_SHUTDOWN;
+    cmd->conn_id = conn_id;
+    cmd->flush_and_close = flush_and_close;
 
-    host->addr = (void *) result;
+    return __async_enqueue( cmd );
 }
 
-void net_free_host( net_host_t     *host )
+int net_async_call( net_async_cb_t  cb,
+                    ptr_id_t        udata_id )
 {
-    c_assert( host->hostname && host->port );
+    async_cmd_t            *cmd;
 
-    free( host->hostname );
-    free( host->port );
+    if( !cb )
+        return -1;
 
-    if( host->label )
-        free( host->label );
+    cmd = malloc( sizeof(async_cmd_t) );
+    if( !cmd )
+        return -1;
 
-    if( host->addr )
-        freeaddrinfo( host->addr );
+    memset( cmd, 0, sizeof(async_cmd_t) );
+
+    cmd->type = ASYNC_CALL;
+    cmd->cb = cb;
+    cmd->udata_id = udata_id;
+
+    return __async_enqueue( cmd );
 }
 
-net_host_t *net_get_host( ll_t     *host_list,
-                          char     *label )
+int net_offload( net_offload_fn_t        fn,
+                 void                   *arg,
+                 net_offload_fn_t        completion_cb )
 {
-    net_host_node_t        *node;
-    net_host_node_t        *node_next;
-    net_host_t             *host = NULL;
-    int                     i = 0;
-
-    c_assert( host_list && label );
+    async_cmd_t            *cmd;
 
     G_net_errno = NET_ERRNO_OK;
 
-    LL_CHECK( host_list, host_list->head );
-    node = PTRID_GET_PTR( host_list->head );
-
-    while( node )
+    if( !fn || !completion_cb )
     {
-        LL_CHECK( host_list, node->id );
-        node_next = PTRID_GET_PTR( node->next );
+        LOGE( "" );
 
-        i++;
-        c_assert( node->host.hostname &&
-                  node->host.port &&
-                  i <= host_list->total );
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
 
-        if( node->host.label &&
-            !strcasecmp( node->host.label, label ) )
-        {
-            host = &node->host;
-            break;
-        }
+    cmd = malloc( sizeof(async_cmd_t) );
+    c_assert( cmd );
 
-        node = node_next;
+    memset( cmd, 0, sizeof(async_cmd_t) );
+
+    cmd->type = ASYNC_OFFLOAD;
+    cmd->fn = fn;
+    cmd->done_cb = completion_cb;
+    cmd->arg = arg;
+
+    if( !g_offload_pool.total )
+    {
+        fn( arg );
+
+        /* NOTE: completion is never called from the caller's stack */
+        return __async_enqueue( cmd );
     }
 
-    return host;
-}
+    __offload_submit( cmd );
 
-/*  It can be used for internal timers and user level timers.  *
- *  Example of user level global timers: to update main_hosts. */
+    LOGD( "jobs:%lu steals:%lu",
+          g_offload_pool.total_jobs,
+          __atomic_load_n( &g_offload_pool.total_steals, __ATOMIC_RELAXED ) );
+
+    return 0;
+}
 
-tmr_id_t net_make_global_tmr( ptr_id_t           udata_id,
-                              net_tmr_cb_t       cb,
-                              struct timeval    *timeout )
+int net_defer( net_defer_cb_t       cb,
+               ptr_id_t             udata_id )
 {
-    tmr_t                  *tmr;
-
     G_net_errno = NET_ERRNO_OK;
 
-    if( !udata_id || !cb || !timeout )
+    if( !cb )
     {
         LOGE( "" );
 
         G_net_errno = NET_ERRNO_WRONG_PARAMS;
-        return 0;
+        return -1;
     }
 
-    if( g_tmr_list.total > MAX_TIMERS )
+    __defer_push( cb, udata_id );
+
+    return 0;
+}
+
+net_hook_id_t net_add_loop_hook( net_hook_type_t    type,
+                                 net_hook_cb_t      cb,
+                                 ptr_id_t           udata_id )
+{
+    hook_t                 *hook;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( type < 0 || type >= NET_HOOK_TYPES || !cb )
     {
-        LOGE( "udata_id:0x%llx", PTRID_FMT( udata_id ) );
+        LOGE( "type:%d", type );
 
-        G_net_errno = NET_ERRNO_TMR_MAX;
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
         return 0;
     }
 
-    tmr = __make_timer( cb, timeout );
+    hook = malloc( sizeof(hook_t) );
+    c_assert( hook );
 
-    LL_ADD_NODE( &g_tmr_list, tmr );
+    memset( hook, 0, sizeof(hook_t) );
 
-    tmr->udata_id = udata_id;
+    hook->type = type;
+    hook->cb = cb;
+    hook->udata_id = udata_id;
 
-    LOG( "tmr:0x%llx udata_id:0x%llx timeout.tv_sec:%ld timeout.tv_usec:%ld "
-         "shift.tv_sec:%ld shift.tv_usec:%ld",
-         PTRID_FMT( tmr->id ), PTRID_FMT( udata_id ),
-         tmr->timeout.tv_sec, tmr->timeout.tv_usec,
-         tmr->shift.tv_sec, tmr->shift.tv_usec );
+    LL_ADD_NODE( &g_hook_lists[type], hook );
+
+    LOG( "hook:0x%llx type:%d total:%d",
+         PTRID_FMT( hook->id ), type, g_hook_lists[type].total );
 
-    return tmr->id;
+    return hook->id;
 }
 
-int net_del_global_tmr( tmr_id_t tmr_id )
+int net_del_loop_hook( net_hook_id_t hook_id )
 {
-    tmr_t                  *tmr;
+    hook_t                 *hook;
+    ll_t                   *list;
 
     G_net_errno = NET_ERRNO_OK;
 
-    if( !tmr_id )
+    if( !hook_id )
     {
         LOGE( "" );
 
@@ -2293,57 +9244,86 @@ int net_del_global_tmr( tmr_id_t tmr_id )
         return -1;
     }
 
-    tmr = PTRID_GET_PTR( tmr_id );
+    hook = PTRID_GET_PTR( hook_id );
+    c_assert( hook->id == hook_id && !hook->to_delete );
 
-    LOG( "tmr:0x%llx", PTRID_FMT( tmr->id ) );
+    list = &g_hook_lists[hook->type];
 
-    return __del_timer( tmr, &g_tmr_list );
+    LOG( "hook:0x%llx type:%d in_hooks:%d",
+         PTRID_FMT( hook_id ), hook->type, g_is_in_hooks );
+
+    /* NOTE: the list may be walked right now */
+    if( g_is_in_hooks )
+    {
+        hook->to_delete = true;
+        return 0;
+    }
+
+    LL_DEL_NODE( list, hook_id );
+
+    memset( hook, 0, sizeof(hook_t) );
+    free( hook );
+
+    return 0;
 }
 
-tmr_id_t net_make_conn_tmr( conn_id_t        conn_id,
-                            ptr_id_t         udata_id,
-                            net_tmr_cb_t     cb,
-                            struct timeval  *timeout )
+int net_pause_read( conn_id_t   conn_id,
+                    bool        pause )
 {
     ctx_t                  *ctx;
 
     G_net_errno = NET_ERRNO_OK;
 
-    if( !conn_id || !cb || !timeout )
+    if( !conn_id )
     {
         LOGE( "" );
 
         G_net_errno = NET_ERRNO_WRONG_PARAMS;
-        return 0;
+        return -1;
     }
 
     ctx = __get_ctx( conn_id );
 
+    /* NOTE: handshakes need EPOLLIN, so only est conns */
     if( !ctx->state || ctx->is_in_dup_udata ||
-        ctx->state->st == S_SSL_SHUTDOWN ||
-        ctx->state->st == S_LISTENING ||
-        ctx->state->st == S_SSL_ACCEPTING ||
-        ctx->to_shutdown || ctx->is_in_destroying ||
-        ctx->flush_and_close )
+        (ctx->state->st != S_ESTABLISHED &&
+         ctx->state->st != S_SSL_ESTABLISHED) ||
+        ctx->to_shutdown || ctx->is_in_destroying )
     {
-        LOGE( "id:0x%llx state:%d",
-              PTRID_FMT( conn_id ), ctx->state->st );
+        LOGE( "id:0x%llx", NET_ID_FMT( conn_id ) );
 
         G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
+        return -1;
+    }
+
+    if( ctx->is_read_paused == pause )
         return 0;
+
+    ctx->is_read_paused = pause;
+
+    __set_read_events( ctx, !pause );
+
+    if( !pause )
+    {
+        ctx->is_read_resumed = true;
+        g_sched_pending++;
     }
 
-    return __make_conn_tmr( ctx, udata_id, cb, timeout );
+    LOG( "id:0x%llx host:%s:%s pause:%d rb.used:%lu",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         pause, B_USED_SIZE( ctx->rb ) );
+
+    return 0;
 }
 
-int net_del_conn_tmr( conn_id_t       conn_id,
-                      tmr_id_t        tmr_id )
+int net_set_batch_read( conn_id_t           conn_id,
+                        net_batch_r_uh_t    cb )
 {
     ctx_t                  *ctx;
 
     G_net_errno = NET_ERRNO_OK;
 
-    if( !conn_id || !tmr_id )
+    if( !conn_id )
     {
         LOGE( "" );
 
@@ -2353,34 +9333,42 @@ int net_del_conn_tmr( conn_id_t       conn_id,
 
     ctx = __get_ctx( conn_id );
 
+    /* NOTE: datagrams and tunnels don't go through rb */
     if( !ctx->state || ctx->is_in_dup_udata ||
-        ctx->state->st == S_SSL_SHUTDOWN ||
-        ctx->state->st == S_LISTENING ||
-        ctx->state->st == S_SSL_ACCEPTING ||
-        ctx->to_shutdown || ctx->is_in_destroying ||
-        ctx->flush_and_close )
+        (ctx->dirn != D_OUTGOING && ctx->dirn != D_INCOMING) ||
+        ctx->cold->tunnel_peer_id ||
+        ctx->to_shutdown || ctx->is_in_destroying )
     {
-        LOGE( "id:0x%llx state:%d",
-              PTRID_FMT( conn_id ), ctx->state->st );
+        LOGE( "id:0x%llx dirn:%d", NET_ID_FMT( conn_id ), ctx->dirn );
 
         G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
         return -1;
     }
 
-    return __del_conn_tmr( ctx, tmr_id );
+    ctx->batch_r_uh_cb = cb;
+
+    /* NOTE: buffered data goes to the new handler */
+    if( B_HAS_USED( ctx->rb ) )
+    {
+        ctx->is_read_resumed = true;
+        g_sched_pending++;
+    }
+
+    LOG( "id:0x%llx host:%s:%s batch:%d rb.used:%lu",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         !!cb, B_USED_SIZE( ctx->rb ) );
+
+    return 0;
 }
 
-int net_post_data( conn_id_t        conn_id,
-                   char            *data,
-                   unsigned long    len,
-                   bool             flush_and_close )
+int net_set_idle_check( conn_id_t           conn_id,
+                        net_idle_uh_t       idle_uh_cb )
 {
     ctx_t                  *ctx;
-    wbuf_t                 *wbuf;
 
     G_net_errno = NET_ERRNO_OK;
 
-    if( !conn_id || !data || !len )
+    if( !conn_id )
     {
         LOGE( "" );
 
@@ -2390,426 +9378,476 @@ int net_post_data( conn_id_t        conn_id,
 
     ctx = __get_ctx( conn_id );
 
-    if( !ctx->state || ctx->is_in_dup_udata ||
-        (ctx->state->st != S_ESTABLISHED &&
-         ctx->state->st != S_SSL_ESTABLISHED) ||
-        ctx->to_shutdown || ctx->is_in_destroying ||
-        ctx->flush_and_close )
+    if( ctx->dirn != D_OUTGOING && ctx->dirn != D_INCOMING )
     {
-        LOGE( "id:0x%llx state:%d",
-              PTRID_FMT( conn_id ), ctx->state->st );
+        LOGE( "id:0x%llx dirn:%d", NET_ID_FMT( conn_id ), ctx->dirn );
 
         G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
         return -1;
     }
 
-    c_assert( !ctx->state_tmr_id );
+    ctx->cold->idle_uh_cb = idle_uh_cb;
 
-    if( flush_and_close )
+    LOGD( "id:0x%llx host:%s:%s idle_check:%d",
+          NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+          !!idle_uh_cb );
+
+    return 0;
+}
+
+int net_consume( conn_id_t      conn_id,
+                 int            len )
+{
+    ctx_t                  *ctx;
+
+    G_net_errno = NET_ERRNO_OK;
+
+    if( !conn_id || len <= 0 )
     {
-        /* NOTE: since this moment, no app timers is needed */
-        __cleanup_timers( ctx );
+        LOGE( "len:%d", len );
 
-        ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
-                                             __flush_and_close_timeout_cb,
-                                             cfg_net_flush_and_close_timeout );
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
+    }
 
-        c_assert( ctx->state_tmr_id );
+    ctx = __get_ctx( conn_id );
 
-        ctx->flush_and_close = true;
+    if( !ctx->batch_r_uh_cb || len > B_USED_SIZE( ctx->rb ) )
+    {
+        LOGE( "id:0x%llx len:%d rb.used:%lu",
+              NET_ID_FMT( conn_id ), len, B_USED_SIZE( ctx->rb ) );
+
+        G_net_errno = NET_ERRNO_WRONG_PARAMS;
+        return -1;
     }
 
-    wbuf = malloc( sizeof(wbuf_t) );
-    memset( wbuf, 0, sizeof(wbuf_t) );
+    B_CUT_USED( ctx->rb, len );
 
-    B_ALLOC_FILL( wbuf->b, data, len );
+    if( g_capture.is_on )
+        __capture_cut( ctx, len );
 
-    LL_ADD_NODE( &ctx->wb_list, wbuf );
+    return 0;
+}
 
-    __enable_write( ctx );
+static int __check_tunnel_conn( ctx_t *ctx )
+{
+    /* NOTE: SSL conns can't be spliced, bytes must  *
+     *       be decrypted, seqpacket has boundaries, *
+     *       shm and pipe bytes aren't in the socket */
+    if( !ctx->state || ctx->is_in_dup_udata || ctx->ssl ||
+        ctx->state->st != S_ESTABLISHED || ctx->is_seqpacket ||
+        ctx->is_shm || ctx->is_pipe ||
+        ctx->to_shutdown || ctx->is_in_destroying ||
+        ctx->flush_and_close || ctx->cold->tunnel_peer_id )
+    {
+        LOGE( "id:0x%llx state:%d ssl:%d",
+              NET_ID_FMT( ctx->id ),
+              ctx->state ? ctx->state->st : 0, !!ctx->ssl );
 
-    LOG( "id:0x%llx host:%s:%s size:%lu msg_id:%llx",
-         PTRID_FMT( ctx->id ), ctx->host, ctx->port,
-         B_SIZE( wbuf->b ), PTRID_FMT( wbuf->id ) );
+        return -1;
+    }
 
     return 0;
 }
 
-conn_id_t net_make_listen( net_r_uh_t       child_r_uh_cb,
-                           net_est_uh_t     child_est_uh_cb,
-                           net_clo_uh_t     child_clo_uh_cb,
-                           net_dup_udata_t  dup_udata_cb,
-                           net_clo_uh_t     clo_uh_cb,
-                           ptr_id_t         udata_id,
-                           int              port,
-                           bool             use_ssl )
+/* NOTE: unconsumed rb data is posted to the peer, *
+ *       it must be done before the state switch   */
+static void __move_rb_to_peer( ctx_t *ctx, ctx_t *peer )
 {
-    ctx_t                  *ctx;
-    int                     fd;
-    int                     r;
+    unsigned long       used = B_USED_SIZE( ctx->rb );
+    int                 r;
+
+    if( !ctx->rb.buf || !used )
+        return;
+
+    r = net_post_data( peer->id, B_USED_PTR( ctx->rb ), used, false );
+    c_assert( r != -1 );
+
+    B_CUT_USED( ctx->rb, used );
+
+    if( g_capture.is_on )
+        __capture_cut( ctx, used );
+
+    LOG( "id:0x%llx host:%s:%s peer_id:0x%llx moved:%lu",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         NET_ID_FMT( peer->id ), used );
+}
+
+static void __start_tunnel( ctx_t *ctx, ctx_t *peer )
+{
+    ctx->cold->tunnel_peer_id = peer->id;
+    ctx->cold->is_tunnel_rd_eof = false;
+
+    ctx->state = &g_ctx_state[S_TUNNEL];
+    c_assert( ctx->state->st == S_TUNNEL );
+
+    /* NOTE: flow control is done by the tunnel itself */
+    ctx->drain_uh_cb = NULL;
+    ctx->batch_r_uh_cb = NULL;
+    ctx->is_drain_pending = false;
+    ctx->is_read_paused = false;
+    ctx->is_read_resumed = false;
+
+    __set_read_events( ctx, true );
+}
+
+int net_tunnel_conns( conn_id_t     conn_id,
+                      conn_id_t     peer_conn_id )
+{
+    ctx_t                  *ctx, *peer;
 
     G_net_errno = NET_ERRNO_OK;
 
-    if( !child_r_uh_cb || !child_est_uh_cb ||
-        !child_clo_uh_cb || !dup_udata_cb ||
-        !clo_uh_cb || !udata_id || port <= 0 )
+    if( !conn_id || !peer_conn_id || conn_id == peer_conn_id )
     {
         LOGE( "" );
 
         G_net_errno = NET_ERRNO_WRONG_PARAMS;
-        return 0;
+        return -1;
     }
 
-    fd = __create_socket();
-    if( fd == -1 )
-    {
-        LOGE( "listen_port:%d use_ssl:%d", port, use_ssl );
-
-        if( G_net_errno == NET_ERRNO_OK )
-            G_net_errno = NET_ERRNO_GENERAL_ERR;
+    ctx = __get_ctx( conn_id );
+    peer = __get_ctx( peer_conn_id );
 
-        return 0;
+    if( __check_tunnel_conn( ctx ) || __check_tunnel_conn( peer ) )
+    {
+        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
+        return -1;
     }
 
-    ctx = __init_new_ctx( fd );
-    c_assert( ctx );
-
-    ctx->serv.sin_family = AF_INET;
-    ctx->serv.sin_addr.s_addr = INADDR_ANY;
-    ctx->serv.sin_port = htons(port);
-
-    r = bind( ctx->fd,
-              (struct sockaddr *) &ctx->serv,
-              sizeof(ctx->serv) );
-
-    if( r == -1 )
+    if( __make_tunnel_pipe( ctx ) )
     {
-        LOGE( "listen_port:%d use_ssl:%d errno:%d strerror:%s",
-              port, use_ssl, errno, strerror( errno ) );
+        G_net_errno = NET_ERRNO_GENERAL_ERR;
+        return -1;
+    }
 
-        PROPER_CLOSE_FD( ctx->fd );
-        __cancel_ctx( ctx );
+    if( __make_tunnel_pipe( peer ) )
+    {
+        PROPER_CLOSE_FD( ctx->cold->tunnel_pipe[0] );
+        PROPER_CLOSE_FD( ctx->cold->tunnel_pipe[1] );
 
         G_net_errno = NET_ERRNO_GENERAL_ERR;
-        return 0;
+        return -1;
     }
 
-    r = listen( ctx->fd, BACKLOG );
+    __move_rb_to_peer( ctx, peer );
+    __move_rb_to_peer( peer, ctx );
 
-    if( r == -1 )
-    {
-        LOGE( "listen_port:%d use_ssl:%d errno:%d strerror:%s",
-              port, use_ssl, errno, strerror( errno ) );
+    __start_tunnel( ctx, peer );
+    __start_tunnel( peer, ctx );
 
-        PROPER_CLOSE_FD( ctx->fd );
-        __cancel_ctx( ctx );
+    LOG( "id:0x%llx host:%s:%s pipe_size:%lu "
+         "peer_id:0x%llx peer_host:%s:%s peer_pipe_size:%lu",
+         NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
+         ctx->cold->tunnel_pipe_size,
+         NET_ID_FMT( peer->id ), peer->cold->host, peer->cold->port,
+         peer->cold->tunnel_pipe_size );
 
-        G_net_errno = NET_ERRNO_GENERAL_ERR;
-        return 0;
-    }
+    return 0;
+}
 
-    ctx->child_use_ssl = use_ssl;
+/******************* Init network & Main loop *********************************/
 
-    ctx->host[0] = '\0';
-    ctx->port[0] = '\0';
+static void __default_config_init()
+{
+    if( !cfg_net_cert_test_file )
+    {
+        cfg_net_cert_test_file = strdup( "core/server_test.crt" );
+    }
 
-    ctx->listen_port = port;
+    if( !cfg_net_key_test_file )
+    {
+        cfg_net_key_test_file = strdup( "core/server_test.key" );
+    }
 
-    ctx->child_r_uh_cb = child_r_uh_cb;
-    ctx->child_est_uh_cb = child_est_uh_cb;
-    ctx->child_clo_uh_cb = child_clo_uh_cb;
+    if( !cfg_net_ssl_shutdown_timeout )
+    {
+        cfg_net_ssl_shutdown_timeout = malloc( sizeof(struct timeval) );
 
-    ctx->dup_udata_cb = dup_udata_cb;
+        cfg_net_ssl_shutdown_timeout->tv_sec = 1;
+        cfg_net_ssl_shutdown_timeout->tv_usec = 0;
+    }
 
-    ctx->clo_uh_cb = clo_uh_cb;
+    if( !cfg_net_ssl_establish_timeout )
+    {
+        cfg_net_ssl_establish_timeout = malloc( sizeof(struct timeval) );
 
-    ctx->udata_id = udata_id;
+        cfg_net_ssl_establish_timeout->tv_sec = 1;
+        cfg_net_ssl_establish_timeout->tv_usec = 0;
+    }
 
-    ctx->dirn = D_LISTEN;
+    if( !cfg_net_ssl_accept_timeout )
+    {
+        cfg_net_ssl_accept_timeout = malloc( sizeof(struct timeval) );
 
-    LOG( "id:0x%llx fd:%x listen_port:%d use_ssl:%d",
-         PTRID_FMT( ctx->id ), ctx->fd,
-         ctx->listen_port, use_ssl );
+        cfg_net_ssl_accept_timeout->tv_sec = 1;
+        cfg_net_ssl_accept_timeout->tv_usec = 0;
+    }
 
-    __start_listen( ctx );
+    if( !cfg_net_establish_timeout )
+    {
+        cfg_net_establish_timeout = malloc( sizeof(struct timeval) );
 
-    return ctx->id;
-}
+        cfg_net_establish_timeout->tv_sec = 1;
+        cfg_net_establish_timeout->tv_usec = 0;
+    }
 
-conn_id_t net_make_conn( net_host_t    *host,
-                         net_r_uh_t     r_uh_cb,
-                         net_est_uh_t   est_uh_cb,
-                         net_clo_uh_t   clo_uh_cb,
-                         ptr_id_t       udata_id )
-{
-    ctx_t                  *ctx;
-    SSL                    *ssl;
-    int                     fd;
+    if( !cfg_net_flush_and_close_timeout )
+    {
+        cfg_net_flush_and_close_timeout = malloc( sizeof(struct timeval) );
 
-    G_net_errno = NET_ERRNO_OK;
+        cfg_net_flush_and_close_timeout->tv_sec = 1;
+        cfg_net_flush_and_close_timeout->tv_usec = 0;
+    }
 
-    if( !host || !host->hostname || !host->port )
+    if( !cfg_net_write_high_watermark )
     {
-        LOGE( "" );
+        cfg_net_write_high_watermark = malloc( sizeof(int) );
 
-        G_net_errno = NET_ERRNO_WRONG_PARAMS;
-        return 0;
+        *cfg_net_write_high_watermark = 4194304;
     }
 
-    if( !host->addr )
+    if( !cfg_net_write_low_watermark )
     {
-        LOGE( "host:%s:%s", host->hostname, host->port );
+        cfg_net_write_low_watermark = malloc( sizeof(int) );
 
-        G_net_errno = NET_ERRNO_WRONG_PARAMS;
-        return 0;
+        *cfg_net_write_low_watermark = 1048576;
     }
 
-    if( !r_uh_cb || !est_uh_cb || !clo_uh_cb || !udata_id )
+    if( !cfg_net_write_high_msgs )
     {
-        LOGE( "host:%s:%s", host->hostname, host->port );
+        cfg_net_write_high_msgs = malloc( sizeof(int) );
 
-        G_net_errno = NET_ERRNO_WRONG_PARAMS;
-        return 0;
+        *cfg_net_write_high_msgs = 4096;
     }
 
-    fd = __create_socket();
-    if( fd == -1 )
+    if( !cfg_net_write_low_msgs )
     {
-        LOGE( "host:%s:%s", host->hostname, host->port );
-
-        if( G_net_errno == NET_ERRNO_OK )
-            G_net_errno = NET_ERRNO_GENERAL_ERR;
+        cfg_net_write_low_msgs = malloc( sizeof(int) );
 
-        return 0;
+        *cfg_net_write_low_msgs = 1024;
     }
 
-    ctx = __init_new_ctx( fd );
-    c_assert( ctx );
-
-    if( host->use_ssl )
+    if( !cfg_net_udp_recv_batch )
     {
-        ssl = SSL_new( g_ssl_client_ctx );
-        c_assert( ssl );
-
-        SSL_set_fd( ssl, ctx->fd );
-        SSL_set_connect_state( ssl ); /* means doing as client */
+        cfg_net_udp_recv_batch = malloc( sizeof(int) );
 
-        ctx->ssl = ssl;
+        *cfg_net_udp_recv_batch = 32;
     }
 
-    strncpy( ctx->host, host->hostname, sizeof(ctx->host) );
-    strncpy( ctx->port, host->port, sizeof(ctx->port) );
-    ctx->host[sizeof(ctx->host) - 1] = '\0';
-    ctx->port[sizeof(ctx->port) - 1] = '\0';
-
-    ctx->peer = *(struct sockaddr_in *)
-                (((struct addrinfo *)host->addr)->ai_addr);
+    if( !cfg_net_shm_ring_size )
+    {
+        cfg_net_shm_ring_size = malloc( sizeof(int) );
 
-    B_ALLOC( ctx->rb, READ_BUFFER_SIZE );
+        *cfg_net_shm_ring_size = 1048576;
+    }
 
-    ctx->r_uh_cb = r_uh_cb;
-    ctx->est_uh_cb = est_uh_cb;
-    ctx->clo_uh_cb = clo_uh_cb;
+    if( !cfg_net_tcp_info_interval )
+    {
+        cfg_net_tcp_info_interval = malloc( sizeof(struct timeval) );
 
-    ctx->udata_id = udata_id;
+        cfg_net_tcp_info_interval->tv_sec = 0;
+        cfg_net_tcp_info_interval->tv_usec = 0;
+    }
 
-    ctx->dirn = D_OUTGOING;
+    if( !cfg_net_handover_idle_conns )
+    {
+        cfg_net_handover_idle_conns = malloc( sizeof(int) );
 
-    LOG( "id:0x%llx udata_id:0x%llx fd:%x "
-         "host:%s:%s use_ssl:%d",
-         PTRID_FMT( ctx->id ), PTRID_FMT( udata_id ),
-         ctx->fd, ctx->host, ctx->port, host->use_ssl );
+        *cfg_net_handover_idle_conns = 0;
+    }
 
-    __start_connect( ctx );
+    if( !cfg_net_handover_drain_timeout )
+    {
+        cfg_net_handover_drain_timeout = malloc( sizeof(struct timeval) );
 
-    return ctx->id;
-}
+        cfg_net_handover_drain_timeout->tv_sec = 10;
+        cfg_net_handover_drain_timeout->tv_usec = 0;
+    }
 
-int net_shutdown_conn( conn_id_t    conn_id,
-                       bool         flush_and_close )
-{
-    ctx_t                  *ctx;
+    if( !cfg_net_offload_threads )
+    {
+        cfg_net_offload_threads = malloc( sizeof(int) );
 
-    G_net_errno = NET_ERRNO_OK;
+        *cfg_net_offload_threads = 0;
+    }
 
-    if( !conn_id )
+    if( !cfg_net_warm_up )
     {
-        LOGE( "" );
+        cfg_net_warm_up = malloc( sizeof(int) );
 
-        G_net_errno = NET_ERRNO_WRONG_PARAMS;
-        return -1;
+        *cfg_net_warm_up = 0;
     }
 
-    ctx = __get_ctx( conn_id );
-
-    if( !ctx->state || ctx->is_in_dup_udata ||
-        ctx->state->st == S_SSL_SHUTDOWN ||
-        ctx->to_shutdown || ctx->is_in_destroying ||
-        ctx->flush_and_close )
+    if( !cfg_net_warm_up_heap_size )
     {
-        if( ctx->flush_and_close )
-        {
-            LOG( "id:0x%llx", PTRID_FMT( conn_id ) );
-        }
-        else
-        {
-            LOGE( "id:0x%llx state:%d",
-                  PTRID_FMT( conn_id ),
-                  ctx->state ? ctx->state->st : 0 );
-        }
+        cfg_net_warm_up_heap_size = malloc( sizeof(int) );
 
-        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
-        return -1;
+        *cfg_net_warm_up_heap_size = 0;
     }
 
-    if( flush_and_close )
+    if( !cfg_net_mlockall )
     {
-        /* NOTE: since this moment, no app timers is needed */
-        __cleanup_timers( ctx );
+        cfg_net_mlockall = malloc( sizeof(int) );
 
-        ctx->state_tmr_id = __make_conn_tmr( ctx, 0,
-                                             __flush_and_close_timeout_cb,
-                                             cfg_net_flush_and_close_timeout );
+        *cfg_net_mlockall = 0;
+    }
 
-        c_assert( ctx->state_tmr_id );
+    if( !cfg_net_huge_pages )
+    {
+        cfg_net_huge_pages = malloc( sizeof(int) );
 
-        ctx->flush_and_close = true;
+        *cfg_net_huge_pages = 0;
     }
-    else
-        ctx->to_shutdown = true;
 
-    LOG( "id:0x%llx flush_and_close:%d",
-         PTRID_FMT( conn_id ), flush_and_close );
+    if( !cfg_net_fault_report_time )
+    {
+        cfg_net_fault_report_time = malloc( sizeof(struct timeval) );
 
-    return 0;
-}
+        cfg_net_fault_report_time->tv_sec = 0;
+        cfg_net_fault_report_time->tv_usec = 0;
+    }
 
-net_state_t net_is_est_conn( conn_id_t conn_id )
-{
-    ctx_t                  *ctx;
+    if( !cfg_net_overload_lag )
+    {
+        cfg_net_overload_lag = malloc( sizeof(struct timeval) );
 
-    G_net_errno = NET_ERRNO_OK;
+        cfg_net_overload_lag->tv_sec = 0;
+        cfg_net_overload_lag->tv_usec = 0;
+    }
 
-    if( !conn_id )
+    if( !cfg_net_overload_depth )
     {
-        LOGE( "" );
+        cfg_net_overload_depth = malloc( sizeof(int) );
 
-        G_net_errno = NET_ERRNO_WRONG_PARAMS;
-        return NET_STATE_ERROR;
+        *cfg_net_overload_depth = 0;
     }
 
-    ctx = __get_ctx( conn_id );
-
-    if( !ctx->state || ctx->is_in_dup_udata )
+    if( !cfg_net_overload_pause_accept )
     {
-        LOGE( "id:0x%llx", PTRID_FMT( conn_id ) );
+        cfg_net_overload_pause_accept = malloc( sizeof(int) );
 
-        G_net_errno = NET_ERRNO_CONN_WRONG_STATE;
-        return NET_STATE_ERROR;
+        *cfg_net_overload_pause_accept = 0;
     }
 
-    if( ctx->to_shutdown || ctx->is_in_destroying )
+    if( !cfg_net_watchdog_budget )
     {
-        LOGD( "id:0x%llx state:%d",
-              PTRID_FMT( conn_id ), ctx->state->st );
+        cfg_net_watchdog_budget = malloc( sizeof(struct timeval) );
 
-        return NET_STATE_NOT_EST;
+        cfg_net_watchdog_budget->tv_sec = 0;
+        cfg_net_watchdog_budget->tv_usec = 0;
     }
 
-    if( ctx->state->st == S_ESTABLISHED     ||
-        ctx->state->st == S_SSL_ESTABLISHED ||
-        ctx->state->st == S_LISTENING )
+    if( !cfg_net_sim )
     {
-        if( ctx->flush_and_close )
-        {
-            LOGD( "id:0x%llx state:%d",
-                  PTRID_FMT( conn_id ), ctx->state->st );
-
-            return NET_STATE_FLUSH_AND_CLOSE;
-        }
-        else
-        {
-            LOGD( "id:0x%llx state:%d",
-                  PTRID_FMT( conn_id ), ctx->state->st );
+        cfg_net_sim = malloc( sizeof(int) );
 
-            return NET_STATE_EST;
-        }
+        *cfg_net_sim = 0;
     }
 
-    LOGD( "id:0x%llx state:%d",
-          PTRID_FMT( conn_id ), ctx->state->st );
-
-    return NET_STATE_NOT_EST;
-}
+    if( !cfg_net_sim_seed )
+    {
+        cfg_net_sim_seed = malloc( sizeof(int) );
 
-/******************* Init network & Main loop *********************************/
+        *cfg_net_sim_seed = 1;
+    }
 
-static void __default_config_init()
-{
-    if( !cfg_net_cert_test_file )
+    if( !cfg_net_sim_latency )
     {
-        cfg_net_cert_test_file = strdup( "core/server_test.crt" );
+        cfg_net_sim_latency = malloc( sizeof(struct timeval) );
+
+        cfg_net_sim_latency->tv_sec = 0;
+        cfg_net_sim_latency->tv_usec = 0;
     }
 
-    if( !cfg_net_key_test_file )
+    if( !cfg_net_sim_loss )
     {
-        cfg_net_key_test_file = strdup( "core/server_test.key" );
+        cfg_net_sim_loss = malloc( sizeof(int) );
+
+        *cfg_net_sim_loss = 0;
     }
 
-    if( !cfg_net_ssl_shutdown_timeout )
+    if( !cfg_net_sim_rto )
     {
-        cfg_net_ssl_shutdown_timeout = malloc( sizeof(struct timeval) );
+        cfg_net_sim_rto = malloc( sizeof(struct timeval) );
 
-        cfg_net_ssl_shutdown_timeout->tv_sec = 1;
-        cfg_net_ssl_shutdown_timeout->tv_usec = 0;
+        cfg_net_sim_rto->tv_sec = 0;
+        cfg_net_sim_rto->tv_usec = 200000;
     }
 
-    if( !cfg_net_ssl_establish_timeout )
+    if( !cfg_net_sim_duration )
     {
-        cfg_net_ssl_establish_timeout = malloc( sizeof(struct timeval) );
+        cfg_net_sim_duration = malloc( sizeof(struct timeval) );
 
-        cfg_net_ssl_establish_timeout->tv_sec = 1;
-        cfg_net_ssl_establish_timeout->tv_usec = 0;
+        cfg_net_sim_duration->tv_sec = 0;
+        cfg_net_sim_duration->tv_usec = 0;
     }
 
-    if( !cfg_net_ssl_accept_timeout )
+    if( !cfg_net_capture_file_size )
     {
-        cfg_net_ssl_accept_timeout = malloc( sizeof(struct timeval) );
-
-        cfg_net_ssl_accept_timeout->tv_sec = 1;
-        cfg_net_ssl_accept_timeout->tv_usec = 0;
+        cfg_net_capture_file_size = malloc( sizeof(int) );
+        *cfg_net_capture_file_size = 67108864;
     }
 
-    if( !cfg_net_establish_timeout )
+    if( !cfg_net_replay_port )
     {
-        cfg_net_establish_timeout = malloc( sizeof(struct timeval) );
+        cfg_net_replay_port = malloc( sizeof(int) );
+        *cfg_net_replay_port = 0;
+    }
 
-        cfg_net_establish_timeout->tv_sec = 1;
-        cfg_net_establish_timeout->tv_usec = 0;
+    if( !cfg_net_replay_paced )
+    {
+        cfg_net_replay_paced = malloc( sizeof(int) );
+        *cfg_net_replay_paced = 0;
     }
 
-    if( !cfg_net_flush_and_close_timeout )
+    if( !cfg_net_replay_drain_timeout )
     {
-        cfg_net_flush_and_close_timeout = malloc( sizeof(struct timeval) );
+        cfg_net_replay_drain_timeout = malloc( sizeof(struct timeval) );
 
-        cfg_net_flush_and_close_timeout->tv_sec = 1;
-        cfg_net_flush_and_close_timeout->tv_usec = 0;
+        cfg_net_replay_drain_timeout->tv_sec = 1;
+        cfg_net_replay_drain_timeout->tv_usec = 0;
     }
 }
 
 void net_init()
 {
-    int         r;
+    int         r, i;
 
     G_net_errno = NET_ERRNO_OK;
 
     __default_config_init();
 
+    /* NOTE: before the first touch of the tables */
+    if( *cfg_net_huge_pages )
+    {
+        __advise_huge_pages( g_ctx_array, sizeof(g_ctx_array) );
+        __advise_huge_pages( g_ctx_cold_array, sizeof(g_ctx_cold_array) );
+    }
+
     memset( g_ctx_array, 0, sizeof(g_ctx_array) );
+    memset( g_ctx_cold_array, 0, sizeof(g_ctx_cold_array) );
+
+    for( i = 0; i <= NET_MAX_FD; i++ )
+        g_ctx_array[i].cold = &g_ctx_cold_array[i];
 
     g_epollfd = epoll_create( NET_MAX_FD + 1 );
     c_assert( g_epollfd > 0 );
 
+    __init_async_queue();
+
+    __init_sim();
+
+    __init_capture();
+
+    __init_replay();
+
+    __init_offload_pool();
+
+    __init_defer_queue();
+
+    __init_read_batch();
+
     SSL_library_init();
 
     g_ssl_client_ctx = SSL_CTX_new( SSLv23_client_method() );
@@ -2869,9 +9907,52 @@ void net_init()
     r = SSL_CTX_check_private_key( g_ssl_server_ctx );
     c_assert( r == 1 );
 
+    /* NOTE: sockets are taken before the module makes listeners */
+    if( cfg_net_handover_path )
+    {
+        c_assert( cfg_net_handover_path[0] == '/' );
+
+        __handover_receive();
+
+        __handover_listen();
+    }
+
     LOG( "epollfd:%x", g_epollfd );
 }
 
+void net_warm_up()
+{
+    struct rusage       start;
+
+    getrusage( RUSAGE_SELF, &start );
+
+    if( *cfg_net_warm_up )
+        __warm_up_heap();
+
+    if( *cfg_net_mlockall &&
+        mlockall( MCL_CURRENT | MCL_FUTURE ) )
+    {
+        LOGE( "errno:%d strerror:%s", errno, strerror( errno ) );
+    }
+
+    __log_faults( "warm up", &start );
+}
+
+/* NOTE: the virtual clock of net_sim moves only in __sim_advance */
+static void __update_now()
+{
+    int         r;
+
+    if( g_sim.is_on )
+    {
+        G_now = g_sim.now;
+        return;
+    }
+
+    r = gettimeofday( &G_now, NULL );
+    assert( !r ); /* NOTE: real assert here */
+}
+
 void net_main_loop()
 {
     ctx_t              *ctx;
@@ -2880,20 +9961,57 @@ void net_main_loop()
     uint32_t            ev;
     int                 fd;
     struct timeval      iter_time_diff;
+    bool                is_load_tracked;
+    int                 depth = 0;
     int                 i;
     int                 r;
 
+    is_load_tracked = __is_load_tracked();
+
     /* NOTE: need fresh G_now */
-    r = gettimeofday( &G_now, NULL );
-    assert( !r ); /* NOTE: real assert here */
+    __update_now();
 
     g_iter_time = G_now;
 
+    if( g_sim.is_on )
+        clock_gettime( CLOCK_MONOTONIC, &g_sim.wall_start );
+
+    /* NOTE: timer needs G_now, so it's made here */
+    if( timerisset( cfg_net_tcp_info_interval ) )
+    {
+        g_tcp_info_tmr_id = net_make_global_tmr( PTRID( &g_tcp_info_tmr_id ),
+                                                 __tcp_info_tmr_cb,
+                                                 cfg_net_tcp_info_interval );
+
+        c_assert( g_tcp_info_tmr_id );
+    }
+
+    getrusage( RUSAGE_SELF, &g_loop_rusage );
+
+    if( timerisset( cfg_net_fault_report_time ) )
+    {
+        g_fault_report_tmr_id =
+            net_make_global_tmr( PTRID( &g_fault_report_tmr_id ),
+                                 __fault_report_tmr_cb,
+                                 cfg_net_fault_report_time );
+
+        c_assert( g_fault_report_tmr_id );
+    }
+
+    __start_watchdog();
+
+    if( g_replay.is_on )
+        __start_replay();
+
     while( true )
     {
+        __call_loop_hooks( NET_HOOK_PRE_POLL );
+
         nfds = epoll_wait( g_epollfd, ready_events,
                            sizeof(ready_events)/sizeof(struct epoll_event),
-                           WAIT_TIMEOUT );
+                           g_sim.is_on || __has_deferred() ||
+                           g_read_batch.total ||
+                           g_sched_pending ? 0 : WAIT_TIMEOUT );
 
         if( nfds < 0 )
         {
@@ -2904,34 +10022,76 @@ void net_main_loop()
             }
 
             LOGE( "errno:%d strerror:%s", errno, strerror( errno ) );
+
+            __stop_watchdog();
             return;
         }
 
         LOGD( "nfds:%d ctx_total:%d", nfds, g_ctx_total );
 
+        if( is_load_tracked )
+        {
+            r = gettimeofday( &g_load.poll_end, NULL );
+            assert( !r ); /* NOTE: real assert here */
+
+            depth = nfds + g_read_batch.total +
+                    (int) ( g_defer_queue.tail - g_defer_queue.head );
+        }
+
+        /* NOTE: commands from other threads go first */
+        for( i = 0; i < nfds; i++ )
+        {
+            if( ready_events[i].data.fd == ASYNC_EPOLL_FD )
+                __call_async_cmds();
+        }
+
         for( i = 0; i < nfds; i++ )
         {
             fd = ready_events[i].data.fd;
             ev = ready_events[i].events;
 
+            if( fd == ASYNC_EPOLL_FD )
+                continue;
+
+            /* NOTE: shm kick, the ctx may be destroyed by  *
+             *       its socket event earlier in this batch */
+            if( fd > NET_MAX_FD )
+            {
+                fd -= NET_MAX_FD + 1;
+                c_assert( fd >= 0 && fd <= NET_MAX_FD );
+
+                ctx = &g_ctx_array[fd];
+
+                g_skip_cb = false;
+
+                if( ctx->id && ctx->is_shm && ctx->cold->shm && !ctx->to_shutdown )
+                    __shm_kick_cb( ctx );
+
+                continue;
+            }
+
             c_assert( fd >= 0 && fd <= NET_MAX_FD );
 
             ctx = &g_ctx_array[fd];
 
             c_assert( ctx->id && ctx->fd == fd );
 
+            __watchdog_mark( ctx->id, NULL );
+
             LOGD( "id:0x%llx host:%s:%s state:%d fd:%x ev:0x%x "
                   "EPOLLIN:%d EPOLLOUT:%d EPOLLRDHUP:%d EPOLLPRI:%d "
                   "EPOLLERR:%d EPOLLHUP:%d EPOLLET:%d EPOLLONESHOT:%d",
-                  PTRID_FMT( ctx->id ), ctx->host, ctx->port,
+                  NET_ID_FMT( ctx->id ), ctx->cold->host, ctx->cold->port,
                   ctx->state->st, fd, ev,
                   ev & EPOLLIN, ev & EPOLLOUT, ev & EPOLLRDHUP, ev & EPOLLPRI,
                   ev & EPOLLERR,ev & EPOLLHUP, ev & EPOLLET, ev & EPOLLONESHOT);
 
             g_skip_cb = false;
 
+            /* NOTE: EPOLLIN may be in this batch already when *
+             *       read was paused by a previous callback    */
             if( (ev & ( EPOLLHUP | EPOLLRDHUP | EPOLLERR )) ||
-                (ev & EPOLLIN) )
+                ((ev & EPOLLIN) && !ctx->is_read_paused) )
             {
                 if( !ctx->to_shutdown )
                     ctx->state->r_cb( ctx );
@@ -2945,21 +10105,52 @@ void net_main_loop()
             }
         }
 
+        __dispatch_read_batch();
+
+        __call_deferred();
+
+        __call_loop_hooks( NET_HOOK_POST_DISPATCH );
+
         /* NOTE: need fresh G_now */
-        r = gettimeofday( &G_now, NULL );
-        assert( !r ); /* NOTE: real assert here */
+        __update_now();
 
         __do_scheduled();
 
+        /* NOTE: the new process has taken over */
+        if( __is_handover_drained() )
+        {
+            __stop_watchdog();
+            return;
+        }
+
+        if( g_replay.is_over )
+        {
+            __stop_watchdog();
+            return;
+        }
+
         /* NOTE: need fresh G_now */
-        r = gettimeofday( &G_now, NULL );
-        assert( !r ); /* NOTE: real assert here */
+        __update_now();
 
         timersub( &G_now, &g_iter_time, &iter_time_diff );
         g_iter_time = G_now;
 
         LOGD( "iter_time_diff:%ld:%ld",
               iter_time_diff.tv_sec, iter_time_diff.tv_usec );
+
+        if( is_load_tracked )
+            __update_load( depth );
+
+        if( g_watchdog.is_running )
+            __watchdog_iter_done( &iter_time_diff );
+
+        if( g_sim.is_on && !__sim_advance( nfds ) )
+        {
+            __sim_report();
+
+            __stop_watchdog();
+            return;
+        }
     }
 }
 
@@ -16,11 +16,19 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.   *
  ********************************************************************/
 
+/* NOTE: hostname starting with '/' is AF_UNIX socket path,  *
+ *       port is "stream", "seqpacket" or "shm" for such a   *
+ *       host, shm conn moves bytes over shared memory rings *
+ *       and uses the socket only to pass them,              *
+ *       hostname starting with '@' is in-process pipe to    *
+ *       the non-SSL net_make_listen on port, net_post_data  *
+ *       appends to the peer's read buffer without syscalls  */
 typedef struct {
     char           *hostname;
     char           *port;
     bool            use_ssl;
     char           *label;
+    char           *sock_profile;
     void           *addr;
 } net_host_t;
 
@@ -33,6 +41,110 @@ typedef struct {
     net_host_t      host;
 } net_host_node_t;
 
+/* NOTE: NET_SOCK_OPT_UNSET means leave the kernel default */
+#define NET_SOCK_OPT_UNSET  (-1)
+
+/* NOTE: named set of socket options from config, *
+ * it's applied at socket creation and accept     */
+typedef struct {
+    /* ll_node_t */
+    ptr_id_t        id;
+    ptr_id_t        prev;
+    ptr_id_t        next;
+
+    char           *name;
+
+    int             nodelay;
+    int             quickack;
+    int             sndbuf;
+    int             rcvbuf;
+    int             user_timeout;   /* milliseconds */
+    int             tos;
+    int             priority;
+
+    /* NOTE: TCP Fast Open, fastopen is used by outgoing conns,    *
+     *       fastopen_qlen by listeners (pending TFO requests).    *
+     *       With fastopen connect() returns 0 at once and the SYN *
+     *       goes out with the first write, so est_uh_cb is called *
+     *       before the SYN-ACK and net_establish_timeout doesn't  *
+     *       cover the handshake (the socket is writable at once,  *
+     *       waiting for EPOLLOUT wouldn't help). The client must  *
+     *       speak first: est_uh_cb should post the request, else  *
+     *       nothing is sent until the first net_post_data. With   *
+     *       SSL the ClientHello is that write and                 *
+     *       net_ssl_establish_timeout bounds it. Without SSL an   *
+     *       unanswered SYN is reported to clo_uh_cb as a write or *
+     *       read error after the kernel's SYN retries, set        *
+     *       user_timeout to bound it                              */
+    int             fastopen;
+    int             fastopen_qlen;
+
+    /* NOTE: SO_TIMESTAMPING for reads, see net_get_rx_timestamp */
+    int             rx_timestamping;
+} net_sock_profile_t;
+
+/* NOTE: UDP endpoint from config, group means multicast *
+ *       which is joined on iface (local NIC address),   *
+ *       dest is the default destination of datagrams    */
+typedef struct {
+    /* ll_node_t */
+    ptr_id_t        id;
+    ptr_id_t        prev;
+    ptr_id_t        next;
+
+    char           *name;
+
+    char           *bind;           /* NULL == INADDR_ANY  */
+    int             port;           /* 0 == ephemeral      */
+    char           *group;
+    char           *iface;
+    char           *dest;
+    int             dest_port;
+
+    int             rcvbuf;
+    int             sndbuf;
+    int             tos;
+    int             mcast_ttl;
+    int             mcast_loop;
+    int             dgram_size;     /* longer are truncated */
+
+    /* NOTE: receive by AF_XDP socket on the NIC queue,   *
+     *       mode is skb (generic, default) or drv, it    *
+     *       requires the build with NET_AF_XDP           */
+    char           *xdp_ifname;
+    int             xdp_queue;
+    char           *xdp_mode;
+} net_udp_endpoint_t;
+
+/* NOTE: ip and port are in network byte order, it's the source *
+ *       of a received datagram or the destination of a sent    *
+ *       one (0 == endpoint dest), ts is the kernel rx time     */
+typedef struct {
+    char           *buf;
+    int             len;
+    uint32_t        ip;
+    uint16_t        port;
+    bool            is_truncated;
+    struct timespec ts;
+} net_dgram_t;
+
+typedef struct {
+    uint64_t        out_attempts;       /* conns made with TFO    */
+    uint64_t        out_syn_data_acked; /* server acked SYN data  */
+    uint64_t        in_total;           /* accepted by TFO lsnrs  */
+    uint64_t        in_syn_data;        /* accepted with SYN data */
+} net_tfo_stats_t;
+
+/* NOTE: lag is the smoothed busy time of a loop iteration (without *
+ *       the wait in epoll_wait), depth is the smoothed number of   *
+ *       ready events and deferred tasks taken by an iteration      */
+typedef struct {
+    struct timeval  lag;
+    int             depth;
+    bool            is_overloaded;
+    uint64_t        overloads;          /* times it became overloaded */
+} net_load_stats_t;
+
 /* codes for clo_uh_cb or logging */
 typedef enum {
     NET_CODE_SUCCESS = 0,
@@ -40,7 +152,8 @@ typedef enum {
     NET_CODE_ERR_SHUT,
     NET_CODE_ERR_ACCEPT,
     NET_CODE_ERR_WRITE,
-    NET_CODE_ERR_READ
+    NET_CODE_ERR_READ,
+    NET_CODE_HANDOVER   /* socket is passed to the new process */
 } net_code_t;
 
 typedef enum {
@@ -59,8 +172,14 @@ typedef enum {
     NET_STATE_FLUSH_AND_CLOSE
 } net_state_t;
 
-typedef ptr_id_t    conn_id_t;
-typedef ptr_id_t    tmr_id_t;
+/* NOTE: conn and tmr ids are handles: a slot index in the low *
+ *       32 bits and a generation of the slot in the high 32   *
+ *       bits, so an id of a closed conn or deleted tmr never  *
+ *       matches a new one in the same slot, 0 is never an id  */
+typedef uint64_t    conn_id_t;
+typedef uint64_t    tmr_id_t;
+
+#define NET_ID_FMT( id )    (long long unsigned int) (id)
 
 /* uh == user handler */
 typedef int  ( *net_r_uh_t )(   conn_id_t    conn_id,
@@ -84,9 +203,148 @@ typedef void ( *net_tmr_cb_t )( conn_id_t    conn_id,
 typedef ptr_id_t ( *net_dup_udata_t )( conn_id_t    conn_id,
                                        ptr_id_t     udata_id );
 
+/* NOTE: dgrams are valid only during the call */
+typedef void ( *net_dgram_uh_t )( conn_id_t      conn_id,
+                                  ptr_id_t       udata_id,
+                                  net_dgram_t   *dgrams,
+                                  int            cnt );
+
+/* NOTE: closure passed by another thread to the loop */
+typedef void ( *net_async_cb_t )( ptr_id_t   udata_id );
+
+/* NOTE: job of net_offload and its completion */
+typedef void ( *net_offload_fn_t )( void    *arg );
+
+/* NOTE: net_defer task and loop hook */
+typedef void ( *net_defer_cb_t )( ptr_id_t  udata_id );
+
+typedef void ( *net_hook_cb_t )( ptr_id_t   hook_id,
+                                 ptr_id_t   udata_id );
+
+typedef ptr_id_t    net_hook_id_t;
+
+/* NOTE: pre-poll hooks run right before epoll_wait(), *
+ *       post-dispatch ones after all ready events and *
+ *       deferred tasks, before timers                 */
+typedef enum {
+    NET_HOOK_PRE_POLL = 0,
+    NET_HOOK_POST_DISPATCH,
+    NET_HOOK_TYPES
+} net_hook_type_t;
+
+/* NOTE: one entry per conn of a read batch, buf is valid *
+ *       during the call until net_consume of the conn    */
+typedef struct {
+    conn_id_t       conn_id;
+    ptr_id_t        udata_id;
+    char           *buf;
+    int             len;
+} net_batch_entry_t;
+
+typedef void ( *net_batch_r_uh_t )( net_batch_entry_t  *entries,
+                                    int                 cnt );
+
+/* NOTE: net_capture_file is a header and records, each record *
+ *       is followed by len bytes padded to 8, used counts the *
+ *       header too, the rest of the file is zeroed            */
+#define NET_CAPTURE_MAGIC   "EUCLCAP1"
+
+typedef enum {
+    NET_CAPTURE_RX = 0,     /* bytes passed to r_uh_cb */
+    NET_CAPTURE_TX          /* bytes of net_post_data */
+} net_capture_dir_t;
+
+typedef struct {
+    char            magic[8];
+    uint64_t        used;
+} net_capture_hdr_t;
+
+typedef struct {
+    conn_id_t       conn_id;
+    uint64_t        ts;                 /* CLOCK_MONOTONIC, nsec */
+    uint32_t        len;
+    uint8_t         dir;
+    uint8_t         is_closed;
+    uint8_t         is_accepted;        /* conn came from a listener */
+    uint8_t         reserved;
+} net_capture_rec_t;
+
+/* NOTE: it's called when write queue drops below *
+ *       low watermark after it was over high one */
+typedef void ( *net_drain_uh_t )( conn_id_t  conn_id,
+                                  ptr_id_t   udata_id );
+
+/* NOTE: it's asked before an idle conn is handed over, *
+ *       false keeps the conn in this process           */
+typedef bool ( *net_idle_uh_t )( conn_id_t   conn_id,
+                                 ptr_id_t    udata_id );
+
+/* NOTE: write lanes, a higher lane is flushed first, *
+ *       but only at message boundaries               */
+typedef enum {
+    NET_PRIO_HIGH = 0,
+    NET_PRIO_NORMAL,
+    NET_PRIO_LOW,
+    NET_PRIO_MAX
+} net_prio_t;
+
+/* NOTE: queueing delay is the time from net_post_data *
+ *       until the first byte of the message is sent   */
+typedef struct {
+    uint64_t        msgs;
+    uint64_t        delay_sum_us;
+    uint64_t        delay_max_us;
+} net_lane_stats_t;
+
+/* NOTE: kernel receive time of the newest bytes of the last *
+ *       read, hw is zero unless the NIC stamps packets      */
+typedef struct {
+    struct timespec sw;
+    struct timespec hw;
+} net_rx_ts_t;
+
+#define NET_RX_LATENCY_BUCKETS  20
+
+/* NOTE: time from kernel receive (sw) until the read, bucket i *
+ *       counts [2^i, 2^(i+1)) us, the first one also < 1 us,   *
+ *       the last one also everything above                     */
+typedef struct {
+    uint64_t        reads;
+    uint64_t        sum_us;
+    uint64_t        max_us;
+    uint64_t        buckets[NET_RX_LATENCY_BUCKETS];
+} net_rx_latency_stats_t;
+
+/* NOTE: getsockopt(TCP_INFO) sample of a TCP conn taken every *
+ *       net_tcp_info_interval, zero sampled means none yet    */
+typedef struct {
+    struct timeval  sampled;
+    uint32_t        rtt_us;         /* smoothed by kernel */
+    uint32_t        rttvar_us;
+    uint32_t        rto_us;
+    uint32_t        snd_cwnd;       /* segments */
+    uint32_t        snd_mss;
+    uint32_t        unacked;        /* segments in flight */
+    uint32_t        lost;
+    uint32_t        retransmits;    /* timeouts of the current segment */
+    uint32_t        total_retrans;
+    uint32_t        send_queue;     /* unacked and unsent bytes, SIOCOUTQ */
+    unsigned long   wb_bytes;       /* queued by net_post_data, current */
+} net_conn_stats_t;
+
+/* NOTE: net_post_data result, data is queued anyway, *
+ *       but producer should stop until drain_uh_cb   */
+#define NET_POST_OVER_HIGH  1
+
 unsigned    G_net_errno;
 
 void        net_init();
+
+/* NOTE: it's called after the module init, just before the loop: *
+ *       the heap is prefaulted if net_warm_up is set, then       *
+ *       mlockall if net_mlockall is set                          */
+void        net_warm_up();
+
 void        net_main_loop();
 
 conn_id_t   net_make_conn( net_host_t          *host,
@@ -102,13 +360,44 @@ conn_id_t   net_make_listen( net_r_uh_t         child_r_uh_cb,
                              net_clo_uh_t       clo_uh_cb,
                              ptr_id_t           udata_id,
                              int                port,
-                             bool               use_ssl );
+                             bool               use_ssl,
+                             char              *sock_profile );
+
+/* NOTE: AF_UNIX listener, a stale socket file is removed, *
+ *       type is "stream", "seqpacket" or "shm", seqpacket *
+ *       conns keep boundaries of net_post_data messages   *
+ *       (<= 64KB), they are read one per recv()           */
+conn_id_t   net_make_unix_listen( net_r_uh_t        child_r_uh_cb,
+                                  net_est_uh_t      child_est_uh_cb,
+                                  net_clo_uh_t      child_clo_uh_cb,
+                                  net_dup_udata_t   dup_udata_cb,
+                                  net_clo_uh_t      clo_uh_cb,
+                                  ptr_id_t          udata_id,
+                                  char             *path,
+                                  char             *type );
+
+conn_id_t   net_make_udp( char                 *endpoint,
+                          net_dgram_uh_t        dgram_uh_cb,
+                          net_clo_uh_t          clo_uh_cb,
+                          ptr_id_t              udata_id );
+
+/* NOTE: datagrams aren't queued, it returns the number *
+ *       of sent ones, the rest can be retried later    */
+int         net_send_dgrams( conn_id_t          conn_id,
+                             net_dgram_t       *dgrams,
+                             int                cnt );
 
 int         net_post_data( conn_id_t            conn_id,
                            char                *data,
                            unsigned long        len,
                            bool                 flush_and_close );
 
+int         net_post_data_prio( conn_id_t           conn_id,
+                                char               *data,
+                                unsigned long       len,
+                                bool                flush_and_close,
+                                net_prio_t          prio );
+
 tmr_id_t    net_make_conn_tmr( conn_id_t            conn_id,
                                ptr_id_t             udata_id,
                                net_tmr_cb_t         cb,
@@ -128,6 +417,99 @@ int         net_shutdown_conn( conn_id_t    conn_id,
 
 net_state_t net_is_est_conn( conn_id_t      conn_id );
 
+/* NOTE: 0 keeps the current value (cfg default initially) */
+int         net_set_write_watermarks( conn_id_t         conn_id,
+                                      net_drain_uh_t    drain_uh_cb,
+                                      unsigned long     high_bytes,
+                                      unsigned long     low_bytes,
+                                      int               high_msgs,
+                                      int               low_msgs );
+
+/* NOTE: both conns must be plain and established and it   *
+ *       can't be called from their r_uh_cb. Since this    *
+ *       moment bytes are moved by splice() without        *
+ *       r_uh_cb, unconsumed read data is posted to the    *
+ *       other side, clo_uh_cb is called for both as usual */
+int         net_tunnel_conns( conn_id_t     conn_id,
+                              conn_id_t     peer_conn_id );
+
+/* NOTE: stats must have NET_PRIO_MAX elements */
+int         net_get_lane_stats( conn_id_t           conn_id,
+                                net_lane_stats_t   *stats );
+
+/* NOTE: it's for r_uh_cb of a plain TCP conn whose sock profile *
+ *       has rx_timestamping, zero ts means no timestamp yet     */
+int         net_get_rx_timestamp( conn_id_t     conn_id,
+                                  net_rx_ts_t  *ts );
+
+int         net_get_rx_latency_stats( conn_id_t                 conn_id,
+                                      net_rx_latency_stats_t   *stats );
+
+/* NOTE: only TCP conns are sampled, if net_tcp_info_interval *
+ *       is zero it samples at the call                       */
+int         net_get_conn_stats( conn_id_t           conn_id,
+                                net_conn_stats_t   *stats );
+
+/* NOTE: the only functions which can be called from other threads, *
+ *       a command is run by the loop at the next iteration, a conn *
+ *       may be closed by then, so it's dropped with logging. They  *
+ *       return -1 on wrong params or no memory, data is copied     */
+int         net_async_post_data( conn_id_t          conn_id,
+                                 char              *data,
+                                 unsigned long      len,
+                                 bool               flush_and_close,
+                                 net_prio_t         prio );
+
+int         net_async_shutdown_conn( conn_id_t      conn_id,
+                                     bool           flush_and_close );
+
+/* NOTE: cb is called by the loop, so it may call any net function */
+int         net_async_call( net_async_cb_t          cb,
+                            ptr_id_t                udata_id );
+
+/* NOTE: loop thread only, fn runs on an offload thread, so it   *
+ *       mustn't call net functions or log, completion_cb gets   *
+ *       the same arg in the loop at one of the next iterations. *
+ *       With zero net_offload_threads fn runs inline.           */
+int         net_offload( net_offload_fn_t        fn,
+                         void                   *arg,
+                         net_offload_fn_t        completion_cb );
+
+/* NOTE: cb is called once in this iteration after all ready  *
+ *       events, a task deferred by a task, a hook or a timer *
+ *       runs in the next one, epoll_wait() doesn't wait then */
+int         net_defer( net_defer_cb_t       cb,
+                       ptr_id_t             udata_id );
+
+/* NOTE: hook is called at each iteration until it's deleted, *
+ *       it may delete itself                                 */
+net_hook_id_t net_add_loop_hook( net_hook_type_t    type,
+                                 net_hook_cb_t      cb,
+                                 ptr_id_t           udata_id );
+
+int         net_del_loop_hook( net_hook_id_t        hook_id );
+
+/* NOTE: buffered data is delivered again after resume */
+int         net_pause_read( conn_id_t   conn_id,
+                            bool        pause );
+
+/* NOTE: batch read mode, data of the conn doesn't go to r_uh_cb,  *
+ *       the loop reads all ready conns first, then conns with the *
+ *       same cb are passed to it in one call (before deferred     *
+ *       tasks). Bytes stay buffered until net_consume, EOF still  *
+ *       goes to r_uh_cb with is_closed. NULL cb turns it off.     */
+int         net_set_batch_read( conn_id_t           conn_id,
+                                net_batch_r_uh_t    cb );
+
+/* NOTE: the upper layer tells by cb whether it has unfinished *
+ *       messages on the conn, see net_handover_idle_conns     */
+int         net_set_idle_check( conn_id_t           conn_id,
+                                net_idle_uh_t       idle_uh_cb );
+
+/* NOTE: it drops len bytes from the head of the buffered data */
+int         net_consume( conn_id_t      conn_id,
+                         int            len );
+
 void        net_update_main_hosts( conn_id_t    conn_id,
                                    ptr_id_t     conn_udata_id,
                                    tmr_id_t     tmr_id,
@@ -140,6 +522,18 @@ void        net_free_host( net_host_t      *host );
 net_host_t *net_get_host( ll_t             *host_list,
                           char             *label );
 
+net_sock_profile_t *net_get_sock_profile( char *name );
+
+net_udp_endpoint_t *net_get_udp_endpoint( char *name );
+
+void net_get_tfo_stats( net_tfo_stats_t *stats );
+
+/* NOTE: it's overloaded above net_overload_lag or net_overload_depth *
+ *       and stays so until both fall below a half of them            */
+bool net_is_overloaded();
+
+void net_get_load_stats( net_load_stats_t *stats );
+
 /* NOTE: Normally we don't need many connections, so using O(n) */
 /* NOTE: Some fds may be allocated by fopen or is still in ssl shutdown */
 #ifdef  DEBUGMANYCONNS
@@ -170,3 +564,59 @@ extern struct timeval      *cfg_net_ssl_accept_timeout;
 extern struct timeval      *cfg_net_establish_timeout;
 extern struct timeval      *cfg_net_flush_and_close_timeout;
 
+extern int                 *cfg_net_write_high_watermark;
+extern int                 *cfg_net_write_low_watermark;
+extern int                 *cfg_net_write_high_msgs;
+extern int                 *cfg_net_write_low_msgs;
+
+extern ll_t                *cfg_net_sock_profiles;
+extern char                *cfg_net_default_sock_profile;
+
+extern int                 *cfg_net_udp_recv_batch;
+extern ll_t                *cfg_net_udp_endpoints;
+
+extern int                 *cfg_net_shm_ring_size;
+
+extern struct timeval      *cfg_net_tcp_info_interval;
+
+extern char                *cfg_net_handover_path;
+extern int                 *cfg_net_handover_idle_conns;
+extern struct timeval      *cfg_net_handover_drain_timeout;
+
+extern int                 *cfg_net_offload_threads;
+
+extern int                 *cfg_net_warm_up;
+extern int                 *cfg_net_warm_up_heap_size;
+extern int                 *cfg_net_mlockall;
+extern int                 *cfg_net_huge_pages;
+extern struct timeval      *cfg_net_fault_report_time;
+
+extern struct timeval      *cfg_net_overload_lag;
+extern int                 *cfg_net_overload_depth;
+extern int                 *cfg_net_overload_pause_accept;
+
+/* NOTE: a budget which isn't above the 10 ms epoll_wait timeout is   *
+ *       clamped to 20 ms. On a stall the loop thread gets SIGUSR2,   *
+ *       the handler is installed with SA_RESTART, but calls that the *
+ *       kernel never restarts still fail with EINTR in the stalled   *
+ *       callback: sleep() and nanosleep() return early, poll(),      *
+ *       select() and epoll_wait() fail, and getaddrinfo() may return *
+ *       EAI_SYSTEM or EAI_AGAIN. Callbacks which block must retry    *
+ *       such calls or not be run with the watchdog on                */
+extern struct timeval      *cfg_net_watchdog_budget;
+
+extern int                 *cfg_net_sim;
+extern int                 *cfg_net_sim_seed;
+extern struct timeval      *cfg_net_sim_latency;
+extern int                 *cfg_net_sim_loss;
+extern struct timeval      *cfg_net_sim_rto;
+extern struct timeval      *cfg_net_sim_duration;
+
+extern char                *cfg_net_capture_file;
+extern int                 *cfg_net_capture_file_size;
+
+extern char                *cfg_net_replay_file;
+extern int                 *cfg_net_replay_port;
+extern int                 *cfg_net_replay_paced;
+extern struct timeval      *cfg_net_replay_drain_timeout;
+
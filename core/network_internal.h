@@ -19,11 +19,23 @@
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <execinfo.h>
 #include <linux/sockios.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/ip.h>
 #include <arpa/inet.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -46,6 +58,9 @@ struct wbuf_s {
 
     buf_t               b;
     int                 tries;
+
+    int                 prio;
+    struct timespec     queued;
 };
 
 struct tmr_s {
@@ -60,10 +75,368 @@ struct tmr_s {
 
     ptr_id_t            udata_id;
 
+    tmr_id_t            tmr_id;
+
     bool                locked;
     bool                to_delete;
 };
 
+/* NOTE: free slots are linked by next_free, gen survives free */
+typedef struct {
+    tmr_t              *tmr;
+    uint32_t            gen;
+    uint32_t            next_free;
+} tmr_slot_t;
+
+typedef struct {
+    tmr_slot_t         *slots;
+    uint32_t            size;
+    uint32_t            free_head;
+} tmr_table_t;
+
+/* NOTE: recvmmsg arrays, everything has batch elements */
+typedef struct {
+    int                 batch;
+    int                 dgram_size;
+
+    char               *bufs;
+    char               *cmsgs;
+    struct mmsghdr     *msgs;
+    struct iovec       *iovs;
+    struct sockaddr_in *addrs;
+    net_dgram_t        *dgrams;
+
+    uint64_t            total_dgrams;
+    uint64_t            total_batches;
+    uint64_t            total_truncated;
+} udp_rx_t;
+
+#define CACHE_LINE_SIZE             64
+
+/* NOTE: head is written only by the writer, tail only by the  *
+ *       reader, a waiting flag only by the side which sleeps, *
+ *       so each field has its own cache line                  */
+typedef struct {
+    uint64_t            head __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint64_t            tail __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint32_t            reader_waiting
+                             __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint32_t            writer_waiting
+                             __attribute__((aligned(CACHE_LINE_SIZE)));
+} shm_ring_hdr_t;
+
+typedef struct {
+    shm_ring_hdr_t     *hdr;
+    char               *data;
+    uint64_t            size;       /* power of 2 */
+} shm_ring_t;
+
+/* NOTE: the client sends it with memfd and two kick eventfds */
+typedef struct {
+    uint32_t            magic;
+    uint32_t            ring_size;
+} shm_hello_t;
+
+typedef struct {
+    void               *map;
+    size_t              map_size;
+
+    shm_ring_t          rx;
+    shm_ring_t          tx;
+
+    int                 kick_fd;        /* peer kicks us */
+    int                 peer_kick_fd;   /* we kick peer */
+
+    bool                is_tx_blocked;
+
+    uint64_t            total_rx_bytes;
+    uint64_t            total_tx_bytes;
+    uint64_t            total_kicks;
+    uint64_t            total_wakeups;
+    uint64_t            total_tx_blocks;
+} shm_t;
+
+typedef struct async_node_s     async_node_t;
+
+struct async_node_s {
+    async_node_t       *next;
+};
+
+/* NOTE: command from another thread, data is for ASYNC_POST, *
+ *       fn, done_cb and arg are for ASYNC_OFFLOAD            */
+typedef struct {
+    async_node_t        node;
+
+    int                 type;
+    conn_id_t           conn_id;
+    bool                flush_and_close;
+    net_prio_t          prio;
+    net_async_cb_t      cb;
+    ptr_id_t            udata_id;
+
+    net_offload_fn_t    fn;
+    net_offload_fn_t    done_cb;
+    void               *arg;
+
+    unsigned long       len;
+    char                data[];
+} async_cmd_t;
+
+/* NOTE: intrusive MPSC queue (D. Vyukov), producers swap head, *
+ *       the loop pops from tail, stub node is never freed      */
+typedef struct {
+    async_node_t       *head __attribute__((aligned(CACHE_LINE_SIZE)));
+    async_node_t       *tail __attribute__((aligned(CACHE_LINE_SIZE)));
+    async_node_t        stub;
+
+    /* NOTE: only the first producer after a drain writes eventfd */
+    uint32_t            is_wakeup_pending
+                             __attribute__((aligned(CACHE_LINE_SIZE)));
+    int                 wakeup_fd;
+} async_queue_t;
+
+/* NOTE: ring of jobs of one offload thread, the owner takes *
+ *       the oldest job, thieves take from the other end     */
+typedef struct {
+    pthread_mutex_t     lock;
+    async_cmd_t       **jobs;
+    unsigned            size;       /* power of 2 */
+    unsigned            head;
+    unsigned            tail;
+
+    pthread_t           thread;
+    int                 ndx;
+} __attribute__((aligned(CACHE_LINE_SIZE))) offload_worker_t;
+
+typedef struct {
+    offload_worker_t   *workers;
+    int                 total;
+    int                 next;       /* loop thread only */
+
+    /* NOTE: threads sleep here only when all rings are empty */
+    pthread_mutex_t     idle_lock;
+    pthread_cond_t      idle_cond;
+    uint32_t            queued;
+    int                 idle;
+
+    uint64_t            total_jobs;
+    uint64_t            total_steals;
+} offload_pool_t;
+
+typedef struct {
+    net_defer_cb_t      cb;
+    ptr_id_t            udata_id;
+} defer_task_t;
+
+typedef struct {
+    defer_task_t       *tasks;
+    unsigned            size;       /* power of 2 */
+    unsigned            head;
+    unsigned            tail;
+} defer_queue_t;
+
+/* NOTE: conns read in this iteration in batch read mode, *
+ *       a slot may be reused in the same iteration, so   *
+ *       ids has room for two conns per slot              */
+typedef struct {
+    conn_id_t          *ids;        /* READ_BATCH_SIZE */
+    int                 total;
+    net_batch_entry_t  *entries;    /* READ_BATCH_SIZE */
+} read_batch_t;
+
+/* NOTE: lag_sum and depth_sum are EWMAs scaled by 2^LOAD_EWMA_SHIFT, *
+ *       lag is in microseconds                                       */
+typedef struct {
+    long                lag_sum;
+    long                depth_sum;
+    bool                is_overloaded;
+    uint64_t            overloads;
+    struct timeval      poll_end;
+} load_t;
+
+/* NOTE: pipe data of net_sim in flight, due is the virtual *
+ *       time of its delivery to rb of the reader           */
+typedef struct {
+    /* ll_node_t */
+    ptr_id_t            id;
+    ptr_id_t            prev;
+    ptr_id_t            next;
+
+    conn_id_t           src_id;
+    conn_id_t           dst_id;
+    struct timeval      due;
+    bool                is_eof;
+    unsigned long       len;
+    char               *data;
+} sim_chunk_t;
+
+typedef struct {
+    bool                is_on;
+    struct timeval      now;
+    struct timeval      start;
+    struct timespec     wall_start;
+    uint64_t            rng;
+    ll_t                chunks;
+
+    uint64_t            iters;
+    uint64_t            jumps;
+    uint64_t            delivered;
+    uint64_t            bytes;
+    uint64_t            lost;
+} sim_t;
+
+typedef struct {
+    /* ll_node_t */
+    ptr_id_t            id;
+    ptr_id_t            prev;
+    ptr_id_t            next;
+
+    net_hook_type_t     type;
+    net_hook_cb_t       cb;
+    ptr_id_t            udata_id;
+
+    /* NOTE: deleted during its list is called */
+    bool                to_delete;
+} hook_t;
+
+#define DEFER_QUEUE_SIZE            256
+
+#define READ_BATCH_SIZE             (2 * (NET_MAX_FD + 1))
+
+#define LOAD_EWMA_SHIFT             3
+
+/* NOTE: the virtual clock moves at least this much per iteration */
+#define SIM_TICK_USEC               1
+
+#define CAPTURE_MAX_FILE_LEN        255
+#define CAPTURE_ALIGN( n )          ( ((n) + 7) & ~7UL )
+
+#define REPLAY_HOST                 "@replay"
+#define REPLAY_BATCH                64
+#define REPLAY_LAT_BUCKETS          32
+
+/* NOTE: the watchdog looks at the loop this many times per budget */
+#define WATCHDOG_CHECKS             4
+#define WATCHDOG_SIGNAL             SIGUSR2
+#define WATCHDOG_MAX_FRAMES         64
+#define WATCHDOG_REPORT_LEN         512
+
+/* NOTE: an idle iteration blocks in epoll_wait for WAIT_TIMEOUT */
+#define WATCHDOG_MIN_BUDGET_MS      ( 2 * WAIT_TIMEOUT )
+
+/****************************************************************
+ *  NOTE: iter, conn_id and cb are written by the loop thread   *
+ *        and read by the watchdog thread, so both of them use  *
+ *        relaxed atomics. report is filled by the watchdog     *
+ *        thread before the signal, frames is used only by the  *
+ *        handler in the loop thread.                           *
+ ****************************************************************/
+typedef struct {
+    pthread_t           loop_thread;
+    pthread_t           thread;
+    bool                is_running;
+    bool                to_stop;
+
+    uint64_t            iter;
+    uint64_t            reported_iter;
+    conn_id_t           conn_id;
+    void               *cb;            /* last callback entered */
+    uint64_t            stalls;
+
+    char                report[WATCHDOG_REPORT_LEN];
+    int                 report_len;
+    void               *frames[WATCHDOG_MAX_FRAMES];
+} watchdog_t;
+
+/* NOTE: the mapped net_capture_file, hdr is the start of map */
+typedef struct {
+    bool                is_on;
+    int                 fd;
+    char               *map;
+    unsigned long       size;
+    net_capture_hdr_t  *hdr;
+
+    uint64_t            records;
+    uint64_t            bytes;
+    uint64_t            rotations;
+    uint64_t            dropped;
+} capture_t;
+
+/* NOTE: pipe conn which replays a captured conn, pending is   *
+ *       the time the first chunk without a reply was fed, the *
+ *       reply is due if the module replied there in capture   */
+typedef struct {
+    /* ll_node_t */
+    ptr_id_t            id;
+    ptr_id_t            prev;
+    ptr_id_t            next;
+
+    conn_id_t           cap_id;
+    conn_id_t           conn_id;
+    bool                is_est;
+    bool                is_eof;
+    bool                is_over_high;
+    bool                is_reply_due;
+    struct timespec     pending;
+} replay_conn_t;
+
+/* NOTE: latency bucket i counts [2^i, 2^(i+1)) nsec */
+typedef struct {
+    bool                is_on;
+    bool                is_done;           /* all records are fed */
+    bool                is_waiting;        /* for a conn or reply */
+    bool                is_over;
+    char               *map;
+    unsigned long       size;
+    unsigned long       off;
+    ll_t                conns;
+
+    uint64_t            first_ts;
+    struct timespec     start;
+    struct timespec     last_feed;
+    struct timespec     last_reply;
+
+    uint64_t            chunks;
+    uint64_t            bytes;
+    uint64_t            skipped;
+    uint64_t            replies;
+    uint64_t            reply_bytes;
+
+    uint64_t            lat_sum;
+    uint64_t            lat_max;
+    uint64_t            lat_buckets[REPLAY_LAT_BUCKETS];
+} replay_t;
+
+#define HANDOVER_BATCH              32
+
+/* NOTE: fds of the records follow in SCM_RIGHTS in the same *
+ *       order, a message without records is the last one    */
+typedef struct {
+    int32_t             dirn;
+    int32_t             listen_port;    /* listener's port for D_INCOMING */
+    uint8_t             use_ssl;        /* D_LISTEN only */
+    char                host[MAX_DOMAIN_LEN];
+    char                port[MAX_PORT_STR_LEN];
+    struct sockaddr_in  peer;           /* D_INCOMING only */
+} handover_rec_t;
+
+typedef struct {
+    uint32_t            magic;
+    uint32_t            total;
+    handover_rec_t      recs[HANDOVER_BATCH];
+} handover_msg_t;
+
+/* NOTE: inherited socket which isn't adopted yet */
+typedef struct {
+    /* ll_node_t */
+    ptr_id_t            id;
+    ptr_id_t            prev;
+    ptr_id_t            next;
+
+    int                 fd;
+    handover_rec_t      rec;
+} handover_node_t;
+
 typedef struct {
     int                 st;
     int                 ssl_rw_st;
@@ -73,43 +446,96 @@ typedef struct {
 
 /* ctx == connection context (just context) *
  * uh  == user handler                      */
-struct ctx_s {
-    int                 fd;
-    uint32_t            ev; /* EPOLLIN, EPOLLOUT etc */
-    conn_id_t           id;
-
+/* NOTE: the part of a ctx which is touched at setup, accept, *
+ *       stats sampling and logging, plus the state of conn   *
+ *       kinds other than TCP, it lives in a separate array   *
+ *       so that ctx_t stays compact                          */
+typedef struct {
     char                host[MAX_DOMAIN_LEN];
     char                port[MAX_PORT_STR_LEN];
 
     int                 listen_port;
 
-    struct sockaddr_in  peer;
     struct sockaddr_in  serv;
 
-    SSL                *ssl;
-
     bool                child_use_ssl;
 
-    buf_t               rb;
-    ll_t                wb_list;
-
-    net_r_uh_t          r_uh_cb;
-    net_est_uh_t        est_uh_cb;
-    net_clo_uh_t        clo_uh_cb;
-
     net_r_uh_t          child_r_uh_cb;
     net_est_uh_t        child_est_uh_cb;
     net_clo_uh_t        child_clo_uh_cb;
 
     net_dup_udata_t     dup_udata_cb;
 
+    net_idle_uh_t       idle_uh_cb;
+
+    net_conn_stats_t    tcp_stats;
+
+    /* NOTE: writer's end of a pipe in net_sim */
+    struct timeval      sim_due;
+    unsigned long       sim_inflight;
+
+    /* NOTE: head of rb which is in net_capture_file already */
+    unsigned long       cap_used;
+
+    struct sockaddr_in  peer;
+
+    net_lane_stats_t    wb_lane_stats[NET_PRIO_MAX];
+
+    /* NOTE: sock profile with rx_timestamping only */
+    net_rx_ts_t         rx_ts;
+    net_rx_latency_stats_t rx_latency;
+
+    /* NOTE: tunnel_pipe carries bytes read from this *
+     *       ctx to be written to the tunnel peer     */
+    conn_id_t           tunnel_peer_id;
+    int                 tunnel_pipe[2];
+    unsigned long       tunnel_pipe_used;
+    unsigned long       tunnel_pipe_size;
+    bool                is_tunnel_rd_eof;
+
+    /* NOTE: D_UDP only */
+    net_udp_endpoint_t *udp;
+    net_dgram_uh_t      dgram_uh_cb;
+    udp_rx_t           *udp_rx;
+
+    /* NOTE: fd is the AF_XDP socket, xsk_join_fd is the *
+     *       UDP socket which keeps the multicast join   */
+    struct xsk_s       *xsk;
+    int                 xsk_join_fd;
+
+    /* NOTE: AF_UNIX conns and listeners only */
+    struct sockaddr_un *unix_addr;
+
+    /* NOTE: shm conn only, NULL until the handshake is done */
+    shm_t              *shm;
+
+    /* NOTE: in-process pipe end */
+    conn_id_t           pipe_peer_id;
+    bool                is_pipe_est_pending;
+    bool                is_pipe_rd_pending;
+    bool                is_pipe_rd_data;
+    bool                is_pipe_rd_eof;
+
+    /* NOTE: listener has inherited accepted conns to adopt */
+    bool                is_handover_pending;
+} ctx_cold_t;
+
+/******************************************************************
+ *  NOTE: fields used by the main loop on every event go first,   *
+ *        the first cache line has fd, id, state, udata_id and    *
+ *        the flags, the callbacks and ssl fill the second one,   *
+ *        rb, the write queue and the timers follow, the state of *
+ *        features and stats lives in ctx_cold_t                  *
+ *****************************************************************/
+struct ctx_s {
+    int                 fd;
+    uint32_t            ev; /* EPOLLIN, EPOLLOUT etc */
+    conn_id_t           id;
+
     state_t            *state;
-    tmr_id_t            state_tmr_id; 
 
     ptr_id_t            udata_id;
 
-    ll_t                tmr_list;
-
     int                 dirn;
 
     bool                to_shutdown;
@@ -118,6 +544,62 @@ struct ctx_s {
     bool                is_in_dup_udata;
     bool                flush_and_close;
     bool                is_shut_wr_done;
+    bool                is_tfo_pending; /* SYN data isn't checked yet */
+    bool                is_wb_over_high;
+    bool                is_drain_pending;
+    bool                is_read_paused;
+    bool                is_read_resumed;
+
+    /* NOTE: kind of conn, checked on the generic read and *
+     *       write paths, the state of the kind is in cold *
+     *       is_seqpacket: AF_UNIX conns and listeners     *
+     *       is_shm: the socket is only for the handshake  *
+     *               and for detecting the peer's close    *
+     *       is_pipe: in-process pipe end, fd is an        *
+     *                eventfd which only owns the slot,    *
+     *                data goes to peer's rb               *
+     *       is_handed_over: socket is shared with new     *
+     *                       process                       */
+    bool                is_seqpacket;
+    bool                is_shm;
+    bool                is_pipe;
+    bool                is_handed_over;
+
+    net_r_uh_t          r_uh_cb;
+    net_est_uh_t        est_uh_cb;
+    net_clo_uh_t        clo_uh_cb;
+    net_drain_uh_t      drain_uh_cb;
+
+    /* NOTE: batch read mode, see net_set_batch_read */
+    net_batch_r_uh_t    batch_r_uh_cb;
+    bool                is_in_read_batch;
+
+    SSL                *ssl;
+
+    buf_t               rb;
+
+    /* NOTE: wb_list keeps only the wbuf being written, *
+     *       the rest wait in wb_lanes by priority      */
+    ll_t                wb_list;
+
+    int                 wb_msgs;    /* wb_list and all wb_lanes */
+    unsigned long       wb_bytes;   /* queued, including written part */
+    unsigned long       wb_high_bytes;
+    unsigned long       wb_low_bytes;
+    int                 wb_high_msgs;
+    int                 wb_low_msgs;
+
+    ll_t                wb_lanes[NET_PRIO_MAX];
+
+    /* NOTE: listener passes it to accepted sockets */
+    net_sock_profile_t *sock_profile;
+
+    /* NOTE: g_ctx_cold_array[fd], set once at net_init */
+    ctx_cold_t         *cold;
+
+    tmr_id_t            state_tmr_id;
+
+    ll_t                tmr_list;
 };
 
 /* NOTE: EPOLLRDHUP is only available since Linux 2.6.17 */
@@ -127,10 +609,58 @@ struct ctx_s {
 
 #define MAX_EVENTS                  16
 #define MAX_TIMERS                  1024
+
+#define NET_ID( slot, gen )         ( ((uint64_t) (gen) << 32) | (slot) )
+#define NET_ID_SLOT( id )           (uint32_t) ( (id) & 0xffffffff )
+#define NET_ID_GEN( id )            (uint32_t) ( (id) >> 32 )
+
+#define TMR_SLOTS_INIT              1024
+#define TMR_SLOT_NONE               UINT32_MAX
+
 #define MAX_WRITE_TRIES             1024
 
 #define BACKLOG                     10
 
+/* NOTE: hardware stamps come only if the NIC is configured for it */
+#define RX_TIMESTAMPING_FLAGS       ( SOF_TIMESTAMPING_RX_SOFTWARE |    \
+                                      SOF_TIMESTAMPING_SOFTWARE |       \
+                                      SOF_TIMESTAMPING_RX_HARDWARE |    \
+                                      SOF_TIMESTAMPING_RAW_HARDWARE )
+
+#define TUNNEL_PIPE_SIZE            262144
+
+/* NOTE: kick eventfd is added to epoll with a shifted fd, *
+ *       so main loop finds the ctx of the socket          */
+#define SHM_KICK_EPOLL_FD( fd )     ( (fd) + NET_MAX_FD + 1 )
+
+#define SHM_MAGIC                   0x45534852
+#define SHM_MIN_RING_SIZE           4096
+#define SHM_MAX_RING_SIZE           1073741824
+#define SHM_MAP_SIZE( ring_size )   ( 2 * ( sizeof(shm_ring_hdr_t) +    \
+                                            (size_t) (ring_size) ) )
+
+/* NOTE: after the range of shm kick fds */
+#define ASYNC_EPOLL_FD              ( 2 * (NET_MAX_FD + 1) )
+#define ASYNC_BATCH                 1024
+
+#define ASYNC_POST                  0
+#define ASYNC_SHUTDOWN              1
+#define ASYNC_CALL                  2
+#define ASYNC_OFFLOAD               3
+
+#define OFFLOAD_RING_SIZE           256
+#define OFFLOAD_MAX_THREADS         64
+
+#define HUGE_PAGE_SIZE              (2 * 1024 * 1024)
+
+#define HANDOVER_MAGIC              0x45484f56
+#define HANDOVER_RECV_TIMEOUT       5   /* sec */
+#define HANDOVER_ADOPT_TIMEOUT      10  /* sec */
+
+#define UDP_MAX_BATCH               64
+#define UDP_DGRAM_SIZE              2048
+#define UDP_CMSG_SIZE               64
+
 #define WAIT_TIMEOUT                10
 
 /* D == Direction of connection */
@@ -138,6 +668,7 @@ struct ctx_s {
 #define D_LISTEN                    0
 #define D_OUTGOING                  1
 #define D_INCOMING                  2
+#define D_UDP                       3
 
 /* R_WANT_W == SSL_read want write  *
  * W_WANT_R == SSL_write want read  */
@@ -222,3 +753,7 @@ struct ctx_s {
 
 #define READ_BUFFER_SIZE            131072
 
+/* NOTE: SOCK_SEQPACKET message can't be read partially, *
+ *       so rb always has this space before recv()       */
+#define UNIX_MAX_MSG_SIZE           65536
+
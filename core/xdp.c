@@ -0,0 +1,623 @@
+/********************************************************************
+ * Copyright (c) 2014, Eldar Gaynetdinov <hal9000ed2k@gmail.com>    *
+ *                                                                  *
+ * Permission to use, copy, modify, and/or distribute this software *
+ * for any purpose with or without fee is hereby granted, provided  *
+ * that the above copyright notice and this permission notice       *
+ * appear in all copies.                                            *
+ *                                                                  *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL    *
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED    *
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL     *
+ * THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT,          *
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING     *
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF       *
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF    *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.   *
+ ********************************************************************/
+
+#include "main.h"
+#include "linked_list.h"
+#include "logger.h"
+#include "network.h"
+#include "xdp.h"
+
+#ifdef  NET_AF_XDP
+
+#include "xdp_internal.h"
+
+/******************* bpf() calls **********************************************/
+
+static int __bpf( int cmd, union bpf_attr *attr )
+{
+    return syscall( __NR_bpf, cmd, attr, sizeof(union bpf_attr) );
+}
+
+static int __create_xsk_map( int max_entries )
+{
+    union bpf_attr          attr;
+    int                     fd;
+
+    memset( &attr, 0, sizeof(attr) );
+
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(int);
+    attr.value_size = sizeof(int);
+    attr.max_entries = max_entries;
+
+    fd = __bpf( BPF_MAP_CREATE, &attr );
+
+    if( fd == -1 )
+    {
+        LOGE( "max_entries:%d errno:%d strerror:%s",
+              max_entries, errno, strerror( errno ) );
+    }
+
+    return fd;
+}
+
+/* NOTE: the program redirects UDP/IPv4 frames without IP *
+ *       options to the port, the rest goes to the kernel *
+ *       stack. XDP_PASS is also the fallback action of   *
+ *       bpf_redirect_map if there is no socket in a slot */
+static int __load_xdp_prog( int map_fd, int port )
+{
+    struct bpf_insn         prog[] = {
+        /* 0 */  BPF_MOV64_REG( BPF_REG_6, BPF_REG_1 ),
+        /* 1 */  BPF_LDX_MEM( BPF_W, BPF_REG_2, BPF_REG_6,
+                              offsetof( struct xdp_md, data ) ),
+        /* 2 */  BPF_LDX_MEM( BPF_W, BPF_REG_3, BPF_REG_6,
+                              offsetof( struct xdp_md, data_end ) ),
+        /* 3 */  BPF_MOV64_REG( BPF_REG_4, BPF_REG_2 ),
+        /* 4 */  BPF_ADD64_IMM( BPF_REG_4, XDP_HDRS_LEN ),
+        /* 5 */  BPF_JGT_REG( BPF_REG_4, BPF_REG_3, 14 ),
+        /* 6 */  BPF_LDX_MEM( BPF_H, BPF_REG_5, BPF_REG_2, 12 ),
+        /* 7 */  BPF_JNE_IMM( BPF_REG_5, htons( 0x0800 ), 12 ),
+        /* 8 */  BPF_LDX_MEM( BPF_B, BPF_REG_5, BPF_REG_2, 14 ),
+        /* 9 */  BPF_JNE_IMM( BPF_REG_5, 0x45, 10 ),
+        /* 10 */ BPF_LDX_MEM( BPF_B, BPF_REG_5, BPF_REG_2, 23 ),
+        /* 11 */ BPF_JNE_IMM( BPF_REG_5, IPPROTO_UDP, 8 ),
+        /* 12 */ BPF_LDX_MEM( BPF_H, BPF_REG_5, BPF_REG_2, 36 ),
+        /* 13 */ BPF_JNE_IMM( BPF_REG_5, htons( port ), 6 ),
+        /* 14 */ BPF_LD_MAP_FD( BPF_REG_1, map_fd ),
+        /* 16 */ BPF_LDX_MEM( BPF_W, BPF_REG_2, BPF_REG_6,
+                              offsetof( struct xdp_md, rx_queue_index ) ),
+        /* 17 */ BPF_MOV64_IMM( BPF_REG_3, XDP_PASS ),
+        /* 18 */ BPF_CALL_FUNC( BPF_FUNC_redirect_map ),
+        /* 19 */ BPF_EXIT_INSN(),
+        /* 20 */ BPF_MOV64_IMM( BPF_REG_0, XDP_PASS ),
+        /* 21 */ BPF_EXIT_INSN()
+    };
+    union bpf_attr          attr;
+    char                   *log;
+    int                     fd;
+
+    log = malloc( XDP_PROG_LOG_SIZE );
+    log[0] = '\0';
+
+    memset( &attr, 0, sizeof(attr) );
+
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t) (unsigned long) prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(struct bpf_insn);
+    attr.license = (uint64_t) (unsigned long) "Dual BSD/GPL";
+    attr.log_buf = (uint64_t) (unsigned long) log;
+    attr.log_size = XDP_PROG_LOG_SIZE;
+    attr.log_level = 1;
+
+    fd = __bpf( BPF_PROG_LOAD, &attr );
+
+    if( fd == -1 )
+    {
+        LOGE( "port:%d errno:%d strerror:%s verifier:%s",
+              port, errno, strerror( errno ), log );
+    }
+
+    free( log );
+
+    return fd;
+}
+
+static int __attach_xdp_prog( int prog_fd, int ifindex, bool drv_mode )
+{
+    union bpf_attr          attr;
+    int                     fd;
+
+    memset( &attr, 0, sizeof(attr) );
+
+    attr.link_create.prog_fd = prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = drv_mode ? XDP_FLAGS_DRV_MODE :
+                                        XDP_FLAGS_SKB_MODE;
+
+    fd = __bpf( BPF_LINK_CREATE, &attr );
+
+    if( fd == -1 )
+    {
+        LOGE( "ifindex:%d drv_mode:%d errno:%d strerror:%s",
+              ifindex, drv_mode, errno, strerror( errno ) );
+    }
+
+    return fd;
+}
+
+static int __update_xsk_map( int map_fd, int queue, int xsk_fd )
+{
+    union bpf_attr          attr;
+
+    memset( &attr, 0, sizeof(attr) );
+
+    attr.map_fd = map_fd;
+    attr.key = (uint64_t) (unsigned long) &queue;
+    attr.value = (uint64_t) (unsigned long) &xsk_fd;
+    attr.flags = BPF_ANY;
+
+    if( __bpf( BPF_MAP_UPDATE_ELEM, &attr ) == -1 )
+    {
+        LOGE( "queue:%d errno:%d strerror:%s",
+              queue, errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************* UMEM and rings *******************************************/
+
+static int __map_ring( xsk_t                   *xsk,
+                       xsk_ring_t              *ring,
+                       struct xdp_ring_offset  *off,
+                       uint32_t                 size,
+                       size_t                   desc_size,
+                       off_t                    pgoff )
+{
+    char               *map;
+
+    ring->map_len = off->desc + size * desc_size;
+
+    map = mmap( NULL, ring->map_len,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE,
+                xsk->fd, pgoff );
+
+    if( map == MAP_FAILED )
+    {
+        LOGE( "fd:%x pgoff:0x%llx errno:%d strerror:%s",
+              xsk->fd, (unsigned long long) pgoff,
+              errno, strerror( errno ) );
+
+        ring->map = NULL;
+        return -1;
+    }
+
+    ring->map = map;
+    ring->producer = (uint32_t *) (map + off->producer);
+    ring->consumer = (uint32_t *) (map + off->consumer);
+    ring->flags = (uint32_t *) (map + off->flags);
+    ring->descs = map + off->desc;
+    ring->mask = size - 1;
+
+    return 0;
+}
+
+static int __set_xsk_opt( int fd, int opt, void *val, socklen_t len )
+{
+    if( setsockopt( fd, SOL_XDP, opt, val, len ) )
+    {
+        LOGE( "fd:%x opt:%d errno:%d strerror:%s",
+              fd, opt, errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static int __setup_umem( xsk_t *xsk )
+{
+    struct xdp_umem_reg         reg;
+    struct xdp_mmap_offsets     off;
+    socklen_t                   len = sizeof(off);
+    int                         fill_size = XDP_FILL_RING_SIZE;
+    int                         comp_size = XDP_COMP_RING_SIZE;
+    int                         rx_size = XDP_RX_RING_SIZE;
+    uint64_t                   *fill;
+    int                         i;
+
+    xsk->umem_len = XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+
+    xsk->umem = mmap( NULL, xsk->umem_len,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+                      -1, 0 );
+
+    if( xsk->umem == MAP_FAILED )
+    {
+        LOGE( "umem_len:%lu errno:%d strerror:%s",
+              (unsigned long) xsk->umem_len, errno, strerror( errno ) );
+
+        xsk->umem = NULL;
+        return -1;
+    }
+
+    memset( &reg, 0, sizeof(reg) );
+
+    reg.addr = (uint64_t) (unsigned long) xsk->umem;
+    reg.len = xsk->umem_len;
+    reg.chunk_size = XDP_FRAME_SIZE;
+
+    if( __set_xsk_opt( xsk->fd, XDP_UMEM_REG, &reg, sizeof(reg) ) ||
+        __set_xsk_opt( xsk->fd, XDP_UMEM_FILL_RING,
+                       &fill_size, sizeof(int) ) ||
+        __set_xsk_opt( xsk->fd, XDP_UMEM_COMPLETION_RING,
+                       &comp_size, sizeof(int) ) ||
+        __set_xsk_opt( xsk->fd, XDP_RX_RING,
+                       &rx_size, sizeof(int) ) )
+    {
+        return -1;
+    }
+
+    if( getsockopt( xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len ) )
+    {
+        LOGE( "fd:%x errno:%d strerror:%s",
+              xsk->fd, errno, strerror( errno ) );
+
+        return -1;
+    }
+
+    if( __map_ring( xsk, &xsk->rx, &off.rx, XDP_RX_RING_SIZE,
+                    sizeof(struct xdp_desc), XDP_PGOFF_RX_RING ) ||
+        __map_ring( xsk, &xsk->fill, &off.fr, XDP_FILL_RING_SIZE,
+                    sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING ) ||
+        __map_ring( xsk, &xsk->comp, &off.cr, XDP_COMP_RING_SIZE,
+                    sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING ) )
+    {
+        return -1;
+    }
+
+    /* NOTE: all frames are given to the kernel, rx ring *
+     *       is smaller, so fill ring can't overflow     */
+    fill = xsk->fill.descs;
+
+    for( i = 0; i < XDP_NUM_FRAMES; i++ )
+        fill[i] = (uint64_t) i * XDP_FRAME_SIZE;
+
+    __atomic_store_n( xsk->fill.producer, XDP_NUM_FRAMES, __ATOMIC_RELEASE );
+
+    return 0;
+}
+
+static void __unmap_ring( xsk_ring_t *ring )
+{
+    if( ring->map )
+        munmap( ring->map, ring->map_len );
+
+    memset( ring, 0, sizeof(xsk_ring_t) );
+}
+
+static void __close_fd( int *fd )
+{
+    if( *fd == -1 )
+        return;
+
+    errno = 0;
+    while( close( *fd ) == -1 && errno == EINTR )
+        errno = 0;
+
+    *fd = -1;
+}
+
+/******************* Frames parsing *******************************************/
+
+/* NOTE: the program already checked headers, but the frame *
+ *       may be passed by another program on the same queue */
+static bool __parse_frame( xsk_t        *xsk,
+                           char         *frame,
+                           uint32_t      len,
+                           net_dgram_t  *dgram )
+{
+    struct iphdr       *ip;
+    struct udphdr      *udp;
+    uint16_t            udp_len;
+
+    if( len < XDP_HDRS_LEN )
+        return false;
+
+    ip = (struct iphdr *) (frame + XDP_ETH_HLEN);
+    udp = (struct udphdr *) (frame + XDP_ETH_HLEN + XDP_IP_HLEN);
+
+    if( *(uint16_t *) (frame + 12) != htons( 0x0800 ) ||
+        ip->version != 4 || ip->ihl != 5 ||
+        ip->protocol != IPPROTO_UDP ||
+        ntohs( udp->dest ) != xsk->port )
+    {
+        return false;
+    }
+
+    udp_len = ntohs( udp->len );
+
+    if( udp_len < XDP_UDP_HLEN ||
+        udp_len > len - XDP_ETH_HLEN - XDP_IP_HLEN )
+    {
+        return false;
+    }
+
+    dgram->buf = frame + XDP_HDRS_LEN;
+    dgram->len = udp_len - XDP_UDP_HLEN;
+    dgram->ip = ip->saddr;
+    dgram->port = udp->source;
+    dgram->is_truncated = false;
+
+    return true;
+}
+
+/******************* Interface functions **************************************/
+
+xsk_t *xdp_open( char      *ifname,
+                 int        queue,
+                 int        port,
+                 bool       drv_mode )
+{
+    xsk_t                  *xsk;
+    struct sockaddr_xdp     sxdp;
+
+    if( !ifname || queue < 0 || port <= 0 )
+    {
+        LOGE( "" );
+        return NULL;
+    }
+
+    xsk = malloc( sizeof(xsk_t) );
+    memset( xsk, 0, sizeof(xsk_t) );
+
+    xsk->map_fd = -1;
+    xsk->prog_fd = -1;
+    xsk->link_fd = -1;
+
+    xsk->queue = queue;
+    xsk->port = port;
+
+    xsk->ifindex = if_nametoindex( ifname );
+    if( !xsk->ifindex )
+    {
+        LOGE( "ifname:%s errno:%d strerror:%s",
+              ifname, errno, strerror( errno ) );
+
+        free( xsk );
+        return NULL;
+    }
+
+    xsk->fd = socket( AF_XDP, SOCK_RAW, 0 );
+    if( xsk->fd == -1 )
+    {
+        LOGE( "ifname:%s errno:%d strerror:%s",
+              ifname, errno, strerror( errno ) );
+
+        free( xsk );
+        return NULL;
+    }
+
+    if( __setup_umem( xsk ) )
+        goto error;
+
+    memset( &sxdp, 0, sizeof(sxdp) );
+
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = xsk->ifindex;
+    sxdp.sxdp_queue_id = queue;
+
+    /* NOTE: generic mode can only copy frames */
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | (drv_mode ? 0 : XDP_COPY);
+
+    if( bind( xsk->fd, (struct sockaddr *) &sxdp, sizeof(sxdp) ) )
+    {
+        LOGE( "ifname:%s queue:%d errno:%d strerror:%s",
+              ifname, queue, errno, strerror( errno ) );
+
+        goto error;
+    }
+
+    xsk->map_fd = __create_xsk_map( queue + 1 );
+    if( xsk->map_fd == -1 )
+        goto error;
+
+    if( __update_xsk_map( xsk->map_fd, queue, xsk->fd ) )
+        goto error;
+
+    xsk->prog_fd = __load_xdp_prog( xsk->map_fd, port );
+    if( xsk->prog_fd == -1 )
+        goto error;
+
+    /* NOTE: the program is detached when link_fd is closed */
+    xsk->link_fd = __attach_xdp_prog( xsk->prog_fd, xsk->ifindex, drv_mode );
+    if( xsk->link_fd == -1 )
+        goto error;
+
+    LOG( "fd:%x ifname:%s ifindex:%d queue:%d port:%d drv_mode:%d",
+         xsk->fd, ifname, xsk->ifindex, queue, port, drv_mode );
+
+    return xsk;
+
+error:
+
+    __close_fd( &xsk->fd );
+
+    xdp_close( xsk );
+
+    return NULL;
+}
+
+void xdp_close( xsk_t *xsk )
+{
+    c_assert( xsk );
+
+    LOG( "ifindex:%d queue:%d port:%d pkts:%llu batches:%llu "
+         "dropped:%llu wakeups:%llu",
+         xsk->ifindex, xsk->queue, xsk->port,
+         (unsigned long long) xsk->stats.pkts,
+         (unsigned long long) xsk->stats.batches,
+         (unsigned long long) xsk->stats.dropped,
+         (unsigned long long) xsk->stats.wakeups );
+
+    __close_fd( &xsk->link_fd );
+    __close_fd( &xsk->prog_fd );
+    __close_fd( &xsk->map_fd );
+
+    __unmap_ring( &xsk->rx );
+    __unmap_ring( &xsk->fill );
+    __unmap_ring( &xsk->comp );
+
+    if( xsk->umem )
+        munmap( xsk->umem, xsk->umem_len );
+
+    memset( xsk, 0, sizeof(xsk_t) );
+    free( xsk );
+}
+
+int xdp_fd( xsk_t *xsk )
+{
+    c_assert( xsk );
+
+    return xsk->fd;
+}
+
+int xdp_recv( xsk_t        *xsk,
+              net_dgram_t  *dgrams,
+              int           max )
+{
+    struct xdp_desc    *descs = xsk->rx.descs;
+    struct xdp_desc    *desc;
+    struct timespec     ts;
+    uint32_t            prod, cons;
+    uint32_t            n, i;
+    int                 cnt = 0;
+
+    c_assert( !xsk->rx_pending && max > 0 );
+
+    prod = __atomic_load_n( xsk->rx.producer, __ATOMIC_ACQUIRE );
+    cons = *xsk->rx.consumer;
+
+    n = prod - cons;
+
+    if( !n )
+        return 0;
+
+    if( n > max )
+        n = max;
+
+    /* NOTE: generic mode has no rx timestamps, *
+     *       so the batch is stamped on arrival */
+    clock_gettime( CLOCK_REALTIME, &ts );
+
+    for( i = 0; i < n; i++ )
+    {
+        desc = &descs[(cons + i) & xsk->rx.mask];
+
+        if( !__parse_frame( xsk, xsk->umem + desc->addr,
+                            desc->len, &dgrams[cnt] ) )
+        {
+            xsk->stats.dropped++;
+            continue;
+        }
+
+        dgrams[cnt].ts = ts;
+        cnt++;
+    }
+
+    xsk->rx_pending = n;
+
+    xsk->stats.pkts += cnt;
+    xsk->stats.batches++;
+
+    return cnt;
+}
+
+void xdp_release( xsk_t *xsk )
+{
+    struct xdp_desc    *descs = xsk->rx.descs;
+    uint64_t           *fill = xsk->fill.descs;
+    uint32_t            cons, fill_prod;
+    uint32_t            i;
+
+    if( !xsk->rx_pending )
+        return;
+
+    cons = *xsk->rx.consumer;
+    fill_prod = *xsk->fill.producer;
+
+    for( i = 0; i < xsk->rx_pending; i++ )
+    {
+        fill[(fill_prod + i) & xsk->fill.mask] =
+            descs[(cons + i) & xsk->rx.mask].addr &
+            ~((uint64_t) XDP_FRAME_SIZE - 1);
+    }
+
+    __atomic_store_n( xsk->fill.producer, fill_prod + i, __ATOMIC_RELEASE );
+    __atomic_store_n( xsk->rx.consumer, cons + i, __ATOMIC_RELEASE );
+
+    xsk->rx_pending = 0;
+
+    if( __atomic_load_n( xsk->fill.flags, __ATOMIC_ACQUIRE ) &
+        XDP_RING_NEED_WAKEUP )
+    {
+        xsk->stats.wakeups++;
+
+        recvfrom( xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL );
+    }
+}
+
+void xdp_get_stats( xsk_t          *xsk,
+                    xdp_stats_t    *stats )
+{
+    c_assert( xsk && stats );
+
+    *stats = xsk->stats;
+}
+
+#else
+
+/* NOTE: without NET_AF_XDP only xdp_open can be called */
+xsk_t *xdp_open( char      *ifname,
+                 int        queue,
+                 int        port,
+                 bool       drv_mode )
+{
+    LOGE( "ifname:%s queue:%d port:%d built without NET_AF_XDP",
+          ifname, queue, port );
+
+    return NULL;
+}
+
+void xdp_close( xsk_t *xsk )
+{
+    c_assert( false );
+}
+
+int xdp_fd( xsk_t *xsk )
+{
+    c_assert( false );
+    return -1;
+}
+
+int xdp_recv( xsk_t        *xsk,
+              net_dgram_t  *dgrams,
+              int           max )
+{
+    c_assert( false );
+    return -1;
+}
+
+void xdp_release( xsk_t *xsk )
+{
+    c_assert( false );
+}
+
+void xdp_get_stats( xsk_t          *xsk,
+                    xdp_stats_t    *stats )
+{
+    c_assert( false );
+}
+
+#endif
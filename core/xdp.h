@@ -0,0 +1,52 @@
+/********************************************************************
+ * Copyright (c) 2014, Eldar Gaynetdinov <hal9000ed2k@gmail.com>    *
+ *                                                                  *
+ * Permission to use, copy, modify, and/or distribute this software *
+ * for any purpose with or without fee is hereby granted, provided  *
+ * that the above copyright notice and this permission notice       *
+ * appear in all copies.                                            *
+ *                                                                  *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL    *
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED    *
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL     *
+ * THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT,          *
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING     *
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF       *
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF    *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.   *
+ ********************************************************************/
+
+/* NOTE: AF_XDP receive backend for UDP endpoints, it's built *
+ *       only with NET_AF_XDP (make xdp). UDP/IPv4 frames to  *
+ *       the port are redirected to the socket by a small XDP *
+ *       program, the rest of traffic is passed to the kernel */
+
+typedef struct xsk_s        xsk_t;
+
+typedef struct {
+    uint64_t        pkts;
+    uint64_t        batches;
+    uint64_t        dropped;    /* not UDP/IPv4 to the port */
+    uint64_t        wakeups;
+} xdp_stats_t;
+
+/* NOTE: fd is closed by the owner, see xdp_fd */
+xsk_t      *xdp_open( char     *ifname,
+                      int       queue,
+                      int       port,
+                      bool      drv_mode );
+
+void        xdp_close( xsk_t   *xsk );
+
+int         xdp_fd( xsk_t      *xsk );
+
+/* NOTE: dgrams point to UMEM frames, they are valid until *
+ *       xdp_release which returns frames to the fill ring */
+int         xdp_recv( xsk_t        *xsk,
+                      net_dgram_t  *dgrams,
+                      int           max );
+
+void        xdp_release( xsk_t     *xsk );
+
+void        xdp_get_stats( xsk_t       *xsk,
+                           xdp_stats_t *stats );
@@ -0,0 +1,115 @@
+/********************************************************************
+ * Copyright (c) 2014, Eldar Gaynetdinov <hal9000ed2k@gmail.com>    *
+ *                                                                  *
+ * Permission to use, copy, modify, and/or distribute this software *
+ * for any purpose with or without fee is hereby granted, provided  *
+ * that the above copyright notice and this permission notice       *
+ * appear in all copies.                                            *
+ *                                                                  *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL    *
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED    *
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL     *
+ * THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT,          *
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING     *
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF       *
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF    *
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.   *
+ ********************************************************************/
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+
+#ifndef AF_XDP
+#define AF_XDP                      44
+#endif
+
+#ifndef SOL_XDP
+#define SOL_XDP                     283
+#endif
+
+#define XDP_NUM_FRAMES              4096
+#define XDP_FRAME_SIZE              2048
+#define XDP_FILL_RING_SIZE          XDP_NUM_FRAMES
+#define XDP_COMP_RING_SIZE          64
+#define XDP_RX_RING_SIZE            2048
+
+#define XDP_ETH_HLEN                14
+#define XDP_IP_HLEN                 20
+#define XDP_UDP_HLEN                8
+#define XDP_HDRS_LEN                (XDP_ETH_HLEN + XDP_IP_HLEN + XDP_UDP_HLEN)
+
+#define XDP_PROG_LOG_SIZE           65536
+
+/* NOTE: producer/consumer are shared with the kernel */
+typedef struct {
+    uint32_t           *producer;
+    uint32_t           *consumer;
+    uint32_t           *flags;
+    void               *descs;
+    uint32_t            mask;
+
+    void               *map;
+    size_t              map_len;
+} xsk_ring_t;
+
+struct xsk_s {
+    int                 fd;
+    int                 map_fd;
+    int                 prog_fd;
+    int                 link_fd;
+
+    int                 ifindex;
+    int                 queue;
+    int                 port;
+
+    char               *umem;
+    size_t              umem_len;
+
+    xsk_ring_t          rx;
+    xsk_ring_t          fill;
+    xsk_ring_t          comp;
+
+    /* NOTE: rx descs handed to the user by xdp_recv */
+    uint32_t            rx_pending;
+
+    xdp_stats_t         stats;
+};
+
+/* NOTE: minimal eBPF encoding, the same as kernel filter.h */
+#define BPF_INSN( c, d, s, o, i )   ((struct bpf_insn) {                \
+                                        .code = (c),                    \
+                                        .dst_reg = (d),                 \
+                                        .src_reg = (s),                 \
+                                        .off = (o),                     \
+                                        .imm = (i) })
+
+#define BPF_MOV64_REG( d, s )       BPF_INSN( BPF_ALU64 | BPF_MOV | BPF_X, \
+                                              d, s, 0, 0 )
+#define BPF_MOV64_IMM( d, i )       BPF_INSN( BPF_ALU64 | BPF_MOV | BPF_K, \
+                                              d, 0, 0, i )
+#define BPF_ADD64_IMM( d, i )       BPF_INSN( BPF_ALU64 | BPF_ADD | BPF_K, \
+                                              d, 0, 0, i )
+#define BPF_LDX_MEM( sz, d, s, o )  BPF_INSN( BPF_LDX | BPF_MEM | (sz),    \
+                                              d, s, o, 0 )
+#define BPF_JGT_REG( d, s, o )      BPF_INSN( BPF_JMP | BPF_JGT | BPF_X,   \
+                                              d, s, o, 0 )
+#define BPF_JNE_IMM( d, i, o )      BPF_INSN( BPF_JMP | BPF_JNE | BPF_K,   \
+                                              d, 0, o, i )
+#define BPF_CALL_FUNC( f )          BPF_INSN( BPF_JMP | BPF_CALL,          \
+                                              0, 0, 0, f )
+#define BPF_EXIT_INSN()             BPF_INSN( BPF_JMP | BPF_EXIT,          \
+                                              0, 0, 0, 0 )
+
+/* NOTE: 64-bit immediate takes two instructions */
+#define BPF_LD_MAP_FD( d, fd )      BPF_INSN( BPF_LD | BPF_DW | BPF_IMM,   \
+                                              d, BPF_PSEUDO_MAP_FD, 0, fd ), \
+                                    BPF_INSN( 0, 0, 0, 0, 0 )
@@ -33,6 +33,8 @@
 
 int            *cfg_proxy_listen_port = NULL;
 int            *cfg_proxy_listen_port_ssl = NULL;
+char           *cfg_proxy_sock_profile = NULL;
+int            *cfg_proxy_tunnel_splice = NULL;
 
 static void __client_r_cb( http_id_t        http_id,
                            ptr_id_t         udata_id,
@@ -58,6 +60,12 @@ static void __raw_client_clo_cb( conn_id_t  conn_id,
                                  ptr_id_t   udata_id,
                                  int        code );
 
+static void __raw_client_drain_cb( conn_id_t    conn_id,
+                                   ptr_id_t     udata_id );
+
+static void __server_drain_cb( http_id_t        http_id,
+                               ptr_id_t         udata_id );
+
 /******************* Mics functions *******************************************/
 
 void __shutdown_child_conns( conn_in_t *conn_in )
@@ -148,6 +156,7 @@ static void __make_conn_raw( conn_in_t         *conn_in,
                              ptr_id_t           msg_id )
 {
     conn_raw_t     *conn_raw;
+    int             r;
 
     assert( !conn_in->conn_raw_id );
 
@@ -169,6 +178,11 @@ static void __make_conn_raw( conn_in_t         *conn_in,
 
     assert( conn_raw->conn_id );
 
+    r = net_set_write_watermarks( conn_raw->conn_id,
+                                  __raw_client_drain_cb,
+                                  0, 0, 0, 0 );
+    assert( !r );
+
     conn_in->conn_raw_id = conn_raw->udata_id;
 
     LOG( "server_http_id:0x%llx server_udata_id:0x%llx "
@@ -178,11 +192,116 @@ static void __make_conn_raw( conn_in_t         *conn_in,
          PTRID_FMT( conn_in->http_id ),
          PTRID_FMT( conn_in->udata_id ),
          PTRID_FMT( msg_id ),
-         PTRID_FMT( conn_raw->conn_id ),
+         NET_ID_FMT( conn_raw->conn_id ),
          PTRID_FMT( conn_raw->udata_id ),
          host->hostname, host->port );
 }
 
+/* NOTE: reading from one side of the tunnel is paused   *
+ *       while the other side's write queue is over high *
+ *       watermark, it's resumed by the drain callback   */
+static void __tunneling_throttle_upstream( conn_raw_t  *conn_raw,
+                                           bool         pause )
+{
+    int             r;
+
+    if( conn_raw->is_read_paused == pause )
+        return;
+
+    r = net_pause_read( conn_raw->conn_id, pause );
+
+    if( r )
+    {
+        LOGE( "client_conn_id:0x%llx net_errno:%u",
+              NET_ID_FMT( conn_raw->conn_id ), G_net_errno );
+
+        return;
+    }
+
+    conn_raw->is_read_paused = pause;
+
+    LOG( "client_conn_id:0x%llx client_udata_id:0x%llx pause:%d",
+         NET_ID_FMT( conn_raw->conn_id ),
+         PTRID_FMT( conn_raw->udata_id ), pause );
+}
+
+static void __tunneling_throttle_downstream( conn_in_t     *conn_in,
+                                             bool           pause )
+{
+    int             r;
+
+    if( conn_in->is_read_paused == pause )
+        return;
+
+    r = http_pause_read( conn_in->http_id, pause );
+
+    if( r )
+    {
+        LOGE( "server_http_id:0x%llx http_errno:%u net_errno:%u",
+              PTRID_FMT( conn_in->http_id ),
+              G_http_errno, G_net_errno );
+
+        return;
+    }
+
+    conn_in->is_read_paused = pause;
+
+    LOG( "server_http_id:0x%llx server_udata_id:0x%llx pause:%d",
+         PTRID_FMT( conn_in->http_id ),
+         PTRID_FMT( conn_in->udata_id ), pause );
+}
+
+/* NOTE: plain tunnels are moved by splice() in net,  *
+ *       otherwise bytes are copied by r_cb callbacks */
+static bool __tunneling_splice( conn_in_t *conn_in )
+{
+    conn_raw_t     *conn_raw;
+    int             r;
+
+    if( !*cfg_proxy_tunnel_splice || !conn_in->conn_raw_id )
+        return false;
+
+    conn_raw = PTRID_GET_PTR( conn_in->conn_raw_id );
+
+    assert( conn_raw->udata_id == conn_in->conn_raw_id &&
+            !conn_raw->pending_data_sent );
+
+    if( conn_in->is_ssl || conn_raw->host->use_ssl )
+        return false;
+
+    r = http_tunnel_raw( conn_in->http_id, conn_raw->conn_id );
+
+    if( r )
+    {
+        LOGE( "server_http_id:0x%llx client_conn_id:0x%llx "
+              "http_errno:%u net_errno:%u",
+              PTRID_FMT( conn_in->http_id ),
+              NET_ID_FMT( conn_raw->conn_id ),
+              G_http_errno, G_net_errno );
+
+        return false;
+    }
+
+    /* NOTE: pending data is posted by net */
+    conn_raw->pending_data = NULL;
+    conn_raw->pending_data_len = 0;
+
+    conn_raw->is_read_paused = false;
+    conn_in->is_read_paused = false;
+
+    LOG( "server_http_id:0x%llx server_udata_id:0x%llx "
+         "client_conn_id:0x%llx client_udata_id:0x%llx "
+         "host:%s:%s",
+         PTRID_FMT( conn_in->http_id ),
+         PTRID_FMT( conn_in->udata_id ),
+         NET_ID_FMT( conn_raw->conn_id ),
+         PTRID_FMT( conn_raw->udata_id ),
+         conn_raw->host->hostname,
+         conn_raw->host->port );
+
+    return true;
+}
+
 static void __tunneling_flush_upstream_data( conn_in_t *conn_in )
 {
     conn_raw_t     *conn_raw;
@@ -206,10 +325,13 @@ static void __tunneling_flush_upstream_data( conn_in_t *conn_in )
     http_msg.raw_body_len = conn_raw->pending_data_len;
 
     r = http_post_raw_data( conn_in->http_id, &http_msg );
-    assert( !r );
+    assert( r != -1 );
 
     conn_raw->pending_data_sent = true;
 
+    if( r == HTTP_POST_OVER_HIGH )
+        __tunneling_throttle_upstream( conn_raw, true );
+
     LOG( "server_http_id:0x%llx server_udata_id:0x%llx "
          "msg_id:0x%llx "
          "client_conn_id:0x%llx client_udata_id:0x%llx "
@@ -217,7 +339,7 @@ static void __tunneling_flush_upstream_data( conn_in_t *conn_in )
          PTRID_FMT( conn_in->http_id ),
          PTRID_FMT( conn_in->udata_id ),
          PTRID_FMT( conn_raw->msg_id ),
-         PTRID_FMT( conn_raw->conn_id ),
+         NET_ID_FMT( conn_raw->conn_id ),
          PTRID_FMT( conn_raw->udata_id ),
          conn_raw->host->hostname,
          conn_raw->host->port );
@@ -249,11 +371,16 @@ static void __tunneling_write_to_upstream( conn_in_t   *conn_in,
                        http_msg->raw_body_len,
                        http_msg->connection_close );
 
+    if( r == NET_POST_OVER_HIGH )
+    {
+        __tunneling_throttle_downstream( conn_in, true );
+    }
+    else
     if( r )
     {
         LOGE( "server_http_id:0x%llx client_conn_id:0x%llx",
               PTRID_FMT( conn_in->http_id ),
-              PTRID_FMT( conn_raw->conn_id ) );
+              NET_ID_FMT( conn_raw->conn_id ) );
 
         r = http_shutdown( conn_in->http_id, false );
         assert( !r );
@@ -266,7 +393,7 @@ static void __tunneling_write_to_upstream( conn_in_t   *conn_in,
          "connection_close:%d host:%s:%s",
          PTRID_FMT( conn_in->http_id ),
          PTRID_FMT( conn_in->udata_id ),
-         PTRID_FMT( conn_raw->conn_id ),
+         NET_ID_FMT( conn_raw->conn_id ),
          PTRID_FMT( conn_raw->udata_id ),
          http_msg->connection_close,
          conn_raw->host->hostname,
@@ -344,7 +471,8 @@ static void __client_r_cb( http_id_t        http_id,
     {
         conn_in->tunneling_mode = true;
 
-        __tunneling_flush_upstream_data( conn_in );
+        if( !__tunneling_splice( conn_in ) )
+            __tunneling_flush_upstream_data( conn_in );
     }
 }
 
@@ -506,7 +634,7 @@ static int __raw_client_r_cb( conn_id_t     conn_id,
 
     r = http_post_raw_data( conn_in->http_id, &http_msg );
 
-    if( r )
+    if( r == -1 )
     {
         LOGE( "server_http_id:0x%llx http_errno:%u net_errno:%u",
               PTRID_FMT( conn_in->http_id ),
@@ -516,12 +644,15 @@ static int __raw_client_r_cb( conn_id_t     conn_id,
         return 0;
     }
 
+    if( r == HTTP_POST_OVER_HIGH )
+        __tunneling_throttle_upstream( conn_raw, true );
+
     LOG( "server_http_id:0x%llx server_udata_id:0x%llx "
          "client_conn_id:0x%llx client_udata_id:0x%llx "
          "is_closed:%d host:%s:%s",
          PTRID_FMT( conn_in->http_id ),
          PTRID_FMT( conn_in->udata_id ),
-         PTRID_FMT( conn_raw->conn_id ),
+         NET_ID_FMT( conn_raw->conn_id ),
          PTRID_FMT( conn_raw->udata_id ),
          is_closed,
          conn_raw->host->hostname,
@@ -568,17 +699,49 @@ static void __raw_client_est_cb( conn_id_t  conn_id,
 
     conn_in->tunneling_mode = ( state == HTTP_POST_STATE_TUNNELING );
 
+    if( conn_in->tunneling_mode && !__tunneling_splice( conn_in ) )
+    {
+        r = http_set_write_watermarks( conn_in->http_id,
+                                       __server_drain_cb,
+                                       0, 0, 0, 0 );
+        assert( !r );
+    }
+
     LOG( "server_http_id:0x%llx server_udata_id:0x%llx "
          "client_conn_id:0x%llx client_udata_id:0x%llx "
          "host:%s:%s",
          PTRID_FMT( conn_in->http_id ),
          PTRID_FMT( conn_in->udata_id ),
-         PTRID_FMT( conn_raw->conn_id ),
+         NET_ID_FMT( conn_raw->conn_id ),
          PTRID_FMT( conn_raw->udata_id ),
          conn_raw->host->hostname,
          conn_raw->host->port );
 }
 
+/* NOTE: upstream write queue is drained, so reading *
+ *       from the client side can be resumed         */
+static void __raw_client_drain_cb( conn_id_t    conn_id,
+                                   ptr_id_t     udata_id )
+{
+    conn_raw_t     *conn_raw;
+    conn_in_t      *conn_in;
+
+    assert( conn_id && udata_id );
+
+    conn_raw = PTRID_GET_PTR( udata_id );
+
+    assert( conn_raw->conn_id == conn_id &&
+            conn_raw->udata_id == udata_id );
+
+    if( !conn_raw->conn_in_id )
+        return;
+
+    conn_in = PTRID_GET_PTR( conn_raw->conn_in_id );
+    assert( conn_in->udata_id == conn_raw->conn_in_id );
+
+    __tunneling_throttle_downstream( conn_in, false );
+}
+
 static void __raw_client_clo_cb( conn_id_t  conn_id,
                                  ptr_id_t   udata_id,
                                  int        code )
@@ -594,7 +757,7 @@ static void __raw_client_clo_cb( conn_id_t  conn_id,
             conn_raw->udata_id == udata_id );
 
     LOG( "conn_id:0x%llx udata_id:0x%llx code:%d", 
-         PTRID_FMT( conn_id ), PTRID_FMT( udata_id ), code );
+         NET_ID_FMT( conn_id ), PTRID_FMT( udata_id ), code );
  
     if( conn_raw->conn_in_id )
     {
@@ -630,7 +793,7 @@ static void __raw_client_clo_cb( conn_id_t  conn_id,
             }
 
             LOG( "conn_id:0x%llx udata_id:0x%llx", 
-                 PTRID_FMT( conn_id ), PTRID_FMT( udata_id ) );
+                 NET_ID_FMT( conn_id ), PTRID_FMT( udata_id ) );
         }
         else
             http_shutdown( conn_in->http_id, true );
@@ -696,6 +859,30 @@ static void __server_r_cb( http_id_t        http_id,
         __make_conn_out( conn_in, host, msg_id, http_msg );
 }
 
+/* NOTE: client write queue is drained, so reading *
+ *       from the upstream can be resumed          */
+static void __server_drain_cb( http_id_t        http_id,
+                               ptr_id_t         udata_id )
+{
+    conn_in_t      *conn_in;
+    conn_raw_t     *conn_raw;
+
+    assert( http_id && udata_id );
+
+    conn_in = PTRID_GET_PTR( udata_id );
+
+    assert( conn_in->http_id == http_id &&
+            conn_in->udata_id == udata_id );
+
+    if( !conn_in->conn_raw_id )
+        return;
+
+    conn_raw = PTRID_GET_PTR( conn_in->conn_raw_id );
+    assert( conn_raw->udata_id == conn_in->conn_raw_id );
+
+    __tunneling_throttle_upstream( conn_raw, false );
+}
+
 static void __server_est_cb( http_id_t      http_id,
                              ptr_id_t       udata_id )
 {
@@ -801,6 +988,13 @@ static void __default_config_init()
 
         *cfg_proxy_listen_port_ssl = 2222;
     }
+
+    if( !cfg_proxy_tunnel_splice )
+    {
+        cfg_proxy_tunnel_splice = malloc( sizeof(int) );
+
+        *cfg_proxy_tunnel_splice = 1;
+    }
 }
 
 void proxy_cfg_init()
@@ -814,6 +1008,14 @@ void proxy_cfg_init()
     config_add_cmd( "proxy_listen_port_ssl",
                     CONFIG_CMD_TYPE_INTEGER,
                     (void **) &cfg_proxy_listen_port_ssl );
+
+    config_add_cmd( "proxy_sock_profile",
+                    CONFIG_CMD_TYPE_STRING,
+                    (void **) &cfg_proxy_sock_profile );
+
+    config_add_cmd( "proxy_tunnel_splice",
+                    CONFIG_CMD_TYPE_INTEGER,
+                    (void **) &cfg_proxy_tunnel_splice );
 }
 
 void proxy_init()
@@ -838,7 +1040,8 @@ void proxy_init()
                                         __listen_clo_cb,
                                         listen->udata_id,
                                         listen->port, 
-                                        listen->is_ssl );
+                                        listen->is_ssl,
+                                        cfg_proxy_sock_profile );
 
     assert( listen->http_id );
 
@@ -857,7 +1060,8 @@ void proxy_init()
                                             __listen_clo_cb,
                                             listen_ssl->udata_id,
                                             listen_ssl->port, 
-                                            listen_ssl->is_ssl );
+                                            listen_ssl->is_ssl,
+                                            cfg_proxy_sock_profile );
 
     assert( listen_ssl->http_id );
 }
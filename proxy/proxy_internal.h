@@ -30,6 +30,7 @@ typedef struct {
     bool            pending_data_sent;
 
     bool            est_reply_sent;
+    bool            is_read_paused;
 } conn_raw_t;
 
 typedef struct {
@@ -63,6 +64,7 @@ typedef struct {
     bool            is_ssl;
 
     bool            tunneling_mode;
+    bool            is_read_paused;
 } conn_in_t;
 
 typedef struct {
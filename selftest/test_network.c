@@ -69,18 +69,37 @@ static void             __random_calls();
 
 /******************* Misc util functions **************************************/
 
+/* NOTE: only in-process pipes ('@' hosts) are simulated by net_sim */
+static bool __is_usable_host( net_host_t *host )
+{
+    return !*cfg_net_sim || host->hostname[0] == '@';
+}
+
 static net_host_t *__get_rand_host()
 {
     net_host_node_t        *node;
     net_host_node_t        *node_next;
     net_host_t             *host = NULL;
+    int                     total = 0;
     int                     rnd;
     int                     i = 0;
 
     LL_CHECK( cfg_net_test_hosts, cfg_net_test_hosts->head );
     node = PTRID_GET_PTR( cfg_net_test_hosts->head );
 
-    rnd = rand() % cfg_net_test_hosts->total;
+    while( node )
+    {
+        if( __is_usable_host( &node->host ) )
+            total++;
+
+        node = PTRID_GET_PTR( node->next );
+    }
+
+    assert( total );
+
+    node = PTRID_GET_PTR( cfg_net_test_hosts->head );
+
+    rnd = rand() % total;
 
     while( node )
     {
@@ -89,16 +108,20 @@ static net_host_t *__get_rand_host()
 
         assert( node->host.hostname &&
                 node->host.port &&
-                i <= cfg_net_test_hosts->total );
+                i <= total );
 
-        if( i == rnd )
-            host = &node->host;
+        if( __is_usable_host( &node->host ) )
+        {
+            if( i == rnd )
+                host = &node->host;
+
+            i++;
+        }
 
-        i++;
         node = node_next;
     }
 
-    assert( host && i == cfg_net_test_hosts->total );
+    assert( host && i == total );
 
     return host;
 }
@@ -657,6 +680,21 @@ static void __rand_tmr_cb( ptr_id_t         http_id,
     __random_calls();
 }
 
+/* NOTE: net_ conn and tmr ids aren't ptr_id_t, so global net_ tmrs *
+ * come through this wrapper                                        */
+
+static void __rand_net_tmr_cb( conn_id_t        conn_id,
+                               ptr_id_t         conn_udata_id,
+                               tmr_id_t         tmr_id,
+                               ptr_id_t         tmr_udata_id )
+{
+    LOGD( "tmr:0x%llx", NET_ID_FMT( tmr_id ) );
+
+    assert( !conn_id && tmr_id );
+
+    __rand_tmr_cb( 0, conn_udata_id, tmr_id, tmr_udata_id );
+}
+
 static ptr_id_t __dup_udata_cb( http_id_t   http_id,
                                 ptr_id_t    udata_id )
 {
@@ -931,7 +969,8 @@ static bool __rand_make_listen()
                                           port,
                                           port ==
                                               *cfg_net_test_listen_port_ssl ?
-                                              true : false );
+                                              true : false,
+                                          NULL );
 
     assert( conn_elt->http_id );
 
@@ -1050,7 +1089,7 @@ static bool __rand_make_conn_tmr()
     __save_tmr_id( conn_elt, new_tmr_id );
 
     LOGD( "rand_conn_id:0x%llx tmr:0x%llx tv_sec:%ld tv_usec:%ld",
-          PTRID_FMT( conn_elt->http_id ), PTRID_FMT( new_tmr_id ),
+          PTRID_FMT( conn_elt->http_id ), NET_ID_FMT( new_tmr_id ),
           rand_timeout.tv_sec, rand_timeout.tv_usec );
 
     return true;
@@ -1058,7 +1097,7 @@ static bool __rand_make_conn_tmr()
 
 static bool __rand_make_global_tmr()
 {
-    ptr_id_t            new_tmr_id;
+    tmr_id_t            new_tmr_id;
     struct timeval      rand_timeout;
     ptr_id_t            udata_id = UDATA_LABEL;
 
@@ -1068,7 +1107,7 @@ static bool __rand_make_global_tmr()
     __make_rand_timeout( &rand_timeout );
 
     new_tmr_id = net_make_global_tmr( udata_id,
-                                      __rand_tmr_cb,
+                                      __rand_net_tmr_cb,
                                       &rand_timeout );
 
     assert( new_tmr_id );
@@ -1076,7 +1115,7 @@ static bool __rand_make_global_tmr()
     __save_tmr_id( NULL, new_tmr_id );
 
     LOGD( "tmr:0x%llx tv_sec:%ld tv_usec:%ld",
-          PTRID_FMT( new_tmr_id ), rand_timeout.tv_sec,
+          NET_ID_FMT( new_tmr_id ), rand_timeout.tv_sec,
           rand_timeout.tv_usec );
 
     return true;
@@ -1109,6 +1148,7 @@ static bool __rand_del_conn_tmr()
 
 static bool __rand_del_global_tmr()
 {
+    static bool         is_stale_checked = false;
     tmr_elt_t          *tmr_elt;
     int                 r;
 
@@ -1120,7 +1160,18 @@ static bool __rand_del_global_tmr()
     r = net_del_global_tmr( tmr_elt->tmr_id );
     assert( !r );
 
-    LOGD( "tmr:0x%llx", PTRID_FMT( tmr_elt->tmr_id ) );
+    LOGD( "tmr:0x%llx", NET_ID_FMT( tmr_elt->tmr_id ) );
+
+    /* NOTE: a deleted id is rejected instead of touching a freed *
+     * timer, the timer is still locked if we're in its cb, so    *
+     * repeat until the id has been really stale once             */
+    if( !is_stale_checked )
+    {
+        r = net_del_global_tmr( tmr_elt->tmr_id );
+        assert( r == -1 );
+
+        is_stale_checked = G_net_errno == NET_ERRNO_WRONG_PARAMS;
+    }
 
     memset( tmr_elt, 0, sizeof(tmr_elt_t) );
 